@@ -0,0 +1,99 @@
+#ifndef AABB_H
+#define AABB_H
+
+#include "glm/glm.hpp"
+#include <vector>
+#include <cfloat>
+
+// Axis aligned bounding box. A default constructed box is empty (min > max)
+struct AABB
+{
+	glm::vec3 min = glm::vec3(FLT_MAX);
+	glm::vec3 max = glm::vec3(-FLT_MAX);
+
+	bool isEmpty() const
+	{
+		return min.x > max.x;
+	}
+
+	glm::vec3 center() const
+	{
+		return (min + max) * 0.5f;
+	}
+
+	glm::vec3 extents() const
+	{
+		return (max - min) * 0.5f;
+	}
+
+	// Half the surface area, enough for SAH cost ratios
+	float halfArea() const
+	{
+		if (isEmpty()) return 0.f;
+		glm::vec3 s = max - min;
+		return s.x * s.y + s.y * s.z + s.z * s.x;
+	}
+
+	void expand(const glm::vec3& p)
+	{
+		min = glm::min(min, p);
+		max = glm::max(max, p);
+	}
+
+	void expand(const AABB& b)
+	{
+		if (b.isEmpty()) return;
+		min = glm::min(min, b.min);
+		max = glm::max(max, b.max);
+	}
+
+	bool intersectsSphere(const glm::vec3& c, float radius) const
+	{
+		if (isEmpty()) return false;
+		glm::vec3 d = glm::clamp(c, min, max) - c;
+		return glm::dot(d, d) <= radius * radius;
+	}
+
+	// Cone from apex along dir (normalized), halfAngle in radians, cut at range. Tests the bounding sphere of the
+	// box, so it's conservative (a box near the cone surface may pass)
+	bool intersectsCone(const glm::vec3& apex, const glm::vec3& dir, float halfAngle, float range) const
+	{
+		if (isEmpty()) return false;
+
+		glm::vec3 v = center() - apex;
+		float r = glm::length(extents());
+		float along = glm::dot(v, dir);
+		if (along > range + r || along < -r) return false;
+
+		float across = glm::sqrt(glm::max(glm::dot(v, v) - along * along, 0.f));
+		float distanceToSurface = glm::cos(halfAngle) * across - glm::sin(halfAngle) * along;
+		return distanceToSurface <= r;
+	}
+
+	// Box of the transformed box (Arvo): the center is transformed, the extents go through |M|
+	AABB transformed(const glm::mat4& m) const
+	{
+		if (isEmpty()) return *this;
+
+		glm::vec3 c = glm::vec3(m * glm::vec4(center(), 1.f));
+		glm::vec3 e = extents();
+		glm::mat3 absM = glm::mat3(glm::abs(glm::vec3(m[0])), glm::abs(glm::vec3(m[1])), glm::abs(glm::vec3(m[2])));
+		glm::vec3 te = absM * e;
+
+		AABB out;
+		out.min = c - te;
+		out.max = c + te;
+		return out;
+	}
+
+	// Interleaved vertex buffer, position first. stride in floats
+	static AABB fromVertices(const std::vector<float>& vertices, int stride)
+	{
+		AABB box;
+		for (size_t i = 0; i + 2 < vertices.size(); i += stride)
+			box.expand(glm::vec3(vertices[i], vertices[i + 1], vertices[i + 2]));
+		return box;
+	}
+};
+
+#endif AABB_H
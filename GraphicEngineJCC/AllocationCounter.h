@@ -0,0 +1,106 @@
+#ifndef ALLOCATION_COUNTER_H
+#define ALLOCATION_COUNTER_H
+
+#include <atomic>
+#include <cstdlib>
+#include <new>
+#include <iostream>
+
+// Counts global operator new calls made by the threads that asked for it (the render thread), so a frame can be
+// checked to allocate nothing once warmed up. Replaces the global operator new/delete: include it in one
+// translation unit only (Main.cpp). Driver and C allocations (malloc) aren't seen.
+class AllocationCounter
+{
+private:
+	static unsigned long long frameStart;
+
+	AllocationCounter() {}
+	~AllocationCounter() {}
+
+public:
+	static std::atomic<unsigned long long> allocations;	// Since the program started
+	static thread_local bool tracked;
+
+	// Allocations of the last complete frame
+	static unsigned long long lastFrameAllocations;
+
+	static void trackThisThread(bool track = true)
+	{
+		tracked = track;
+	}
+
+	// Call at the start of each frame
+	static void beginFrame()
+	{
+		unsigned long long now = allocations;
+		lastFrameAllocations = now - frameStart;
+		frameStart = now;
+	}
+
+	static void printStats()
+	{
+		std::cout << "ALLOCATION_COUNTER::" << lastFrameAllocations << " heap allocations last frame" << std::endl;
+	}
+};
+
+// Static variables initialization
+std::atomic<unsigned long long> AllocationCounter::allocations(0);
+thread_local bool AllocationCounter::tracked = false;
+unsigned long long AllocationCounter::lastFrameAllocations = 0;
+unsigned long long AllocationCounter::frameStart = 0;
+
+// Global operator new/delete replacements
+void* operator new(std::size_t size)
+{
+	if (AllocationCounter::tracked) AllocationCounter::allocations++;
+	if (void* p = std::malloc(size ? size : 1)) return p;
+	throw std::bad_alloc();
+}
+
+void* operator new[](std::size_t size)
+{
+	return operator new(size);
+}
+
+void* operator new(std::size_t size, const std::nothrow_t&) noexcept
+{
+	if (AllocationCounter::tracked) AllocationCounter::allocations++;
+	return std::malloc(size ? size : 1);
+}
+
+void* operator new[](std::size_t size, const std::nothrow_t& tag) noexcept
+{
+	return operator new(size, tag);
+}
+
+void operator delete(void* p) noexcept
+{
+	std::free(p);
+}
+
+void operator delete[](void* p) noexcept
+{
+	std::free(p);
+}
+
+void operator delete(void* p, std::size_t) noexcept
+{
+	std::free(p);
+}
+
+void operator delete[](void* p, std::size_t) noexcept
+{
+	std::free(p);
+}
+
+void operator delete(void* p, const std::nothrow_t&) noexcept
+{
+	std::free(p);
+}
+
+void operator delete[](void* p, const std::nothrow_t&) noexcept
+{
+	std::free(p);
+}
+
+#endif ALLOCATION_COUNTER_H
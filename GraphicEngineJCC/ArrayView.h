@@ -0,0 +1,36 @@
+#ifndef ARRAY_VIEW_H
+#define ARRAY_VIEW_H
+
+#include <vector>
+#include <cstddef>
+
+// Read only view of contiguous elements (a vector, part of one, a single element). Cheap to pass by value,
+// never copies or allocates. The viewed memory must outlive the view.
+template<class T>
+class ArrayView
+{
+public:
+	ArrayView() {}
+	ArrayView(const T* first, size_t count) : first(first), count(count) {}
+	ArrayView(const std::vector<T>& v) : first(v.data()), count(v.size()) {}
+
+	const T* data() const { return first; }
+	size_t size() const { return count; }
+	bool empty() const { return count == 0; }
+
+	const T& operator[](size_t i) const { return first[i]; }
+	const T* begin() const { return first; }
+	const T* end() const { return first + count; }
+
+	// Same elements, not only same values (e.g. "is this the list the BVH was built from")
+	bool sameAs(ArrayView other) const
+	{
+		return first == other.first && count == other.count;
+	}
+
+private:
+	const T* first = nullptr;
+	size_t count = 0;
+};
+
+#endif ARRAY_VIEW_H
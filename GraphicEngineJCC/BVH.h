@@ -0,0 +1,447 @@
+#ifndef BVH_H
+#define BVH_H
+
+#include "glm/glm.hpp"
+#include "AABB.h"
+#include "Frustum.h"
+#include "ECS.h"
+#include "Components.h"
+#include "ArrayView.h"
+#include <vector>
+#include <algorithm>
+#include <cfloat>
+#include <iostream>
+
+// Bounding volume hierarchy, one entity per leaf. Built top-down with a binned SAH, then kept up to date with refits:
+// only the leaves whose world bounds changed (Bounds version) and their ancestors are touched. When refits have made the tree
+// much worse than the built one (cost ratio), update() rebuilds it.
+// Queries return indices into the indexed list. Entities without bounds are never culled, every query returns them.
+class BVH
+{
+	template<class T> using vector = std::vector<T>;
+	using vec3 = glm::vec3;
+
+public:
+	struct Node
+	{
+		AABB box;
+		int left = -1;		// Children, -1 in leaves
+		int right = -1;
+		int parent = -1;
+		int object = -1;	// Leaf object, -1 in inner nodes
+	};
+
+	static const int SAH_BINS = 16;
+	float rebuildRatio = 1.5f; // Rebuild when the SAH cost grows past this factor of the built one
+	int costCheckInterval = 30; // Updates between cost checks (O(nodes))
+
+	// Last update(): leaves refitted / whether it rebuilt
+	unsigned int lastRefits = 0;
+	bool lastRebuilt = false;
+
+	// Index a list of entities by their Bounds (world). The list is tracked by address, see indexes()
+	void build(const vector<Entity>& entities, const ComponentPool<Bounds>& bounds)
+	{
+		source = &entities;
+		versions.resize(entities.size());
+
+		objectBoxes.resize(entities.size());
+		for (size_t i = 0; i < entities.size(); i++)
+		{
+			const Bounds* b = bounds.tryGet(entities[i]);
+			objectBoxes[i] = b ? b->world : AABB();
+			versions[i] = b ? b->version : 0;
+		}
+
+		build(objectBoxes);
+		dirty = false;
+	}
+
+	// Index plain boxes (no objects)
+	void build(const vector<AABB>& boxes)
+	{
+		nodes.clear();
+		leafOf.assign(boxes.size(), -1);
+		unbounded.clear();
+		leafBoxes = boxes;
+		root = -1;
+
+		buildPrims.clear();
+		for (int i = 0; i < (int)boxes.size(); i++)
+		{
+			if (boxes[i].isEmpty()) unbounded.push_back(i);
+			else buildPrims.push_back(i);
+		}
+
+		centroids.resize(boxes.size());
+		for (int i : buildPrims) centroids[i] = boxes[i].center();
+
+		if (!buildPrims.empty())
+		{
+			nodes.reserve(buildPrims.size() * 2);
+			root = buildNode(buildPrims, 0, (int)buildPrims.size(), -1);
+		}
+
+		builtCost = cost();
+		updatesSinceCheck = 0;
+	}
+
+	// Entities were added/removed from the indexed list
+	void markDirty()
+	{
+		dirty = true;
+	}
+
+	bool indexes(ArrayView<Entity> entities) const
+	{
+		return source && entities.sameAs(*source) && !dirty;
+	}
+
+	bool isDirty() const
+	{
+		return dirty || source == nullptr;
+	}
+
+	// Refit the leaves of the entities whose bounds moved, rebuild if the list changed or the tree degraded
+	void update(const vector<Entity>& entities, const ComponentPool<Bounds>& bounds)
+	{
+		lastRefits = 0;
+		lastRebuilt = false;
+
+		if (isDirty() || source != &entities || entities.size() != versions.size())
+		{
+			build(entities, bounds);
+			lastRebuilt = true;
+			return;
+		}
+
+		for (size_t i = 0; i < entities.size(); i++)
+		{
+			const Bounds* b = bounds.tryGet(entities[i]);
+			if (b == nullptr || b->version == versions[i]) continue;
+
+			versions[i] = b->version;
+			updateBox((int)i, b->world);
+			lastRefits++;
+		}
+
+		if (lastRefits > 0 && ++updatesSinceCheck >= costCheckInterval)
+		{
+			updatesSinceCheck = 0;
+			if (cost() > builtCost * rebuildRatio)
+			{
+				build(entities, bounds);
+				lastRebuilt = true;
+			}
+		}
+	}
+
+	// New bounds for one indexed box: refit the path to the root
+	void updateBox(int index, const AABB& box)
+	{
+		leafBoxes[index] = box;
+
+		int n = leafOf[index];
+		if (n == -1) return; // Unbounded when built, stays in the always visible list
+
+		nodes[n].box = box;
+		for (n = nodes[n].parent; n != -1; n = nodes[n].parent)
+		{
+			AABB b = nodes[nodes[n].left].box;
+			b.expand(nodes[nodes[n].right].box);
+			nodes[n].box = b;
+		}
+	}
+
+	// SAH cost: expected nodes visited by a random query, sum(area(node)) / area(root)
+	float cost() const
+	{
+		if (root == -1) return 0.f;
+		float rootArea = glm::max(nodes[root].box.halfArea(), 1e-12f);
+
+		float c = 0.f;
+		for (const Node& n : nodes) c += n.box.halfArea();
+		return c / rootArea;
+	}
+
+	// Queries ***********************************************************************************************************
+	void queryFrustum(const Frustum& frustum, vector<int>& out) const
+	{
+		out.insert(out.end(), unbounded.begin(), unbounded.end());
+		if (root == -1) return;
+
+		stack.clear();
+		stack.push_back(root);
+		while (!stack.empty())
+		{
+			int n = stack.back();
+			stack.pop_back();
+
+			const Node& node = nodes[n];
+			if (!frustum.intersects(node.box)) continue;
+
+			if (node.object != -1) out.push_back(node.object);
+			else if (frustum.contains(node.box)) collectLeaves(n, out);
+			else
+			{
+				stack.push_back(node.right);
+				stack.push_back(node.left);
+			}
+		}
+	}
+
+	void querySphere(vec3 center, float radius, vector<int>& out) const
+	{
+		out.insert(out.end(), unbounded.begin(), unbounded.end());
+		if (root == -1) return;
+
+		float r2 = radius * radius;
+		stack.clear();
+		stack.push_back(root);
+		while (!stack.empty())
+		{
+			int n = stack.back();
+			stack.pop_back();
+
+			const Node& node = nodes[n];
+			vec3 closest = glm::clamp(center, node.box.min, node.box.max);
+			vec3 diff = closest - center;
+			if (glm::dot(diff, diff) > r2) continue;
+
+			if (node.object != -1) out.push_back(node.object);
+			else
+			{
+				stack.push_back(node.right);
+				stack.push_back(node.left);
+			}
+		}
+	}
+
+	// Closest box hit by the ray. Returns the index or -1, t is the entry distance along dir
+	int raycast(vec3 origin, vec3 dir, float& t, float maxDistance = FLT_MAX) const
+	{
+		int hit = -1;
+		t = maxDistance;
+		if (root == -1) return hit;
+
+		vec3 invDir = 1.f / dir;
+
+		stack.clear();
+		stack.push_back(root);
+		while (!stack.empty())
+		{
+			int n = stack.back();
+			stack.pop_back();
+
+			const Node& node = nodes[n];
+			float entry;
+			if (!rayBox(origin, invDir, node.box, t, entry)) continue;
+
+			if (node.object != -1)
+			{
+				hit = node.object;
+				t = entry;
+				continue;
+			}
+
+			// Visit the nearer child first so the far one is more likely to be rejected
+			float tl, tr;
+			bool hl = rayBox(origin, invDir, nodes[node.left].box, t, tl);
+			bool hr = rayBox(origin, invDir, nodes[node.right].box, t, tr);
+			if (hl && hr)
+			{
+				if (tl < tr) { stack.push_back(node.right); stack.push_back(node.left); }
+				else { stack.push_back(node.left); stack.push_back(node.right); }
+			}
+			else if (hl) stack.push_back(node.left);
+			else if (hr) stack.push_back(node.right);
+		}
+		return hit;
+	}
+
+	// Same queries, returning entities of the indexed list
+	void queryFrustum(const Frustum& frustum, vector<Entity>& out) const
+	{
+		indexScratch.clear();
+		queryFrustum(frustum, indexScratch);
+		for (int i : indexScratch) out.push_back((*source)[i]);
+	}
+
+	void querySphere(vec3 center, float radius, vector<Entity>& out) const
+	{
+		indexScratch.clear();
+		querySphere(center, radius, indexScratch);
+		for (int i : indexScratch) out.push_back((*source)[i]);
+	}
+
+	// Null entity if nothing is hit
+	Entity pick(vec3 origin, vec3 dir, float& t) const
+	{
+		int i = raycast(origin, dir, t);
+		return (i == -1 || source == nullptr) ? Entity() : (*source)[i];
+	}
+
+	void printStats() const
+	{
+		std::cout << "BVH::" << nodes.size() << " nodes, SAH cost " << cost() << " (built " << builtCost << "), "
+			<< lastRefits << " leaves refitted" << (lastRebuilt ? ", rebuilt" : "") << std::endl;
+	}
+
+	const vector<Node>& getNodes() const
+	{
+		return nodes;
+	}
+
+private:
+	vector<Node> nodes;
+	vector<int> leafOf;				// Box index -> leaf node
+	vector<AABB> leafBoxes;
+	vector<vec3> centroids;
+	vector<int> unbounded;			// Boxes with no bounds, always returned
+	vector<unsigned int> versions;	// Bounds version of each entity when its leaf was last fitted
+	const vector<Entity>* source = nullptr;
+	int root = -1;
+	bool dirty = true;
+
+	float builtCost = 0.f;
+	int updatesSinceCheck = 0;
+
+	mutable vector<int> stack;		// Traversal stack, reused between queries
+	mutable vector<int> indexScratch;
+
+	// Build temporaries, kept so a rebuild at run time doesn't allocate
+	vector<AABB> objectBoxes;
+	vector<int> buildPrims;
+
+	int buildNode(vector<int>& prims, int begin, int end, int parent)
+	{
+		int n = (int)nodes.size();
+		nodes.push_back(Node());
+		nodes[n].parent = parent;
+
+		AABB box, centroidBox;
+		for (int i = begin; i < end; i++)
+		{
+			box.expand(leafBoxes[prims[i]]);
+			centroidBox.expand(centroids[prims[i]]);
+		}
+		nodes[n].box = box;
+
+		if (end - begin == 1)
+		{
+			nodes[n].object = prims[begin];
+			leafOf[prims[begin]] = n;
+			return n;
+		}
+
+		int mid = splitSAH(prims, begin, end, centroidBox);
+
+		int left = buildNode(prims, begin, mid, n);
+		int right = buildNode(prims, mid, end, n);
+		nodes[n].left = left;
+		nodes[n].right = right;
+		return n;
+	}
+
+	// Binned SAH along the widest centroid axis. Falls back to a median split if every centroid lands in one bin
+	int splitSAH(vector<int>& prims, int begin, int end, const AABB& centroidBox)
+	{
+		vec3 size = centroidBox.max - centroidBox.min;
+		int axis = (size.x > size.y && size.x > size.z) ? 0 : (size.y > size.z ? 1 : 2);
+		float minC = centroidBox.min[axis];
+		float extent = size[axis];
+
+		int mid = (begin + end) / 2;
+		if (extent <= 0.f) return mid;
+
+		AABB binBox[SAH_BINS];
+		int binCount[SAH_BINS] = { 0 };
+		float scale = SAH_BINS / extent;
+
+		auto binOf = [&](int prim)
+		{
+			return glm::min((int)((centroids[prim][axis] - minC) * scale), SAH_BINS - 1);
+		};
+
+		for (int i = begin; i < end; i++)
+		{
+			int b = binOf(prims[i]);
+			binCount[b]++;
+			binBox[b].expand(leafBoxes[prims[i]]);
+		}
+
+		// Sweep from the right storing area * count, then from the left evaluating each split
+		float rightCost[SAH_BINS];
+		AABB acc;
+		int count = 0;
+		for (int b = SAH_BINS - 1; b > 0; b--)
+		{
+			acc.expand(binBox[b]);
+			count += binCount[b];
+			rightCost[b] = acc.halfArea() * count;
+		}
+
+		float bestCost = FLT_MAX;
+		int bestSplit = -1;
+		acc = AABB();
+		count = 0;
+		for (int b = 0; b < SAH_BINS - 1; b++)
+		{
+			acc.expand(binBox[b]);
+			count += binCount[b];
+			if (count == 0 || count == end - begin) continue;
+
+			float c = acc.halfArea() * count + rightCost[b + 1];
+			if (c < bestCost)
+			{
+				bestCost = c;
+				bestSplit = b;
+			}
+		}
+
+		if (bestSplit == -1)
+		{
+			std::nth_element(prims.begin() + begin, prims.begin() + mid, prims.begin() + end,
+				[&](int a, int b) { return centroids[a][axis] < centroids[b][axis]; });
+			return mid;
+		}
+
+		int* split = std::partition(prims.data() + begin, prims.data() + end, [&](int p) { return binOf(p) <= bestSplit; });
+		return (int)(split - prims.data());
+	}
+
+	void collectLeaves(int n, vector<int>& out) const
+	{
+		size_t base = stack.size();
+		stack.push_back(n);
+		while (stack.size() > base)
+		{
+			int i = stack.back();
+			stack.pop_back();
+
+			if (nodes[i].object != -1) out.push_back(nodes[i].object);
+			else
+			{
+				stack.push_back(nodes[i].right);
+				stack.push_back(nodes[i].left);
+			}
+		}
+	}
+
+	// Slab test. Hit only if the box is entered before maxT
+	static bool rayBox(vec3 origin, vec3 invDir, const AABB& box, float maxT, float& entry)
+	{
+		vec3 t0 = (box.min - origin) * invDir;
+		vec3 t1 = (box.max - origin) * invDir;
+		vec3 tmin = glm::min(t0, t1);
+		vec3 tmax = glm::max(t0, t1);
+
+		float tNear = glm::max(glm::max(tmin.x, tmin.y), glm::max(tmin.z, 0.f));
+		float tFar = glm::min(glm::min(tmax.x, tmax.y), tmax.z);
+
+		entry = tNear;
+		return tNear <= tFar && tNear < maxT;
+	}
+};
+
+#endif BVH_H
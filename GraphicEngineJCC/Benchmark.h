@@ -0,0 +1,1410 @@
+#ifndef BENCHMARK_H
+#define BENCHMARK_H
+
+#include "glm/glm.hpp"
+#include "glm/gtc/matrix_transform.hpp"
+#include "AABB.h"
+#include "Frustum.h"
+#include "Transformation.h"
+#include "BVH.h"
+#include "ECS.h"
+#include "Components.h"
+#include "SceneSystems.h"
+#include "TransformSystem.h"
+#include "SceneFile.h"
+#include "LightClusters.h"
+#include "ShadowMap.h"
+#include "Cubemap.h"
+#include "Mesh.h"
+#include "Shape.h"
+#include "ShaderRegistry.h"
+#include "GPUTimer.h"
+#include "Scene.h"
+#include <vector>
+#include <map>
+#include <random>
+#include <chrono>
+#include <iostream>
+#include <fstream>
+#include <cstdio>
+#include <thread>
+#include <limits>
+
+// CPU only benchmarks, no GL context needed. Run with "GraphicEngineJCC --bench". The GPU ones (runGpu) run in a
+// hidden window's context with "GraphicEngineJCC --bench-gpu"
+class Benchmark
+{
+	template<class T> using vector = std::vector<T>;
+	using clock = std::chrono::steady_clock;
+
+private:
+	Benchmark() {}
+	~Benchmark() {}
+
+	static float elapsedMs(clock::time_point start)
+	{
+		return std::chrono::duration<float, std::milli>(clock::now() - start).count();
+	}
+
+	static float buildMatrices(ArrayView<SceneFile::Object> objects)
+	{
+		float sum = 0.f;
+		Transformation t;
+		for (const SceneFile::Object& o : objects)
+		{
+			t.translation = glm::vec3(o.translation[0], o.translation[1], o.translation[2]);
+			t.rotation = glm::vec3(o.rotation[0], o.rotation[1], o.rotation[2]);
+			t.scale = glm::vec3(o.scale[0], o.scale[1], o.scale[2]);
+			sum += t.getMatrix()[3][0];
+		}
+		return sum;
+	}
+
+public:
+
+	// Random unit cubes spread around the camera, culled against its view frustum
+	static void frustumCulling(size_t count = 100000, int iterations = 20)
+	{
+		std::mt19937 rng(1234);
+		std::uniform_real_distribution<float> pos(-200.f, 200.f);
+		std::uniform_real_distribution<float> angle(0.f, 360.f);
+		std::uniform_real_distribution<float> size(0.5f, 4.f);
+
+		AABB unitBox;
+		unitBox.min = glm::vec3(-0.5f);
+		unitBox.max = glm::vec3(0.5f);
+
+		vector<Transformation> transforms(count);
+		for (Transformation& t : transforms)
+		{
+			t.translation = glm::vec3(pos(rng), pos(rng), pos(rng));
+			t.rotation = glm::vec3(angle(rng), angle(rng), angle(rng));
+			t.scale = glm::vec3(size(rng));
+		}
+
+		glm::mat4 projection = glm::perspective(glm::radians(45.f), 16.f / 9.f, 0.1f, 100.f);
+		glm::mat4 view = glm::lookAt(glm::vec3(0.f), glm::vec3(0.f, 0.f, -1.f), glm::vec3(0.f, 1.f, 0.f));
+		Frustum frustum = Frustum::fromMatrix(projection * view);
+
+		vector<AABB> worldBoxes(count);
+		vector<unsigned char> visible(count);
+
+		// Object space -> world bounds, what RenderQueue::submit does per object
+		clock::time_point start = clock::now();
+		for (int it = 0; it < iterations; it++)
+		{
+			for (size_t i = 0; i < count; i++) worldBoxes[i] = unitBox.transformed(transforms[i].getMatrix());
+		}
+		float transformMs = elapsedMs(start) / iterations;
+
+		size_t visibleCount = 0;
+		start = clock::now();
+		for (int it = 0; it < iterations; it++)
+		{
+			visibleCount = 0;
+			for (size_t i = 0; i < count; i++) visibleCount += frustum.intersectsScalar(worldBoxes[i]);
+		}
+		float scalarMs = elapsedMs(start) / iterations;
+
+		size_t simdCount = 0;
+		start = clock::now();
+		for (int it = 0; it < iterations; it++) simdCount = frustum.cull(worldBoxes.data(), count, visible.data());
+		float simdMs = elapsedMs(start) / iterations;
+
+		std::cout << "BENCHMARK::Frustum culling, " << count << " objects, " << visibleCount << " visible";
+		if (simdCount != visibleCount) std::cout << " (MISMATCH, SIMD " << simdCount << ")";
+		std::cout << std::endl;
+		std::cout << "  World bounds:  " << transformMs << " ms" << std::endl;
+		std::cout << "  Scalar test:   " << scalarMs << " ms" << std::endl;
+#ifdef FRUSTUM_SSE
+		std::cout << "  SSE test:      " << simdMs << " ms" << std::endl;
+#else
+		std::cout << "  Test (no SSE): " << simdMs << " ms" << std::endl;
+#endif
+	}
+
+	// BVH queries against the linear scan, 1k to 1M boxes in a volume that grows with the count (constant density)
+	static void spatialIndexScaling(int queries = 50)
+	{
+		size_t counts[] = { 1000, 10000, 100000, 1000000 };
+
+		std::cout << "BENCHMARK::BVH scaling (ms per query, BVH / linear)" << std::endl;
+		for (size_t count : counts)
+		{
+			std::mt19937 rng(42);
+			float side = 20.f * std::cbrt((float)count);
+			std::uniform_real_distribution<float> pos(-side * 0.5f, side * 0.5f);
+			std::uniform_real_distribution<float> size(0.5f, 3.f);
+			std::uniform_real_distribution<float> unit(-1.f, 1.f);
+
+			vector<AABB> boxes(count);
+			for (AABB& b : boxes)
+			{
+				glm::vec3 c(pos(rng), pos(rng), pos(rng));
+				glm::vec3 e(size(rng), size(rng), size(rng));
+				b.min = c - e;
+				b.max = c + e;
+			}
+
+			BVH bvh;
+			clock::time_point start = clock::now();
+			bvh.build(boxes);
+			float buildMs = elapsedMs(start);
+
+			vector<Frustum> frusta(queries);
+			vector<glm::vec3> origins(queries), dirs(queries);
+			for (int q = 0; q < queries; q++)
+			{
+				origins[q] = glm::vec3(pos(rng), pos(rng), pos(rng));
+				dirs[q] = glm::normalize(glm::vec3(unit(rng), unit(rng), unit(rng)) + glm::vec3(0.f, 0.f, 1e-3f));
+				glm::mat4 projection = glm::perspective(glm::radians(60.f), 16.f / 9.f, 0.1f, 100.f);
+				frusta[q] = Frustum::fromMatrix(projection * glm::lookAt(origins[q], origins[q] + dirs[q], glm::vec3(0.f, 1.f, 0.f)));
+			}
+
+			vector<int> result;
+			vector<unsigned char> visible(count);
+			size_t bvhHits = 0, linearHits = 0;
+
+			// Frustum
+			start = clock::now();
+			for (int q = 0; q < queries; q++)
+			{
+				result.clear();
+				bvh.queryFrustum(frusta[q], result);
+				bvhHits += result.size();
+			}
+			float bvhFrustum = elapsedMs(start) / queries;
+
+			start = clock::now();
+			for (int q = 0; q < queries; q++) linearHits += frusta[q].cull(boxes.data(), count, visible.data());
+			float linearFrustum = elapsedMs(start) / queries;
+
+			// Sphere (point light reach)
+			size_t bvhSphereHits = 0;
+			start = clock::now();
+			for (int q = 0; q < queries; q++)
+			{
+				result.clear();
+				bvh.querySphere(origins[q], 25.f, result);
+				bvhSphereHits += result.size();
+			}
+			float bvhSphere = elapsedMs(start) / queries;
+
+			size_t sphereHits = 0;
+			start = clock::now();
+			for (int q = 0; q < queries; q++)
+			{
+				for (const AABB& b : boxes)
+				{
+					glm::vec3 d = glm::clamp(origins[q], b.min, b.max) - origins[q];
+					sphereHits += glm::dot(d, d) <= 625.f;
+				}
+			}
+			float linearSphere = elapsedMs(start) / queries;
+
+			// Ray (picking)
+			vector<float> bvhT(queries), linearT(queries);
+			start = clock::now();
+			for (int q = 0; q < queries; q++) bvh.raycast(origins[q], dirs[q], bvhT[q]);
+			float bvhRay = elapsedMs(start) / queries;
+
+			start = clock::now();
+			for (int q = 0; q < queries; q++)
+			{
+				glm::vec3 inv = 1.f / dirs[q];
+				float best = FLT_MAX;
+				for (const AABB& b : boxes)
+				{
+					glm::vec3 t0 = (b.min - origins[q]) * inv, t1 = (b.max - origins[q]) * inv;
+					glm::vec3 tmin = glm::min(t0, t1), tmax = glm::max(t0, t1);
+					float tNear = glm::max(glm::max(tmin.x, tmin.y), glm::max(tmin.z, 0.f));
+					float tFar = glm::min(glm::min(tmax.x, tmax.y), tmax.z);
+					if (tNear <= tFar && tNear < best) best = tNear;
+				}
+				linearT[q] = best;
+			}
+			float linearRay = elapsedMs(start) / queries;
+			bool rayMismatch = bvhT != linearT;
+
+			std::cout << "  " << count << " objects, build " << buildMs << " ms" << std::endl;
+			std::cout << "    Frustum " << bvhFrustum << " / " << linearFrustum << (bvhHits != linearHits ? " (MISMATCH)" : "") << std::endl;
+			std::cout << "    Sphere  " << bvhSphere << " / " << linearSphere << (bvhSphereHits != sphereHits ? " (MISMATCH)" : "") << std::endl;
+			std::cout << "    Ray     " << bvhRay << " / " << linearRay << (rayMismatch ? " (MISMATCH)" : "") << std::endl;
+		}
+	}
+
+	// Deep hierarchies (chains), a few nodes edited per frame. Cached update against rebuilding every matrix in every
+	// pass, which is what setTransform(Transformation) did (3 passes: shadow, G-buffer, main)
+	static void transformHierarchy(int chains = 1000, int depth = 16, float editedFraction = 0.01f, int frames = 50)
+	{
+		const int passes = 3;
+		std::mt19937 rng(7);
+		std::uniform_real_distribution<float> angle(0.f, 360.f);
+
+		Registry registry;
+		vector<Entity> nodes(chains * depth);
+		for (int c = 0; c < chains; c++)
+		{
+			for (int d = 0; d < depth; d++)
+			{
+				Transform t;
+				t.local.translation = glm::vec3(0.f, 1.f, 0.f);
+				t.local.rotation = glm::vec3(0.f, angle(rng), 0.f);
+				if (d > 0) t.parent = nodes[c * depth + d - 1];
+
+				nodes[c * depth + d] = registry.create();
+				registry.add(nodes[c * depth + d], t);
+			}
+		}
+
+		int edits = glm::max(1, (int)(nodes.size() * editedFraction));
+		vector<int> edited(edits * frames);
+		std::uniform_int_distribution<int> pick(0, (int)nodes.size() - 1);
+		for (int& e : edited) e = pick(rng);
+
+		ComponentPool<Transform>& transforms = registry.pool<Transform>();
+		SceneSystems::updateTransforms(registry);
+
+		// Every pass rebuilds every world matrix (top-down, so only one local matrix per node)
+		vector<glm::mat4> world(nodes.size());
+		float sink = 0.f;
+		clock::time_point start = clock::now();
+		for (int f = 0; f < frames; f++)
+		{
+			for (int e = 0; e < edits; e++) transforms.get(nodes[edited[f * edits + e]]).local.rotation.x += 1.f;
+
+			for (int p = 0; p < passes; p++)
+			{
+				for (int c = 0; c < chains; c++)
+				{
+					glm::mat4 parent(1.f);
+					for (int d = 0; d < depth; d++)
+					{
+						int i = c * depth + d;
+						world[i] = parent * transforms.get(nodes[i]).local.getMatrix();
+						parent = world[i];
+					}
+				}
+				sink += world[0][3][1];
+			}
+		}
+		float naiveMs = elapsedMs(start) / frames;
+
+		// Cached: one update per frame, passes read the world matrices
+		unsigned int worldRebuilds = 0;
+		start = clock::now();
+		for (int f = 0; f < frames; f++)
+		{
+			for (int e = 0; e < edits; e++) transforms.get(nodes[edited[f * edits + e]]).local.rotation.x += 1.f;
+
+			SceneSystems::beginFrame();
+			SceneSystems::updateTransforms(registry);
+			worldRebuilds += SceneSystems::lastFrameWorldRebuilds;
+
+			for (int p = 0; p < passes; p++) sink += transforms.get(nodes[(f * 31) % nodes.size()]).world[3][1];
+		}
+		SceneSystems::beginFrame();
+		worldRebuilds = (worldRebuilds + SceneSystems::lastFrameWorldRebuilds) / frames;
+		float cachedMs = elapsedMs(start) / frames;
+
+		std::cout << "BENCHMARK::Transform hierarchy, " << chains << " chains x " << depth << " levels, " << edits << " nodes edited per frame" << std::endl;
+		std::cout << "  Rebuild in every pass: " << naiveMs << " ms/frame" << std::endl;
+		std::cout << "  Cached world matrices: " << cachedMs << " ms/frame (" << worldRebuilds << " world matrices rebuilt per frame)" << (sink == 0.12345f ? " " : "") << std::endl;
+	}
+
+	// Per frame work over every object, every one moving: transform update, world bounds and frustum culling.
+	// Heap objects mimic the old layout (one allocation per object mixing transform, bounds and render data, bounds
+	// through a virtual call) against the ECS systems walking the packed component arrays
+	static void entityIteration(int frames = 10)
+	{
+		size_t counts[] = { 10000, 100000, 1000000 };
+
+		struct HeapObject
+		{
+			Transformation transformation;
+			glm::mat4 world = glm::mat4(1.f);
+			AABB bounds;
+			char renderData[256] = {};	// Vertex/index vectors, textures and material the old classes carried inline
+
+			virtual ~HeapObject() {}
+			virtual AABB worldBounds() const { return bounds.transformed(world); }
+		};
+
+		glm::mat4 projection = glm::perspective(glm::radians(45.f), 16.f / 9.f, 0.1f, 100.f);
+		glm::mat4 view = glm::lookAt(glm::vec3(0.f), glm::vec3(0.f, 0.f, -1.f), glm::vec3(0.f, 1.f, 0.f));
+		Frustum frustum = Frustum::fromMatrix(projection * view);
+
+		AABB unitBox;
+		unitBox.min = glm::vec3(-0.5f);
+		unitBox.max = glm::vec3(0.5f);
+
+		std::cout << "BENCHMARK::Entity iteration (ms per frame, heap objects / ECS: update, cull, total)" << std::endl;
+		std::cout << "  (the ECS update also computes the world bounds, the heap objects do it while culling)" << std::endl;
+		for (size_t count : counts)
+		{
+			std::mt19937 rng(5);
+			std::uniform_real_distribution<float> pos(-200.f, 200.f);
+			std::uniform_real_distribution<float> angle(0.f, 360.f);
+
+			vector<HeapObject*> objects(count);
+			Registry registry;
+			vector<Entity> entities(count);
+			for (size_t i = 0; i < count; i++)
+			{
+				Transform t;
+				t.local.translation = glm::vec3(pos(rng), pos(rng), pos(rng));
+				t.local.rotation = glm::vec3(angle(rng), angle(rng), angle(rng));
+				Bounds b;
+				b.local = unitBox;
+
+				objects[i] = new HeapObject();
+				objects[i]->transformation = t.local;
+				objects[i]->bounds = unitBox;
+
+				entities[i] = registry.create();
+				registry.add(entities[i], t);
+				registry.add(entities[i], b);
+				registry.add(entities[i], MeshRenderer());
+			}
+
+			vector<HeapObject*> visibleObjects;
+			vector<Entity> visibleEntities;
+			visibleObjects.reserve(count);
+			visibleEntities.reserve(count);
+
+			float heapUpdate = 0.f, heapCull = 0.f;
+			for (int f = 0; f < frames; f++)
+			{
+				clock::time_point start = clock::now();
+				for (HeapObject* o : objects)
+				{
+					o->transformation.rotation.y += 1.f;
+					o->world = o->transformation.getMatrix();
+				}
+				heapUpdate += elapsedMs(start);
+
+				start = clock::now();
+				visibleObjects.clear();
+				for (HeapObject* o : objects)
+					if (frustum.intersects(o->worldBounds())) visibleObjects.push_back(o);
+				heapCull += elapsedMs(start);
+			}
+
+			ComponentPool<Transform>& transforms = registry.pool<Transform>();
+			float ecsUpdate = 0.f, ecsCull = 0.f;
+			for (int f = 0; f < frames; f++)
+			{
+				clock::time_point start = clock::now();
+				Transform* t = transforms.data();
+				for (size_t i = 0; i < transforms.size(); i++) t[i].local.rotation.y += 1.f;
+				SceneSystems::updateTransforms(registry);
+				SceneSystems::updateBounds(registry);
+				ecsUpdate += elapsedMs(start);
+
+				start = clock::now();
+				visibleEntities.clear();
+				SceneSystems::cull(registry, entities, frustum, visibleEntities);
+				ecsCull += elapsedMs(start);
+			}
+
+			for (HeapObject* o : objects) delete o;
+
+			std::cout << "  " << count << " entities: update " << heapUpdate / frames << " / " << ecsUpdate / frames << ", cull " << heapCull / frames << " / " << ecsCull / frames
+				<< ", total " << (heapUpdate + heapCull) / frames << " / " << (ecsUpdate + ecsCull) / frames
+				<< (visibleObjects.size() != visibleEntities.size() ? " (MISMATCH)" : "") << std::endl;
+		}
+	}
+
+	// World matrices of N flat objects: Transformation::getMatrix() per object (the setTransform path) against the
+	// TransformSystem SoA arrays, composed one by one and in SIMD batches
+	static void transformComposition(int iterations = 10)
+	{
+		size_t counts[] = { 10000, 100000, 1000000 };
+
+#if defined(TRANSFORM_AVX)
+		const char* simd = "AVX";
+#elif defined(TRANSFORM_SSE)
+		const char* simd = "SSE";
+#else
+		const char* simd = "none";
+#endif
+		std::cout << "BENCHMARK::Transform composition (ms, getMatrix / SoA scalar / SoA " << simd << ")" << std::endl;
+		for (size_t count : counts)
+		{
+			std::mt19937 rng(99);
+			std::uniform_real_distribution<float> pos(-100.f, 100.f);
+			std::uniform_real_distribution<float> angle(0.f, 360.f);
+			std::uniform_real_distribution<float> size(0.5f, 2.f);
+
+			vector<Transformation> transforms(count);
+			TransformSystem system(count);
+			for (Transformation& t : transforms)
+			{
+				t.translation = glm::vec3(pos(rng), pos(rng), pos(rng));
+				t.rotation = glm::vec3(angle(rng), angle(rng), angle(rng));
+				t.scale = glm::vec3(size(rng), size(rng), size(rng));
+				system.add(t);
+			}
+
+			vector<glm::mat4> models(count);
+			clock::time_point start = clock::now();
+			for (int it = 0; it < iterations; it++)
+			{
+				for (size_t i = 0; i < count; i++) models[i] = transforms[i].getMatrix();
+			}
+			float aosMs = elapsedMs(start) / iterations;
+
+			start = clock::now();
+			for (int it = 0; it < iterations; it++) system.composeScalar();
+			float scalarMs = elapsedMs(start) / iterations;
+
+			start = clock::now();
+			for (int it = 0; it < iterations; it++) system.compose();
+			float simdMs = elapsedMs(start) / iterations;
+
+			float maxError = 0.f;
+			for (size_t i = 0; i < count; i++)
+			{
+				const glm::mat4& m = system.getWorldMatrix((int)i);
+				for (int c = 0; c < 4; c++) maxError = glm::max(maxError, glm::length(m[c] - models[i][c]) / glm::max(1.f, glm::length(models[i][c])));
+			}
+
+			std::cout << "  " << count << " objects: " << aosMs << " / " << scalarMs << " / " << simdMs << (maxError > 1e-4f ? " (MISMATCH)" : "") << std::endl;
+		}
+	}
+
+	// Scene of count objects over 8 sphere meshes and 16 materials, a quarter of the objects parented. assets: the
+	// materials reference textures and there is a skybox (none of them exist, only the file size matters)
+	static void writeScene(const char* textPath, size_t count, bool assets)
+	{
+		std::mt19937 rng(7);
+		std::uniform_real_distribution<float> pos(-500.f, 500.f);
+		std::uniform_real_distribution<float> angle(0.f, 360.f);
+		std::uniform_real_distribution<float> size(0.5f, 2.f);
+		const int meshCount = 8, materialCount = 16;
+
+		std::ofstream text(textPath);
+		for (int i = 0; i < meshCount; i++) text << "mesh m" << i << " sphere " << 0.5f + i * 0.25f << " 16 16\n";
+		for (int i = 0; i < materialCount; i++)
+		{
+			text << "material mat" << i << " 1 " << i / 16.f << " 0.5";
+			if (assets) text << " base=textures/b" << i << ".png";
+			text << "\n";
+		}
+		for (size_t i = 0; i < count; i++)
+		{
+			text << "object m" << rng() % meshCount << " mat" << rng() % materialCount << " " << pos(rng) << " " << pos(rng) << " " << pos(rng) << " "
+				<< angle(rng) << " " << angle(rng) << " " << angle(rng) << " " << size(rng) << " " << size(rng) << " " << size(rng);
+			if (i > 0 && rng() % 4 == 0) text << " " << rng() % i; // A quarter of the objects have a parent
+			text << "\n";
+		}
+		text << "light directional 1 -1 -1 1 1 1\nlight point 0 5 0 20 1 0.5 0.2 noshadow\n";
+		if (assets) text << "skybox textures/sky.hdr .hdr\n";
+	}
+
+	// Load of a generated scene: the text form parsed against the binary file mapped. Both then walk the object
+	// table and build each world matrix, the part of Scene::loadScene() that doesn't touch GL (sceneLoadingGl times
+	// the whole of it). Files are written just before, so they come from the OS cache (a warm load)
+	static void sceneLoading(size_t count = 100000, int iterations = 5)
+	{
+		const char* textPath = "benchmark_scene.jscene.txt";
+		const char* binaryPath = "benchmark_scene.jscene";
+		writeScene(textPath, count, true);
+		SceneFile::convert(textPath, binaryPath);
+
+		float sink = 0.f;
+		clock::time_point start = clock::now();
+		for (int it = 0; it < iterations; it++)
+		{
+			SceneFile::Writer parsed;
+			parsed.fromText(textPath);
+			sink += buildMatrices(parsed.objects);
+		}
+		float textMs = elapsedMs(start) / iterations;
+
+		start = clock::now();
+		float openMs = 0.f;
+		for (int it = 0; it < iterations; it++)
+		{
+			clock::time_point openStart = clock::now();
+			SceneFile file;
+			file.open(binaryPath);
+			openMs += elapsedMs(openStart);
+			sink += buildMatrices(file.objects());
+		}
+		float binaryMs = elapsedMs(start) / iterations;
+		openMs /= iterations;
+
+		std::remove(textPath);
+		std::remove(binaryPath);
+
+		std::cout << "BENCHMARK::Scene loading, " << count << " objects" << std::endl;
+		std::cout << "  Text form parsed: " << textMs << " ms" << std::endl;
+		std::cout << "  Binary mapped: " << binaryMs << " ms (open and validate " << openMs << " ms, rest is the matrices)" << (sink == 0.12345f ? " " : "") << std::endl;
+	}
+
+	// Point lights binned into froxels (LightClusters), against every fragment looping over every light. The shading
+	// work is estimated on a ground plane under the camera: light evaluations per fragment, sampled on a 160x90 grid
+	static void clusteredLighting(int iterations = 20)
+	{
+		int counts[] = { 1, 64, 512, 4096 };
+		const int samplesX = 160, samplesY = 90;
+
+		float nearPlane = 0.1f, farPlane = 100.f;
+		glm::mat4 projection = glm::perspective(glm::radians(45.f), 16.f / 9.f, nearPlane, farPlane);
+		glm::mat4 view = glm::lookAt(glm::vec3(0.f, 1.f, 0.f), glm::vec3(0.f, 0.5f, -1.f), glm::vec3(0.f, 1.f, 0.f));
+		glm::mat4 inverse = glm::inverse(projection * view);
+
+		std::cout << "BENCHMARK::Clustered lighting, " << LightClusters::TILES_X << "x" << LightClusters::TILES_Y << "x" << LightClusters::SLICES << " froxels" << std::endl;
+		for (int count : counts)
+		{
+			std::mt19937 rng(11);
+			std::uniform_real_distribution<float> x(-40.f, 40.f), y(-2.f, 3.f), z(-90.f, 5.f), channel(0.2f, 1.f), distance(2.f, 6.f);
+
+			vector<PointLight> lights;
+			lights.reserve(count);
+			for (int i = 0; i < count; i++) lights.push_back(PointLight(glm::vec3(x(rng), y(rng), z(rng)), distance(rng), glm::vec3(channel(rng), channel(rng), channel(rng))));
+
+			LightClusters clusters;
+			clock::time_point start = clock::now();
+			for (int i = 0; i < iterations; i++) clusters.buildScalar(view, projection, nearPlane, farPlane, lights);
+			float scalarMs = elapsedMs(start) / iterations;
+			size_t scalarEntries = clusters.getIndexCount();
+
+			start = clock::now();
+			for (int i = 0; i < iterations; i++) clusters.build(view, projection, nearPlane, farPlane, lights);
+			float simdMs = elapsedMs(start) / iterations;
+
+			// Ground plane (y = -1) fragments, the lights of their froxel
+			size_t fragments = 0, evaluations = 0;
+			for (int sy = 0; sy < samplesY; sy++)
+			{
+				for (int sx = 0; sx < samplesX; sx++)
+				{
+					glm::vec2 ndc((sx + 0.5f) / samplesX * 2.f - 1.f, (sy + 0.5f) / samplesY * 2.f - 1.f);
+					glm::vec4 n = inverse * glm::vec4(ndc, -1.f, 1.f), f = inverse * glm::vec4(ndc, 1.f, 1.f);
+					glm::vec3 origin = glm::vec3(n) / n.w, direction = glm::vec3(f) / f.w - origin;
+					if (direction.y >= 0.f) continue;
+
+					glm::vec3 p = origin + direction * ((-1.f - origin.y) / direction.y);
+					float depth = -(view * glm::vec4(p, 1.f)).z;
+					if (depth > farPlane) continue;
+
+					int tx = glm::min((int)((ndc.x * 0.5f + 0.5f) * LightClusters::TILES_X), LightClusters::TILES_X - 1);
+					int ty = glm::min((int)((ndc.y * 0.5f + 0.5f) * LightClusters::TILES_Y), LightClusters::TILES_Y - 1);
+					evaluations += clusters.getCluster(tx, ty, clusters.slice(depth)).count;
+					fragments++;
+				}
+			}
+
+			for (PointLight& l : lights) delete l.lightCamera;
+
+			std::cout << "  " << count << " lights: binning " << simdMs << " ms (scalar " << scalarMs << " ms), " << clusters.getVisibleLights() << " visible, "
+				<< clusters.getIndexCount() << " froxel entries" << (scalarEntries != clusters.getIndexCount() ? " (MISMATCH)" : "") << std::endl;
+			std::cout << "    lights evaluated per fragment: " << (fragments ? (float)evaluations / fragments : 0.f) << " clustered, " << count << " forward" << std::endl;
+		}
+	}
+
+	// Directional light cascades against the single orthographic map they replace (8192^2, 20 units wide): memory,
+	// texels rendered per frame, world size of a texel, fitting cost and stability (where a fixed world point lands
+	// inside its texel must not change while the camera moves, or the shadow edges shimmer)
+	static void cascadedShadows(int iterations = 10000)
+	{
+		const unsigned int singleSize = 8192;
+		const float singleWidth = 20.f;
+
+		Camera camera(glm::vec3(0.f, 1.f, 3.f), glm::vec3(0.f, 0.f, -1.f));
+		DirectionalLight light(glm::normalize(glm::vec3(-0.577f, -0.577f, -0.577f)));
+
+		clock::time_point start = clock::now();
+		for (int i = 0; i < iterations; i++) ShadowMap::fitCascades(light, camera);
+		float fitUs = elapsedMs(start) * 1000.f / iterations;
+
+		// Camera sliding sideways and forwards by less than a texel per step, first cascade
+		glm::vec3 point(0.3f, 0.f, -2.f);
+		float minFraction = 1.f, maxFraction = 0.f;
+		for (int step = 0; step < 200; step++)
+		{
+			camera.setPosition(glm::vec3(0.013f * step, 1.f, 3.f - 0.007f * step));
+			ShadowMap::fitCascades(light, camera);
+			float x = ((light.cascadeMatrices[0] * glm::vec4(point, 1.f)).x * 0.5f + 0.5f) * ShadowMap::getCascadeSize();
+			float fraction = x - glm::floor(x);
+			minFraction = glm::min(minFraction, fraction);
+			maxFraction = glm::max(maxFraction, fraction);
+		}
+		delete light.lightCamera;
+
+		size_t cascadeTexels = (size_t)ShadowMap::getCascadeSize() * ShadowMap::getCascadeSize() * DirectionalLight::CASCADES;
+		size_t singleTexels = (size_t)singleSize * singleSize;
+
+		std::cout << "BENCHMARK::Cascaded shadows, " << DirectionalLight::CASCADES << " x " << ShadowMap::getCascadeSize() << "^2 against one " << singleSize << "^2 map" << std::endl;
+		std::cout << "  Memory: " << ShadowMap::getCascadeMemory() / (1024 * 1024) << " MB / " << singleTexels * sizeof(float) / (1024 * 1024) << " MB, texels cleared and rasterized per frame: "
+			<< cascadeTexels / 1000000.f << "M / " << singleTexels / 1000000.f << "M" << std::endl;
+		std::cout << "  Single map: " << singleWidth / singleSize * 1000.f << " mm texels, " << singleWidth << " units wide around a fixed point" << std::endl;
+		float sliceNear = camera.getNearPlane();
+		for (int c = 0; c < DirectionalLight::CASCADES; c++)
+		{
+			float width = 2.f / glm::length(glm::vec3(light.cascadeMatrices[c][0][0], light.cascadeMatrices[c][1][0], light.cascadeMatrices[c][2][0]));
+			std::cout << "  Cascade " << c << ": " << sliceNear << " - " << light.cascadeSplits[c] << " from the camera, " << width / ShadowMap::getCascadeSize() * 1000.f << " mm texels" << std::endl;
+			sliceNear = light.cascadeSplits[c];
+		}
+		std::cout << "  Fitting: " << fitUs << " us per frame. Texel position drift while moving: " << maxFraction - minFraction << " texels" << std::endl;
+	}
+
+	// Spot and point light shadows in one 64 MB ShadowAtlas against a fixed 8192^2 map per spot light and cube map per
+	// point light. The camera walks through the lights: allocation cost, how often the atlas is repacked, how many
+	// lights lose resolution or their shadow, and a check that no two tiles overlap
+	static void shadowAtlas(int frames = 300)
+	{
+		int counts[] = { 4, 16, 64, 256 };
+		const size_t fixedSize = 8192;
+
+		ShadowAtlas::setBudget(64 * 1024 * 1024);
+		std::cout << "BENCHMARK::Shadow atlas, " << ShadowAtlas::getAtlasSize() << "^2 (" << ShadowAtlas::getMemory() / (1024 * 1024) << " MB), half spot and half point lights" << std::endl;
+		for (int count : counts)
+		{
+			std::mt19937 rng(5);
+			std::uniform_real_distribution<float> x(-20.f, 20.f), y(-1.f, 3.f), z(-60.f, 0.f), channel(0.2f, 1.f), distance(4.f, 12.f);
+
+			vector<SpotLight> spots;
+			vector<PointLight> points;
+			for (int i = 0; i < count / 2; i++)
+			{
+				spots.push_back(SpotLight(glm::vec3(x(rng), y(rng), z(rng)), glm::vec3(0.f, -1.f, 0.f), 35.f, distance(rng), glm::vec3(channel(rng), channel(rng), channel(rng))));
+				points.push_back(PointLight(glm::vec3(x(rng), y(rng), z(rng)), distance(rng), glm::vec3(channel(rng), channel(rng), channel(rng))));
+			}
+
+			Camera camera(glm::vec3(0.f, 1.f, 5.f), glm::vec3(0.f, 0.f, -1.f));
+			unsigned int repacks = ShadowAtlas::getRepacks();
+			size_t shadowed = 0, reduced = 0, dropped = 0;
+			float ms = 0.f;
+			for (int frame = 0; frame < frames; frame++)
+			{
+				camera.setPosition(glm::vec3(0.f, 1.f, 5.f - 0.2f * frame));
+				clock::time_point start = clock::now();
+				ShadowAtlas::allocate(camera, spots, points);
+				ms += elapsedMs(start);
+
+				for (const ShadowAtlas::Tile& t : ShadowAtlas::getTiles())
+				{
+					shadowed += t.size > 0 ? 1 : 0;
+					reduced += t.size > 0 && t.size < t.requested ? 1 : 0;
+					dropped += t.size == 0 ? 1 : 0;
+				}
+			}
+			repacks = ShadowAtlas::getRepacks() - repacks;
+
+			// Tiles of the last frame, in texels
+			vector<glm::uvec3> rects;
+			for (const SpotLight& l : spots)
+				if (l.shadowResolution > 0) rects.push_back(glm::uvec3(l.shadowTiles[0] * (float)ShadowAtlas::getAtlasSize(), l.shadowResolution));
+			for (const PointLight& l : points)
+				for (int f = 0; f < 6 && l.shadowResolution > 0; f++) rects.push_back(glm::uvec3(l.shadowTiles[f] * (float)ShadowAtlas::getAtlasSize(), l.shadowResolution));
+			size_t overlaps = 0;
+			for (size_t a = 0; a < rects.size(); a++)
+				for (size_t b = a + 1; b < rects.size(); b++)
+					overlaps += rects[a].x < rects[b].x + rects[b].z && rects[b].x < rects[a].x + rects[a].z && rects[a].y < rects[b].y + rects[b].z && rects[b].y < rects[a].y + rects[a].z;
+
+			for (SpotLight& l : spots) delete l.lightCamera;
+			for (PointLight& l : points) delete l.lightCamera;
+
+			size_t fixedMB = (spots.size() + points.size() * 6) * fixedSize * fixedSize * sizeof(float) / (1024 * 1024);
+			std::cout << "  " << count << " lights: allocation " << ms / frames * 1000.f << " us per frame, " << repacks << " repacks in " << frames << " frames, "
+				<< overlaps << " overlapping tiles" << std::endl;
+			std::cout << "    per frame: " << (float)shadowed / frames << " shadowed (" << (float)reduced / frames << " below the requested size), " << (float)dropped / frames
+				<< " dropped, " << ShadowAtlas::getMemory() / (1024 * 1024) << " MB against " << fixedMB << " MB of fixed maps" << std::endl;
+		}
+	}
+
+	// Shadow views of a static scene with a few moving casters: how many views each caching mode updates per frame and
+	// how many casters it draws (what the GPU pays for), and the cost of the cache decisions. The movers stop half way,
+	// STATIC_FRAMES later they join the static layer
+	static void shadowCaching(int frames = 120)
+	{
+		const int side = 100, regions = 4, movers = 20;
+		const int views = regions * regions;
+
+		Registry registry;
+		vector<Entity> entities;
+		for (int i = 0; i < side * side; i++)
+		{
+			Transform t;
+			t.local.translation = glm::vec3(i % side + 0.5f, 0.f, i / side + 0.5f);
+			Bounds b;
+			b.local.min = glm::vec3(-0.4f);
+			b.local.max = glm::vec3(0.4f);
+
+			entities.push_back(registry.create());
+			registry.add(entities.back(), t);
+			registry.add(entities.back(), b);
+		}
+
+		// Casters of each view: a square region of the grid (movers stay in theirs)
+		vector<vector<Entity>> viewCasters(views);
+		for (int i = 0; i < side * side; i++) viewCasters[(i / side) / (side / regions) * regions + (i % side) / (side / regions)].push_back(entities[i]);
+
+		std::mt19937 rng(3);
+		std::uniform_int_distribution<int> pick(0, side * side - 1);
+		vector<Entity> moving(movers);
+		for (Entity& e : moving) e = entities[pick(rng)];
+
+		const char* names[] = { "Off", "Cached", "Static / dynamic layers" };
+		std::cout << "BENCHMARK::Shadow caching, " << views << " views of " << side * side / views << " casters, " << movers << " movers for "
+			<< frames / 2 << " of " << frames << " frames" << std::endl;
+		for (int mode = 0; mode < 3; mode++)
+		{
+			ShadowCache cache;
+			cache.setEnabled(mode != 0);
+			cache.setLayers(mode == 2);
+
+			size_t updates[4] = {}, drawn = 0;
+			float ms = 0.f;
+			for (int f = 0; f < frames; f++)
+			{
+				if (f < frames / 2)
+					for (Entity e : moving) registry.get<Transform>(e).local.translation.y = 0.01f * f;
+
+				SceneSystems::beginFrame();
+				SceneSystems::updateTransforms(registry);
+				SceneSystems::updateBounds(registry);
+
+				clock::time_point start = clock::now();
+				for (int v = 0; v < views; v++)
+				{
+					ShadowCache::Update u = cache.plan(&viewCasters[v], v, ShadowCache::mix(0, v), viewCasters[v], registry.pool<Bounds>(), SceneSystems::frame);
+					updates[u]++;
+					if (u == ShadowCache::FULL || u == ShadowCache::STATIC) drawn += viewCasters[v].size();
+					else if (u == ShadowCache::DYNAMIC) drawn += cache.getDynamicCasters().size();
+				}
+				ms += elapsedMs(start);
+			}
+
+			std::cout << "  " << names[mode] << ": " << (float)(updates[ShadowCache::FULL] + updates[ShadowCache::STATIC]) / frames << " views rendered, "
+				<< (float)updates[ShadowCache::DYNAMIC] / frames << " dynamic layer only, " << (float)updates[ShadowCache::SKIPPED] / frames << " skipped per frame, "
+				<< (float)drawn / frames << " casters drawn per frame, decisions " << ms / frames * 1000.f << " us per frame" << std::endl;
+		}
+	}
+
+	// Point light casters around the light sent to the cube faces by each ShadowMap::CubePath: the CPU culling each
+	// path does, and the work it hands to the GPU (time those in the app with V and P). Geometry shader amplification
+	// reserves max_vertices (18) outputs per triangle whatever the face mask, the other paths only run the vertex
+	// shader more often
+	static void cubeShadowPaths(int iterations = 200)
+	{
+		const int count = 2000;
+		const size_t vertices = 1000, triangles = 2000; // Per caster mesh
+		const float range = 10.f;
+
+		std::mt19937 rng(9);
+		std::uniform_real_distribution<float> position(-range, range), size(0.2f, 1.5f);
+		vector<AABB> boxes;
+		while ((int)boxes.size() < count)
+		{
+			glm::vec3 p(position(rng), position(rng), position(rng));
+			if (glm::length(p) > range) continue;
+			AABB box;
+			box.min = p - glm::vec3(size(rng));
+			box.max = p + glm::vec3(size(rng));
+			boxes.push_back(box);
+		}
+
+		glm::vec3 lightPos(0.f);
+		glm::mat4 projection = glm::perspective(glm::radians(90.f), 1.f, 0.1f, range);
+		glm::vec3 targets[] = { { 1, 0, 0 }, { -1, 0, 0 }, { 0, 1, 0 }, { 0, -1, 0 }, { 0, 0, 1 }, { 0, 0, -1 } };
+		glm::vec3 ups[] = { { 0, -1, 0 }, { 0, -1, 0 }, { 0, 0, 1 }, { 0, 0, -1 }, { 0, -1, 0 }, { 0, -1, 0 } };
+		Frustum faces[6];
+		for (int f = 0; f < 6; f++) faces[f] = Frustum::fromMatrix(projection * glm::lookAt(lightPos, lightPos + targets[f], ups[f]));
+
+		// One pass: a mask per caster over the 6 faces
+		size_t drawn = 0, faceRenders = 0;
+		clock::time_point start = clock::now();
+		for (int i = 0; i < iterations; i++)
+		{
+			drawn = faceRenders = 0;
+			for (const AABB& box : boxes)
+			{
+				unsigned int mask = 0;
+				for (int f = 0; f < 6; f++)
+					if (faces[f].intersects(box)) mask |= 1u << f;
+				drawn += mask ? 1 : 0;
+				for (; mask; mask &= mask - 1) faceRenders++;
+			}
+		}
+		float maskUs = elapsedMs(start) * 1000.f / iterations;
+
+		// Six passes: the casters culled again for each face
+		size_t passDraws = 0;
+		start = clock::now();
+		for (int i = 0; i < iterations; i++)
+		{
+			passDraws = 0;
+			for (int f = 0; f < 6; f++)
+				for (const AABB& box : boxes) passDraws += faces[f].intersects(box) ? 1 : 0;
+		}
+		float passUs = elapsedMs(start) * 1000.f / iterations;
+
+		std::cout << "BENCHMARK::Cube shadow paths, " << count << " casters of " << triangles << " triangles in range, " << faceRenders << " face renders ("
+			<< (float)faceRenders / drawn << " faces per caster)" << std::endl;
+		std::cout << "  Geometry shader: culling " << maskUs << " us, " << drawn << " draws, " << drawn * vertices / 1000000.f << "M vertices, "
+			<< drawn * triangles / 1000000.f << "M geometry shader invocations reserving " << drawn * triangles * 18 / 1000000.f << "M output vertices for "
+			<< faceRenders * triangles * 3 / 1000000.f << "M emitted" << std::endl;
+		std::cout << "  Vertex shader viewport: culling " << maskUs << " us, " << drawn << " instanced draws, " << faceRenders * vertices / 1000000.f
+			<< "M vertices, no geometry shader" << std::endl;
+		std::cout << "  Six passes: culling " << passUs << " us, " << passDraws << " draws, " << passDraws * vertices / 1000000.f
+			<< "M vertices, 6 queues sorted and 6 viewport changes" << std::endl;
+	}
+
+	// PCF against EVSM (ShadowMoments) on a shadow map seen straight from the light: a ground plane under two
+	// overlapping boxes, the higher one over part of the lower one. The moments go through the same steps as on the
+	// GPU (half resolution, 9 tap blur each way, bilinear lookup). Light leaks: lit fraction of receivers every texel
+	// of the blur footprint has in shadow (the lower box under the higher one is the classic variance leak). Acne:
+	// shadow on receivers the footprint has fully lit. Times are CPU ones, for the ratios: the GPU blurs once per view
+	// updated, and PCF fetches 9 times per fragment and light (compare the main pass with M and P in the app)
+	static void shadowFiltering(int iterations = 20)
+	{
+		const int size = 256, half = size / ShadowMoments::SCALE;
+		const float weights[5] = { 0.227027f, 0.1945946f, 0.1216216f, 0.054054f, 0.016216f };
+		const float plane = 0.9f, low = 0.6f, high = 0.3f;
+
+		// Depth seen from the light
+		auto inHigh = [](int x, int y) { return x >= 64 && x < 160 && y >= 64 && y < 192; };
+		auto inLow = [](int x, int y) { return x >= 128 && x < 224 && y >= 96 && y < 224; };
+		vector<float> depth(size * size);
+		for (int y = 0; y < size; y++)
+			for (int x = 0; x < size; x++)
+				depth[y * size + x] = inHigh(x, y) ? high : (inLow(x, y) ? low : plane);
+		auto depthAt = [&](int x, int y) { return depth[glm::clamp(y, 0, size - 1) * size + glm::clamp(x, 0, size - 1)]; };
+
+		// Moments: 2 x 2 texels each, then the separable blur
+		vector<glm::vec4> moments(half * half), blurred(half * half);
+		auto prefilter = [&]()
+		{
+			for (int y = 0; y < half; y++)
+				for (int x = 0; x < half; x++)
+					moments[y * half + x] = (ShadowMoments::warp(depthAt(2 * x, 2 * y)) + ShadowMoments::warp(depthAt(2 * x + 1, 2 * y))
+						+ ShadowMoments::warp(depthAt(2 * x, 2 * y + 1)) + ShadowMoments::warp(depthAt(2 * x + 1, 2 * y + 1))) * 0.25f;
+
+			for (int pass = 0; pass < 2; pass++)
+			{
+				vector<glm::vec4>& src = pass == 0 ? moments : blurred;
+				vector<glm::vec4>& dst = pass == 0 ? blurred : moments;
+				glm::ivec2 dir = pass == 0 ? glm::ivec2(1, 0) : glm::ivec2(0, 1);
+				for (int y = 0; y < half; y++)
+					for (int x = 0; x < half; x++)
+					{
+						glm::vec4 sum = src[y * half + x] * weights[0];
+						for (int k = 1; k < 5; k++)
+						{
+							glm::ivec2 a = glm::clamp(glm::ivec2(x, y) + dir * k, glm::ivec2(0), glm::ivec2(half - 1));
+							glm::ivec2 b = glm::clamp(glm::ivec2(x, y) - dir * k, glm::ivec2(0), glm::ivec2(half - 1));
+							sum += (src[a.y * half + a.x] + src[b.y * half + b.x]) * weights[k];
+						}
+						dst[y * half + x] = sum;
+					}
+			}
+		};
+		auto bilinear = [&](float u, float v)
+		{
+			float fx = glm::clamp(u * half - 0.5f, 0.f, half - 1.f), fy = glm::clamp(v * half - 0.5f, 0.f, half - 1.f);
+			int x0 = (int)fx, y0 = (int)fy, x1 = glm::min(x0 + 1, half - 1), y1 = glm::min(y0 + 1, half - 1);
+			float tx = fx - x0, ty = fy - y0;
+			return glm::mix(glm::mix(moments[y0 * half + x0], moments[y0 * half + x1], tx), glm::mix(moments[y1 * half + x0], moments[y1 * half + x1], tx), ty);
+		};
+		auto pcf = [&](int x, int y, float receiver)
+		{
+			float shadow = 0.f;
+			for (int dy = -1; dy <= 1; dy++)
+				for (int dx = -1; dx <= 1; dx++) shadow += receiver > depthAt(x + dx, y + dy) + 0.001f ? 1.f : 0.f;
+			return shadow / 9.f;
+		};
+		// Every depth texel under the blur footprint (about 10 texels each way) occluding the receiver, or none
+		auto footprint = [&](int x, int y, float receiver, bool occluded)
+		{
+			for (int dy = -10; dy <= 10; dy++)
+				for (int dx = -10; dx <= 10; dx++)
+					if ((receiver > depthAt(x + dx, y + dy) + 0.001f) != occluded) return false;
+			return true;
+		};
+
+		struct Method { const char* name; glm::vec2 exponents; float bleed; };
+		Method methods[] = {
+			{ "PCF 3x3", glm::vec2(0.f), 0.f },
+			{ "EVSM", ShadowMoments::exponents, ShadowMoments::lightBleedReduction },
+			{ "EVSM, no light bleeding cut", ShadowMoments::exponents, 0.f },
+			{ "EVSM 5 / 5 (16 bit float range), no cut", glm::vec2(5.f), 0.f } };
+		glm::vec2 exponents = ShadowMoments::exponents;
+		float bleed = ShadowMoments::lightBleedReduction;
+
+		std::cout << "BENCHMARK::Shadow filtering, " << size << "^2 depth, " << half << "^2 moments, receivers on the ground and on the lower box" << std::endl;
+		for (int m = 0; m < 4; m++)
+		{
+			bool evsm = m > 0;
+			ShadowMoments::exponents = methods[m].exponents;
+			ShadowMoments::lightBleedReduction = methods[m].bleed;
+
+			float prefilterMs = 0.f;
+			if (evsm)
+			{
+				clock::time_point start = clock::now();
+				for (int i = 0; i < iterations; i++) prefilter();
+				prefilterMs = elapsedMs(start) / iterations;
+			}
+
+			// Receivers: the plane under everything, and the top of the lower box
+			auto lookup = [&](int x, int y, float receiver)
+			{
+				return evsm ? ShadowMoments::shadow(bilinear((x + 0.5f) / size, (y + 0.5f) / size), receiver) : pcf(x, y, receiver);
+			};
+
+			float sink = 0.f;
+			size_t lookups = 0;
+			clock::time_point start = clock::now();
+			for (int i = 0; i < iterations; i++)
+				for (int y = 0; y < size; y++)
+					for (int x = 0; x < size; x++, lookups++) sink += lookup(x, y, plane);
+			float lookupNs = elapsedMs(start) * 1e6f / lookups;
+
+			double leak = 0.0, maxLeak = 0.0, acne = 0.0;
+			size_t umbra = 0, lit = 0;
+			for (int y = 0; y < size; y++)
+				for (int x = 0; x < size; x++)
+					for (int surface = 0; surface < 2; surface++)
+					{
+						if (surface == 1 && !inLow(x, y)) continue;
+						float receiver = surface == 0 ? plane : low;
+						float shadow = lookup(x, y, receiver);
+						if (footprint(x, y, receiver, true))
+						{
+							leak += 1.f - shadow;
+							maxLeak = glm::max(maxLeak, (double)(1.f - shadow));
+							umbra++;
+						}
+						else if (footprint(x, y, receiver, false))
+						{
+							acne += shadow;
+							lit++;
+						}
+					}
+
+			std::cout << "  " << methods[m].name << ": " << (evsm ? 1 : 9) << " fetches, " << lookupNs << " ns per lookup" << (sink < 0.f ? " " : "");
+			if (evsm) std::cout << " after a " << prefilterMs << " ms prefilter";
+			std::cout << ", leak " << 100.0 * leak / glm::max(umbra, (size_t)1) << "% mean / " << 100.0 * maxLeak << "% max over " << umbra
+				<< " umbra receivers, acne " << 100.0 * acne / glm::max(lit, (size_t)1) << "% over " << lit << " lit ones" << std::endl;
+		}
+		ShadowMoments::exponents = exponents;
+		ShadowMoments::lightBleedReduction = bleed;
+	}
+
+	// Shadow updates per frame with and without the ShadowScheduler: lights scattered along the path of a camera
+	// flying through them, one point light in 8 moving. Costs are the scheduler's estimate before any GPU timing
+	// (the same for every view), so planned ms is views times that; the spikes are the frames over budget. Maxima
+	// leave out the first frame, where every light is drawn in its new tiles
+	static void shadowScheduling(int frames = 300)
+	{
+		const int count = 64;
+		ShadowAtlas::setBudget(64 * 1024 * 1024);
+		std::cout << "BENCHMARK::Shadow scheduling, " << count << " lights (1 spot in 4), " << ShadowScheduler::budgetMs << " ms budget" << std::endl;
+
+		for (int scheduled = 0; scheduled < 2; scheduled++)
+		{
+			std::mt19937 rng(8);
+			std::uniform_real_distribution<float> x(-20.f, 20.f), y(-1.f, 3.f), z(-60.f, 0.f), channel(0.2f, 1.f), distance(4.f, 12.f);
+			vector<SpotLight> spots;
+			vector<PointLight> points;
+			for (int i = 0; i < count; i++)
+			{
+				glm::vec3 p(x(rng), y(rng), z(rng)), c(channel(rng), channel(rng), channel(rng));
+				if (i % 4 == 0) spots.push_back(SpotLight(p, glm::vec3(0.f, -1.f, 0.f), 35.f, distance(rng), c));
+				else points.push_back(PointLight(p, distance(rng), c));
+			}
+
+			ShadowScheduler::reset();
+			ShadowScheduler::setEnabled(scheduled == 1);
+			Camera camera(glm::vec3(0.f, 1.f, 5.f), glm::vec3(0.f, 0.f, -1.f));
+			float ms = 0.f, planned = 0.f, maxPlanned = 0.f;
+			size_t views = 0, maxViews = 0, overBudget = 0, forced = 0, sliced = 0, dropped = 0;
+			unsigned int maxWait = 0;
+			for (int frame = 0; frame < frames; frame++)
+			{
+				camera.setPosition(glm::vec3(0.f, 1.f, 5.f - 0.2f * frame));
+				for (size_t i = 0; i < points.size(); i += 8)
+				{
+					glm::vec3 p = points[i].getPosition();
+					points[i].setPosition(p + glm::vec3(glm::cos(frame * 0.05f), 0.f, glm::sin(frame * 0.05f)) * 0.1f);
+				}
+				ShadowAtlas::allocate(camera, spots, points);
+
+				clock::time_point start = clock::now();
+				ShadowScheduler::plan(camera, nullptr, spots, points);
+				ms += elapsedMs(start);
+
+				const ShadowScheduler::Stats& s = ShadowScheduler::getStats();
+				planned += s.plannedMs;
+				overBudget += s.plannedMs > ShadowScheduler::budgetMs ? 1 : 0;
+				views += s.views;
+				forced += s.forced;
+				sliced += s.sliced;
+				dropped += s.dropped;
+				if (frame == 0) continue;
+				maxPlanned = glm::max(maxPlanned, s.plannedMs);
+				maxViews = glm::max(maxViews, (size_t)s.views);
+				maxWait = glm::max(maxWait, s.maxWait);
+			}
+
+			for (SpotLight& l : spots) delete l.lightCamera;
+			for (PointLight& l : points) delete l.lightCamera;
+
+			std::cout << "  " << (scheduled ? "Scheduled" : "Every light every frame") << ": plan " << ms / frames * 1000.f << " us, views per frame " << (float)views / frames
+				<< " mean / " << maxViews << " max, planned " << planned / frames << " ms mean / " << maxPlanned << " ms max, " << overBudget << " of " << frames
+				<< " frames over budget" << std::endl;
+			std::cout << "    per frame: " << (float)forced / frames << " forced updates (tiles moved in the atlas), " << (float)dropped / frames << " lights without shadow waiting for theirs, "
+				<< (float)sliced / frames << " point lights one face; longest wait " << maxWait << " frames" << std::endl;
+		}
+		ShadowScheduler::reset();
+		ShadowScheduler::setEnabled(true);
+	}
+
+	// Full bake of an .hdr environment by each path (Cubemap::bakePath), the file decoded and uploaded beforehand:
+	// GPU and CPU time, environment samples per texel, and how far the compute targets are from the raster ones
+	// (RMS of the difference over RMS of the raster texels, every face and mip)
+	static void environmentBake(const char* path = "textures/Arches_E_PineTree_3k.hdr", int runs = 3)
+	{
+		std::cout << "BENCHMARK::Environment bake, " << path << ", " << Cubemap::CUBE_SIZE << " cube, " << Cubemap::IRRADIANCE_SIZE << " irradiance, "
+			<< Cubemap::PREFILTER_SIZE << " pre-filter (" << Cubemap::PREFILTER_MIPS << " mips)" << std::endl;
+
+		Cubemap::BakePath previous = Cubemap::bakePath;
+		Cubemap* baked[2] = { nullptr, nullptr };
+		unsigned int query[2];
+		glGenQueries(2, query);
+
+		for (int p = Cubemap::RASTER; p <= Cubemap::COMPUTE; p++)
+		{
+			Cubemap::bakePath = (Cubemap::BakePath)p;
+			double gpuMs = 0.0;
+			float cpuMs = 0.f;
+			for (int run = 0; run < runs; run++)
+			{
+				Cubemap* c = new Cubemap(path, ".hdr", true, false);
+				while (!c->prepare()) std::this_thread::sleep_for(std::chrono::milliseconds(1));
+				if (c->getStage() == Cubemap::DONE) // Didn't load
+				{
+					delete c;
+					delete baked[0];
+					glDeleteQueries(2, query);
+					Cubemap::bakePath = previous;
+					return;
+				}
+
+				glFinish();
+				clock::time_point start = clock::now();
+				glQueryCounter(query[0], GL_TIMESTAMP);
+				c->bake(std::numeric_limits<float>::infinity());
+				glQueryCounter(query[1], GL_TIMESTAMP);
+				glFinish();
+				cpuMs += elapsedMs(start);
+
+				GLuint64 begin = 0, end = 0;
+				glGetQueryObjectui64v(query[0], GL_QUERY_RESULT, &begin);
+				glGetQueryObjectui64v(query[1], GL_QUERY_RESULT, &end);
+				gpuMs += (end - begin) / 1e6;
+
+				if (run == runs - 1) baked[p] = c;
+				else delete c;
+			}
+
+			bool compute = p == Cubemap::COMPUTE;
+			std::cout << "  " << (compute ? "Compute" : "Raster") << ": " << gpuMs / runs << " ms GPU, " << cpuMs / runs << " ms CPU; samples per texel "
+				<< (compute ? Cubemap::IRRADIANCE_TABLE_SAMPLES : Cubemap::IRRADIANCE_SAMPLES) << " irradiance, "
+				<< (compute ? Cubemap::PREFILTER_TABLE_SAMPLES : Cubemap::PREFILTER_SAMPLES) << " pre-filter" << std::endl;
+		}
+
+		std::cout << "  Compute against raster: cube " << cubeDifference(baked[1]->cubemapID, baked[0]->cubemapID, Cubemap::CUBE_SIZE, 1)
+			<< ", irradiance " << cubeDifference(baked[1]->cubemapEnvID, baked[0]->cubemapEnvID, Cubemap::IRRADIANCE_SIZE, 1)
+			<< ", pre-filter " << cubeDifference(baked[1]->cubemapPrefilterID, baked[0]->cubemapPrefilterID, Cubemap::PREFILTER_SIZE, Cubemap::PREFILTER_MIPS)
+			<< " (relative RMS)" << std::endl;
+
+		delete baked[0];
+		delete baked[1];
+		glDeleteQueries(2, query);
+		Cubemap::bakePath = previous;
+	}
+
+	// Scene::loadScene() of a generated scene, in the window's context: the meshes built and uploaded, an entity per
+	// object. Then the first frame's transform and bounds update and the BVH build, which every load is followed by.
+	// The materials have no textures and there is no skybox, both are loaded once per table entry
+	static void sceneLoadingGl(size_t count = 100000)
+	{
+		const char* textPath = "benchmark_scene.jscene.txt";
+		const char* binaryPath = "benchmark_scene.jscene";
+		writeScene(textPath, count, false);
+		SceneFile::convert(textPath, binaryPath);
+
+		size_t entities = Scene::sceneObjects.size();
+		glFinish();
+		clock::time_point start = clock::now();
+		bool loaded = Scene::loadScene(binaryPath);
+		glFinish();
+		float loadMs = elapsedMs(start);
+
+		start = clock::now();
+		Scene::updateTransforms();
+		Scene::updateSpatialIndex();
+		float updateMs = elapsedMs(start);
+
+		std::remove(textPath);
+		std::remove(binaryPath);
+
+		std::cout << "BENCHMARK::Scene loading with GL, " << count << " objects" << std::endl;
+		if (!loaded) return;
+		std::cout << "  Scene::loadScene: " << loadMs << " ms, " << Scene::sceneObjects.size() - entities << " entities" << std::endl;
+		std::cout << "  First update (transforms, bounds, BVH build): " << updateMs << " ms" << std::endl;
+	}
+
+	static void runAll()
+	{
+		frustumCulling();
+		spatialIndexScaling();
+		transformHierarchy();
+		transformComposition();
+		entityIteration();
+		clusteredLighting();
+		cascadedShadows();
+		shadowAtlas();
+		shadowCaching();
+		cubeShadowPaths();
+		shadowFiltering();
+		shadowScheduling();
+		sceneLoading();
+	}
+
+	// The vertex bound objects of the scene through the main pass program (vsStandard + fsPBR): the dense sphere
+	// (512x512) and the instanced rocks (32 x 32 instances of a 48x48 sphere), one draw each. The target is 64x64 so
+	// fragments cost next to nothing. GPUTimer per draw, and the time until glFinish returns
+	static void vertexBound(int frames = 40)
+	{
+		const int size = 64, warmup = 5;
+		unsigned int fbo, color, depth;
+		glGenFramebuffers(1, &fbo);
+		glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+		glGenTextures(1, &color);
+		glBindTexture(GL_TEXTURE_2D, color);
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA16F, size, size, 0, GL_RGBA, GL_FLOAT, nullptr);
+		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, color, 0);
+		glGenRenderbuffers(1, &depth);
+		glBindRenderbuffer(GL_RENDERBUFFER, depth);
+		glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH24_STENCIL8, size, size);
+		glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_RENDERBUFFER, depth);
+		glViewport(0, 0, size, size);
+
+		std::map<std::string, const char*> defines;
+		defines["MAX_SPOT_LIGHT"] = "1";
+		std::shared_ptr<Shader> shader = ShaderRegistry::get("vsStandard.vert", "fsPBR.frag", "", defines);
+
+		vector<Texture> noTextures;
+		vector<float> vert;
+		vector<unsigned int> ind;
+		Shape::generateSphere(1., 512, 512, vert, ind);
+		Mesh dense(vert, ind, noTextures);
+		size_t denseVertices = vert.size() / 11;
+
+		vert.clear();
+		ind.clear();
+		Shape::generateSphere(0.2f, 48, 48, vert, ind);
+		vector<glm::mat4> rockModels;
+		for (int i = 0; i < 32 * 32; i++)
+		{
+			glm::vec3 position(-8.f + (i % 32) * 0.5f, -1.f + 0.3f * glm::sin(i * 12.9898f), -2.f - (i / 32) * 0.5f);
+			glm::mat4 m = glm::translate(glm::mat4(1.f), position);
+			m = glm::rotate(m, glm::radians(i * 37.f), glm::normalize(glm::vec3(1.f, 2.f, 0.5f)));
+			rockModels.push_back(glm::scale(m, glm::vec3(0.6f + 0.4f * glm::abs(glm::sin(i * 3.7f)), 0.5f, 0.8f)));
+		}
+		Mesh rocks(vert, ind, noTextures, glm::vec3(1.f), (int)rockModels.size(), rockModels.data());
+		size_t rockVertices = vert.size() / 11 * rockModels.size();
+
+		glm::mat4 view = glm::lookAt(glm::vec3(0.f, 10.f, 12.f), glm::vec3(0.f, -1.f, -8.f), glm::vec3(0.f, 1.f, 0.f));
+		glm::mat4 projection = glm::perspective(glm::radians(60.f), 1.f, 0.1f, 100.f);
+		glm::mat4 model(1.5f);
+		model[3][3] = 1.f;
+
+		std::cout << "BENCHMARK::Vertex bound draws, main pass program, " << frames << " frames" << std::endl;
+		Mesh* meshes[2] = { &dense, &rocks };
+		const char* names[2] = { "Dense sphere", "Instanced rocks" };
+		size_t vertices[2] = { denseVertices, rockVertices };
+		for (int i = 0; i < 2; i++)
+		{
+			GPUTimer timer(names[i]);
+			float gpuMs = 0.f, finishMs = 0.f;
+			int gpuSamples = 0;
+			for (int f = 0; f < warmup + frames; f++)
+			{
+				glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+				clock::time_point start = clock::now();
+				timer.begin(); // Reads the draw of 3 frames ago
+				if (f >= warmup + 3)
+				{
+					gpuMs += timer.gpuMs;
+					gpuSamples++;
+				}
+				shader->use();
+				// Nothing is bound, but samplers of different types can't share unit 0
+				shader->setInt("irradianceMap", 10);
+				shader->setInt("prefilterMap", 11);
+				shader->setInt("dShadowMap", 12);
+				shader->setInt("dShadowMoments", 13);
+				shader->setInt("shadowMomentsAtlas", 14);
+				shader->setMat4("view", glm::value_ptr(view));
+				shader->setMat4("projection", glm::value_ptr(projection));
+				shader->setModel(model);
+				meshes[i]->Draw(shader.get());
+				timer.end();
+				glFinish();
+				if (f >= warmup) finishMs += elapsedMs(start);
+			}
+			std::cout << "  " << names[i] << " (" << vertices[i] / 1000 << "k vertices): GPU " << gpuMs / glm::max(gpuSamples, 1) << " ms, until finished "
+				<< finishMs / frames << " ms" << std::endl;
+		}
+
+		glBindFramebuffer(GL_FRAMEBUFFER, 0);
+		glDeleteFramebuffers(1, &fbo);
+		glDeleteTextures(1, &color);
+		glDeleteRenderbuffers(1, &depth);
+		GLState::invalidate();
+	}
+
+	// A spot light's shadow pass over count casters, each with its own mesh (as every entity of the scene has) of a
+	// segments x segments sphere and its own color: the RenderQueue in depth-only mode (DepthGeometry positions, one
+	// multi-draw) against the per-caster path (each mesh's vertex array and material, a draw per caster). CPU is the
+	// time to record the pass, GPU the GPUTimer around it, and the wall time until glFinish returns. runGpu times a
+	// pass bound by the draw submission (small map, low poly casters) and one bound by the rasterization
+	static void shadowBatching(int count = 2000, int size = 2048, int segments = 16, int frames = 40)
+	{
+		const int warmup = 5;
+		unsigned int fbo, depth;
+		glGenFramebuffers(1, &fbo);
+		glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+		glGenTextures(1, &depth);
+		glBindTexture(GL_TEXTURE_2D, depth);
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT32F, size, size, 0, GL_DEPTH_COMPONENT, GL_FLOAT, nullptr);
+		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, depth, 0);
+		glDrawBuffer(GL_NONE);
+		glReadBuffer(GL_NONE);
+		glViewport(0, 0, size, size);
+		GLState::enable(GL_DEPTH_TEST);
+
+		std::shared_ptr<Shader> shader = ShaderRegistry::get("vsShadowMap.vert", "fsEmpty.frag");
+
+		vector<Texture> noTextures;
+		vector<float> vert;
+		vector<unsigned int> ind;
+		Shape::generateSphere(0.3f, segments, segments, vert, ind);
+		vector<Mesh> meshes;
+		meshes.reserve(count);
+		for (int i = 0; i < count; i++) meshes.emplace_back(vert, ind, noTextures, glm::vec3((i % 7) / 7.f, (i % 11) / 11.f, (i % 13) / 13.f));
+
+		// Casters on a grid under the light, the queue reads their world matrices and meshes from the registry
+		Registry registry;
+		vector<Entity> entities;
+		int side = (int)glm::ceil(glm::sqrt((float)count));
+		for (int i = 0; i < count; i++)
+		{
+			Transform t;
+			t.world = glm::translate(glm::mat4(1.f), glm::vec3((i % side) - side * 0.5f, 0.f, (i / side) - side * 0.5f));
+			MeshRenderer r;
+			r.meshes = &meshes[i];
+			r.meshCount = 1;
+
+			entities.push_back(registry.create());
+			registry.add(entities.back(), t);
+			registry.add(entities.back(), r);
+		}
+		Registry* sceneRegistry = RenderQueue::registry;
+		const BVH* sceneIndex = RenderQueue::spatialIndex;
+		RenderQueue::registry = &registry;
+		RenderQueue::spatialIndex = nullptr;
+
+		glm::vec3 eye(0.f, side * 1.5f, 0.f);
+		glm::mat4 lightSpaceMatrix = glm::perspective(glm::radians(60.f), 1.f, 1.f, side * 3.f)
+			* glm::lookAt(eye, glm::vec3(0.f), glm::vec3(0.f, 0.f, -1.f));
+
+		std::cout << "BENCHMARK::Shadow pass, " << count << " casters (" << vert.size() / 11 << " vertices each), " << size << "^2 spot light map, " << frames << " frames" << std::endl;
+		const char* names[2] = { "Depth-only, batched", "Per caster" };
+		for (int mode = 0; mode < 2; mode++)
+		{
+			RenderQueue queue;
+			queue.setDepthOnly(mode == 0);
+			GPUTimer timer(names[mode]);
+			float cpuMs = 0.f, gpuMs = 0.f, finishMs = 0.f;
+			int gpuSamples = 0;
+			for (int f = 0; f < warmup + frames; f++)
+			{
+				glClear(GL_DEPTH_BUFFER_BIT);
+				glFinish();
+				clock::time_point start = clock::now();
+				timer.begin(); // Reads the pass of 3 frames ago
+				if (f >= warmup + 3)
+				{
+					gpuMs += timer.gpuMs;
+					gpuSamples++;
+				}
+				shader->use();
+				shader->setMat4("lightSpaceMatrix", (float*)glm::value_ptr(lightSpaceMatrix));
+				queue.draw(entities, shader.get(), RenderQueue::SHADOW, eye, side * 3.f);
+				timer.end();
+				if (f >= warmup) cpuMs += elapsedMs(start);
+				glFinish();
+				if (f >= warmup) finishMs += elapsedMs(start);
+			}
+			std::cout << "  " << names[mode] << ": " << queue.getDrawCalls() << " draws, CPU " << cpuMs / frames << " ms, GPU "
+				<< gpuMs / glm::max(gpuSamples, 1) << " ms, until finished " << finishMs / frames << " ms" << std::endl;
+		}
+
+		RenderQueue::registry = sceneRegistry;
+		RenderQueue::spatialIndex = sceneIndex;
+		glBindFramebuffer(GL_FRAMEBUFFER, 0);
+		glDeleteFramebuffers(1, &fbo);
+		glDeleteTextures(1, &depth);
+		GLState::invalidate();
+	}
+
+	static void runGpu()
+	{
+		vertexBound();
+		shadowBatching(2000, 128, 4);
+		shadowBatching();
+		environmentBake();
+		sceneLoadingGl();
+	}
+
+private:
+	// RMS of a - b over RMS of b, every face of mips [0, mips) of two cubes of the same size
+	static double cubeDifference(unsigned int a, unsigned int b, unsigned int size, unsigned int mips)
+	{
+		double difference = 0.0, reference = 0.0;
+		vector<float> texelsA, texelsB;
+		for (unsigned int mip = 0; mip < mips; mip++)
+		{
+			unsigned int mipSize = glm::max(size >> mip, 1u);
+			texelsA.resize((size_t)mipSize * mipSize * 4);
+			texelsB.resize(texelsA.size());
+			for (unsigned int face = 0; face < 6; face++)
+			{
+				glBindTexture(GL_TEXTURE_CUBE_MAP, a);
+				glGetTexImage(GL_TEXTURE_CUBE_MAP_POSITIVE_X + face, mip, GL_RGBA, GL_FLOAT, texelsA.data());
+				glBindTexture(GL_TEXTURE_CUBE_MAP, b);
+				glGetTexImage(GL_TEXTURE_CUBE_MAP_POSITIVE_X + face, mip, GL_RGBA, GL_FLOAT, texelsB.data());
+				for (size_t i = 0; i < texelsA.size(); i += 4)
+				{
+					for (size_t c = i; c < i + 3; c++)
+					{
+						difference += (texelsA[c] - texelsB[c]) * (texelsA[c] - texelsB[c]);
+						reference += texelsB[c] * texelsB[c];
+					}
+				}
+			}
+		}
+		GLState::invalidate();
+		return reference > 0.0 ? glm::sqrt(difference / reference) : 0.0;
+	}
+};
+
+#endif BENCHMARK_H
@@ -59,6 +59,11 @@ public:
 		return position;
 	}
 
+	glm::vec3 getDirection() const
+	{
+		return direction;
+	}
+
 	glm::mat4 getViewMatrix() const
 	{
 		return glm::lookAt(position, position + direction, worldUp);
@@ -182,6 +187,11 @@ public:
 		cameraHeight = height;
 	}
 
+	int getCameraHeight() const
+	{
+		return cameraHeight;
+	}
+
 	float getFarPlane() const
 	{
 		return farPlane;
@@ -0,0 +1,62 @@
+#ifndef COMPONENTS_H
+#define COMPONENTS_H
+
+#include "glm/glm.hpp"
+#include "ECS.h"
+#include "Transformation.h"
+#include "AABB.h"
+
+class Mesh;
+
+// Scene components. Systems (SceneSystems.h) derive world matrices, world bounds and light placement from them.
+
+// Local transformation, relative to the parent entity. Edit local directly: the transform update notices the change.
+// The pool is kept sorted by depth, so one pass in order sees every parent before its children.
+struct Transform
+{
+	Transformation local;
+	Entity parent;				// Null: root
+
+	// Written by the transform update
+	glm::mat4 world = glm::mat4(1.f);
+	unsigned int version = 0;	// Changes every time world does
+	unsigned int depth = 0;		// Ancestors
+
+	// Update cache
+	Transformation cachedLocal;
+	glm::mat4 localMatrix = glm::mat4(1.f);
+	unsigned int parentVersion = 0;
+	bool dirty = true;
+};
+
+// Box used by culling and the spatial index
+struct Bounds
+{
+	AABB local;							// Object space. Empty: never culled
+	AABB world;
+	bool worldSpace = false;			// local is already in world space (instanced meshes place each instance themselves)
+	unsigned int transformVersion = ~0u;// Transform version world was computed from
+	unsigned int version = 0;			// Changes every time world does, the spatial index refits on it
+	unsigned int changedFrame = 0;		// SceneSystems frame of the last change, shadows cache the casters quiet for a while
+};
+
+// What the render passes draw: a single mesh, or all the meshes of a model (contiguous, owned by the asset)
+struct MeshRenderer
+{
+	Mesh* meshes = nullptr;
+	unsigned int meshCount = 0;
+};
+
+// Places a light of the Scene light arrays with the entity's transform. position and direction are local to it
+struct Light
+{
+	enum Type { DIRECTIONAL_LIGHT, SPOT_LIGHT, POINT_LIGHT };
+
+	Type type = DIRECTIONAL_LIGHT;
+	unsigned int index = 0;		// In Scene::directionalLights / spotLights / pointLights
+	glm::vec3 position = glm::vec3(0.f);
+	glm::vec3 direction = glm::vec3(0.f, -1.f, 0.f);
+	unsigned int transformVersion = ~0u;
+};
+
+#endif COMPONENTS_H
@@ -1,263 +1,88 @@
 #ifndef CUBEMAP_H
 #define CUBEMAP_H
 
-#include "Shader.h"
+#include "ShaderRegistry.h"
 #include "Shape.h"
 #include "Mesh.h"
+#include "GLState.h"
 #include <Vector>
+#include <future>
+#include <chrono>
+#include <limits>
 #include <stb_image.h>
 
+// Skybox and image based lighting of an environment. An .hdr environment is baked into the skybox cube (conversion),
+// the diffuse irradiance cube and the prefiltered specular cube. A progressive cubemap decodes its file in another
+// thread and bakes across frames (see bake()): rows of one face of one mip at a time within a GPU time budget, into
+// textures of its own, so whatever was shown keeps being shown until the bake is done. A quick bake at low resolution
+// can be shown meanwhile. The BRDF lookup texture doesn't depend on the environment, every cubemap shares one.
+// Two bake paths (bakePath): RASTER draws the cube once per face with the fs*Cubemap shaders, COMPUTE writes the six
+// faces of a mip per dispatch (csCubemapBake.comp) from a table of filtered importance samples, a few dozen per
+// texel instead of 1024 (pre-filter) or 15876 (irradiance)
 class Cubemap
 {
 public:
-	Shader *cubemapShader = new Shader("vsCubemap.vert","fsCubemap.frag");
-	Shader *cubemapConversion = new Shader("vsCubemapConversion.vert", "fsCubemapConversion.frag");
-	Shader* cubemapConvolution = new Shader("vsCubemapConversion.vert", "fsCubemapConvolution.frag");
-	Shader* cubemapPrefilter = new Shader("vsCubemapConversion.vert", "fsPrefilterCubemap.frag");
-	Shader* brdfShader = new Shader("vsQuad.vert", "fsBrdfLUT.frag");
+	// Bake progress, in order
+	enum BakeStage { LOADING, CONVERSION, IRRADIANCE, PREFILTER, DONE };
 
-	unsigned int cubemapID;				// Skybox
-	unsigned int cubemapEnvID;			// Ambient diffuse light
+	enum BakePath { RASTER, COMPUTE };
 
-	// Using pre-filtered and BRDF LUT makes Ambient specular light
-	unsigned int cubemapPrefilterID;	// Pre-filtered cubemap
-	unsigned int brdfLutID;				// BRDF Lookup texture 2D
-
-
-	Cubemap(std::string path, std::string format = ".png")
-	{
-		setupMesh();
-
-		int width, height, nrChannels;
-
-		if (format == ".hdr")
-		{
-			// Load equirectangular 2D texture *********************************************************************
-			unsigned int hdrTexture;
-			stbi_set_flip_vertically_on_load(true);
-
-			float* data = stbi_loadf(path.c_str(), &width, &height, &nrChannels, 0);
-			if (data)
-			{
-				#pragma region Read .hdr file
-				glGenTextures(1, &hdrTexture);
-				glBindTexture(GL_TEXTURE_2D, hdrTexture);
-				if (nrChannels == 4)
-					glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA32F, width, height, 0, GL_RGBA, GL_FLOAT, data);
-				else
-					glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB32F, width, height, 0, GL_RGB, GL_FLOAT, data);
-
-				glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-				glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-				glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-				glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-				stbi_image_free(data);
-				#pragma endregion
-
-				#pragma region From equirectangular texture to a 6 textures cubemap
-				// Convert equirectangular 2D texture in 6 textures to make a cubemap **********************************
-
-				const unsigned int cubeResolution = 1024;
-
-				// Framebuffer
-				unsigned int captureFBO, captureRBO;
-				glGenFramebuffers(1, &captureFBO);
-				glGenRenderbuffers(1, &captureRBO);
-
-				glBindFramebuffer(GL_FRAMEBUFFER, captureFBO);
-				glBindRenderbuffer(GL_RENDERBUFFER, captureRBO);
-
-				// Depth
-				glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, cubeResolution, cubeResolution);
-				glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, captureRBO);
-
-				// Color
-				glGenTextures(1, &cubemapID);
-				glBindTexture(GL_TEXTURE_CUBE_MAP, cubemapID);
-				for (unsigned int i = 0; i < 6; ++i)
-				{
-					glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, 0, GL_RGB32F, cubeResolution, cubeResolution, 0, GL_RGB, GL_FLOAT, nullptr);
-				}
-
-				glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-				glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-				glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
-				glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-				glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-
-				// 6 "Cameras" to capture 6 faces of a cube with equirectangular texture
-				glm::mat4 captureProjection = glm::perspective(glm::radians(90.0f), 1.0f, -0.1f, 10.0f);
-				glm::mat4 captureViews[] = {
-					glm::lookAt(glm::vec3(0.0f, 0.0f, 0.0f), glm::vec3(1.0f, 0.0f, 0.0f), glm::vec3(0.0f, -1.0f, 0.0f)),
-					glm::lookAt(glm::vec3(0.0f, 0.0f, 0.0f), glm::vec3(-1.0f, 0.0f, 0.0f), glm::vec3(0.0f, -1.0f, 0.0f)),
-					glm::lookAt(glm::vec3(0.0f, 0.0f, 0.0f), glm::vec3(0.0f, 1.0f, 0.0f), glm::vec3(0.0f, 0.0f, 1.0f)),
-					glm::lookAt(glm::vec3(0.0f, 0.0f, 0.0f), glm::vec3(0.0f, -1.0f, 0.0f), glm::vec3(0.0f, 0.0f, -1.0f)),
-					glm::lookAt(glm::vec3(0.0f, 0.0f, 0.0f), glm::vec3(0.0f, 0.0f, 1.0f), glm::vec3(0.0f, -1.0f, 0.0f)),
-					glm::lookAt(glm::vec3(0.0f, 0.0f, 0.0f), glm::vec3(0.0f, 0.0f, -1.0f), glm::vec3(0.0f, -1.0f, 0.0f))
-				};
-
-				// Convert HDR equirectangular environment map to cubemap equivalent
-				cubemapConversion->use();
-				cubemapConversion->setInt("equirectangularMap", 0);
-				cubemapConversion->setMat4("projection", glm::value_ptr(captureProjection));
-
-				// Bind equirectangular texture to texture unit 0
-				glActiveTexture(GL_TEXTURE0);
-				glBindTexture(GL_TEXTURE_2D, hdrTexture);
-
-				// Match the viewport and the cube resolution
-				glViewport(0, 0, cubeResolution, cubeResolution);
-				glBindFramebuffer(GL_FRAMEBUFFER, captureFBO);
-
-				// Draw 6 times a cube with equirectangular texture to capture the 6 faces
-				for (unsigned int i = 0; i < 6; ++i)
-				{
-					cubemapConversion->setMat4("view", glm::value_ptr(captureViews[i]));
-					glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, cubemapID, 0);
-					glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-
-					glBindVertexArray(VAO);
-					glDrawArrays(GL_TRIANGLES, 0, 36);
-					glBindVertexArray(0);
-				}
-				#pragma endregion
-
-				#pragma region Cubemap convolution to get an enviromental lighting pre-calculation (ambient diffuse light)
-				// Cubemap convolution ********************************************************************************************
-				// Color
-				glGenTextures(1, &cubemapEnvID);
-				glBindTexture(GL_TEXTURE_CUBE_MAP, cubemapEnvID);
-				for (unsigned int i = 0; i < 6; ++i)
-				{
-					// Low resolution for a blurry texture
-					glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, 0, GL_RGB32F, 32, 32, 0, GL_RGB, GL_FLOAT, nullptr);
-				}
-				
-				glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-				glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-				glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
-				glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-				glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-
-				glBindFramebuffer(GL_FRAMEBUFFER, captureFBO); // Re-use Framebuffer
-				glBindRenderbuffer(GL_RENDERBUFFER, captureRBO); // Change depth resolution
-				glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, 32, 32);
+	// Sizes (texels per side) of the full and the quick bake
+	static const unsigned int CUBE_SIZE = 1024, IRRADIANCE_SIZE = 32, PREFILTER_SIZE = 256;
+	static const unsigned int QUICK_CUBE_SIZE = 128, QUICK_IRRADIANCE_SIZE = 8, QUICK_PREFILTER_SIZE = 32;
+	static const unsigned int PREFILTER_MIPS = 5;
 
-				cubemapConvolution->use();
-				cubemapConvolution->setInt("skybox", 0);
-				cubemapConvolution->setMat4("projection", glm::value_ptr(captureProjection));
+	// Environment samples per texel of fsCubemapConvolution.frag (a 0.025 rad step over the hemisphere) and
+	// fsPrefilterCubemap.frag
+	static const unsigned int IRRADIANCE_SAMPLES = 252 * 63;
+	static const unsigned int PREFILTER_SAMPLES = 1024;
 
-				glActiveTexture(GL_TEXTURE0);
-				glBindTexture(GL_TEXTURE_CUBE_MAP, cubemapID);
+	// Samples per texel of the compute convolutions
+	static const unsigned int IRRADIANCE_TABLE_SAMPLES = 128;
+	static const unsigned int PREFILTER_TABLE_SAMPLES = 64;
 
-				glViewport(0, 0, 32, 32); // Low resolution viewport
-				glBindFramebuffer(GL_FRAMEBUFFER, captureFBO);
+	// Of the bakes started from now on
+	static BakePath bakePath;
 
-				for (unsigned int i = 0; i < 6; ++i)
-				{
-					cubemapConvolution->setMat4("view", glm::value_ptr(captureViews[i]));
-					glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, cubemapEnvID, 0);
-					glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-
-					glBindVertexArray(VAO);
-					glDrawArrays(GL_TRIANGLES, 0, 36);
-					glBindVertexArray(0);
-				}
+	// GPU time per frame of the progressive bakes (see Scene::bakeSkyboxes)
+	static float bakeBudgetMs;
 
-				glBindFramebuffer(GL_FRAMEBUFFER, 0);
-				#pragma endregion
+	std::shared_ptr<Shader> cubemapShader = ShaderRegistry::get("vsCubemap.vert","fsCubemap.frag");
+	std::shared_ptr<Shader> cubemapConversion = ShaderRegistry::get("vsCubemapConversion.vert", "fsCubemapConversion.frag");
+	std::shared_ptr<Shader> cubemapConvolution = ShaderRegistry::get("vsCubemapConversion.vert", "fsCubemapConvolution.frag");
+	std::shared_ptr<Shader> cubemapPrefilter = ShaderRegistry::get("vsCubemapConversion.vert", "fsPrefilterCubemap.frag");
+	std::shared_ptr<Shader> brdfShader = ShaderRegistry::get("vsQuad.vert", "fsBrdfLUT.frag");
+	std::shared_ptr<Shader> bakeShader = ShaderRegistry::getCompute("csCubemapBake.comp");
 
-				#pragma region Split sum first part: Prefilter cubemap (ambient specular light part 1)
-				// Color with mipmap
-				const unsigned int texPrefilterWidth = 256;
-				const unsigned int texPrefilterHeight = texPrefilterWidth;
+	// 0 until a bake is done (progressive: the quick bake first, then the full one)
+	unsigned int cubemapID = 0;				// Skybox
+	unsigned int cubemapEnvID = 0;			// Ambient diffuse light
 
-				glGenTextures(1, &cubemapPrefilterID);
-				glBindTexture(GL_TEXTURE_CUBE_MAP, cubemapPrefilterID);
-
-				for (unsigned int i = 0; i < 6; ++i)
-				{
-					// Low resolution for a blurry texture
-					glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, 0, GL_RGB32F, texPrefilterWidth, texPrefilterHeight, 0, GL_RGB, GL_FLOAT, nullptr);
-				}
-
-				glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-				glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-				glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
-				glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR); // Trilinear filtering
-				glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-
-				glGenerateMipmap(GL_TEXTURE_CUBE_MAP);
+	// Using pre-filtered and BRDF LUT makes Ambient specular light
+	unsigned int cubemapPrefilterID = 0;	// Pre-filtered cubemap
+	unsigned int brdfLutID = 0;				// BRDF Lookup texture 2D
 
-				cubemapPrefilter->use();
-				cubemapPrefilter->setInt("skybox", 0);
-				cubemapPrefilter->setMat4("projection", glm::value_ptr(captureProjection));
 
-				glActiveTexture(GL_TEXTURE0);
-				glBindTexture(GL_TEXTURE_CUBE_MAP, cubemapID);
-				glBindFramebuffer(GL_FRAMEBUFFER, captureFBO);
+	// progressive: .hdr files are decoded in another thread and baked by bake(), quickBake: a low resolution bake is
+	// shown until the full one is done
+	Cubemap(std::string path, std::string format = ".png", bool progressive = false, bool quickBake = true)
+		: path(path), progressive(progressive), quickBake(progressive && quickBake)
+	{
+		setupMesh();
 
-				unsigned int maxMipLevels = 5;
-				for (unsigned int mip = 0; mip < maxMipLevels; ++mip)
-				{
-					// Reisze framebuffer according to mip-level size.
-					unsigned int mipWidth = texPrefilterWidth * std::pow(0.5, mip);
-					unsigned int mipHeight = texPrefilterHeight * std::pow(0.5, mip);
-
-					// Depth, one for each mipmap level
-					glBindRenderbuffer(GL_RENDERBUFFER, captureRBO);
-					glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, mipWidth, mipHeight);
-					glViewport(0, 0, mipWidth, mipHeight);
-
-					float roughness = (float)mip / (float)(maxMipLevels - 1);
-					cubemapPrefilter->setFloat("roughness", roughness);
-					for (unsigned int i = 0; i < 6; ++i)
-					{
-						cubemapPrefilter->setMat4("view", glm::value_ptr(captureViews[i]));
-						glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, cubemapPrefilterID, mip);
-						glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-
-						glBindVertexArray(VAO);
-						glDrawArrays(GL_TRIANGLES, 0, 36);
-						glBindVertexArray(0);
-					}
-				}
-				glBindFramebuffer(GL_FRAMEBUFFER, 0);
-				#pragma endregion				
-
-				#pragma region Split sum second part: BRDF lookup texture 2D (ambient specular light part 2)
-				glGenTextures(1, &brdfLutID);
-				// pre-allocate enough memory for the LUT texture.
-				glBindTexture(GL_TEXTURE_2D, brdfLutID);
-				glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA16F, 512, 512, 0, GL_RG, GL_FLOAT, 0);
-
-				glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-				glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-				glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-				glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-
-				glBindFramebuffer(GL_FRAMEBUFFER, captureFBO);
-				glBindRenderbuffer(GL_RENDERBUFFER, captureRBO);
-				// Depth
-				glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, 512, 512);
-				// Color
-				glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, brdfLutID, 0);
-				glViewport(0, 0, 512, 512);
-
-				brdfShader->use();
-				glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-				glBindVertexArray(VAOQuad);
-				glDrawArrays(GL_TRIANGLES, 0, 6);
-				glBindFramebuffer(GL_FRAMEBUFFER, 0);
-				#pragma endregion
+		int width, height, nrChannels;
 
-			}
-			else
+		if (format == ".hdr")
+		{
+			if (progressive)
 			{
-				std::cout << "Cubemap failed to load at path: " << path << std::endl;
-				stbi_image_free(data);
+				loading = std::async(std::launch::async, &Cubemap::load, path, true);
+				return;
 			}
-				
+
+			// Everything now
+			image = load(path, false);
+			bake(std::numeric_limits<float>::infinity());
 		}
 		else {
 			//TODO: Update non-hdr cubemaps
@@ -272,6 +97,7 @@ public:
 
 			glGenTextures(1, &cubemapID);
 			glBindTexture(GL_TEXTURE_CUBE_MAP, cubemapID);
+			stage = DONE;
 
 			for (unsigned int i = 0; i < faces.size(); i++)
 			{
@@ -301,9 +127,105 @@ public:
 
 	}
 
+
+	// Owns its textures
+	Cubemap(const Cubemap&) = delete;
+	Cubemap& operator=(const Cubemap&) = delete;
+
+	~Cubemap()
+	{
+		if (loading.valid()) image = loading.get();
+		if (image.data != nullptr) stbi_image_free(image.data);
+
+		unsigned int textures[] = { cubemapID, cubemapEnvID, cubemapPrefilterID, hdrTexture };
+		glDeleteTextures(4, textures);
+		if (stage != DONE && stage != LOADING) deleteTargets(full);
+		if (timer[0] != 0) glDeleteQueries(2, timer);
+		glDeleteVertexArrays(1, &VAO);
+		glDeleteVertexArrays(1, &VAOQuad);
+	}
+
+	// Once the loading thread is done: uploads the file, runs the quick bake and creates the targets of the full one.
+	// False until then. bake() calls it
+	bool prepare()
+	{
+		if (stage != LOADING) return true;
+		if (loading.valid())
+		{
+			if (loading.wait_for(std::chrono::seconds(0)) != std::future_status::ready) return false;
+			image = loading.get();
+		}
+		if (!upload()) return true;
+
+		if (quickBake)
+		{
+			Targets quick = createTargets(QUICK_CUBE_SIZE, QUICK_IRRADIANCE_SIZE, QUICK_PREFILTER_SIZE);
+			beginSlices();
+			runSlices(quick, std::numeric_limits<double>::infinity());
+			endSlices();
+			publish(quick);
+		}
+		full = createTargets(CUBE_SIZE, IRRADIANCE_SIZE, PREFILTER_SIZE);
+		stage = CONVERSION;
+		return true;
+	}
+
+	// Progressive bake: prepare(), then draws the full bake for about budgetMs of GPU time, at least one row. Call
+	// once per frame until it returns true, the full bake then replaces the quick one
+	bool bake(float budgetMs)
+	{
+		if (!prepare()) return false;
+		if (stage == DONE) return true;
+
+		bool timed = progressive && !timing;
+		if (progressive)
+		{
+			if (timer[0] == 0) glGenQueries(2, timer);
+			readTimer();
+			timed = !timing;
+			if (timed) glQueryCounter(timer[0], GL_TIMESTAMP);
+		}
+
+		beginSlices();
+		double samples = runSlices(full, budgetMs);
+		endSlices();
+		frames++;
+
+		if (timed)
+		{
+			glQueryCounter(timer[1], GL_TIMESTAMP);
+			timedSamples = samples;
+			timing = true;
+		}
+
+		stage = full.stage;
+		if (stage == DONE)
+		{
+			if (cubemapID != 0) deleteTargets(Targets{ cubemapID, cubemapEnvID, cubemapPrefilterID }); // Quick bake
+			publish(full);
+			glDeleteTextures(1, &hdrTexture);
+			hdrTexture = 0;
+			if (progressive) std::cout << "CUBEMAP::" << path << " baked in " << frames << " frames (" << (full.path == COMPUTE ? "compute, " : "raster, ")
+				<< bakeBudgetMs << " ms budget, " << msPerSample[full.path] * 1e6 << " ns per 1000 samples)" << std::endl;
+		}
+		return stage == DONE;
+	}
+
+	BakeStage getStage() const
+	{
+		return stage;
+	}
+
+	// Something to show: a bake (quick or full) is done
+	bool isReady() const
+	{
+		return cubemapID != 0;
+	}
+
 	void draw(const Camera& camera)
 	{
 		cubemapShader->use();
+		GLState::enable(GL_DEPTH_TEST);
 
 		glm::mat4 view = glm::mat4(glm::mat3(camera.getViewMatrix())); // This center the skybox on the camera
 		glm::mat4 projection = camera.getProjectionMatrix(true);
@@ -311,15 +233,414 @@ public:
 		cubemapShader->setMat4("view", glm::value_ptr(view));
 		cubemapShader->setMat4("projection", glm::value_ptr(projection));
 
+		GLState::bindVertexArray(VAO);
+		GLState::bindTexture(0, GL_TEXTURE_CUBE_MAP, cubemapID);
+		glDrawArrays(GL_TRIANGLES, 0, 36);
+	}
+
+
+private:
+	struct Image
+	{
+		float* data = nullptr;
+		int width = 0, height = 0, channels = 0;
+	};
+
+	// Textures of a bake and how far it is
+	struct Targets
+	{
+		unsigned int cube = 0, irradiance = 0, prefilter = 0;
+		unsigned int cubeSize = 0, irradianceSize = 0, prefilterSize = 0;
+		BakePath path = RASTER;
+		BakeStage stage = CONVERSION;
+		unsigned int face = 0, mip = 0, row = 0;
+	};
+
+	// Samples of a convolution in the compute table
+	struct SampleRange
+	{
+		unsigned int first = 0, count = 0;
+	};
+
+	static double msPerSample[2];		// GPU time of one sample per path, measured by the progressive bakes
+	static unsigned int captureFBO;
+	static unsigned int sharedBrdfLut;
+
+	static unsigned int sampleBuffer;	// Table of the compute convolutions
+	static SampleRange irradianceSamples;
+	static SampleRange prefilterSamples[PREFILTER_MIPS];
+
+	std::string path;
+	bool progressive = false;
+	bool quickBake = false;
+	BakeStage stage = LOADING;
+	std::future<Image> loading;
+	Image image;
+	unsigned int hdrTexture = 0;
+	Targets full;
+	unsigned int frames = 0;
+
+	// One frame of the bake timed at a time
+	unsigned int timer[2] = { 0, 0 };
+	bool timing = false;
+	double timedSamples = 0.0;
+
+	// Decodes an .hdr file. thread: in the loading thread, the flip is only set for it
+	static Image load(std::string path, bool thread)
+	{
+		Image image;
+		if (thread) stbi_set_flip_vertically_on_load_thread(true);
+		else stbi_set_flip_vertically_on_load(true);
+		image.data = stbi_loadf(path.c_str(), &image.width, &image.height, &image.channels, 0);
+		return image;
+	}
+
+	// The decoded file into hdrTexture. False if it didn't load, nothing to bake then
+	bool upload()
+	{
+		if (image.data == nullptr)
+		{
+			std::cout << "Cubemap failed to load at path: " << path << std::endl;
+			stage = DONE;
+			return false;
+		}
+
+		#pragma region Read .hdr file
+		glGenTextures(1, &hdrTexture);
+		glBindTexture(GL_TEXTURE_2D, hdrTexture);
+		if (image.channels == 4)
+			glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA32F, image.width, image.height, 0, GL_RGBA, GL_FLOAT, image.data);
+		else
+			glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB32F, image.width, image.height, 0, GL_RGB, GL_FLOAT, image.data);
+
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		stbi_image_free(image.data);
+		image.data = nullptr;
+		#pragma endregion
+
+		GLState::invalidate();
+		return true;
+	}
+
+	// In the format both paths write: image stores have no 3 channel formats, and the skybox is tone mapped to 0 - 1
+	static Targets createTargets(unsigned int cubeSize, unsigned int irradianceSize, unsigned int prefilterSize)
+	{
+		Targets t;
+		t.path = bakePath;
+		t.cube = createCube(cubeSize, t.path == COMPUTE); // Filtered importance sampling reads its mips
+		t.irradiance = createCube(irradianceSize, false); // Low resolution for a blurry texture
+		t.prefilter = createCube(prefilterSize, true);
+		t.cubeSize = cubeSize;
+		t.irradianceSize = irradianceSize;
+		t.prefilterSize = prefilterSize;
+		return t;
+	}
+
+	static unsigned int createCube(unsigned int size, bool mipmaps)
+	{
+		unsigned int id;
+		glGenTextures(1, &id);
+		glBindTexture(GL_TEXTURE_CUBE_MAP, id);
+		for (unsigned int i = 0; i < 6; ++i)
+		{
+			glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, 0, GL_RGBA16F, size, size, 0, GL_RGBA, GL_FLOAT, nullptr);
+		}
+
+		glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, mipmaps ? GL_LINEAR_MIPMAP_LINEAR : GL_LINEAR); // Trilinear filtering
+		glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+
+		if (mipmaps) glGenerateMipmap(GL_TEXTURE_CUBE_MAP);
+		return id;
+	}
+
+	static void deleteTargets(const Targets& t)
+	{
+		unsigned int textures[] = { t.cube, t.irradiance, t.prefilter };
+		glDeleteTextures(3, textures);
+	}
+
+	void publish(const Targets& t)
+	{
+		cubemapID = t.cube;
+		cubemapEnvID = t.irradiance;
+		cubemapPrefilterID = t.prefilter;
+		brdfLutID = brdfLut();
+	}
+
+	// 6 "Cameras" to capture 6 faces of a cube
+	static glm::mat4 captureView(unsigned int face)
+	{
+		static const glm::vec3 directions[6] = { glm::vec3(1.0f, 0.0f, 0.0f), glm::vec3(-1.0f, 0.0f, 0.0f), glm::vec3(0.0f, 1.0f, 0.0f),
+			glm::vec3(0.0f, -1.0f, 0.0f), glm::vec3(0.0f, 0.0f, 1.0f), glm::vec3(0.0f, 0.0f, -1.0f) };
+		static const glm::vec3 ups[6] = { glm::vec3(0.0f, -1.0f, 0.0f), glm::vec3(0.0f, -1.0f, 0.0f), glm::vec3(0.0f, 0.0f, 1.0f),
+			glm::vec3(0.0f, 0.0f, -1.0f), glm::vec3(0.0f, -1.0f, 0.0f), glm::vec3(0.0f, -1.0f, 0.0f) };
+		return glm::lookAt(glm::vec3(0.0f, 0.0f, 0.0f), directions[face], ups[face]);
+	}
+
+	// The bake draws the cube seen from its center, one face per view: no depth buffer needed, its faces never overlap
+	void beginSlices()
+	{
+		if (captureFBO == 0) glGenFramebuffers(1, &captureFBO);
+		glBindFramebuffer(GL_FRAMEBUFFER, captureFBO);
+		glDisable(GL_DEPTH_TEST);
+		glDisable(GL_BLEND);
+		glEnable(GL_SCISSOR_TEST);
 		glBindVertexArray(VAO);
+	}
+
+	void endSlices()
+	{
+		glEnable(GL_DEPTH_TEST);
+		glEnable(GL_BLEND);
+		glDisable(GL_SCISSOR_TEST);
+		glBindVertexArray(0);
+		glBindFramebuffer(GL_FRAMEBUFFER, 0);
+		GLState::invalidate(); // The bake binds its own program, framebuffer and textures
+	}
+
+	// Draws rows of t, in order, until budgetMs of estimated GPU time (at least one row). Returns the samples taken
+	double runSlices(Targets& t, double budgetMs)
+	{
+		double samples = 0.0;
+		while (t.stage != DONE)
+		{
+			unsigned int size = t.stage == CONVERSION ? t.cubeSize : t.stage == IRRADIANCE ? t.irradianceSize : glm::max(t.prefilterSize >> t.mip, 1u);
+			unsigned int faces = t.path == COMPUTE ? 6 : 1; // A dispatch writes the rows of every face
+			double rowSamples = (double)size * faces * samplesPerTexel(t);
+			double ms = msPerSample[t.path];
+
+			unsigned int rows = size - t.row;
+			double left = budgetMs - samples * ms;
+			if (rows * rowSamples * ms > left) rows = left > 0.0 ? (unsigned int)(left / (rowSamples * ms)) : 0;
+			if (rows == 0 && samples > 0.0) break;
+			rows = glm::max(rows, 1u);
+
+			if (t.path == COMPUTE) dispatchRows(t, size, rows);
+			else drawRows(t, size, rows);
+			samples += rows * rowSamples;
+
+			// Next rows, face, mip, then stage
+			t.row += rows;
+			if (t.row < size) continue;
+			t.row = 0;
+			t.face += faces;
+			if (t.face < 6) continue;
+			t.face = 0;
+			if (t.stage == CONVERSION && t.path == COMPUTE)
+			{
+				glBindTexture(GL_TEXTURE_CUBE_MAP, t.cube);
+				glGenerateMipmap(GL_TEXTURE_CUBE_MAP);
+			}
+			if (t.stage == PREFILTER && ++t.mip < PREFILTER_MIPS) continue;
+			t.mip = 0;
+			t.stage = (BakeStage)(t.stage + 1);
+		}
+		return samples;
+	}
+
+	// Environment samples per texel of the current stage of t
+	static unsigned int samplesPerTexel(const Targets& t)
+	{
+		if (t.stage == CONVERSION) return 1;
+		if (t.path == RASTER) return t.stage == IRRADIANCE ? IRRADIANCE_SAMPLES : PREFILTER_SAMPLES;
+		return t.stage == IRRADIANCE ? IRRADIANCE_TABLE_SAMPLES : glm::max(prefilterSamples[t.mip].count, 1u);
+	}
+
+	// Rows [t.row, t.row + rows) of the current mip of t, all six faces
+	void dispatchRows(const Targets& t, unsigned int size, unsigned int rows)
+	{
+		if (sampleBuffer == 0) createSampleTable();
+
+		unsigned int target = t.stage == CONVERSION ? t.cube : t.stage == IRRADIANCE ? t.irradiance : t.prefilter;
+		int mip = t.stage == PREFILTER ? (int)t.mip : 0;
+		SampleRange range = t.stage == IRRADIANCE ? irradianceSamples : prefilterSamples[t.mip];
+
+		bakeShader->use();
+		bakeShader->setInt("pass", t.stage - CONVERSION);
+		bakeShader->setInt("size", (int)size);
+		bakeShader->setInt("firstRow", (int)t.row);
+		bakeShader->setInt("lastRow", (int)(t.row + rows));
+		bakeShader->setInt("equirectangularMap", 0);
+		bakeShader->setInt("skybox", 1);
+		bakeShader->setFloat("skyboxSize", (float)t.cubeSize);
+		bakeShader->setInt("firstSample", (int)range.first);
+		bakeShader->setInt("sampleCount", (int)range.count);
+
 		glActiveTexture(GL_TEXTURE0);
-		glBindTexture(GL_TEXTURE_CUBE_MAP, cubemapID);
+		glBindTexture(GL_TEXTURE_2D, hdrTexture);
+		glActiveTexture(GL_TEXTURE1);
+		glBindTexture(GL_TEXTURE_CUBE_MAP, t.stage == CONVERSION ? 0 : t.cube); // Not while it is written
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, sampleBuffer);
+		glBindImageTexture(0, target, mip, GL_TRUE, 0, GL_WRITE_ONLY, GL_RGBA16F);
+
+		glDispatchCompute((size + 7) / 8, (rows + 7) / 8, 6);
+		glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT | GL_TEXTURE_UPDATE_BARRIER_BIT);
+	}
+
+	// Hammersley point i of n, the radical inverse by bit reversal
+	static glm::vec2 hammersley(unsigned int i, unsigned int n)
+	{
+		unsigned int bits = i;
+		bits = (bits << 16u) | (bits >> 16u);
+		bits = ((bits & 0x55555555u) << 1u) | ((bits & 0xAAAAAAAAu) >> 1u);
+		bits = ((bits & 0x33333333u) << 2u) | ((bits & 0xCCCCCCCCu) >> 2u);
+		bits = ((bits & 0x0F0F0F0Fu) << 4u) | ((bits & 0xF0F0F0F0u) >> 4u);
+		bits = ((bits & 0x00FF00FFu) << 8u) | ((bits & 0xFF00FF00u) >> 8u);
+		return glm::vec2((float)i / (float)n, (float)bits * 2.3283064365386963e-10f);
+	}
+
+	// Mip offset of a sample of density pdf among n: half the log2 of its solid angle over a texel's of a 1 x 1 cube,
+	// biased by 1 (Colbert and Krivanek). The shader adds log2 of the skybox size
+	static float sampleLod(float pdf, unsigned int n)
+	{
+		return 0.5f * glm::log2(6.f / (4.f * glm::pi<float>() * n * pdf)) + 1.f;
+	}
+
+	// The tangent space samples of the irradiance (cosine distributed) and of each pre-filter mip (GGX of its
+	// roughness, N = V, only the L above the surface)
+	static std::vector<glm::vec4> sampleTable()
+	{
+		const float PI = glm::pi<float>();
+		std::vector<glm::vec4> table;
+
+		irradianceSamples.first = 0;
+		for (unsigned int i = 0; i < IRRADIANCE_TABLE_SAMPLES; i++)
+		{
+			glm::vec2 xi = hammersley(i, IRRADIANCE_TABLE_SAMPLES);
+			float phi = 2.f * PI * xi.x;
+			float cosTheta = glm::sqrt(1.f - xi.y);
+			float sinTheta = glm::sqrt(xi.y);
+			table.push_back(glm::vec4(glm::cos(phi) * sinTheta, glm::sin(phi) * sinTheta, cosTheta, sampleLod(cosTheta / PI, IRRADIANCE_TABLE_SAMPLES)));
+		}
+		irradianceSamples.count = IRRADIANCE_TABLE_SAMPLES;
+
+		for (unsigned int mip = 0; mip < PREFILTER_MIPS; mip++)
+		{
+			prefilterSamples[mip].first = (unsigned int)table.size();
+			float roughness = (float)mip / (float)(PREFILTER_MIPS - 1);
+			float a = roughness * roughness;
+
+			// Roughness 0 is a mirror, the skybox itself
+			if (mip == 0) table.push_back(glm::vec4(0.f, 0.f, 1.f, -100.f));
+			for (unsigned int i = 0; mip > 0 && i < PREFILTER_TABLE_SAMPLES; i++)
+			{
+				glm::vec2 xi = hammersley(i, PREFILTER_TABLE_SAMPLES);
+				float phi = 2.f * PI * xi.x;
+				float cosTheta = glm::sqrt((1.f - xi.y) / (1.f + (a * a - 1.f) * xi.y));
+				float sinTheta = glm::sqrt(1.f - cosTheta * cosTheta);
+				glm::vec3 H(glm::cos(phi) * sinTheta, glm::sin(phi) * sinTheta, cosTheta);
+				glm::vec3 L = 2.f * H.z * H - glm::vec3(0.f, 0.f, 1.f);
+				if (L.z <= 0.f) continue;
+
+				// pdf of L is D(H) / 4 when N = V
+				float d = cosTheta * cosTheta * (a * a - 1.f) + 1.f;
+				float D = a * a / (PI * d * d);
+				table.push_back(glm::vec4(L, sampleLod(D / 4.f, PREFILTER_TABLE_SAMPLES)));
+			}
+			prefilterSamples[mip].count = (unsigned int)table.size() - prefilterSamples[mip].first;
+		}
+		return table;
+	}
+
+	static void createSampleTable()
+	{
+		std::vector<glm::vec4> table = sampleTable();
+		glGenBuffers(1, &sampleBuffer);
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, sampleBuffer);
+		glBufferData(GL_SHADER_STORAGE_BUFFER, table.size() * sizeof(glm::vec4), table.data(), GL_STATIC_DRAW);
+	}
+
+	// Rows [t.row, t.row + rows) of the current face (and mip) of t
+	void drawRows(const Targets& t, unsigned int size, unsigned int rows)
+	{
+		glm::mat4 captureProjection = glm::perspective(glm::radians(90.0f), 1.0f, -0.1f, 10.0f);
+		glm::mat4 view = captureView(t.face);
+		Shader* shader;
+		unsigned int target;
+		int mip = 0;
+
+		if (t.stage == CONVERSION)
+		{
+			// Convert HDR equirectangular environment map to cubemap equivalent
+			shader = cubemapConversion.get();
+			target = t.cube;
+			shader->use();
+			shader->setInt("equirectangularMap", 0);
+			glActiveTexture(GL_TEXTURE0);
+			glBindTexture(GL_TEXTURE_2D, hdrTexture);
+		}
+		else
+		{
+			// Convolution of the skybox: ambient diffuse light, or pre-filtered by the roughness of the mip (ambient
+			// specular light, split sum first part)
+			shader = t.stage == IRRADIANCE ? cubemapConvolution.get() : cubemapPrefilter.get();
+			target = t.stage == IRRADIANCE ? t.irradiance : t.prefilter;
+			mip = t.stage == PREFILTER ? (int)t.mip : 0;
+			shader->use();
+			shader->setInt("skybox", 0);
+			if (t.stage == PREFILTER) shader->setFloat("roughness", (float)t.mip / (float)(PREFILTER_MIPS - 1));
+			glActiveTexture(GL_TEXTURE0);
+			glBindTexture(GL_TEXTURE_CUBE_MAP, t.cube);
+		}
+		shader->setMat4("projection", glm::value_ptr(captureProjection));
+		shader->setMat4("view", glm::value_ptr(view));
+
+		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_CUBE_MAP_POSITIVE_X + t.face, target, mip);
+		glViewport(0, 0, size, size);
+		glScissor(0, t.row, size, rows);
 		glDrawArrays(GL_TRIANGLES, 0, 36);
-		glBindVertexArray(0);
 	}
 
+	// Last timed frame of the bake, if the GPU is done with it, into msPerSample
+	void readTimer()
+	{
+		if (!timing) return;
+
+		int available = 0;
+		glGetQueryObjectiv(timer[1], GL_QUERY_RESULT_AVAILABLE, &available);
+		if (!available) return;
+
+		GLuint64 begin = 0, end = 0;
+		glGetQueryObjectui64v(timer[0], GL_QUERY_RESULT, &begin);
+		glGetQueryObjectui64v(timer[1], GL_QUERY_RESULT, &end);
+		timing = false;
+		if (timedSamples > 0.0) msPerSample[full.path] = glm::mix(msPerSample[full.path], (end - begin) / 1e6 / timedSamples, 0.5);
+	}
+
+	#pragma region Split sum second part: BRDF lookup texture 2D (ambient specular light part 2)
+	unsigned int brdfLut()
+	{
+		if (sharedBrdfLut != 0) return sharedBrdfLut;
+
+		glGenTextures(1, &sharedBrdfLut);
+		// pre-allocate enough memory for the LUT texture.
+		glBindTexture(GL_TEXTURE_2D, sharedBrdfLut);
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA16F, 512, 512, 0, GL_RG, GL_FLOAT, 0);
+
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+
+		beginSlices();
+		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, sharedBrdfLut, 0);
+		glViewport(0, 0, 512, 512);
+		glScissor(0, 0, 512, 512);
+
+		brdfShader->use();
+		glBindVertexArray(VAOQuad);
+		glDrawArrays(GL_TRIANGLES, 0, 6);
+		endSlices();
+		return sharedBrdfLut;
+	}
+	#pragma endregion
 
-private:
 	unsigned int VAO, VBO;
 	unsigned int VAOQuad, VBOQuad;
 
@@ -425,4 +746,14 @@ private:
 	}
 };
 
+// Static variables initialization
+float Cubemap::bakeBudgetMs = 2.f;
+Cubemap::BakePath Cubemap::bakePath = Cubemap::COMPUTE;
+double Cubemap::msPerSample[2] = { 1e-6, 1e-6 }; // Until measured, about 1 G samples a second
+unsigned int Cubemap::captureFBO = 0;
+unsigned int Cubemap::sharedBrdfLut = 0;
+unsigned int Cubemap::sampleBuffer = 0;
+Cubemap::SampleRange Cubemap::irradianceSamples;
+Cubemap::SampleRange Cubemap::prefilterSamples[Cubemap::PREFILTER_MIPS];
+
 #endif CUBEMAP_H
\ No newline at end of file
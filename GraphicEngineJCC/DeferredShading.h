@@ -3,10 +3,12 @@
 
 #include "glad/glad.h"
 #include <string>
-#include "Shader.h"
+#include "ShaderRegistry.h"
 #include "Camera.h"
-#include "DrawableObject.h"
+#include "ECS.h"
 #include "GBuffer.h"
+#include "ShadowAtlas.h"
+#include "ShadowMoments.h"
 #include <vector>
 //#include "Scene.h"
 
@@ -16,8 +18,7 @@ class DeferredShading
 private:
 	unsigned int gPosition, gNormal, gColorSpec, VAO;
 
-	Shader* gBufferShader = new Shader("vsGBuffer.vert", "fsGBuffer.frag");
-	Shader* deferredShader;
+	std::shared_ptr<Shader> deferredShader;
 
 	GBuffer* gBuffer = new GBuffer();
 
@@ -42,7 +43,7 @@ public:
 		defineValues.insert(std::pair<std::string, const char*>("MAX_SPOT_LIGHT", sLightSizeStr.c_str()));
 		defineValues.insert(std::pair<std::string, const char*>("MAX_POINT_LIGHT", pLightSizeStr.c_str()));	
 
-		deferredShader = new Shader("vsStandardDeferred.vert", "fsStandardDeferred.frag", "", defineValues);
+		deferredShader = ShaderRegistry::get("vsStandardDeferred.vert", "fsStandardDeferred.frag", "", defineValues);
 		
 
 		#pragma region Init quad VAO
@@ -82,21 +83,18 @@ public:
 
 	}
 
-	void draw(const Camera& camera, const std::vector<DrawableObject*>& sceneObjects)
+	void draw(const Camera& camera, const std::vector<Entity>& sceneObjects)
 	{
 		gBuffer->drawGBuffer(camera, sceneObjects);
 
-		glBindFramebuffer(GL_FRAMEBUFFER, 0);
-		glBindVertexArray(VAO);
-		glDisable(GL_DEPTH_TEST);
+		GLState::bindFramebuffer(0);
+		GLState::bindVertexArray(VAO);
+		GLState::disable(GL_DEPTH_TEST);
 		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
-		glActiveTexture(GL_TEXTURE0);
-		glBindTexture(GL_TEXTURE_2D, gBuffer->gPosition);
-		glActiveTexture(GL_TEXTURE1);
-		glBindTexture(GL_TEXTURE_2D, gBuffer->gNormal);
-		glActiveTexture(GL_TEXTURE2);
-		glBindTexture(GL_TEXTURE_2D, gBuffer->gColorSpec);
+		GLState::bindTexture(0, GL_TEXTURE_2D, gBuffer->gPosition);
+		GLState::bindTexture(1, GL_TEXTURE_2D, gBuffer->gNormal);
+		GLState::bindTexture(2, GL_TEXTURE_2D, gBuffer->gColorSpec);
 
 		// also send light relevant uniforms
 		deferredShader->use();
@@ -104,15 +102,15 @@ public:
 		deferredShader->setInt("NormalTex", 1);
 		deferredShader->setInt("ColorSpec",2);
 		deferredShader->addDirectionalLight(dirLights[0]);
+		deferredShader->addShadowAtlas(ShadowAtlas::getTexture());
+		deferredShader->addShadowMoments(ShadowMoments::getTexture(dirLights[0].shadowMap), ShadowMoments::getTexture(ShadowAtlas::getTexture()),
+			ShadowMoments::exponents, ShadowMoments::lightBleedReduction);
 		deferredShader->addSpotLight(spotLights);
 		deferredShader->addPointLight(pointLights);
 
 		deferredShader->addCamera(camera);
 
 		glDrawArrays(GL_TRIANGLES, 0, 6);
-		glEnable(GL_DEPTH_TEST);
-		glBindVertexArray(0);
-
 	}
 };
 #endif DEFERRED_SHADING_H
@@ -0,0 +1,193 @@
+#ifndef DEPTH_GEOMETRY_H
+#define DEPTH_GEOMETRY_H
+
+#include "glad/glad.h"
+#include "glm/glm.hpp"
+#include "GLState.h"
+#include <vector>
+#include <algorithm>
+#include <cstddef>
+#include <iostream>
+
+// The positions of every mesh, tightly packed (12 bytes per vertex instead of the 44 of the full vertex), and their
+// indices, in one vertex array. Depth-only passes draw from it: nothing but positions is fetched, no material is
+// bound, and as every mesh lives in the same buffers a whole queue is one glMultiDrawElementsIndirect. Each command
+// reads its model matrices (and cube face mask) from per-instance attributes starting at its baseInstance
+class DepthGeometry
+{
+	template<class T> using vector = std::vector<T>;
+
+public:
+	// Where a mesh is in the shared buffers
+	struct Range
+	{
+		unsigned int firstIndex = 0;
+		unsigned int indexCount = 0;
+		int baseVertex = 0;
+	};
+
+	// Per-instance attributes of a batch, locations 4-7 (model) and 8 (faceMask) of the shadow vertex shaders
+	struct Instance
+	{
+		glm::mat4 model;
+		int faceMask;
+	};
+
+	// As glMultiDrawElementsIndirect reads it
+	struct Command
+	{
+		unsigned int count;
+		unsigned int instanceCount;
+		unsigned int firstIndex;
+		int baseVertex;
+		unsigned int baseInstance;
+	};
+
+private:
+	static unsigned int vao;
+	static unsigned int positionBuffer, indexBuffer;
+	static unsigned int instanceBuffer, commandBuffer; // Streamed by every batch
+	static size_t vertices, vertexCapacity;
+	static size_t indices, indexCapacity;
+	static size_t instanceBytes, commandBytes;
+
+	DepthGeometry() {}
+	~DepthGeometry() {}
+
+public:
+	// Copies the positions (first 3 of every stride floats) and the indices of a mesh
+	static Range add(const vector<float>& vertexData, unsigned int stride, const vector<unsigned int>& indexData)
+	{
+		if (vao == 0) init();
+
+		size_t count = vertexData.size() / stride;
+		vector<float> positions(count * 3);
+		for (size_t v = 0; v < count; v++)
+			for (int c = 0; c < 3; c++) positions[v * 3 + c] = vertexData[v * stride + c];
+
+		bool moved = grow(positionBuffer, vertexCapacity, vertices, vertices + count, 3 * sizeof(float));
+		moved |= grow(indexBuffer, indexCapacity, indices, indices + indexData.size(), sizeof(unsigned int));
+		if (moved) attach();
+
+		glBindBuffer(GL_COPY_WRITE_BUFFER, positionBuffer);
+		glBufferSubData(GL_COPY_WRITE_BUFFER, vertices * 3 * sizeof(float), positions.size() * sizeof(float), positions.data());
+		glBindBuffer(GL_COPY_WRITE_BUFFER, indexBuffer);
+		glBufferSubData(GL_COPY_WRITE_BUFFER, indices * sizeof(unsigned int), indexData.size() * sizeof(unsigned int), indexData.data());
+
+		Range range;
+		range.firstIndex = (unsigned int)indices;
+		range.indexCount = (unsigned int)indexData.size();
+		range.baseVertex = (int)vertices;
+		vertices += count;
+		indices += indexData.size();
+		return range;
+	}
+
+	// Uploads a batch and binds the vertex array, then draw() its commands
+	static void upload(const Instance* instanceData, size_t instanceCount, const Command* commands, size_t commandCount)
+	{
+		GLState::bindVertexArray(vao);
+		stream(instanceBuffer, GL_ARRAY_BUFFER, instanceBytes, instanceData, instanceCount * sizeof(Instance));
+		stream(commandBuffer, GL_DRAW_INDIRECT_BUFFER, commandBytes, commands, commandCount * sizeof(Command));
+	}
+
+	// Commands [first, first + count) of the last upload
+	static void draw(size_t first, size_t count)
+	{
+		glMultiDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT, (const void*)(first * sizeof(Command)), (GLsizei)count, 0);
+	}
+
+	// Bytes of the shared positions and indices
+	static size_t getMemory()
+	{
+		return vertexCapacity * 3 * sizeof(float) + indexCapacity * sizeof(unsigned int);
+	}
+
+	static void printStats()
+	{
+		std::cout << "DEPTH_GEOMETRY::" << vertices << " vertices, " << indices / 3 << " triangles, " << getMemory() / (1024 * 1024) << " MB ("
+			<< vertices * 11 * sizeof(float) / (1024 * 1024) << " MB as full vertices)" << std::endl;
+	}
+
+private:
+	static void init()
+	{
+		glGenVertexArrays(1, &vao);
+		glGenBuffers(1, &instanceBuffer);
+		glGenBuffers(1, &commandBuffer);
+		grow(positionBuffer, vertexCapacity, 0, 1 << 16, 3 * sizeof(float));
+		grow(indexBuffer, indexCapacity, 0, 1 << 18, sizeof(unsigned int));
+		attach();
+	}
+
+	// A larger buffer, the used part copied over. True if it was replaced
+	static bool grow(unsigned int& buffer, size_t& capacity, size_t used, size_t needed, size_t elementSize)
+	{
+		if (needed <= capacity) return false;
+
+		size_t newCapacity = std::max(needed, capacity * 2);
+		unsigned int newBuffer;
+		glGenBuffers(1, &newBuffer);
+		glBindBuffer(GL_COPY_WRITE_BUFFER, newBuffer);
+		glBufferData(GL_COPY_WRITE_BUFFER, newCapacity * elementSize, NULL, GL_STATIC_DRAW);
+		if (buffer != 0)
+		{
+			glBindBuffer(GL_COPY_READ_BUFFER, buffer);
+			glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, used * elementSize);
+			glDeleteBuffers(1, &buffer);
+		}
+		buffer = newBuffer;
+		capacity = newCapacity;
+		return true;
+	}
+
+	// Points the vertex array at the current buffers
+	static void attach()
+	{
+		glBindVertexArray(vao);
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indexBuffer);
+
+		glBindBuffer(GL_ARRAY_BUFFER, positionBuffer);
+		glEnableVertexAttribArray(0);
+		glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(float), (void*)0);
+
+		// One Instance per instance, from the baseInstance of each command
+		glBindBuffer(GL_ARRAY_BUFFER, instanceBuffer);
+		for (int i = 0; i < 4; i++)
+		{
+			glEnableVertexAttribArray(4 + i);
+			glVertexAttribPointer(4 + i, 4, GL_FLOAT, GL_FALSE, sizeof(Instance), (void*)(i * sizeof(glm::vec4)));
+			glVertexAttribDivisor(4 + i, 1);
+		}
+		glEnableVertexAttribArray(8);
+		glVertexAttribIPointer(8, 1, GL_INT, sizeof(Instance), (void*)offsetof(Instance, faceMask));
+		glVertexAttribDivisor(8, 1);
+
+		glBindVertexArray(0);
+		GLState::invalidate();
+	}
+
+	// New storage every upload (orphaned), the draws still reading the last one keep it
+	static void stream(unsigned int buffer, GLenum target, size_t& allocated, const void* data, size_t bytes)
+	{
+		glBindBuffer(target, buffer);
+		allocated = std::max(allocated, bytes);
+		glBufferData(target, allocated, NULL, GL_STREAM_DRAW);
+		glBufferSubData(target, 0, bytes, data);
+	}
+};
+
+// Static variables initialization
+unsigned int DepthGeometry::vao = 0;
+unsigned int DepthGeometry::positionBuffer = 0;
+unsigned int DepthGeometry::indexBuffer = 0;
+unsigned int DepthGeometry::instanceBuffer = 0;
+unsigned int DepthGeometry::commandBuffer = 0;
+size_t DepthGeometry::vertices = 0;
+size_t DepthGeometry::vertexCapacity = 0;
+size_t DepthGeometry::indices = 0;
+size_t DepthGeometry::indexCapacity = 0;
+size_t DepthGeometry::instanceBytes = 0;
+size_t DepthGeometry::commandBytes = 0;
+
+#endif DEPTH_GEOMETRY_H
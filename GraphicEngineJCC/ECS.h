@@ -0,0 +1,226 @@
+#ifndef ECS_H
+#define ECS_H
+
+#include <vector>
+#include <memory>
+#include <algorithm>
+#include <numeric>
+
+// Handle of an entity: slot index in the low 24 bits, generation in the high 8. Destroying an entity bumps the
+// generation of its slot, so old handles stop matching when the slot is reused.
+struct Entity
+{
+	static const unsigned int INDEX_BITS = 24;
+	static const unsigned int INDEX_MASK = (1u << INDEX_BITS) - 1;
+
+	unsigned int id = ~0u;
+
+	Entity() {}
+	explicit Entity(unsigned int id) : id(id) {}
+	Entity(unsigned int index, unsigned int generation) : id((generation << INDEX_BITS) | (index & INDEX_MASK)) {}
+
+	unsigned int index() const { return id & INDEX_MASK; }
+	unsigned int generation() const { return id >> INDEX_BITS; }
+	bool isNull() const { return id == ~0u; }
+
+	bool operator==(Entity other) const { return id == other.id; }
+	bool operator!=(Entity other) const { return id != other.id; }
+};
+
+class ComponentPoolBase
+{
+public:
+	virtual ~ComponentPoolBase() {}
+	virtual bool has(Entity e) const = 0;
+	virtual void remove(Entity e) = 0;
+};
+
+// Sparse set: components are packed in a dense array (iterated by the systems), the sparse array maps an entity
+// index to its position there. Add, remove and lookup are O(1); removing moves the last component into the hole,
+// so pointers and references into the pool are only valid until the next add or remove.
+template<class T>
+class ComponentPool : public ComponentPoolBase
+{
+	template<class U> using vector = std::vector<U>;
+	enum : unsigned int { ABSENT = ~0u };
+
+public:
+	T& add(Entity e, const T& component = T())
+	{
+		unsigned int i = e.index();
+		if (i >= sparse.size()) sparse.resize(i + 1, ABSENT);
+
+		if (sparse[i] != ABSENT && entities[sparse[i]] == e) return components[sparse[i]] = component;
+
+		sparse[i] = (unsigned int)entities.size();
+		entities.push_back(e);
+		components.push_back(component);
+		return components.back();
+	}
+
+	void remove(Entity e) override
+	{
+		if (!has(e)) return;
+
+		unsigned int hole = sparse[e.index()];
+		unsigned int last = (unsigned int)entities.size() - 1;
+		if (hole != last)
+		{
+			entities[hole] = entities[last];
+			components[hole] = std::move(components[last]);
+			sparse[entities[hole].index()] = hole;
+		}
+		entities.pop_back();
+		components.pop_back();
+		sparse[e.index()] = ABSENT;
+	}
+
+	bool has(Entity e) const override
+	{
+		unsigned int i = e.index();
+		return i < sparse.size() && sparse[i] != ABSENT && entities[sparse[i]] == e;
+	}
+
+	// e must have the component
+	T& get(Entity e) { return components[sparse[e.index()]]; }
+	const T& get(Entity e) const { return components[sparse[e.index()]]; }
+
+	T* tryGet(Entity e) { return has(e) ? &components[sparse[e.index()]] : nullptr; }
+	const T* tryGet(Entity e) const { return has(e) ? &components[sparse[e.index()]] : nullptr; }
+
+	// Dense arrays, same order
+	size_t size() const { return entities.size(); }
+	const vector<Entity>& getEntities() const { return entities; }
+	T* data() { return components.data(); }
+	const T* data() const { return components.data(); }
+
+	// Reorder the dense arrays by component (e.g. parents before children). Stable, so a sorted pool stays as is
+	template<class Less> void sort(Less less)
+	{
+		order.resize(entities.size());
+		std::iota(order.begin(), order.end(), 0u);
+		std::stable_sort(order.begin(), order.end(), [&](unsigned int a, unsigned int b) { return less(components[a], components[b]); });
+
+		sortedEntities.resize(entities.size());
+		sortedComponents.clear();
+		sortedComponents.reserve(components.size());
+		for (size_t i = 0; i < order.size(); i++)
+		{
+			sortedEntities[i] = entities[order[i]];
+			sortedComponents.push_back(std::move(components[order[i]]));
+			sparse[sortedEntities[i].index()] = (unsigned int)i;
+		}
+		entities.swap(sortedEntities);
+		components.swap(sortedComponents);
+	}
+
+private:
+	vector<unsigned int> sparse;
+	vector<Entity> entities;
+	vector<T> components;
+
+	// sort() temporaries, kept so sorting at run time doesn't allocate
+	vector<unsigned int> order;
+	vector<Entity> sortedEntities;
+	vector<T> sortedComponents;
+};
+
+// Owns the entities and one pool per component type, created on first use
+class Registry
+{
+	template<class T> using vector = std::vector<T>;
+
+public:
+	Entity create()
+	{
+		alive++;
+		if (!freeSlots.empty())
+		{
+			unsigned int i = freeSlots.back();
+			freeSlots.pop_back();
+			return Entity(i, generations[i]);
+		}
+
+		generations.push_back(0);
+		return Entity((unsigned int)generations.size() - 1, 0);
+	}
+
+	// Removes every component of the entity. Its handle (and copies of it) stop being alive
+	void destroy(Entity e)
+	{
+		if (!isAlive(e)) return;
+
+		for (std::unique_ptr<ComponentPoolBase>& p : pools)
+			if (p) p->remove(e);
+
+		generations[e.index()] = (generations[e.index()] + 1) & 0xFF;
+		freeSlots.push_back(e.index());
+		alive--;
+	}
+
+	bool isAlive(Entity e) const
+	{
+		return !e.isNull() && e.index() < generations.size() && generations[e.index()] == e.generation();
+	}
+
+	size_t size() const
+	{
+		return alive;
+	}
+
+	template<class T> ComponentPool<T>& pool()
+	{
+		unsigned int type = typeIndex<T>();
+		if (type >= pools.size()) pools.resize(type + 1);
+		if (!pools[type]) pools[type].reset(new ComponentPool<T>());
+		return *static_cast<ComponentPool<T>*>(pools[type].get());
+	}
+
+	template<class T> T& add(Entity e, const T& component = T()) { return pool<T>().add(e, component); }
+	template<class T> void remove(Entity e) { pool<T>().remove(e); }
+	template<class T> bool has(Entity e) { return pool<T>().has(e); }
+	template<class T> T& get(Entity e) { return pool<T>().get(e); }
+	template<class T> T* tryGet(Entity e) { return pool<T>().tryGet(e); }
+
+	// f(Entity, A&, B&) for every entity with both components. Walks the smaller pool
+	template<class A, class B, class F> void each(F f)
+	{
+		ComponentPool<A>& a = pool<A>();
+		ComponentPool<B>& b = pool<B>();
+		if (a.size() <= b.size())
+		{
+			for (size_t i = 0; i < a.size(); i++)
+			{
+				Entity e = a.getEntities()[i];
+				if (B* cb = b.tryGet(e)) f(e, a.data()[i], *cb);
+			}
+		}
+		else
+		{
+			for (size_t i = 0; i < b.size(); i++)
+			{
+				Entity e = b.getEntities()[i];
+				if (A* ca = a.tryGet(e)) f(e, *ca, b.data()[i]);
+			}
+		}
+	}
+
+private:
+	vector<unsigned char> generations;	// Per slot
+	vector<unsigned int> freeSlots;
+	vector<std::unique_ptr<ComponentPoolBase>> pools;
+	size_t alive = 0;
+
+	static unsigned int typeCount;
+
+	template<class T> static unsigned int typeIndex()
+	{
+		static unsigned int index = typeCount++;
+		return index;
+	}
+};
+
+// Static variables initialization
+unsigned int Registry::typeCount = 0;
+
+#endif ECS_H
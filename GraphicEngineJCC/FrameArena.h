@@ -0,0 +1,174 @@
+#ifndef FRAME_ARENA_H
+#define FRAME_ARENA_H
+
+#include <vector>
+#include <cstring>
+#include <cstddef>
+#include <type_traits>
+#include <algorithm>
+#include <iostream>
+
+// Linear allocator for data that only lives during one frame. Allocating is a pointer bump, nothing is freed
+// individually: beginFrame() releases everything at once. When a frame needs more than the block holds, the rest
+// comes from the heap and the block grows at the next beginFrame(), so after a few frames it fits the frame.
+class FrameArena
+{
+private:
+	static const size_t INITIAL_CAPACITY = 1 << 20;
+
+	static char* block;
+	static size_t capacity;
+	static size_t used;
+	static size_t overflowBytes;
+	static std::vector<void*> overflow;	// Heap allocations of this frame, freed by beginFrame()
+	static unsigned int frame;
+
+	FrameArena() {}
+	~FrameArena() {}
+
+public:
+	// Bytes used by the last complete frame, and how many of them didn't fit the block
+	static size_t lastFrameBytes;
+	static size_t lastFrameOverflow;
+
+	// align: power of two, up to 16
+	static void* allocate(size_t bytes, size_t align = 16)
+	{
+		size_t start = (used + align - 1) & ~(align - 1);
+		if (start + bytes <= capacity)
+		{
+			used = start + bytes;
+			return block + start;
+		}
+
+		overflowBytes += bytes;
+		void* p = ::operator new(bytes);
+		overflow.push_back(p);
+		return p;
+	}
+
+	template<class T> static T* allocate(size_t count)
+	{
+		return (T*)allocate(count * sizeof(T), alignof(T));
+	}
+
+	// Call at the start of each frame. Everything allocated before is invalid after this
+	static void beginFrame()
+	{
+		lastFrameBytes = used + overflowBytes;
+		lastFrameOverflow = overflowBytes;
+
+		for (void* p : overflow) ::operator delete(p);
+		overflow.clear();
+
+		if (block == nullptr || overflowBytes > 0)
+		{
+			size_t newCapacity = std::max(capacity * 2, lastFrameBytes + lastFrameBytes / 2);
+			if (newCapacity < INITIAL_CAPACITY) newCapacity = INITIAL_CAPACITY;
+			delete[] block;
+			block = new char[newCapacity];
+			capacity = newCapacity;
+		}
+
+		used = 0;
+		overflowBytes = 0;
+		frame++;
+	}
+
+	// Frame number, FrameArrays use it to notice their memory was released
+	static unsigned int getFrame()
+	{
+		return frame;
+	}
+
+	static void printStats()
+	{
+		std::cout << "FRAME_ARENA::" << lastFrameBytes / 1024 << " KB used of " << capacity / 1024 << " KB";
+		if (lastFrameOverflow > 0) std::cout << ", " << lastFrameOverflow / 1024 << " KB overflowed to the heap";
+		std::cout << std::endl;
+	}
+};
+
+// Growable array on the FrameArena, for trivially copyable elements. Growing takes a new, bigger piece of the
+// arena (the old one is wasted until the frame ends). The contents don't survive FrameArena::beginFrame():
+// call clear() before filling it in a new frame.
+template<class T>
+class FrameArray
+{
+	static_assert(std::is_trivially_copyable<T>::value, "FrameArray elements are copied with memcpy and never destroyed");
+
+public:
+	void clear()
+	{
+		count = 0;
+		if (frame != FrameArena::getFrame())
+		{
+			first = nullptr;
+			capacity = 0;
+			frame = FrameArena::getFrame();
+		}
+	}
+
+	void push_back(const T& value)
+	{
+		if (count == capacity) grow(count + 1);
+		first[count++] = value;
+	}
+
+	// New elements are left uninitialized
+	void resize(size_t n)
+	{
+		if (n > capacity) grow(n);
+		count = n;
+	}
+
+	void swap(FrameArray& other)
+	{
+		std::swap(first, other.first);
+		std::swap(count, other.count);
+		std::swap(capacity, other.capacity);
+		std::swap(frame, other.frame);
+	}
+
+	T* data() { return first; }
+	const T* data() const { return first; }
+	size_t size() const { return count; }
+	bool empty() const { return count == 0; }
+
+	T& operator[](size_t i) { return first[i]; }
+	const T& operator[](size_t i) const { return first[i]; }
+	T* begin() { return first; }
+	T* end() { return first + count; }
+	const T* begin() const { return first; }
+	const T* end() const { return first + count; }
+
+private:
+	T* first = nullptr;
+	size_t count = 0;
+	size_t capacity = 0;
+	unsigned int frame = 0;
+
+	void grow(size_t minCapacity)
+	{
+		if (frame != FrameArena::getFrame()) clear(); // Filled in an older frame, that memory is gone
+
+		size_t newCapacity = std::max(std::max(minCapacity, capacity * 2), (size_t)64);
+		T* p = FrameArena::allocate<T>(newCapacity);
+		if (count > 0) std::memcpy(p, first, count * sizeof(T));
+		first = p;
+		capacity = newCapacity;
+	}
+};
+
+// Static variables initialization
+char* FrameArena::block = nullptr;
+size_t FrameArena::capacity = 0;
+size_t FrameArena::used = 0;
+size_t FrameArena::overflowBytes = 0;
+std::vector<void*> FrameArena::overflow;
+unsigned int FrameArena::frame = 0;
+
+size_t FrameArena::lastFrameBytes = 0;
+size_t FrameArena::lastFrameOverflow = 0;
+
+#endif FRAME_ARENA_H
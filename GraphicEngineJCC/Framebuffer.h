@@ -9,8 +9,8 @@ private:
 	unsigned int pingpongFBO[2];
 	unsigned int pingpongBuffer[2];
 
-	Shader* framebufferShader = new Shader("vsFrameBuffer.vert", "fsFrameBuffer.frag");
-	Shader* blurShader = new Shader("vsFrameBuffer.vert", "fsGaussianBlur.frag");
+	std::shared_ptr<Shader> framebufferShader = ShaderRegistry::get("vsFrameBuffer.vert", "fsFrameBuffer.frag");
+	std::shared_ptr<Shader> blurShader = ShaderRegistry::get("vsFrameBuffer.vert", "fsGaussianBlur.frag");
 
 	
 
@@ -135,32 +135,27 @@ public:
 	}
 
 	// Draw in the default framebuffer a quad with the texture stored in the custom framebuffer 
-	void draw(const Camera& camera, const std::vector<DrawableObject*>& sceneObjects, bool enableBlur = true, bool enableSSAO = true)
+	void draw(const Camera& camera, ArrayView<Entity> sceneObjects, bool enableBlur = true, bool enableSSAO = true)
 	{
 		ssao->drawSSAO(camera, sceneObjects);
 
 		unsigned int colorBufferBlurred = applyBlur(colorBuffer[1]);
-		glBindFramebuffer(GL_FRAMEBUFFER, 0);
+		GLState::bindFramebuffer(0);
 		framebufferShader->use();
-		glBindVertexArray(VAO);
-		glDisable(GL_DEPTH_TEST);
+		GLState::bindVertexArray(VAO);
+		GLState::disable(GL_DEPTH_TEST);
 		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
-		glActiveTexture(GL_TEXTURE0);
-		glBindTexture(GL_TEXTURE_2D, colorBuffer[0]);
+		GLState::bindTexture(0, GL_TEXTURE_2D, colorBuffer[0]);
 		framebufferShader->setInt("colorTexture", 0);
 
-		glActiveTexture(GL_TEXTURE1);
-		glBindTexture(GL_TEXTURE_2D, colorBufferBlurred);
+		GLState::bindTexture(1, GL_TEXTURE_2D, colorBufferBlurred);
 		framebufferShader->setInt("bloomBlur", 1);
 
-		glActiveTexture(GL_TEXTURE2);
-		glBindTexture(GL_TEXTURE_2D, ssao->ssaoColorBufferBlur);
+		GLState::bindTexture(2, GL_TEXTURE_2D, ssao->ssaoColorBufferBlur);
 		framebufferShader->setInt("ssaoTexture", 2);
 
 		glDrawArrays(GL_TRIANGLES, 0, 6);
-		glEnable(GL_DEPTH_TEST);
-		glBindVertexArray(0);
 	}
 
 	// Apply blur to the given texture
@@ -169,26 +164,20 @@ public:
 		bool horizontal = true, first_iteration = true;
 		int amount = intensity * 2;
 		blurShader->use();
+		GLState::bindVertexArray(VAO);
+		GLState::disable(GL_DEPTH_TEST);
 		for (unsigned int i = 0; i < amount; i++)
 		{
-			glBindFramebuffer(GL_FRAMEBUFFER, pingpongFBO[horizontal]);
+			GLState::bindFramebuffer(pingpongFBO[horizontal]);
 			blurShader->setInt("horizontal", horizontal);
-			glActiveTexture(GL_TEXTURE0);
-			glBindTexture(GL_TEXTURE_2D, first_iteration ? colorBuffer[1] : pingpongBuffer[!horizontal]);
-
-			glBindVertexArray(VAO);
-			glDisable(GL_DEPTH_TEST);
+			GLState::bindTexture(0, GL_TEXTURE_2D, first_iteration ? colorBuffer[1] : pingpongBuffer[!horizontal]);
 
 			glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 			glDrawArrays(GL_TRIANGLES, 0, 6);
 
-			glEnable(GL_DEPTH_TEST);
-			glBindVertexArray(0);
-
 			horizontal = !horizontal;
 			if (first_iteration) first_iteration = false;
 		}
-		glBindFramebuffer(GL_FRAMEBUFFER, 0);
 
 		return pingpongBuffer[1];
 	}
@@ -196,13 +185,13 @@ public:
 	void bindFramebuffer()
 	{
 		// Store color, depth and stencil in this framebuffer
-		glBindFramebuffer(GL_FRAMEBUFFER, fboID);
+		GLState::bindFramebuffer(fboID);
 	}
 
 	void unbindFramebuffer()
 	{
 		// Default framebuffer
-		glBindFramebuffer(GL_FRAMEBUFFER, 0);
+		GLState::bindFramebuffer(0);
 	}
 };
 
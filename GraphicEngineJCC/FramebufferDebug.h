@@ -1,14 +1,14 @@
 #ifndef FRAMEBUFFER_DEBUG_H
 #define FRAMEBUFFER_DEBUG_H
 
-#include "Shader.h"
+#include "ShaderRegistry.h"
 #include "glad/glad.h"
 #include "glm/glm.hpp"
 
 class FramebufferDebug
 {
 public:
-	Shader* fbDebugShader = new Shader("vsQuad.vert", "fsQuad.frag");
+	std::shared_ptr<Shader> fbDebugShader = ShaderRegistry::get("vsQuad.vert", "fsQuad.frag");
 	unsigned int VAO;
 
 	FramebufferDebug(glm::vec2 position, glm::vec2 scale, glm::vec2 mainWindowResolution) 
@@ -67,16 +67,11 @@ public:
 	{
 
 		fbDebugShader->use();
-		glDisable(GL_DEPTH_TEST);
+		GLState::disable(GL_DEPTH_TEST);
 
-		glActiveTexture(GL_TEXTURE0);
-		glBindTexture(GL_TEXTURE_2D, textureID);
-		glBindVertexArray(VAO);
+		GLState::bindTexture(0, GL_TEXTURE_2D, textureID);
+		GLState::bindVertexArray(VAO);
 		glDrawArrays(GL_TRIANGLES, 0, 6);
-		glEnable(GL_DEPTH_TEST);
-
-		glBindVertexArray(0);
-		glUseProgram(0);
 	}
 
 private:
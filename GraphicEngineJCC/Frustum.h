@@ -0,0 +1,156 @@
+#ifndef FRUSTUM_H
+#define FRUSTUM_H
+
+#include "glm/glm.hpp"
+#include "AABB.h"
+#include <cmath>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__SSE__)
+#define FRUSTUM_SSE
+#include <xmmintrin.h>
+#endif
+
+// View volume as 6 planes (n.p + d >= 0 inside), stored as columns so 4 planes are tested at once.
+// Planes 6 and 7 are padding that always passes.
+class Frustum
+{
+public:
+	static const int PLANES = 8;
+
+	alignas(16) float nx[PLANES];
+	alignas(16) float ny[PLANES];
+	alignas(16) float nz[PLANES];
+	alignas(16) float d[PLANES];
+
+	// |n|, precomputed for the box radius
+	alignas(16) float ax[PLANES];
+	alignas(16) float ay[PLANES];
+	alignas(16) float az[PLANES];
+
+	Frustum()
+	{
+		for (int i = 0; i < PLANES; i++) setPlane(i, glm::vec4(0.f, 0.f, 0.f, 1.f));
+	}
+
+	// Gribb/Hartmann extraction from projection * view (GL clip space, z in [-w, w])
+	static Frustum fromMatrix(const glm::mat4& m)
+	{
+		glm::vec4 row0(m[0][0], m[1][0], m[2][0], m[3][0]);
+		glm::vec4 row1(m[0][1], m[1][1], m[2][1], m[3][1]);
+		glm::vec4 row2(m[0][2], m[1][2], m[2][2], m[3][2]);
+		glm::vec4 row3(m[0][3], m[1][3], m[2][3], m[3][3]);
+
+		Frustum f;
+		f.setPlane(0, row3 + row0); // Left
+		f.setPlane(1, row3 - row0); // Right
+		f.setPlane(2, row3 + row1); // Bottom
+		f.setPlane(3, row3 - row1); // Top
+		f.setPlane(4, row3 + row2); // Near
+		f.setPlane(5, row3 - row2); // Far
+		return f;
+	}
+
+	// Axis aligned box volume, e.g. the reach of a point light
+	static Frustum fromBox(glm::vec3 center, float halfSize)
+	{
+		Frustum f;
+		f.setPlane(0, glm::vec4(1.f, 0.f, 0.f, halfSize - center.x));
+		f.setPlane(1, glm::vec4(-1.f, 0.f, 0.f, halfSize + center.x));
+		f.setPlane(2, glm::vec4(0.f, 1.f, 0.f, halfSize - center.y));
+		f.setPlane(3, glm::vec4(0.f, -1.f, 0.f, halfSize + center.y));
+		f.setPlane(4, glm::vec4(0.f, 0.f, 1.f, halfSize - center.z));
+		f.setPlane(5, glm::vec4(0.f, 0.f, -1.f, halfSize + center.z));
+		return f;
+	}
+
+	// False only if the box is completely outside one plane. Empty boxes (no bounds) are never culled
+	bool intersects(const AABB& box) const
+	{
+		if (box.isEmpty()) return true;
+
+		glm::vec3 c = box.center();
+		glm::vec3 e = box.extents();
+
+#ifdef FRUSTUM_SSE
+		__m128 cx = _mm_set1_ps(c.x), cy = _mm_set1_ps(c.y), cz = _mm_set1_ps(c.z);
+		__m128 ex = _mm_set1_ps(e.x), ey = _mm_set1_ps(e.y), ez = _mm_set1_ps(e.z);
+
+		for (int i = 0; i < PLANES; i += 4)
+		{
+			// Signed distance of the center + projected radius of the box
+			__m128 dist = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_load_ps(nx + i), cx), _mm_mul_ps(_mm_load_ps(ny + i), cy)),
+				_mm_add_ps(_mm_mul_ps(_mm_load_ps(nz + i), cz), _mm_load_ps(d + i)));
+			__m128 radius = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_load_ps(ax + i), ex), _mm_mul_ps(_mm_load_ps(ay + i), ey)),
+				_mm_mul_ps(_mm_load_ps(az + i), ez));
+
+			if (_mm_movemask_ps(_mm_cmplt_ps(_mm_add_ps(dist, radius), _mm_setzero_ps()))) return false;
+		}
+		return true;
+#else
+		return intersectsScalar(box);
+#endif
+	}
+
+	// Reference version, also used where SSE is not available
+	bool intersectsScalar(const AABB& box) const
+	{
+		if (box.isEmpty()) return true;
+
+		glm::vec3 c = box.center();
+		glm::vec3 e = box.extents();
+
+		for (int i = 0; i < 6; i++)
+		{
+			float dist = nx[i] * c.x + ny[i] * c.y + nz[i] * c.z + d[i];
+			float radius = ax[i] * e.x + ay[i] * e.y + az[i] * e.z;
+			if (dist + radius < 0.f) return false;
+		}
+		return true;
+	}
+
+	// True if the box is completely inside every plane (everything below a BVH node is visible)
+	bool contains(const AABB& box) const
+	{
+		if (box.isEmpty()) return false;
+
+		glm::vec3 c = box.center();
+		glm::vec3 e = box.extents();
+
+		for (int i = 0; i < 6; i++)
+		{
+			float dist = nx[i] * c.x + ny[i] * c.y + nz[i] * c.z + d[i];
+			float radius = ax[i] * e.x + ay[i] * e.y + az[i] * e.z;
+			if (dist - radius < 0.f) return false;
+		}
+		return true;
+	}
+
+	// Writes 1/0 per box, returns the visible count
+	size_t cull(const AABB* boxes, size_t count, unsigned char* visible) const
+	{
+		size_t n = 0;
+		for (size_t i = 0; i < count; i++)
+		{
+			visible[i] = intersects(boxes[i]) ? 1 : 0;
+			n += visible[i];
+		}
+		return n;
+	}
+
+private:
+	void setPlane(int i, glm::vec4 p)
+	{
+		float len = glm::length(glm::vec3(p));
+		if (len > 0.f) p /= len;
+
+		nx[i] = p.x;
+		ny[i] = p.y;
+		nz[i] = p.z;
+		d[i] = p.w;
+		ax[i] = std::fabs(p.x);
+		ay[i] = std::fabs(p.y);
+		az[i] = std::fabs(p.z);
+	}
+};
+
+#endif FRUSTUM_H
@@ -3,9 +3,10 @@
 
 #include "glad/glad.h"
 //#include <string>
-#include "Shader.h"
+#include "ShaderRegistry.h"
 #include "Camera.h"
-#include "DrawableObject.h"
+#include "ECS.h"
+#include "RenderQueue.h"
 #include <Vector>
 
 class GBuffer
@@ -13,7 +14,8 @@ class GBuffer
 private:
 	unsigned int gBuffer;
 
-	Shader* gBufferShader = new Shader("vsGBuffer.vert", "fsGBuffer.frag");
+	std::shared_ptr<Shader> gBufferShader = ShaderRegistry::get("vsGBuffer.vert", "fsGBuffer.frag");
+	RenderQueue queue;
 public:
 	unsigned int gPosition, gNormal, gColorSpec;
 
@@ -84,9 +86,10 @@ public:
 		glBindFramebuffer(GL_FRAMEBUFFER, 0);
 	};
 
-	void drawGBuffer(const Camera& camera, const std::vector<DrawableObject*>& sceneObjects, CoordSpace space = CoordSpace::WORLD)
+	void drawGBuffer(const Camera& camera, ArrayView<Entity> sceneObjects, CoordSpace space = CoordSpace::WORLD)
 	{
-		glBindFramebuffer(GL_FRAMEBUFFER, gBuffer);
+		GLState::bindFramebuffer(gBuffer);
+		GLState::enable(GL_DEPTH_TEST);
 		glClearColor(0.0, 0.0, 0.0, 1.0); // black so it wont leak in g-buffer
 		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
@@ -94,13 +97,8 @@ public:
 		gBufferShader->setBool("viewSpace", space == CoordSpace::VIEW);
 		gBufferShader->addCamera(camera);
 
-		for (auto obj : sceneObjects)
-		{
-			gBufferShader->setTransform(obj->transformation);
-			obj->Draw(gBufferShader);
-		}
-
-		glBindFramebuffer(GL_FRAMEBUFFER, 0);
+		Frustum frustum = Frustum::fromMatrix(camera.getProjectionMatrix(true) * camera.getViewMatrix());
+		queue.draw(sceneObjects, gBufferShader.get(), RenderQueue::GBUFFER, camera.getPosition(), camera.getFarPlane(), &frustum);
 	}
 };
 #endif GBUFFER_H
@@ -0,0 +1,181 @@
+#ifndef GL_STATE_H
+#define GL_STATE_H
+
+#include "glad/glad.h"
+#include <map>
+#include <iostream>
+
+// Thin cache over the GL state the frame touches the most. A call that wouldn't change anything is dropped.
+// Passes set the state they need (e.g. GLState::disable(GL_DEPTH_TEST)) instead of restoring it afterwards.
+// NOTE: raw glBind*/glUseProgram/glEnable calls (resource creation) leave the cache out of date, call invalidate() after them.
+class GLState
+{
+private:
+	static const unsigned int UNKNOWN = 0xFFFFFFFF;
+	static const int MAX_UNITS = 96;	// Texture units tracked
+	static const int TARGETS = 4;		// 2D, cube map, 2D array, cube map array
+
+	static unsigned int program;
+	static unsigned int vertexArray;
+	static unsigned int framebuffer;
+	static unsigned int activeUnit;
+	static unsigned int textures[MAX_UNITS][TARGETS];
+	static unsigned int samplers[MAX_UNITS];
+	static std::map<GLenum, bool> enabled; // Missing capability == unknown
+	static GLenum cullMode;
+
+	static unsigned int issued;
+	static unsigned int elided;
+
+	GLState() {}
+	~GLState() {}
+
+	static int targetIndex(GLenum target)
+	{
+		switch (target)
+		{
+		case GL_TEXTURE_2D: return 0;
+		case GL_TEXTURE_CUBE_MAP: return 1;
+		case GL_TEXTURE_2D_ARRAY: return 2;
+		case GL_TEXTURE_CUBE_MAP_ARRAY: return 3;
+		default: return -1;
+		}
+	}
+
+	// True if the call has to reach the driver. Updates the cached value and the counters
+	static bool changes(unsigned int& cached, unsigned int value)
+	{
+		if (cached == value)
+		{
+			elided++;
+			return false;
+		}
+		cached = value;
+		issued++;
+		return true;
+	}
+
+	static void setCapability(GLenum cap, bool value)
+	{
+		std::map<GLenum, bool>::iterator itr = enabled.find(cap);
+		if (itr != enabled.end() && itr->second == value)
+		{
+			elided++;
+			return;
+		}
+		enabled[cap] = value;
+		issued++;
+
+		if (value) glEnable(cap);
+		else glDisable(cap);
+	}
+
+public:
+	// Calls that reached the driver / calls dropped during the last complete frame
+	static unsigned int lastFrameIssued;
+	static unsigned int lastFrameElided;
+
+	static void useProgram(unsigned int id)
+	{
+		if (changes(program, id)) glUseProgram(id);
+	}
+
+	static void bindVertexArray(unsigned int vao)
+	{
+		if (changes(vertexArray, vao)) glBindVertexArray(vao);
+	}
+
+	static void bindFramebuffer(unsigned int fbo)
+	{
+		if (changes(framebuffer, fbo)) glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+	}
+
+	// Bind a texture to a texture unit. glActiveTexture is only issued if the bind is needed and the unit differs
+	static void bindTexture(unsigned int unit, GLenum target, unsigned int id)
+	{
+		int t = targetIndex(target);
+		if (t != -1 && unit < MAX_UNITS && !changes(textures[unit][t], id)) return;
+		if (t == -1 || unit >= MAX_UNITS) issued++;
+
+		if (changes(activeUnit, unit)) glActiveTexture(GL_TEXTURE0 + unit);
+		glBindTexture(target, id);
+	}
+
+	static void bindSampler(unsigned int unit, unsigned int sampler)
+	{
+		if (unit >= MAX_UNITS)
+		{
+			issued++;
+			glBindSampler(unit, sampler);
+			return;
+		}
+		if (changes(samplers[unit], sampler)) glBindSampler(unit, sampler);
+	}
+
+	static void enable(GLenum cap)
+	{
+		setCapability(cap, true);
+	}
+
+	static void disable(GLenum cap)
+	{
+		setCapability(cap, false);
+	}
+
+	static void cullFace(GLenum mode)
+	{
+		if (changes(cullMode, mode)) glCullFace(mode);
+	}
+
+	// Forget everything, the next call of each kind is always issued
+	static void invalidate()
+	{
+		program = UNKNOWN;
+		vertexArray = UNKNOWN;
+		framebuffer = UNKNOWN;
+		activeUnit = UNKNOWN;
+		cullMode = UNKNOWN;
+
+		for (int i = 0; i < MAX_UNITS; i++)
+		{
+			for (int j = 0; j < TARGETS; j++) textures[i][j] = UNKNOWN;
+			samplers[i] = UNKNOWN;
+		}
+
+		enabled.clear();
+	}
+
+	// Call at the start of each frame
+	static void beginFrame()
+	{
+		lastFrameIssued = issued;
+		lastFrameElided = elided;
+		issued = 0;
+		elided = 0;
+	}
+
+	static void printStats()
+	{
+		unsigned int total = lastFrameIssued + lastFrameElided;
+		std::cout << "GL_STATE::Issued " << lastFrameIssued << " / Elided " << lastFrameElided;
+		if (total > 0) std::cout << " (" << 100.f * lastFrameElided / total << "% avoided)";
+		std::cout << std::endl;
+	}
+};
+
+// Static variables initialization
+unsigned int GLState::program = GLState::UNKNOWN;
+unsigned int GLState::vertexArray = GLState::UNKNOWN;
+unsigned int GLState::framebuffer = GLState::UNKNOWN;
+unsigned int GLState::activeUnit = GLState::UNKNOWN;
+unsigned int GLState::textures[GLState::MAX_UNITS][GLState::TARGETS];
+unsigned int GLState::samplers[GLState::MAX_UNITS];
+std::map<GLenum, bool> GLState::enabled;
+GLenum GLState::cullMode = GLState::UNKNOWN;
+
+unsigned int GLState::issued = 0;
+unsigned int GLState::elided = 0;
+unsigned int GLState::lastFrameIssued = 0;
+unsigned int GLState::lastFrameElided = 0;
+
+#endif GL_STATE_H
@@ -0,0 +1,95 @@
+#ifndef GPU_TIMER_H
+#define GPU_TIMER_H
+
+#include "glad/glad.h"
+#include <vector>
+#include <string>
+#include <chrono>
+#include <algorithm>
+#include <iostream>
+
+// Measures a block of GPU work with timestamp queries (they can be nested, unlike GL_TIME_ELAPSED).
+// Results are read a few frames later so the CPU never waits for the GPU. The CPU time of the block is measured too.
+class GPUTimer
+{
+	using string = std::string;
+	using clock = std::chrono::steady_clock;
+
+private:
+	static const int LATENCY = 3; // Frames in flight before a result is read
+
+	string name;
+	unsigned int queries[LATENCY][2];	// begin / end timestamps
+	int frame = 0;
+	bool created = false;
+	clock::time_point cpuStart;
+
+public:
+	// Last result available, in milliseconds
+	float gpuMs = 0.f;
+	float cpuMs = 0.f;
+
+	static std::vector<GPUTimer*> timers;
+
+	GPUTimer(string name) : name(name)
+	{
+		timers.push_back(this);
+	}
+
+	~GPUTimer()
+	{
+		timers.erase(std::remove(timers.begin(), timers.end(), this), timers.end());
+	}
+
+	GPUTimer(const GPUTimer&) = delete;
+	GPUTimer& operator=(const GPUTimer&) = delete;
+
+	void begin()
+	{
+		if (!created)
+		{
+			glGenQueries(LATENCY * 2, &queries[0][0]);
+			created = true;
+		}
+
+		// The slot about to be reused holds the result of LATENCY frames ago
+		int slot = frame % LATENCY;
+		if (frame >= LATENCY)
+		{
+			int available = 0;
+			glGetQueryObjectiv(queries[slot][1], GL_QUERY_RESULT_AVAILABLE, &available);
+			if (available)
+			{
+				GLuint64 start, end;
+				glGetQueryObjectui64v(queries[slot][0], GL_QUERY_RESULT, &start);
+				glGetQueryObjectui64v(queries[slot][1], GL_QUERY_RESULT, &end);
+				gpuMs = (end - start) / 1000000.f;
+			}
+		}
+
+		glQueryCounter(queries[slot][0], GL_TIMESTAMP);
+		cpuStart = clock::now();
+	}
+
+	void end()
+	{
+		cpuMs = std::chrono::duration<float, std::milli>(clock::now() - cpuStart).count();
+		glQueryCounter(queries[frame % LATENCY][1], GL_TIMESTAMP);
+		frame++;
+	}
+
+	void print() const
+	{
+		std::cout << "GPU_TIMER::" << name << " GPU " << gpuMs << " ms / CPU " << cpuMs << " ms" << std::endl;
+	}
+
+	static void printStats()
+	{
+		for (GPUTimer* t : timers) t->print();
+	}
+};
+
+// Static variables initialization
+std::vector<GPUTimer*> GPUTimer::timers;
+
+#endif GPU_TIMER_H
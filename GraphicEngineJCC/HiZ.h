@@ -0,0 +1,400 @@
+#ifndef HIZ_H
+#define HIZ_H
+
+#include "glad/glad.h"
+#include "glm/glm.hpp"
+#include "AABB.h"
+#include "GLState.h"
+#include "ShaderRegistry.h"
+#include <vector>
+#include <iostream>
+
+// Hierarchical-Z occlusion culling.
+// After the main pass, build() reduces the depth buffer into a max-depth mip chain and reads a small level back
+// asynchronously (PBO + fence). A later frame tests bounds against that CPU copy with the view it was rendered from.
+// Objects it rejects aren't dropped: they are re-tested against the current depth with box proxies and occlusion
+// queries, and drawn under conditional rendering, so a disoccluded object still shows up in the same frame.
+class HiZ
+{
+	template<class T> using vector = std::vector<T>;
+	using vec3 = glm::vec3;
+	using mat4 = glm::mat4;
+
+private:
+	static const int READBACKS = 2;		// PBOs in flight
+	static const int MAX_READ_WIDTH = 128;	// First level read back to the CPU is at most this wide
+
+	struct Readback
+	{
+		unsigned int pbo = 0;
+		GLsync fence = 0;
+		mat4 viewProjection;
+	};
+
+	struct CPULevel
+	{
+		int width, height;
+		vector<float> depth;
+	};
+
+	int width, height, levels;	// Hi-Z level 0 is half the depth buffer
+	int readLevel;
+	unsigned int texture, fbo, emptyVAO;
+
+	std::shared_ptr<Shader> reduceShader = ShaderRegistry::get("vsHiZ.vert", "fsHiZReduce.frag");
+	std::shared_ptr<Shader> proxyShader = ShaderRegistry::get("vsBoundingBox.vert", "fsEmpty.frag");
+
+	Readback readbacks[READBACKS];
+	int nextReadback = 0;
+
+	vector<CPULevel> cpuLevels;		// Level 0 is Hi-Z readLevel
+	mat4 cpuViewProjection;			// View the CPU pyramid was rendered with
+	bool cpuReady = false;
+
+	mat4 viewProjection;			// Current frame
+	vec3 cameraPos;
+
+	// Occlusion queries of the re-test, one pool per frame in flight
+	vector<unsigned int> queries[2];
+	unsigned int queryCount[2] = { 0, 0 };
+	int queryFrame = 0;
+	unsigned int queriesUsed = 0;
+
+	unsigned int tested = 0, occluded = 0;
+
+public:
+	bool enabled = true;
+
+	// Last complete frame: bounds tested, rejected by the Hi-Z, rejected objects the re-test found visible
+	unsigned int lastTested = 0, lastOccluded = 0, lastRetestVisible = 0;
+
+	HiZ(int depthWidth, int depthHeight)
+	{
+		width = glm::max(depthWidth / 2, 1);
+		height = glm::max(depthHeight / 2, 1);
+		levels = 1 + (int)glm::floor(glm::log2((float)glm::max(width, height)));
+
+		readLevel = 0;
+		while (readLevel < levels - 1 && (width >> readLevel) > MAX_READ_WIDTH) readLevel++;
+
+		glGenTextures(1, &texture);
+		glBindTexture(GL_TEXTURE_2D, texture);
+		glTexStorage2D(GL_TEXTURE_2D, levels, GL_R32F, width, height);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+		glGenFramebuffers(1, &fbo);
+		glGenVertexArrays(1, &emptyVAO);
+
+		int readWidth = levelSize(width, readLevel), readHeight = levelSize(height, readLevel);
+		for (Readback& r : readbacks)
+		{
+			glGenBuffers(1, &r.pbo);
+			glBindBuffer(GL_PIXEL_PACK_BUFFER, r.pbo);
+			glBufferData(GL_PIXEL_PACK_BUFFER, readWidth * readHeight * sizeof(float), NULL, GL_STREAM_READ);
+		}
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+		// CPU pyramid from the read level up to 1x1
+		for (int w = readWidth, h = readHeight; ; w = glm::max(w / 2, 1), h = glm::max(h / 2, 1))
+		{
+			CPULevel level;
+			level.width = w;
+			level.height = h;
+			level.depth.assign(w * h, 1.f);
+			cpuLevels.push_back(level);
+			if (w == 1 && h == 1) break;
+		}
+
+		GLState::invalidate();
+	}
+
+	~HiZ()
+	{
+		if (!Shader::glContextAlive) return;
+
+		glDeleteTextures(1, &texture);
+		glDeleteFramebuffers(1, &fbo);
+		glDeleteVertexArrays(1, &emptyVAO);
+		for (Readback& r : readbacks)
+		{
+			glDeleteBuffers(1, &r.pbo);
+			if (r.fence) glDeleteSync(r.fence);
+		}
+		for (int i = 0; i < 2; i++)
+		{
+			if (!queries[i].empty()) glDeleteQueries((int)queries[i].size(), queries[i].data());
+		}
+	}
+
+	HiZ(const HiZ&) = delete;
+	HiZ& operator=(const HiZ&) = delete;
+
+	// Call at the start of the frame with the camera the main pass uses. Picks up finished readbacks
+	void beginFrame(const mat4& cameraViewProjection, vec3 cameraPosition)
+	{
+		viewProjection = cameraViewProjection;
+		cameraPos = cameraPosition;
+
+		lastTested = tested;
+		lastOccluded = occluded;
+		tested = occluded = 0;
+
+		readQueries();
+		fetchReadback();
+	}
+
+	// Reduce the depth buffer of the finished main pass and start reading it back
+	void build(unsigned int depthTexture)
+	{
+		if (!enabled) return;
+
+		int viewport[4];
+		glGetIntegerv(GL_VIEWPORT, viewport);
+
+		GLState::bindFramebuffer(fbo);
+		reduceShader->use();
+		reduceShader->setInt("source", 0);
+		GLState::bindVertexArray(emptyVAO);
+		GLState::disable(GL_DEPTH_TEST);
+		GLState::disable(GL_BLEND);
+		GLState::disable(GL_CULL_FACE);
+
+		for (int level = 0; level < levels; level++)
+		{
+			// Source: depth buffer, then the previous level alone (no feedback loop with the level being written)
+			if (level == 0) GLState::bindTexture(0, GL_TEXTURE_2D, depthTexture);
+			else
+			{
+				GLState::bindTexture(0, GL_TEXTURE_2D, texture);
+				glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, level - 1);
+				glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, level - 1);
+			}
+
+			glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, texture, level);
+			glViewport(0, 0, levelSize(width, level), levelSize(height, level));
+			glDrawArrays(GL_TRIANGLES, 0, 3);
+		}
+
+		GLState::bindTexture(0, GL_TEXTURE_2D, texture);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, 0);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, levels - 1);
+
+		// Async copy of the read level, tagged with the view it was rendered from
+		Readback& r = readbacks[nextReadback];
+		nextReadback = (nextReadback + 1) % READBACKS;
+		if (r.fence) glDeleteSync(r.fence);
+
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, r.pbo);
+		glGetTexImage(GL_TEXTURE_2D, readLevel, GL_RED, GL_FLOAT, 0);
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+		r.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+		r.viewProjection = viewProjection;
+
+		GLState::enable(GL_DEPTH_TEST);
+		GLState::enable(GL_BLEND);
+		GLState::enable(GL_CULL_FACE);
+		glViewport(viewport[0], viewport[1], viewport[2], viewport[3]);
+	}
+
+	bool isReady() const
+	{
+		return enabled && cpuReady;
+	}
+
+	// True if the world space box was hidden in the read back pyramid. Boxes it can't judge (behind the camera,
+	// partly off screen in that view) are visible
+	bool isOccluded(const AABB& box)
+	{
+		if (!isReady() || box.isEmpty()) return false;
+		tested++;
+
+		vec3 ndcMin(1e30f), ndcMax(-1e30f);
+		for (int i = 0; i < 8; i++)
+		{
+			vec3 corner((i & 1) ? box.max.x : box.min.x, (i & 2) ? box.max.y : box.min.y, (i & 4) ? box.max.z : box.min.z);
+			glm::vec4 clip = cpuViewProjection * glm::vec4(corner, 1.f);
+			if (clip.w <= 1e-5f) return false; // Crosses the camera plane
+
+			vec3 ndc = vec3(clip) / clip.w;
+			ndcMin = glm::min(ndcMin, ndc);
+			ndcMax = glm::max(ndcMax, ndc);
+		}
+
+		// Parts outside the old view have no depth to compare with
+		if (ndcMin.x < -1.f || ndcMax.x > 1.f || ndcMin.y < -1.f || ndcMax.y > 1.f) return false;
+
+		// Screen rect in texels of the first CPU level, nearest depth of the box in [0, 1]
+		const CPULevel& base = cpuLevels[0];
+		float x0 = (glm::clamp(ndcMin.x, -1.f, 1.f) * 0.5f + 0.5f) * base.width;
+		float x1 = (glm::clamp(ndcMax.x, -1.f, 1.f) * 0.5f + 0.5f) * base.width;
+		float y0 = (glm::clamp(ndcMin.y, -1.f, 1.f) * 0.5f + 0.5f) * base.height;
+		float y1 = (glm::clamp(ndcMax.y, -1.f, 1.f) * 0.5f + 0.5f) * base.height;
+		float nearest = ndcMin.z * 0.5f + 0.5f;
+
+		// Level where the rect covers about 2x2 texels
+		float size = glm::max(x1 - x0, y1 - y0);
+		int level = glm::clamp((int)glm::ceil(glm::log2(glm::max(size, 1.f))) - 1, 0, (int)cpuLevels.size() - 1);
+
+		const CPULevel& l = cpuLevels[level];
+		int tx0 = glm::clamp((int)x0 >> level, 0, l.width - 1), tx1 = glm::clamp((int)x1 >> level, 0, l.width - 1);
+		int ty0 = glm::clamp((int)y0 >> level, 0, l.height - 1), ty1 = glm::clamp((int)y1 >> level, 0, l.height - 1);
+
+		float farthest = 0.f;
+		for (int y = ty0; y <= ty1; y++)
+			for (int x = tx0; x <= tx1; x++) farthest = glm::max(farthest, l.depth[y * l.width + x]);
+
+		if (nearest > farthest)
+		{
+			occluded++;
+			return true;
+		}
+		return false;
+	}
+
+	// Re-test *******************************************************************************************************
+	// Box proxies go through the current depth buffer with color and depth writes off
+	void beginProxies()
+	{
+		queriesUsed = 0;
+
+		proxyShader->use();
+		proxyShader->setMat4("viewProjection", glm::value_ptr(viewProjection));
+		GLState::bindVertexArray(emptyVAO);
+		GLState::disable(GL_CULL_FACE);
+		glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+		glDepthMask(GL_FALSE);
+	}
+
+	// Returns the query the conditional draws wait on, 0 if the box must be drawn anyway (camera inside it)
+	unsigned int drawProxy(const AABB& box)
+	{
+		if (glm::all(glm::greaterThanEqual(cameraPos, box.min)) && glm::all(glm::lessThanEqual(cameraPos, box.max))) return 0;
+
+		vector<unsigned int>& pool = queries[queryFrame];
+		if (queriesUsed == pool.size())
+		{
+			pool.resize(pool.size() + 64);
+			glGenQueries(64, &pool[pool.size() - 64]);
+		}
+		unsigned int query = pool[queriesUsed++];
+
+		proxyShader->setVec3("boxMin", box.min);
+		proxyShader->setVec3("boxMax", box.max);
+
+		glBeginQuery(GL_ANY_SAMPLES_PASSED_CONSERVATIVE, query);
+		glDrawArrays(GL_TRIANGLES, 0, 36);
+		glEndQuery(GL_ANY_SAMPLES_PASSED_CONSERVATIVE);
+
+		return query;
+	}
+
+	void endProxies()
+	{
+		glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+		glDepthMask(GL_TRUE);
+		GLState::enable(GL_CULL_FACE);
+
+		queryCount[queryFrame] = queriesUsed;
+		queryFrame = 1 - queryFrame;
+	}
+
+	void printStats() const
+	{
+		std::cout << "HI_Z::" << (enabled ? "" : "(disabled) ") << lastTested << " tested, " << lastOccluded << " occluded";
+		if (lastTested > 0) std::cout << " (" << 100.f * lastOccluded / lastTested << "%)";
+		std::cout << ", " << lastRetestVisible << " brought back by the re-test" << std::endl;
+	}
+
+	unsigned int getTexture() const
+	{
+		return texture;
+	}
+
+private:
+	static int levelSize(int size, int level)
+	{
+		return glm::max(size >> level, 1);
+	}
+
+	// Results of the re-test issued two frames ago, only if they're already there
+	void readQueries()
+	{
+		vector<unsigned int>& pool = queries[queryFrame];
+		unsigned int visible = 0;
+
+		for (unsigned int i = 0; i < queryCount[queryFrame]; i++)
+		{
+			unsigned int available = 0, passed = 0;
+			glGetQueryObjectuiv(pool[i], GL_QUERY_RESULT_AVAILABLE, &available);
+			if (!available) continue;
+			glGetQueryObjectuiv(pool[i], GL_QUERY_RESULT, &passed);
+			visible += passed ? 1 : 0;
+		}
+
+		lastRetestVisible = visible;
+		queryCount[queryFrame] = 0;
+	}
+
+	// Newest finished readback becomes the CPU pyramid
+	void fetchReadback()
+	{
+		for (int i = 1; i <= READBACKS; i++)
+		{
+			Readback& r = readbacks[(nextReadback - i + READBACKS) % READBACKS];
+			if (!r.fence) continue;
+
+			if (glClientWaitSync(r.fence, 0, 0) == GL_TIMEOUT_EXPIRED) continue;
+
+			glDeleteSync(r.fence);
+			r.fence = 0;
+
+			glBindBuffer(GL_PIXEL_PACK_BUFFER, r.pbo);
+			float* data = (float*)glMapBuffer(GL_PIXEL_PACK_BUFFER, GL_READ_ONLY);
+			if (data)
+			{
+				CPULevel& base = cpuLevels[0];
+				std::copy(data, data + base.width * base.height, base.depth.begin());
+				glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+
+				reduceCPU();
+				cpuViewProjection = r.viewProjection;
+				cpuReady = true;
+			}
+			glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+			return;
+		}
+	}
+
+	// Same reduction as fsHiZReduce.frag for the levels above the read one
+	void reduceCPU()
+	{
+		for (size_t l = 1; l < cpuLevels.size(); l++)
+		{
+			const CPULevel& src = cpuLevels[l - 1];
+			CPULevel& dst = cpuLevels[l];
+
+			for (int y = 0; y < dst.height; y++)
+			{
+				int lastY = (y == dst.height - 1 && (src.height & 1)) ? 2 : 1;
+				for (int x = 0; x < dst.width; x++)
+				{
+					int lastX = (x == dst.width - 1 && (src.width & 1)) ? 2 : 1;
+
+					float depth = 0.f;
+					for (int j = 0; j <= lastY; j++)
+						for (int i = 0; i <= lastX; i++)
+						{
+							int sx = glm::min(x * 2 + i, src.width - 1), sy = glm::min(y * 2 + j, src.height - 1);
+							depth = glm::max(depth, src.depth[sy * src.width + sx]);
+						}
+					dst.depth[y * dst.width + x] = depth;
+				}
+			}
+		}
+	}
+};
+
+#endif HIZ_H
@@ -19,10 +19,24 @@ public:
 	float specular = 0.f;
 
 	Camera* lightCamera;
-	unsigned int shadowMap;
+	unsigned int shadowMap = 0;	// Directional light cascades, 0: none. Spot and point lights render into the ShadowAtlas
+	
+	// Tiles of the ShadowAtlas this frame: texels per side (0: no shadow) and where each one starts in atlas uv,
+	// 1 for a spot light, 1 per cube face of a point light (+X -X +Y -Y +Z -Z)
+	unsigned int shadowResolution = 0;
+	unsigned int shadowRequest = 0;	// Size it asked for, before the atlas budget
+	glm::vec2 shadowTiles[6];
 	bool perspective = true;
 	bool castShadows = true;
 
+	// How the shadow is filtered: 3x3 PCF on the depth, or EVSM moments blurred and mip-mapped (see ShadowMoments)
+	enum ShadowFilter
+	{
+		PCF = 0,
+		EVSM = 1
+	};
+	ShadowFilter shadowFilter = PCF;
+
 protected:
 
 	LightBase(vec3 color = vec3(1.f), float ambient = 0.2f, float diffuse = 1.f, float specular = 0.8f)
@@ -32,6 +46,21 @@ protected:
 		this->diffuse = diffuse;
 		this->specular = specular;
 	}
+
+	// Distance where the attenuated light drops below 1/256 (nothing visible to shadow past it), capped by the
+	// shadow camera far plane. No attenuation: the far plane
+	float attenuationRange(float constant, float linear, float quadratic) const
+	{
+		float far = lightCamera->getFarPlane();
+		float limit = 256.f * glm::max(glm::max(color.r, color.g), color.b); // constant + linear d + quadratic d^2 == limit
+
+		float d;
+		if (quadratic > 0.f) d = (-linear + glm::sqrt(glm::max(linear * linear - 4.f * quadratic * (constant - limit), 0.f))) / (2.f * quadratic);
+		else if (linear > 0.f) d = (limit - constant) / linear;
+		else return far;
+
+		return glm::clamp(d, 0.f, far);
+	}
 };
 
 //struct DirectionalLight : LightBase {
@@ -47,6 +76,13 @@ private:
 	vec3 direction;
 
 public:
+	// Cascaded shadows: the main camera frustum up to shadowDistance is split in CASCADES slices, each one shadowed
+	// by a layer of shadowMap (a 2D array). Written by ShadowMap::generateShadowMap every frame
+	static const int CASCADES = 4;
+	float shadowDistance = 60.f;	// Past it, no shadow
+	float splitLambda = 0.75f;		// 0: uniform splits, 1: logarithmic
+	glm::mat4 cascadeMatrices[CASCADES];
+	float cascadeSplits[CASCADES] = {};	// View depth where each cascade ends
 
 	DirectionalLight(vec3 direction = vec3(0.f, -1.f, 0.f), vec3 color = vec3(1.f), vec3 cameraPos = vec3(0.f))
 		: LightBase(color)
@@ -62,7 +98,7 @@ public:
 		//LightManager::currentDLight.push_back(*this);
 	}
 
-	glm::vec3 getDirection()
+	glm::vec3 getDirection() const
 	{
 		return direction;
 	}
@@ -112,6 +148,12 @@ public:
 
 	}
 
+	// Reach of the light, see attenuationRange()
+	float getRange() const
+	{
+		return attenuationRange(constant, linear, quadratic);
+	}
+
 	void setLightDistance(float dist)
 	{
 		// If dist is negative or 0 then distance is infinite, in other words, without atenuation
@@ -128,7 +170,7 @@ public:
 
 	}
 
-	vec3 getPosition()
+	vec3 getPosition() const
 	{
 		return position;
 	}
@@ -139,7 +181,7 @@ public:
 		lightCamera->setPosition(pos);
 	}
 
-	vec3 getDirection()
+	vec3 getDirection() const
 	{
 		return direction;
 	}
@@ -150,12 +192,12 @@ public:
 		lightCamera->setDirection(dir);
 	}
 
-	float getCutOff()
+	float getCutOff() const
 	{
 		return cutOff;
 	}
 
-	float getOuterCutOff()
+	float getOuterCutOff() const
 	{
 		return oCutOff;
 	}
@@ -198,6 +240,12 @@ public:
 
 	}
 
+	// Reach of the light, see attenuationRange()
+	float getRange() const
+	{
+		return attenuationRange(constant, linear, quadratic);
+	}
+
 	void setLightDistance(float dist)
 	{
 		// If dist is negative or 0 then distance is infinite, in other words, without atenuation
@@ -0,0 +1,333 @@
+#ifndef LIGHT_CLUSTERS_H
+#define LIGHT_CLUSTERS_H
+
+#include "glad/glad.h"
+#include "glm/glm.hpp"
+#include "LightBase.h"
+#include "Shader.h"
+#include "GLState.h"
+#include "ArrayView.h"
+#include <vector>
+#include <cmath>
+#include <iostream>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__SSE__)
+#define LIGHT_CLUSTERS_SSE
+#include <xmmintrin.h>
+#endif
+
+// Clustered forward shading of the point lights. The view frustum is split in TILES_X x TILES_Y screen tiles and
+// SLICES depth slices (exponential, so near froxels stay small), and each light is binned into the froxels its range
+// sphere touches. fsPBR.frag reads the light list of its own froxel from three shader storage buffers: the lights,
+// an (offset, count) pair per froxel and the light indices of every froxel one after the other.
+// Tiles are bounded by planes through the camera built from the projection matrix: a light is tested against the
+// TILES_X + 1 column planes and the TILES_Y + 1 row planes (4 at a time with SSE) instead of against every froxel.
+class LightClusters
+{
+	template<class T> using vector = std::vector<T>;
+	using vec3 = glm::vec3;
+	using vec4 = glm::vec4;
+	using mat4 = glm::mat4;
+
+public:
+	// Same values as the CLUSTER_* defines of fsPBR.frag
+	static const int TILES_X = 16;
+	static const int TILES_Y = 9;
+	static const int SLICES = 24;
+	static const int CLUSTERS = TILES_X * TILES_Y * SLICES;
+
+	// Shader storage bindings (binding 1 is the instance matrices, see Mesh)
+	static const unsigned int LIGHT_BINDING = 2;
+	static const unsigned int CLUSTER_BINDING = 3;
+	static const unsigned int INDEX_BINDING = 4;
+
+	// A point light as fsPBR.frag reads it (std430: vec3 + float pack in 16 bytes)
+	struct GPULight
+	{
+		vec3 position;
+		float range;
+		vec3 color;
+		float farPlane;
+		float constant;
+		float linear;
+		float quadratic;
+		float shadowSize;		// Texels per side of its ShadowAtlas tiles, 0: no shadow
+		vec4 shadowFaces[3];	// Atlas uv of the cube face tiles, two per vec4 (PointLight::shadowTiles)
+		int shadowFilter;		// LightBase::ShadowFilter
+		float padding[3];		// std430 rounds the struct up to its vec4 alignment
+	};
+
+	struct Cluster
+	{
+		unsigned int offset;	// In the index list
+		unsigned int count;
+	};
+
+	LightClusters()
+	{
+		clusters.resize(CLUSTERS);
+	}
+
+	~LightClusters()
+	{
+		if (lightBuffer != 0) glDeleteBuffers(1, &lightBuffer);
+		if (clusterBuffer != 0) glDeleteBuffers(1, &clusterBuffer);
+		if (indexBuffer != 0) glDeleteBuffers(1, &indexBuffer);
+	}
+
+	LightClusters(const LightClusters&) = delete;
+	LightClusters& operator=(const LightClusters&) = delete;
+
+	// Bins the lights for this camera. CPU only, call bind() to upload the result
+	void build(const mat4& view, const mat4& projection, float nearPlane, float farPlane, ArrayView<PointLight> pointLights)
+	{
+		assign(view, projection, nearPlane, farPlane, pointLights, true);
+	}
+
+	// Reference path, one plane at a time
+	void buildScalar(const mat4& view, const mat4& projection, float nearPlane, float farPlane, ArrayView<PointLight> pointLights)
+	{
+		assign(view, projection, nearPlane, farPlane, pointLights, false);
+	}
+
+	// Uploads the last build to the storage buffers, binds them and sets the uniforms of sh
+	void bind(Shader& sh)
+	{
+		upload(lightBuffer, lightBufferBytes, lights.data(), lights.size() * sizeof(GPULight), LIGHT_BINDING);
+		upload(clusterBuffer, clusterBufferBytes, clusters.data(), clusters.size() * sizeof(Cluster), CLUSTER_BINDING);
+		upload(indexBuffer, indexBufferBytes, indices.data(), indices.size() * sizeof(unsigned int), INDEX_BINDING);
+
+		sh.setFloat("clusterNear", sliceNear);
+		sh.setFloat("clusterLogDepth", sliceLogDepth);
+	}
+
+	// Froxel of a view space depth (positive), what fsPBR.frag computes per fragment
+	int slice(float depth) const
+	{
+		if (depth <= sliceNear) return 0;
+		return glm::min((int)(std::log(depth / sliceNear) / sliceLogDepth * SLICES), SLICES - 1);
+	}
+
+	const Cluster& getCluster(int x, int y, int z) const
+	{
+		return clusters[x + TILES_X * (y + TILES_Y * z)];
+	}
+
+	// Stats ********************************************************************************************************************
+	unsigned int getVisibleLights() const { return visibleLights; }
+	size_t getIndexCount() const { return indices.size(); }
+
+	// Lights per froxel, only counting the froxels with any
+	float getAverageLights() const
+	{
+		unsigned int used = 0;
+		for (const Cluster& c : clusters) used += c.count > 0 ? 1 : 0;
+		return used > 0 ? (float)indices.size() / used : 0.f;
+	}
+
+	unsigned int getMaxLights() const
+	{
+		unsigned int m = 0;
+		for (const Cluster& c : clusters) m = glm::max(m, c.count);
+		return m;
+	}
+
+	void printStats() const
+	{
+		std::cout << "LIGHT_CLUSTERS::" << visibleLights << " / " << lights.size() << " point lights visible, " << indices.size() << " froxel entries ("
+			<< getAverageLights() << " lights per lit froxel, " << getMaxLights() << " max)" << std::endl;
+	}
+
+private:
+	// Column and row planes (n.p + d >= 0: right of / above the boundary), padded to a multiple of 4. Padding
+	// planes are zero, outside the tile masks anyway
+	static const int COLUMN_PLANES = (TILES_X + 1 + 3) / 4 * 4;
+	static const int ROW_PLANES = (TILES_Y + 1 + 3) / 4 * 4;
+
+	alignas(16) float columnX[COLUMN_PLANES], columnY[COLUMN_PLANES], columnZ[COLUMN_PLANES], columnD[COLUMN_PLANES];
+	alignas(16) float rowX[ROW_PLANES], rowY[ROW_PLANES], rowZ[ROW_PLANES], rowD[ROW_PLANES];
+
+	float sliceNear = 0.1f;
+	float sliceLogDepth = 1.f;	// log(far / near)
+
+	// Froxel box of a light, inclusive
+	struct Range
+	{
+		unsigned char x0, x1, y0, y1, z0, z1;
+	};
+
+	vector<GPULight> lights;
+	vector<Range> ranges;
+	vector<unsigned char> visible;
+	vector<Cluster> clusters;
+	vector<unsigned int> indices;
+	unsigned int visibleLights = 0;
+
+	unsigned int lightBuffer = 0, clusterBuffer = 0, indexBuffer = 0;
+	GLsizeiptr lightBufferBytes = 0, clusterBufferBytes = 0, indexBufferBytes = 0;
+
+	void assign(const mat4& view, const mat4& projection, float nearPlane, float farPlane, ArrayView<PointLight> pointLights, bool simd)
+	{
+		sliceNear = glm::max(nearPlane, 0.01f);
+		sliceLogDepth = std::log(glm::max(farPlane, sliceNear * 2.f) / sliceNear);
+		setPlanes(projection);
+
+		// Lights in view space
+		lights.resize(pointLights.size());
+		ranges.resize(pointLights.size());
+		visible.resize(pointLights.size());
+		for (size_t i = 0; i < pointLights.size(); i++)
+		{
+			const PointLight& l = pointLights[i];
+			GPULight& g = lights[i];
+			g.position = l.getPosition();
+			g.range = l.getRange();
+			g.color = l.color;
+			g.farPlane = l.lightCamera->getFarPlane();
+			g.constant = l.constant;
+			g.linear = l.linear;
+			g.quadratic = l.quadratic;
+			g.shadowSize = (float)l.shadowResolution;
+			for (int f = 0; f < 3; f++) g.shadowFaces[f] = vec4(l.shadowTiles[2 * f], l.shadowTiles[2 * f + 1]);
+			g.shadowFilter = (int)l.shadowFilter;
+
+			vec3 c = vec3(view * vec4(g.position, 1.f));
+			visible[i] = froxelRange(c, g.range, simd, ranges[i]) ? 1 : 0;
+		}
+
+		// Counts, offsets, then the indices
+		for (Cluster& c : clusters) c.count = 0;
+		visibleLights = 0;
+		for (size_t i = 0; i < lights.size(); i++)
+		{
+			if (!visible[i]) continue;
+			visibleLights++;
+			forEachCluster(ranges[i], [&](Cluster& c) { c.count++; });
+		}
+
+		unsigned int offset = 0;
+		for (Cluster& c : clusters)
+		{
+			c.offset = offset;
+			offset += c.count;
+			c.count = 0;
+		}
+
+		indices.resize(offset);
+		for (size_t i = 0; i < lights.size(); i++)
+		{
+			if (!visible[i]) continue;
+			unsigned int index = (unsigned int)i;
+			forEachCluster(ranges[i], [&](Cluster& c) { indices[c.offset + c.count++] = index; });
+		}
+	}
+
+	template<class F> void forEachCluster(const Range& r, F f)
+	{
+		for (int z = r.z0; z <= r.z1; z++)
+			for (int y = r.y0; y <= r.y1; y++)
+			{
+				Cluster* row = &clusters[TILES_X * (y + TILES_Y * z)];
+				for (int x = r.x0; x <= r.x1; x++) f(row[x]);
+			}
+	}
+
+	// Boundary k of the tiles along clip axis (x or y) is where clip = (-1 + 2k / tiles) w. Normalized, so the
+	// plane distance compares with the light radius
+	void setPlanes(const mat4& projection)
+	{
+		vec4 row0(projection[0][0], projection[1][0], projection[2][0], projection[3][0]);
+		vec4 row1(projection[0][1], projection[1][1], projection[2][1], projection[3][1]);
+		vec4 row3(projection[0][3], projection[1][3], projection[2][3], projection[3][3]);
+
+		for (int k = 0; k < COLUMN_PLANES; k++)
+		{
+			vec4 p = k <= TILES_X ? normalizePlane(row0 - (-1.f + 2.f * k / TILES_X) * row3) : vec4(0.f);
+			columnX[k] = p.x; columnY[k] = p.y; columnZ[k] = p.z; columnD[k] = p.w;
+		}
+		for (int k = 0; k < ROW_PLANES; k++)
+		{
+			vec4 p = k <= TILES_Y ? normalizePlane(row1 - (-1.f + 2.f * k / TILES_Y) * row3) : vec4(0.f);
+			rowX[k] = p.x; rowY[k] = p.y; rowZ[k] = p.z; rowD[k] = p.w;
+		}
+	}
+
+	static vec4 normalizePlane(vec4 p)
+	{
+		return p / glm::length(vec3(p));
+	}
+
+	// False if the sphere (view space) misses every froxel
+	bool froxelRange(vec3 c, float radius, bool simd, Range& out) const
+	{
+		float zNear = -c.z - radius, zFar = -c.z + radius;
+		if (zFar < sliceNear || zNear > sliceNear * std::exp(sliceLogDepth)) return false;
+
+		int x0, x1, y0, y1;
+		if (!tileRange(columnX, columnY, columnZ, columnD, COLUMN_PLANES, TILES_X, c, radius, simd, x0, x1)) return false;
+		if (!tileRange(rowX, rowY, rowZ, rowD, ROW_PLANES, TILES_Y, c, radius, simd, y0, y1)) return false;
+
+		out.x0 = (unsigned char)x0; out.x1 = (unsigned char)x1;
+		out.y0 = (unsigned char)y0; out.y1 = (unsigned char)y1;
+		out.z0 = (unsigned char)slice(zNear);
+		out.z1 = (unsigned char)slice(zFar);
+		return true;
+	}
+
+	// Tile k lies between boundaries k and k + 1: the sphere touches it unless it is completely on the wrong side
+	// of one of them. Tiles touched are contiguous, first and last are returned
+	static bool tileRange(const float* nx, const float* ny, const float* nz, const float* d, int planes, int tiles, vec3 c, float radius, bool simd,
+		int& first, int& last)
+	{
+		unsigned int above = 0; // Bit k: distance to boundary k > -radius
+		unsigned int below = 0; // Bit k: distance to boundary k < radius
+
+#ifdef LIGHT_CLUSTERS_SSE
+		if (simd)
+		{
+			__m128 cx = _mm_set1_ps(c.x), cy = _mm_set1_ps(c.y), cz = _mm_set1_ps(c.z);
+			__m128 r = _mm_set1_ps(radius), minusR = _mm_set1_ps(-radius);
+			for (int k = 0; k < planes; k += 4)
+			{
+				__m128 dist = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_load_ps(nx + k), cx), _mm_mul_ps(_mm_load_ps(ny + k), cy)),
+					_mm_add_ps(_mm_mul_ps(_mm_load_ps(nz + k), cz), _mm_load_ps(d + k)));
+				above |= (unsigned int)_mm_movemask_ps(_mm_cmpgt_ps(dist, minusR)) << k;
+				below |= (unsigned int)_mm_movemask_ps(_mm_cmplt_ps(dist, r)) << k;
+			}
+		}
+		else
+#endif
+		{
+			for (int k = 0; k < planes; k++)
+			{
+				float dist = nx[k] * c.x + ny[k] * c.y + nz[k] * c.z + d[k];
+				above |= (dist > -radius ? 1u : 0u) << k;
+				below |= (dist < radius ? 1u : 0u) << k;
+			}
+		}
+
+		unsigned int touched = above & (below >> 1) & ((1u << tiles) - 1);
+		if (touched == 0) return false;
+
+		first = 0;
+		while (!(touched & (1u << first))) first++;
+		last = tiles - 1;
+		while (!(touched & (1u << last))) last--;
+		return true;
+	}
+
+	// Same reuse as TransformSystem::bindStorage: grow when needed, orphan otherwise
+	static void upload(unsigned int& buffer, GLsizeiptr& capacity, const void* data, size_t size, unsigned int binding)
+	{
+		GLsizeiptr bytes = (GLsizeiptr)size;
+		if (buffer == 0) glGenBuffers(1, &buffer);
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, buffer);
+		if (bytes > capacity) capacity = glm::max(bytes, (GLsizeiptr)16); // Never empty, the shader declares the buffer anyway
+		glBufferData(GL_SHADER_STORAGE_BUFFER, capacity, nullptr, GL_DYNAMIC_DRAW); // Allocate, or orphan: the last frame may still read it
+
+		if (bytes > 0) glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, bytes, data);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, binding, buffer);
+	}
+};
+
+#endif LIGHT_CLUSTERS_H
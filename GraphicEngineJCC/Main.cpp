@@ -5,9 +5,12 @@
 #include <vector>
 #include <string>
 #include <map>
+#include <algorithm>
+#include <random>
+#include <cstdlib>
 #include "Camera.h"
 #include "LightBase.h"
-#include "DrawableObject.h"
+#include "ECS.h"
 #include "DeferredShading.h"
 #include "Shape.h"
 #include "Mesh.h"
@@ -17,6 +20,15 @@
 #include "Cubemap.h"
 #include "ShadowMap.h"
 #include "Scene.h"
+#include "ShaderManager.h"
+#include "GLState.h"
+#include "ShaderRegistry.h"
+#include "GPUTimer.h"
+#include "Benchmark.h"
+#include "HiZ.h"
+#include "TransformSystem.h"
+#include "FrameArena.h"
+#include "AllocationCounter.h"
 #include "assimp/Importer.hpp"
 #include "assimp/scene.h"
 #include "assimp/postprocess.h"
@@ -45,6 +57,10 @@ float lastX, lastY;
 // Scene info
 int skyboxID = 0; // Current skybox
 int modelID = 0; // Current model
+LightBase::ShadowFilter shadowFilter = LightBase::PCF; // Of every light, M toggles it
+bool drawAllObjects = false; // Every scene object instead of only the current model
+int shadowCaching = 0; // 0: cached, 1: static and dynamic layers, 2: off
+HiZ* occlusion; // Main pass occlusion culling
 
 
 #pragma region Utility functions
@@ -107,6 +123,71 @@ void key_callback(GLFWwindow* window, int key, int scancode, int action, int mod
 	// Swap models
 	if (key == GLFW_KEY_SPACE && action == GLFW_PRESS)
 		modelID = (modelID + 1) % int(Scene::sceneObjects.size());
+
+	// Draw the whole scene (culled through the BVH) / only the current model
+	if (key == GLFW_KEY_TAB && action == GLFW_PRESS)
+		drawAllObjects = !drawAllObjects;
+
+	// Toggle Hi-Z occlusion culling (compare the main pass timings with P)
+	if (key == GLFW_KEY_O && action == GLFW_PRESS)
+		occlusion->enabled = !occlusion->enabled;
+
+	// Cycle the shadow caching modes (compare the shadow updates with P)
+	if (key == GLFW_KEY_C && action == GLFW_PRESS)
+	{
+		shadowCaching = (shadowCaching + 1) % 3;
+		ShadowMap::setCaching(shadowCaching != 2, shadowCaching == 1);
+	}
+
+	// Cycle how point light shadows reach their cube faces (compare the shadow pass timings with P)
+	if (key == GLFW_KEY_V && action == GLFW_PRESS)
+		ShadowMap::setCubePath(ShadowMap::CubePath((ShadowMap::getCubePath() + 1) % 3));
+
+	// Toggle depth-only batched shadow casters (compare the shadow pass timings with P)
+	if (key == GLFW_KEY_B && action == GLFW_PRESS)
+		ShadowMap::setDepthOnly(!ShadowMap::isDepthOnly());
+
+	// Toggle the time-sliced shadow updates (compare the shadow pass timings and the scheduler stats with P)
+	if (key == GLFW_KEY_T && action == GLFW_PRESS)
+		ShadowScheduler::setEnabled(!ShadowScheduler::isEnabled());
+
+	// Toggle every light between PCF and EVSM shadows (compare the main pass timings with P)
+	if (key == GLFW_KEY_M && action == GLFW_PRESS)
+	{
+		shadowFilter = shadowFilter == LightBase::PCF ? LightBase::EVSM : LightBase::PCF;
+		for (DirectionalLight& light : Scene::directionalLights) light.shadowFilter = shadowFilter;
+		for (SpotLight& light : Scene::spotLights) light.shadowFilter = shadowFilter;
+		for (PointLight& light : Scene::pointLights) light.shadowFilter = shadowFilter;
+	}
+
+	// Pick the object in the middle of the screen
+	if (key == GLFW_KEY_F && action == GLFW_PRESS)
+	{
+		float distance;
+		Entity picked = Scene::pick(camera->getPosition(), camera->getDirection(), distance);
+		if (!picked.isNull())
+		{
+			int index = int(std::find(Scene::sceneObjects.begin(), Scene::sceneObjects.end(), picked) - Scene::sceneObjects.begin());
+			cout << "PICK::Object " << index << " at " << distance << endl;
+		}
+		else cout << "PICK::Nothing" << endl;
+	}
+
+	// Print last frame render stats
+	if (key == GLFW_KEY_P && action == GLFW_PRESS)
+	{
+		GLState::printStats();
+		RenderQueue::printStats();
+		ShaderRegistry::printStats();
+		GPUTimer::printStats();
+		SceneSystems::printStats();
+		ShadowMap::printStats();
+		FrameArena::printStats();
+		AllocationCounter::printStats();
+		Scene::getSpatialIndex().printStats();
+		Scene::getLightClusters().printStats();
+		occlusion->printStats();
+	}
 }
 
 // Key listener by polling, needed for a smooth camera movement
@@ -129,7 +210,7 @@ void processInput(GLFWwindow* window)
 
 }
 
-int glfwConfig(GLFWwindow*& window)
+int glfwConfig(GLFWwindow*& window, bool visible = true)
 {
 	// GLFW init
 	glfwInit();
@@ -141,6 +222,7 @@ int glfwConfig(GLFWwindow*& window)
 
 	// GLFW window
 	glfwWindowHint(GLFW_SAMPLES, 4);
+	glfwWindowHint(GLFW_VISIBLE, visible ? GLFW_TRUE : GLFW_FALSE);
 	window = glfwCreateWindow(WINDOW_WIDTH, WINDOW_HEIGHT, "Motor grafico creado por Jaime Carmona Chavero", NULL, NULL);
 
 	if (window == NULL)
@@ -350,25 +432,35 @@ vector<PointLight> generatePointLights()
 	return pointLights;
 }
 
+// Many small unshadowed point lights scattered around the scene, to load the clustered lighting ("--lights N")
+void generateLightField(int count)
+{
+	std::mt19937 rng(42);
+	std::uniform_real_distribution<float> x(-20.f, 20.f), y(-2.f, 3.f), z(-20.f, 20.f), channel(0.2f, 1.f), distance(2.f, 6.f);
+
+	for (int i = 0; i < count; i++)
+		Scene::createPointLight(vec3(x(rng), y(rng), z(rng)), distance(rng), vec3(channel(rng), channel(rng), channel(rng)), false);
+}
+
 // Spawn here 
-vector<DrawableObject*> generateSceneObjects()
+vector<Entity> generateSceneObjects()
 {
-	vector<DrawableObject*> sceneObj;
+	vector<Entity> sceneObj;
 
 	// Models
-	DrawableObject* model1 = Scene::createModel("Models/Camera/Camera.obj");
-	model1->transformation.translation = vec3(0.f, -1.f, 0.f);
+	Entity model1 = Scene::createModel("Models/Camera/Camera.obj");
+	Scene::transform(model1).translation = vec3(0.f, -1.f, 0.f);
 
-	DrawableObject* model2 = Scene::createModel("Models/Sword/Sword.obj");
-	model2->transformation.translation = vec3(0.f, 0.2f, 0.f);
+	Entity model2 = Scene::createModel("Models/Sword/Sword.obj");
+	Scene::transform(model2).translation = vec3(0.f, 0.2f, 0.f);
 
-	DrawableObject* model3 = Scene::createModel("Models/Knight/Knight.obj");
-	model3->transformation.translation = vec3(0.f, -2.f, 0.f);
-	model3->transformation.rotation = vec3(-90.0f, 0.0f, 0.0f);
+	Entity model3 = Scene::createModel("Models/Knight/Knight.obj");
+	Scene::transform(model3).translation = vec3(0.f, -2.f, 0.f);
+	Scene::transform(model3).rotation = vec3(-90.0f, 0.0f, 0.0f);
 
-	DrawableObject* model4 = Scene::createModel("Models/TV/TV.obj");
-	model4->transformation.translation = vec3(0.f, 0.f, 0.f);
-	model4->transformation.scale = vec3(0.5f, 0.5f, 0.5f);
+	Entity model4 = Scene::createModel("Models/TV/TV.obj");
+	Scene::transform(model4).translation = vec3(0.f, 0.f, 0.f);
+	Scene::transform(model4).scale = vec3(0.5f, 0.5f, 0.5f);
 
 
 	// Obj1
@@ -395,8 +487,8 @@ vector<DrawableObject*> generateSceneObjects()
 
 	Shape::generateSphere(1., 32, 32, vert1, ind1);
 
-	DrawableObject* obj1 = Scene::createMesh(vert1, ind1, textures1);
-	obj1->transformation.translation = vec3(0.f, 0.f, 0.f);
+	Entity obj1 = Scene::createMesh(vert1, ind1, textures1);
+	Scene::transform(obj1).translation = vec3(0.f, 0.f, 0.f);
 
 	// Gold
 	Texture obj2Diff("textures/gold/gold-scuffed_basecolor-boosted.png", "texture_base");
@@ -416,8 +508,8 @@ vector<DrawableObject*> generateSceneObjects()
 	//Shape::generateCube(1, 1, 1, vert1, ind1);
 	Shape::generateSphere(1., 32, 32, vert2, ind2);
 
-	DrawableObject* obj2 = Scene::createMesh(vert2, ind2, textures2,glm::vec3(1.f,0.7f,0.6f));
-	obj2->transformation.translation = vec3(0.f, 0.f, 0.f);
+	Entity obj2 = Scene::createMesh(vert2, ind2, textures2,glm::vec3(1.f,0.7f,0.6f));
+	Scene::transform(obj2).translation = vec3(0.f, 0.f, 0.f);
 
 	//// Obj2
 	//Texture obj2Diff("textures/wood.png", "texture_diffuse");
@@ -437,7 +529,7 @@ vector<DrawableObject*> generateSceneObjects()
 	//Shape::generateSphere(1, 32, 32, vert2, ind2);
 
 	////DrawableObject* obj2 = new Mesh(vert2, ind2, textures2);
-	//DrawableObject* obj2 = Scene::createMesh(vert2, ind2, textures2, glm::vec3(1.0f, 0.f, 0.f));
+	//Entity obj2 = Scene::createMesh(vert2, ind2, textures2, glm::vec3(1.0f, 0.f, 0.f));
 	//obj2->transformation.translation = vec3(2.f, 0.f, -8.f);
 
 	//// Floor
@@ -455,7 +547,7 @@ vector<DrawableObject*> generateSceneObjects()
 
 	////Mesh floor(vert2, ind2, textures2);
 	////DrawableObject* floor = new Mesh(vert3, ind3, textures3);
-	//DrawableObject* floor = Scene::createMesh(vert3, ind3, textures3);
+	//Entity floor = Scene::createMesh(vert3, ind3, textures3);
 	//floor->transformation.translation = vec3(0.f, -2.f, -5.f);
 	
 	//sceneObj.push_back(obj1);
@@ -465,59 +557,199 @@ vector<DrawableObject*> generateSceneObjects()
 	return sceneObj;
 }
 
-#pragma endregion
+// Occlusion test scene: a grid of closed rooms, each full of dense spheres. Only the room the camera is in
+// (plus what the doors show) is visible, draw it with Tab (all objects)
+void generateInteriorScene(int roomsX = 6, int roomsZ = 6, int spheresPerRoom = 12)
+{
+	const float room = 10.f, wall = 0.2f, height = 4.f, origin = 20.f;
 
+	vector<Texture> noTextures;
+	vector<float> wallXVert, wallZVert, sphereVert;
+	vector<unsigned int> wallXInd, wallZInd, sphereInd;
+	Shape::generateCube(room, height, wall, wallXVert, wallXInd);
+	Shape::generateCube(wall, height, room, wallZVert, wallZInd);
+	Shape::generateSphere(0.6f, 96, 96, sphereVert, sphereInd);
 
-void drawScene(Shader& sh, vector<DrawableObject*> obj, DirectionalLight dLight, vector<SpotLight> sLight, vector<PointLight> pLight)
+	for (int x = 0; x < roomsX; x++)
+	{
+		for (int z = 0; z < roomsZ; z++)
+		{
+			vec3 corner(origin + x * room, -1.f, -z * room);
+
+			// Two walls per room, the grid closes the rest. The middle of each wall is left out as a door
+			for (int half = 0; half < 2; half++)
+			{
+				Entity wx = Scene::createMesh(wallXVert, wallXInd, noTextures, vec3(0.8f, 0.75f, 0.7f));
+				Scene::transform(wx).translation = corner + vec3(room * 0.5f, height * 0.5f, 0.f);
+				Scene::transform(wx).scale = vec3(0.4f, 1.f, 1.f);
+				Scene::transform(wx).translation.x += (half == 0 ? -0.3f : 0.3f) * room;
+
+				Entity wz = Scene::createMesh(wallZVert, wallZInd, noTextures, vec3(0.7f, 0.75f, 0.8f));
+				Scene::transform(wz).translation = corner + vec3(0.f, height * 0.5f, -room * 0.5f);
+				Scene::transform(wz).scale = vec3(1.f, 1.f, 0.4f);
+				Scene::transform(wz).translation.z += (half == 0 ? -0.3f : 0.3f) * room;
+			}
+
+			for (int i = 0; i < spheresPerRoom; i++)
+			{
+				Entity s = Scene::createMesh(sphereVert, sphereInd, noTextures, vec3(0.9f, 0.3f + 0.05f * i, 0.2f));
+				Scene::transform(s).translation = corner + vec3(1.5f + (i % 4) * 2.3f, 0.8f, -1.5f - (i / 4) * 3.f);
+			}
+		}
+	}
+}
+
+// Vertex bound scene: a dense sphere (~260k vertices) and instanced rocks, 32 x 32 instances of a 48x48 sphere
+// (~2.4M vertices in one draw). Compare the main pass timings with P; Benchmark::vertexBound times the same meshes
+// on their own. No rock model ships with the project, Scene::createModel(path, instances, models) takes the same matrices
+void generateVertexBoundScene()
 {
-	sh.use();
+	vector<Texture> iron;
+	iron.push_back(Texture("textures/rustediron/rustediron2_basecolor.png", "texture_base"));
+	iron.push_back(Texture("textures/rustediron/rustediron2_metallic.png", "texture_metallic"));
+	iron.push_back(Texture("textures/rustediron/rustediron2_normal.png", "texture_normal"));
+	iron.push_back(Texture("textures/rustediron/rustediron2_roughness.png", "texture_roughness"));
+
+	vector<float> vertDense;
+	vector<unsigned int> indDense;
+	Shape::generateSphere(1., 512, 512, vertDense, indDense);
+
+	Entity dense = Scene::createMesh(vertDense, indDense, iron);
+	Scene::transform(dense).scale = vec3(1.5f);
+
+	vector<float> vertRock;
+	vector<unsigned int> indRock;
+	Shape::generateSphere(0.2f, 48, 48, vertRock, indRock);
+
+	vector<mat4> rockModels;
+	for (int i = 0; i < 32 * 32; i++)
+	{
+		vec3 position(-8.f + (i % 32) * 0.5f, -1.f + 0.3f * glm::sin(i * 12.9898f), -2.f - (i / 32) * 0.5f);
+		mat4 m = glm::translate(mat4(1.f), position);
+		m = glm::rotate(m, glm::radians(i * 37.f), glm::normalize(vec3(1.f, 2.f, 0.5f)));
+		rockModels.push_back(glm::scale(m, vec3(0.6f + 0.4f * glm::abs(glm::sin(i * 3.7f)), 0.5f, 0.8f)));
+	}
+	Scene::createMesh(vertRock, indRock, iron, vec3(1.f), (int)rockModels.size(), rockModels.data());
+}
 
-	sh.addDirectionalLight(dLight);
-	sh.addSpotLight(sLight);
-	sh.addPointLight(pLight);
-	sh.addCamera(*camera);
+// Ring of small cubes instanced from a TransformSystem (one storage buffer, one draw call), spun every frame.
+// Only with --belt: its bounds change every frame, so the shadow views it's in are never cached
+void generateAsteroidBelt(TransformSystem& belt, int count = 4096, float radius = 30.f)
+{
+	vector<Texture> noTextures;
+	vector<float> vert;
+	vector<unsigned int> ind;
+	Shape::generateCube(0.3f, 0.3f, 0.3f, vert, ind);
 
-	for (int i = 0; i < obj.size(); i++)
+	for (int i = 0; i < count; i++)
 	{
-		sh.setTransform(obj[i]->transformation);
-		obj[i]->Draw(&sh);
+		float a = glm::two_pi<float>() * i / count;
+		float r = radius + 3.f * glm::sin(i * 12.9898f);
+		belt.add(vec3(glm::cos(a) * r, 2.f * glm::sin(i * 78.233f), glm::sin(a) * r), TransformSystem::toQuat(vec3(i * 37.f, i * 11.f, 0.f)), vec3(0.5f + 0.5f * glm::abs(glm::sin(i * 3.7f))));
 	}
+
+	Scene::createMesh(vert, ind, noTextures, &belt, vec3(0.55f, 0.5f, 0.45f));
 }
 
-int main()
+void animateAsteroidBelt(TransformSystem& belt, float deltaTime)
 {
+	glm::quat spin = glm::angleAxis(deltaTime, glm::normalize(vec3(1.f, 1.f, 0.f)));
+	for (int i = 0; i < (int)belt.size(); i++) belt.setRotation(i, belt.getRotation(i) * spin);
+}
+
+#pragma endregion
+
+
+int main(int argc, char** argv)
+{
+	// CPU benchmarks only, no window
+	if (argc > 1 && std::string(argv[1]) == "--bench")
+	{
+		Benchmark::runAll();
+		return 0;
+	}
+	// Text scene to binary: "--convert scene.jscene.txt scene.jscene"
+	if (argc > 3 && std::string(argv[1]) == "--convert")
+	{
+		return SceneFile::convert(argv[2], argv[3]) ? 0 : 1;
+	}
+	bool interiorScene = argc > 1 && std::string(argv[1]) == "--interior";
+	bool beltScene = argc > 1 && std::string(argv[1]) == "--belt";
+	bool vertexBoundScene = argc > 1 && std::string(argv[1]) == "--vertex-bound";
+	const char* sceneFile = argc > 2 && std::string(argv[1]) == "--scene" ? argv[2] : nullptr;
+	int lightField = argc > 2 && std::string(argv[1]) == "--lights" ? std::atoi(argv[2]) : 0;
+
+	// Headless check: a fixed number of frames in a hidden window, fails if any frame after the warm-up allocates
+	bool allocationTest = argc > 1 && std::string(argv[1]) == "--alloc-test";
+	const int testFrames = 300, warmupFrames = 60;
+	int frame = 0, allocatingFrames = 0;
+	AllocationCounter::trackThisThread();
+
+	// GPU benchmarks, in a hidden window's context
+	bool gpuBenchmark = argc > 1 && std::string(argv[1]) == "--bench-gpu";
 
 	GLFWwindow* window;
-	if (glfwConfig(window) == -1) return -1;
+	if (glfwConfig(window, !allocationTest && !gpuBenchmark) == -1) return -1;
 
 	glConfig();
 
+	if (gpuBenchmark)
+	{
+		Benchmark::runGpu();
+		glfwTerminate();
+		return 0;
+	}
+
+	ShaderManager::startWatching(); // Hot reload of Shaders/
+
 #pragma region Shaders, camera, lights and cubemap
 	Camera cam(vec3(0.f, 0.f, 3.f), vec3(0.0f, 0.0f, -1.f));
 	camera = &cam;
 
-	ShadowMap::init(1024 * 8, 1024 * 8);
+	// Directional light cascades 4 x 2048 (64 MB, against 256 MB for the single 8192 map). Spot and point lights share
+	// the atlas, tiles sized every frame from their screen coverage. All of them within 128 MB (see ShadowResources)
+	ShadowMap::init(2048, 128 * 1024 * 1024);
 
-	generateDirectLight();
-	generateSpotLights();
-	generatePointLights();
-	generateSceneObjects();
+	if (sceneFile != nullptr)
+	{
+		if (!Scene::loadScene(sceneFile)) return -1;
+		if (Scene::directionalLights.empty()) generateDirectLight(); // The passes expect one
+	}
+	else
+	{
+		generateDirectLight();
+		generateSpotLights();
+		generatePointLights();
+		generateSceneObjects();
+	}
+	if (interiorScene) generateInteriorScene();
+	if (vertexBoundScene) generateVertexBoundScene();
+	generateLightField(lightField);
+
+	TransformSystem belt(4096);
+	if (beltScene) generateAsteroidBelt(belt);
 
-	std::string sLightSizeStr = std::to_string(Scene::spotLights.size());
-	std::string pLightSizeStr = std::to_string(Scene::pointLights.size());
+	// GLSL has no empty arrays: a scene file without spot lights still gets one (black) slot. Point lights are
+	// clustered (LightClusters), their count doesn't change the shader
+	std::string sLightSizeStr = std::to_string(glm::max(Scene::spotLights.size(), (size_t)1));
 
 
 	std::map<std::string, const char*> defineValues;
 	defineValues.insert(std::pair<std::string, const char*>("MAX_SPOT_LIGHT", sLightSizeStr.c_str()));
-	defineValues.insert(std::pair<std::string, const char*>("MAX_POINT_LIGHT", pLightSizeStr.c_str()));
 	//Shader shader("vsStandard.vert", "fsStandard.frag", "", defineValues);
-	Shader shader("vsStandard.vert", "fsPBR.frag", "", defineValues);
+	std::shared_ptr<Shader> shader = ShaderRegistry::get("vsStandard.vert", "fsPBR.frag", "", defineValues);
 
-	Scene::createSkybox("textures/Arches_E_PineTree_3k.hdr", ".hdr");
-	Scene::createSkybox("textures/Ice_Lake_Ref.hdr", ".hdr");
-	Scene::createSkybox("textures/Chelsea_Stairs_3k.hdr", ".hdr");
+	if (Scene::skyboxes.empty())
+	{
+		Scene::createSkybox("textures/Arches_E_PineTree_3k.hdr", ".hdr");
+		// Baked across the first frames, 1 - 3 keep the current skybox until theirs is ready
+		Scene::createSkybox("textures/Ice_Lake_Ref.hdr", ".hdr", true);
+		Scene::createSkybox("textures/Chelsea_Stairs_3k.hdr", ".hdr", true);
+	}
 	
 	Framebuffer hdr;
+	HiZ hiZ(1600, 900); // Size of hdr.depth
+	occlusion = &hiZ;
 
 	// Testing viewports
 	FramebufferDebug fbDebug1(glm::vec2(0.f), glm::vec2(200.f * (16.f / 9.f), 200.f), glm::vec2(WINDOW_WIDTH, WINDOW_HEIGHT));
@@ -525,40 +757,88 @@ int main()
 
 #pragma endregion
 
-	vector<DrawableObject*> model; // What model want to see in the scene
+	GPUTimer shadowTimer("Shadow pass");
+	GPUTimer mainTimer("Main pass");
+	GPUTimer postTimer("Post process");
+	GPUTimer bakeTimer("Skybox bake");
+	Cubemap* skybox = Scene::skyboxes[0]; // Shown, the one of skyboxID once it is ready
+
+	GLState::invalidate(); // Setup code above binds GL objects directly
+	if (allocationTest) drawAllObjects = true;
 
 	// (Main) Render loop. Prevent closing the window until glfwWindowShouldClose returns true
 	while (!glfwWindowShouldClose(window))
 	{		
+		AllocationCounter::beginFrame();
+		FrameArena::beginFrame();
+		if (allocationTest)
+		{
+			if (frame > warmupFrames && AllocationCounter::lastFrameAllocations > 0)
+			{
+				cout << "ERROR::ALLOCATION::Frame " << frame - 1 << " made " << AllocationCounter::lastFrameAllocations << " heap allocations" << endl;
+				allocatingFrames++;
+			}
+			if (frame == testFrames) break;
+		}
+		frame++;
+
+		GLState::beginFrame();
+		RenderQueue::beginFrame();
+		SceneSystems::beginFrame();
+		ShadowMap::beginFrame();
 
 		calculateDeltaTime();
 
 		// Check if any key has pressed/released
 		processInput(window);
 
+		// Swap in any shader rebuilt since the last frame
+		ShaderManager::update();
+
+		// Progressive skyboxes, a slice per frame
+		bakeTimer.begin();
+		Scene::bakeSkyboxes();
+		bakeTimer.end();
+		Cubemap* wanted = Scene::skyboxes[glm::min(skyboxID, (int)Scene::skyboxes.size() - 1)];
+		if (wanted->isReady()) skybox = wanted;
+
 		// If glClear() is called, use the input color
 		glClearColor(0.2f, 0.3f, 0.3f, 1.0f);
 
-		model.push_back(Scene::sceneObjects[modelID]);
+		ArrayView<Entity> drawList = drawAllObjects ? ArrayView<Entity>(Scene::sceneObjects) : ArrayView<Entity>(&Scene::sceneObjects[modelID], 1);
+		if (beltScene) animateAsteroidBelt(belt, deltaTime);
+		Scene::updateTransforms();
+		Scene::updateSpatialIndex();
+
+		hiZ.beginFrame(camera->getProjectionMatrix(true) * camera->getViewMatrix(), camera->getPosition());
+		RenderQueue::occlusion = hiZ.enabled ? &hiZ : nullptr;
+
 		// Generate shadows before draw a scene
-		Scene::generateShadows(model);
+		shadowTimer.begin();
+		Scene::generateShadows(*camera, drawList);
+		shadowTimer.end();
 
 
 		// Normal rendering
 		glViewport(0, 0, WINDOW_WIDTH, WINDOW_HEIGHT);
-		glBindFramebuffer(GL_FRAMEBUFFER, hdr.fboID);
+		GLState::bindFramebuffer(hdr.fboID);
 		//hdr.bindFramebuffer();
 		//glBindFramebuffer(GL_FRAMEBUFFER, 0);
 		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
 		
 		
-		Scene::drawScene(hdr.fboID, shader, *camera, Scene::skyboxes[skyboxID], model);
+		mainTimer.begin();
+		Scene::drawScene(hdr.fboID, *shader, *camera, skybox, drawList);
+		mainTimer.end();
 
-		glBindFramebuffer(GL_FRAMEBUFFER, 0);
-		hdr.draw(*camera, model);
+		// Depth pyramid for the next frames
+		hiZ.build(hdr.depth);
 
-		model.clear();
+		GLState::bindFramebuffer(0);
+		postTimer.begin();
+		hdr.draw(*camera, drawList);
+		postTimer.end();
 
 
 		fbDebug1.draw(hdr.ssao->gBuffer->gNormal);
@@ -581,6 +861,14 @@ int main()
 
 	// If the while ends, close glfw (clear resources) and finish the main execution
 
+	ShaderManager::stopWatching();
+	ShaderRegistry::shutdown();
 	glfwTerminate();
+
+	if (allocationTest)
+	{
+		cout << "ALLOCATION_TEST::" << allocatingFrames << " of " << testFrames - warmupFrames << " frames allocated after the warm-up" << endl;
+		return allocatingFrames > 0 ? 1 : 0;
+	}
 	return 0;
 }
\ No newline at end of file
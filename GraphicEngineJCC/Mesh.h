@@ -1,8 +1,12 @@
 #ifndef MESH_H
 #define MESH_H
 
-#include "DrawableObject.h"
 #include "Shader.h"
+#include "Texture.h"
+#include "AABB.h"
+#include "GLState.h"
+#include "TransformSystem.h"
+#include "DepthGeometry.h"
 //#include "Scene.h"
 #include <vector>
 #include "glm/glm.hpp"
@@ -14,7 +18,8 @@ struct Vertex {
 	glm::vec2 TexCoords;
 };
 
-class Mesh : virtual public DrawableObject
+// Geometry and material. Scene entities draw it through a MeshRenderer component
+class Mesh
 {
 	// Using
 	template<class T> using vector = std::vector<T>;
@@ -31,9 +36,14 @@ public:
 	float roughness = 0.9f;
 	float ao = 1.f;
 
+	AABB bounds; // Object space, world space when instanced
 
 	int nInstances = 1;
 	glm::mat4 *instModels;
+	TransformSystem* instanceTransforms = nullptr; // Instances read from its storage buffer instead of instModels
+
+	// Shader storage binding of the instance matrices (vsStandard, vsGBuffer)
+	static const unsigned int INSTANCE_BINDING = 1;
 
 	Mesh(vector<float> vertices, vector<unsigned int> indices, vector<Texture> textures, glm::vec3 color = glm::vec3(1.f)) 
 	{
@@ -41,6 +51,7 @@ public:
 		this->indices = indices;
 		this->textures = textures;
 		this->color = color;
+		bounds = AABB::fromVertices(vertices, 11);
 		setupMesh();
 		//setupTexture();
 	}
@@ -49,17 +60,67 @@ public:
 	{
 		nInstances = glm::max(1, instances);
 		instModels = models;
+		instanceModels.assign(models, models + nInstances);
 
 		this->vertices = vertices;
 		this->indices = indices;
 		this->textures = textures;
 		this->color = color;
+
+		// Every instance inside the box
+		AABB meshBounds = AABB::fromVertices(vertices, 11);
+		for (int i = 0; i < nInstances; i++) bounds.expand(meshBounds.transformed(models[i]));
+
 		setupMesh();
 		//setupTexture();
 	}
 
+	// One instance per transform of the system, which can change every frame
+	Mesh(vector<float> vertices, vector<unsigned int> indices, vector<Texture> textures, glm::vec3 color, TransformSystem* transforms)
+	{
+		instanceTransforms = transforms;
+
+		this->vertices = vertices;
+		this->indices = indices;
+		this->textures = textures;
+		this->color = color;
+		meshBounds = AABB::fromVertices(vertices, 11);
+
+		setupMesh();
+		refreshInstances();
+	}
+
+	bool isInstanced() const
+	{
+		return nInstances > 1 || instanceTransforms;
+	}
+
+	// Composes the instance transforms if they changed and refits bounds (world space, like any instanced mesh).
+	// True if the bounds changed
+	bool refreshInstances()
+	{
+		if (!instanceTransforms) return false;
+
+		instanceTransforms->update();
+		if (instanceTransforms->getVersion() == instanceVersion) return false;
+		instanceVersion = instanceTransforms->getVersion();
+
+		nInstances = (int)instanceTransforms->size();
+		bounds = AABB();
+		const glm::mat4* models = instanceTransforms->getWorldMatrices();
+		for (int i = 0; i < nInstances; i++) bounds.expand(meshBounds.transformed(models[i]));
+		return true;
+	}
+
 	void Draw(Shader* shader) {
 		
+		bindMaterial(shader);
+		drawGeometry(shader);
+	}
+
+	// Textures and material uniforms
+	void bindMaterial(Shader* shader)
+	{
 		shader->setTextures(textures);
 		shader->setFloat("material.shininess", 32.0f);
 		shader->setVec3("material.color", color);
@@ -67,11 +128,69 @@ public:
 		shader->setFloat("material.metallic", metallic);
 		shader->setFloat("material.roughness", roughness);
 		shader->setFloat("material.ao", ao);
-		
-		glBindVertexArray(VAO);
-		if (nInstances > 1)
+	}
+
+	// Identifies everything bindMaterial() sets. Equal hash == same material state
+	unsigned long long materialHash() const
+	{
+		unsigned long long hash = 14695981039346656037ull; // FNV-1a
+		auto add = [&hash](const void* data, size_t size)
+		{
+			const unsigned char* bytes = (const unsigned char*)data;
+			for (size_t i = 0; i < size; i++)
+			{
+				hash ^= bytes[i];
+				hash *= 1099511628211ull;
+			}
+		};
+
+		for (const Texture& t : textures) add(&t.id, sizeof(t.id));
+		add(&color, sizeof(color));
+		add(&specular, sizeof(specular));
+		add(&metallic, sizeof(metallic));
+		add(&roughness, sizeof(roughness));
+		add(&ao, sizeof(ao));
+
+		return hash;
+	}
+
+	unsigned int getVAO() const
+	{
+		return VAO;
+	}
+
+	// Positions and indices in the DepthGeometry buffers
+	const DepthGeometry::Range& getDepthRange() const
+	{
+		return depthRange;
+	}
+
+	// Model matrix of each instance: the owner's world matrix, or the instances' own (world space already)
+	const glm::mat4* getInstanceModels(const glm::mat4& world, int& count) const
+	{
+		count = instanceTransforms || nInstances > 1 ? nInstances : 1;
+		if (instanceTransforms) return instanceTransforms->getWorldMatrices();
+		return nInstances > 1 ? instanceModels.data() : &world;
+	}
+
+	// Vertex array and draw call. copies > 1 draws the mesh that many times in one call, for shaders that send each
+	// copy to another layer or viewport (gl_InstanceID % copies). Not for instanced meshes, whose per-instance data
+	// only holds nInstances entries: they ignore it (see RenderQueue::executeItems)
+	void drawGeometry(Shader* shader, unsigned int copies = 1)
+	{
+		GLState::bindVertexArray(VAO);
+		if (instanceTransforms)
 		{
+			if (nInstances == 0) return;
+			instanceTransforms->bindStorage(INSTANCE_BINDING);
 			shader->setBool("multipleInstances", true);
+			shader->setBool("storageInstances", true);
+			glDrawElementsInstanced(GL_TRIANGLES, indices.size(), GL_UNSIGNED_INT, 0, nInstances);
+		}
+		else if (nInstances > 1)
+		{
+			shader->setBool("multipleInstances", true);
+			shader->setBool("storageInstances", false);
 			glDrawElementsInstanced(GL_TRIANGLES, indices.size(), GL_UNSIGNED_INT, 0, nInstances);
 		}
 		else
@@ -80,15 +199,19 @@ public:
 			//glClearDepthf(0.4f);// DELETE
 			//glDepthMask(GL_FALSE);
 
-			glDrawElements(GL_TRIANGLES, indices.size(), GL_UNSIGNED_INT, 0);
+			if (copies > 1) glDrawElementsInstanced(GL_TRIANGLES, indices.size(), GL_UNSIGNED_INT, 0, copies);
+			else glDrawElements(GL_TRIANGLES, indices.size(), GL_UNSIGNED_INT, 0);
 		}
-		glBindVertexArray(0);
-		
 	}
 
 private:
 	// render data
 	unsigned int VAO, VBO, EBO;
+	DepthGeometry::Range depthRange;
+	vector<glm::mat4> instanceModels;	// instModels, which the caller may free
+
+	AABB meshBounds;					// Object space, instanceTransforms only
+	unsigned int instanceVersion = ~0u;	// instanceTransforms version the bounds were built from
 
 	void setupMesh() {
 		glGenVertexArrays(1, &VAO);
@@ -146,6 +269,7 @@ private:
 		}
 
 		glBindVertexArray(0);
+		depthRange = DepthGeometry::add(vertices, 11, indices);
 		glDeleteBuffers(1, &VBO);// TODO: Delete afte VAO deletion
 		glDeleteBuffers(1, &EBO);// TODO: Delete afte VAO deletion
 	}
@@ -1,14 +1,14 @@
 #ifndef MODEL_H
 #define MODEL_H
 
-#include "DrawableObject.h"
 #include <stb_image.h>
 #include "assimp/Importer.hpp"
 #include "assimp/scene.h"
 #include "assimp/postprocess.h"
 #include "Mesh.h"
 
-class Model : virtual public DrawableObject
+// Meshes loaded from a file. Scene entities draw them through a MeshRenderer component
+class Model
 {
 	// Using
 	template<class T> using vector = std::vector<T>;
@@ -19,6 +19,8 @@ public:
 	unsigned int nInstances = 1;
 	glm::mat4 *instModels;
 
+	AABB bounds; // Object space, all the meshes
+
 	Model(const char* path)
 	{
 		loadModel(path);
@@ -38,6 +40,17 @@ public:
 			meshes[i].Draw(shader);
 	}
 
+	// Contiguous, fixed once loaded
+	Mesh* getMeshes()
+	{
+		return meshes.data();
+	}
+
+	unsigned int getMeshCount() const
+	{
+		return (unsigned int)meshes.size();
+	}
+
 private:
 	// model data
 	vector<Mesh> meshes;
@@ -62,6 +75,8 @@ private:
 		}
 		directory = path.substr(0, path.find_last_of('/'));
 		processNode(scene->mRootNode, scene);
+
+		for (unsigned int i = 0; i < meshes.size(); i++) bounds.expand(meshes[i].bounds);
 	}
 
 	void processNode(aiNode* node, const aiScene* scene)
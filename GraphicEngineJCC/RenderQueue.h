@@ -0,0 +1,520 @@
+#ifndef RENDER_QUEUE_H
+#define RENDER_QUEUE_H
+
+#include "ECS.h"
+#include "Components.h"
+#include "SceneSystems.h"
+#include "Mesh.h"
+#include "DepthGeometry.h"
+#include "Shader.h"
+#include "Frustum.h"
+#include "BVH.h"
+#include "HiZ.h"
+#include "ArrayView.h"
+#include "FrameArena.h"
+#include "glm/glm.hpp"
+#include <vector>
+#include <iostream>
+
+// Draws sorted by a 64 bit key, so consecutive draws share as much state as possible:
+//
+//  63    60 59        52 51           32 31        16 15           0
+//  | pass  | shader    | material       | VAO        | depth bucket |
+//
+// Depth is front to back (early-Z). Each pass keeps its own queue. Items live on the FrameArena: a queue is filled
+// and drawn within one frame. Depth-only queues (shadow maps) leave material and VAO out of the key: they draw from
+// the DepthGeometry buffers, every item of a shader in one indirect multi-draw.
+class RenderQueue
+{
+	template<class T> using vector = std::vector<T>;
+	using vec3 = glm::vec3;
+	using uint64 = unsigned long long;
+
+public:
+	enum Pass
+	{
+		MAIN = 0,
+		GBUFFER = 1,
+		SHADOW = 2,
+		PASS_COUNT
+	};
+
+	struct DrawItem
+	{
+		uint64 key;
+		Mesh* mesh;
+		Entity owner;				// A model's meshes share it
+		const glm::mat4* world;		// Owner's world matrix, in the Transform pool (no entity is added while drawing)
+		Shader* shader;
+		uint64 material;			// Full material hash, the key only keeps 20 bits of it
+		unsigned int proxy;			// Occluded items: box proxy of the owner
+		unsigned int faceMask;		// Layered passes: faces (bits) the owner touches
+	};
+
+	// Stats of the last complete frame, all queues together
+	static unsigned int lastFrameDraws;
+	static unsigned int lastFrameShaderSkips;
+	static unsigned int lastFrameTransformSkips;
+	static unsigned int lastFrameMaterialSkips;
+	static unsigned int lastFrameDepthItems;	// Drawn through depth-only batches (in lastFrameDraws multi-draws)
+
+	// Meshes submitted / objects and sub-meshes dropped by frustum culling, per pass
+	static unsigned int lastFrameSubmitted[PASS_COUNT];
+	static unsigned int lastFrameCulled[PASS_COUNT];
+
+	// Components of the entities submitted, set by the Scene
+	static Registry* registry;
+
+	// Spatial index of the scene list. A culled submit of the list it indexes queries it instead of testing every entity
+	static const BVH* spatialIndex;
+
+	// Occlusion culling of the main pass, nullptr disables it
+	static HiZ* occlusion;
+
+	static void beginFrame()
+	{
+		lastFrameDraws = draws;
+		lastFrameShaderSkips = shaderSkips;
+		lastFrameTransformSkips = transformSkips;
+		lastFrameMaterialSkips = materialSkips;
+		lastFrameDepthItems = depthItems;
+		draws = shaderSkips = transformSkips = materialSkips = depthItems = 0;
+
+		for (int p = 0; p < PASS_COUNT; p++)
+		{
+			lastFrameSubmitted[p] = submitted[p];
+			lastFrameCulled[p] = culled[p];
+			submitted[p] = culled[p] = 0;
+		}
+	}
+
+	static void printStats()
+	{
+		std::cout << "RENDER_QUEUE::" << lastFrameDraws << " draws, skipped " << lastFrameShaderSkips << " shader / "
+			<< lastFrameTransformSkips << " transform / " << lastFrameMaterialSkips << " material changes, " << lastFrameDepthItems
+			<< " items in depth-only batches" << std::endl;
+
+		const char* names[PASS_COUNT] = { "Main", "GBuffer", "Shadow" };
+		for (int p = 0; p < PASS_COUNT; p++)
+			std::cout << "RENDER_QUEUE::" << names[p] << " pass: " << lastFrameSubmitted[p] << " drawn, " << lastFrameCulled[p] << " culled" << std::endl;
+	}
+
+	void clear()
+	{
+		faces = nullptr;
+		faceRenders = 0;
+		drawCalls = 0;
+		items.clear();
+		scratch.clear();
+		occludedItems.clear();
+		instancedItems.clear();
+		occludedBoxes.clear();
+		proxyQueries.clear();
+	}
+
+	// Add every mesh of the entities' MeshRenderer. eye/maxDistance give the front to back order (camera or light
+	// position). With a frustum, the entities and then each of their meshes are dropped if their bounds are outside.
+	// Layered passes (point light cube maps) call setFaces() first
+	void submit(ArrayView<Entity> entities, Shader* shader, Pass pass, vec3 eye, float maxDistance, const Frustum* frustum = nullptr)
+	{
+		if (frustum)
+		{
+			candidates.clear();
+			SceneSystems::cull(*registry, entities, *frustum, candidates, spatialIndex);
+			culled[pass] += (unsigned int)(entities.size() - candidates.size());
+			entities = candidates;
+		}
+
+		ComponentPool<MeshRenderer>& renderers = registry->pool<MeshRenderer>();
+		ComponentPool<Transform>& transforms = registry->pool<Transform>();
+		ComponentPool<Bounds>& bounds = registry->pool<Bounds>();
+		for (Entity e : entities)
+		{
+			const MeshRenderer* r = renderers.tryGet(e);
+			const Transform* t = transforms.tryGet(e);
+			if (r && t) submitEntity(e, *r, *t, bounds.tryGet(e), shader, pass, eye, maxDistance, frustum);
+		}
+	}
+
+	// Frustum of each layer of a layered pass (at most 32). Every object gets a mask of the layers its bounds touch,
+	// set as the "faceMask" uniform; objects touching none are culled. Until the next clear()
+	void setFaces(const Frustum* faceFrusta, int count)
+	{
+		faces = faceFrusta;
+		faceCount = count;
+	}
+
+	// Layered passes: each item drawn as one instance per face of its mask, for a vertex shader that picks the face
+	// from gl_InstanceID (instead of a geometry shader amplifying every triangle). Kept until changed
+	void setFaceInstancing(bool enabled)
+	{
+		faceInstancing = enabled;
+	}
+
+	// Passes that only write depth: items keep no material and draw positions only (see DepthGeometry), a single
+	// multi-draw per shader. The vertex shader reads the model (and faceMask) from per-instance attributes when its
+	// "batched" uniform is set. Kept until changed
+	void setDepthOnly(bool enabled)
+	{
+		depthOnly = enabled;
+	}
+
+	bool isDepthOnly() const
+	{
+		return depthOnly;
+	}
+
+	// Sum over the submitted objects of the faces each one is rendered to
+	unsigned int getFaceRenders() const
+	{
+		return faceRenders;
+	}
+
+	// GL draw calls of the last execute()
+	unsigned int getDrawCalls() const
+	{
+		return drawCalls;
+	}
+
+	// LSD radix sort, 8 bits per pass. Bytes equal in every key are skipped
+	void sort()
+	{
+		size_t n = items.size();
+		if (n < 2) return;
+
+		scratch.resize(n);
+		DrawItem* src = items.data();
+		DrawItem* dst = scratch.data();
+
+		for (int shift = 0; shift < 64; shift += 8)
+		{
+			size_t count[256] = { 0 };
+			for (size_t i = 0; i < n; i++) count[(src[i].key >> shift) & 0xFF]++;
+
+			if (count[(src[0].key >> shift) & 0xFF] == n) continue;
+
+			size_t offset = 0;
+			for (int b = 0; b < 256; b++)
+			{
+				size_t c = count[b];
+				count[b] = offset;
+				offset += c;
+			}
+
+			for (size_t i = 0; i < n; i++) dst[count[(src[i].key >> shift) & 0xFF]++] = src[i];
+
+			std::swap(src, dst);
+		}
+
+		if (src != items.data()) items.swap(scratch);
+	}
+
+	// Draw in order. Shader, transformation and material are only set when they differ from the previous item.
+	// Items the Hi-Z rejected go last: a box proxy per object is tested against the depth just drawn, and their
+	// draws only happen on the GPU if the proxy passed (conditional rendering, the CPU never waits)
+	void execute()
+	{
+		if (depthOnly) executeDepth(items, nullptr);
+		else executeItems(items, nullptr);
+
+		if (occludedItems.empty()) return;
+
+		proxyQueries.resize(occludedBoxes.size());
+		occlusion->beginProxies();
+		for (size_t i = 0; i < occludedBoxes.size(); i++) proxyQueries[i] = occlusion->drawProxy(occludedBoxes[i]);
+		occlusion->endProxies();
+
+		if (depthOnly) executeDepth(occludedItems, proxyQueries.data());
+		else executeItems(occludedItems, proxyQueries.data());
+	}
+
+	// Face instancing draws each item once per face of its mask. Instanced meshes can't be drawn that way (their
+	// per-instance attributes hold one matrix per instance), they go through executeDepth, which expands every
+	// instance into its faces
+	void executeItems(FrameArray<DrawItem>& list, const unsigned int* queries)
+	{
+		Shader* lastShader = nullptr;
+		Entity lastOwner;
+		uint64 lastMaterial = 0;
+		bool hasMaterial = false;
+		instancedItems.clear();
+
+		for (DrawItem& item : list)
+		{
+			if (faces && faceInstancing && item.mesh->isInstanced())
+			{
+				instancedItems.push_back(item);
+				continue;
+			}
+
+			if (item.shader != lastShader)
+			{
+				item.shader->use();
+				lastShader = item.shader;
+				lastOwner = Entity(); // Uniforms belong to the program
+				hasMaterial = false;
+			}
+			else shaderSkips++;
+
+			if (item.owner != lastOwner)
+			{
+				item.shader->setModel(*item.world);
+				if (faces) item.shader->setInt("faceMask", (int)item.faceMask);
+				lastOwner = item.owner;
+			}
+			else transformSkips++;
+
+			if (!hasMaterial || item.material != lastMaterial)
+			{
+				item.mesh->bindMaterial(item.shader);
+				lastMaterial = item.material;
+				hasMaterial = true;
+			}
+			else materialSkips++;
+
+			unsigned int query = queries ? queries[item.proxy] : 0;
+			if (query) glBeginConditionalRender(query, GL_QUERY_WAIT);
+			item.mesh->drawGeometry(item.shader, faces && faceInstancing ? bitCount(item.faceMask) : 1);
+			if (query) glEndConditionalRender();
+			draws++;
+			drawCalls++;
+		}
+
+		if (!instancedItems.empty()) executeDepth(instancedItems, queries);
+	}
+
+	// Each run of items of one shader: an indirect command per item over the DepthGeometry, its instances as
+	// per-instance attributes, one multi-draw for the run. Layered passes: the face mask goes with every instance,
+	// or with face instancing one instance per face, its bit alone. Occluded items (queries) are drawn one command at
+	// a time, each under its proxy's condition
+	void executeDepth(FrameArray<DrawItem>& list, const unsigned int* queries)
+	{
+		for (size_t first = 0; first < list.size();)
+		{
+			Shader* shader = list[first].shader;
+			size_t last = first;
+			while (last < list.size() && list[last].shader == shader) last++;
+
+			depthInstances.clear();
+			depthCommands.clear();
+			commandItems.clear();
+			for (size_t i = first; i < last; i++)
+			{
+				const DrawItem& item = list[i];
+				int count;
+				const glm::mat4* models = item.mesh->getInstanceModels(*item.world, count);
+				if (count == 0) continue;
+
+				DepthGeometry::Command c;
+				c.count = item.mesh->getDepthRange().indexCount;
+				c.firstIndex = item.mesh->getDepthRange().firstIndex;
+				c.baseVertex = item.mesh->getDepthRange().baseVertex;
+				c.baseInstance = (unsigned int)depthInstances.size();
+
+				unsigned int mask = faces ? item.faceMask : 0;
+				for (int k = 0; k < count; k++)
+				{
+					DepthGeometry::Instance instance;
+					instance.model = models[k];
+					if (faces && faceInstancing)
+					{
+						for (unsigned int bits = mask; bits; bits &= bits - 1)
+						{
+							instance.faceMask = (int)(bits & (~bits + 1));
+							depthInstances.push_back(instance);
+						}
+					}
+					else
+					{
+						instance.faceMask = (int)mask;
+						depthInstances.push_back(instance);
+					}
+				}
+				c.instanceCount = (unsigned int)depthInstances.size() - c.baseInstance;
+				depthCommands.push_back(c);
+				commandItems.push_back((unsigned int)i);
+			}
+			shaderSkips += (unsigned int)(last - first) - 1;
+			first = last;
+			if (depthCommands.empty()) continue;
+
+			shader->use();
+			shader->setBool("batched", true);
+			DepthGeometry::upload(depthInstances.data(), depthInstances.size(), depthCommands.data(), depthCommands.size());
+			if (!queries)
+			{
+				DepthGeometry::draw(0, depthCommands.size());
+				draws++;
+				drawCalls++;
+			}
+			else
+			{
+				for (size_t c = 0; c < depthCommands.size(); c++)
+				{
+					unsigned int query = queries[list[commandItems[c]].proxy];
+					if (query) glBeginConditionalRender(query, GL_QUERY_WAIT);
+					DepthGeometry::draw(c, 1);
+					if (query) glEndConditionalRender();
+					draws++;
+					drawCalls++;
+				}
+			}
+			shader->setBool("batched", false);
+			depthItems += (unsigned int)depthCommands.size();
+		}
+	}
+
+	// clear + submit + sort + execute. faceFrusta: see setFaces()
+	void draw(ArrayView<Entity> entities, Shader* shader, Pass pass, vec3 eye, float maxDistance, const Frustum* frustum = nullptr,
+		const Frustum* faceFrusta = nullptr, int faceFrustaCount = 0)
+	{
+		clear();
+		setFaces(faceFrusta, faceFrustaCount);
+		submit(entities, shader, pass, eye, maxDistance, frustum);
+		sort();
+		execute();
+	}
+
+	const FrameArray<DrawItem>& getItems() const
+	{
+		return items;
+	}
+
+private:
+	FrameArray<DrawItem> items;
+	FrameArray<DrawItem> scratch;		// Radix sort buffer
+	FrameArray<DrawItem> occludedItems;	// Rejected by the Hi-Z, drawn if their proxy passes
+	FrameArray<DrawItem> instancedItems;	// Face instanced passes: instanced meshes, drawn batched (see executeItems)
+	FrameArray<AABB> occludedBoxes;
+	FrameArray<unsigned int> proxyQueries;
+	vector<Entity> candidates;			// Culling result, reused
+
+	const Frustum* faces = nullptr;
+	int faceCount = 0;
+	unsigned int faceRenders = 0;
+	bool faceInstancing = false;
+	bool depthOnly = false;
+	unsigned int drawCalls = 0;
+	FrameArray<DepthGeometry::Instance> depthInstances;
+	FrameArray<DepthGeometry::Command> depthCommands;
+	FrameArray<unsigned int> commandItems; // Item of each command
+
+	static unsigned int draws;
+	static unsigned int shaderSkips;
+	static unsigned int transformSkips;
+	static unsigned int materialSkips;
+	static unsigned int depthItems;
+	static unsigned int submitted[PASS_COUNT];
+	static unsigned int culled[PASS_COUNT];
+
+	// The entity passed the frustum test already (submit() culls the list first), only its meshes are left
+	void submitEntity(Entity e, const MeshRenderer& renderer, const Transform& transform, const Bounds* bounds, Shader* shader, Pass pass,
+		vec3 eye, float maxDistance, const Frustum* frustum)
+	{
+		bool occlusionTest = pass == MAIN && occlusion && occlusion->isReady();
+		bool occluded = false;
+
+		const glm::mat4& model = transform.world;
+		unsigned int faceMask = 0;
+		if (faces)
+		{
+			faceMask = faceCount >= 32 ? ~0u : (1u << faceCount) - 1; // Unbounded: every face
+			if (!bounds || bounds->world.isEmpty()) faceRenders += faceCount;
+		}
+
+		if (bounds && !bounds->world.isEmpty() && (occlusionTest || faces))
+		{
+			const AABB& box = bounds->world;
+			if (faces)
+			{
+				faceMask = 0;
+				for (int f = 0; f < faceCount; f++)
+					if (faces[f].intersects(box)) faceMask |= 1u << f;
+
+				if (faceMask == 0)
+				{
+					culled[pass]++;
+					return;
+				}
+				faceRenders += bitCount(faceMask);
+			}
+
+			if (occlusionTest && occlusion->isOccluded(box))
+			{
+				occluded = true;
+				occludedBoxes.push_back(box);
+			}
+		}
+
+		float distance = glm::length(vec3(model[3]) - eye);
+		unsigned int depth = (unsigned int)(glm::clamp(distance / maxDistance, 0.f, 1.f) * 0xFFFF);
+
+		for (unsigned int i = 0; i < renderer.meshCount; i++)
+		{
+			Mesh* m = renderer.meshes + i;
+			if (frustum && renderer.meshCount > 1)
+			{
+				AABB box = m->isInstanced() ? m->bounds : m->bounds.transformed(model);
+				if (!frustum->intersects(box))
+				{
+					culled[pass]++;
+					continue;
+				}
+			}
+			submitted[pass]++;
+
+			DrawItem item;
+			item.mesh = m;
+			item.owner = e;
+			item.world = &transform.world;
+			item.shader = shader;
+			item.material = depthOnly ? 0 : m->materialHash();
+			item.key = makeKey(pass, shader->ID, item.material, depthOnly ? 0 : m->getVAO(), depth);
+			item.proxy = occluded ? (unsigned int)occludedBoxes.size() - 1 : 0;
+			item.faceMask = faceMask;
+
+			if (occluded) occludedItems.push_back(item);
+			else items.push_back(item);
+		}
+	}
+
+	static unsigned int bitCount(unsigned int mask)
+	{
+		unsigned int count = 0;
+		for (; mask; mask &= mask - 1) count++;
+		return count;
+	}
+
+	static uint64 makeKey(Pass pass, unsigned int shaderID, uint64 material, unsigned int vao, unsigned int depth)
+	{
+		return ((uint64)(pass & 0xF) << 60) |
+			((uint64)(shaderID & 0xFF) << 52) |
+			((material & 0xFFFFF) << 32) |
+			((uint64)(vao & 0xFFFF) << 16) |
+			(uint64)(depth & 0xFFFF);
+	}
+};
+
+// Static variables initialization
+unsigned int RenderQueue::lastFrameDraws = 0;
+unsigned int RenderQueue::lastFrameShaderSkips = 0;
+unsigned int RenderQueue::lastFrameTransformSkips = 0;
+unsigned int RenderQueue::lastFrameMaterialSkips = 0;
+unsigned int RenderQueue::lastFrameDepthItems = 0;
+
+unsigned int RenderQueue::draws = 0;
+unsigned int RenderQueue::shaderSkips = 0;
+unsigned int RenderQueue::transformSkips = 0;
+unsigned int RenderQueue::materialSkips = 0;
+unsigned int RenderQueue::depthItems = 0;
+
+unsigned int RenderQueue::lastFrameSubmitted[RenderQueue::PASS_COUNT] = { 0 };
+unsigned int RenderQueue::lastFrameCulled[RenderQueue::PASS_COUNT] = { 0 };
+unsigned int RenderQueue::submitted[RenderQueue::PASS_COUNT] = { 0 };
+unsigned int RenderQueue::culled[RenderQueue::PASS_COUNT] = { 0 };
+
+Registry* RenderQueue::registry = nullptr;
+const BVH* RenderQueue::spatialIndex = nullptr;
+HiZ* RenderQueue::occlusion = nullptr;
+
+#endif RENDER_QUEUE_H
@@ -6,15 +6,15 @@
 #include "glm/glm.hpp"
 #include "glad/glad.h"
 #include "GBuffer.h"
-#include "Shader.h"
+#include "ShaderRegistry.h"
 
 
 class SSAO
 {
 private:
 	
-	Shader* SSAOShader = new Shader("vsQuad.vert", "fsSSAO.frag");
-	Shader* SSAOBlurShader = new Shader("vsQuad.vert", "fsSSAOBlur.frag");
+	std::shared_ptr<Shader> SSAOShader = ShaderRegistry::get("vsQuad.vert", "fsSSAO.frag");
+	std::shared_ptr<Shader> SSAOBlurShader = ShaderRegistry::get("vsQuad.vert", "fsSSAOBlur.frag");
 
 	std::vector<glm::vec3> ssaoKernel;
 	std::vector<glm::vec3> ssaoNoise;
@@ -179,38 +179,27 @@ public:
 #pragma endregion
 	}
 
-	void drawSSAO(const Camera& camera, const std::vector<DrawableObject*>& sceneObjects)
+	void drawSSAO(const Camera& camera, ArrayView<Entity> sceneObjects)
 	{
 		gBuffer->drawGBuffer(camera, sceneObjects, GBuffer::CoordSpace::VIEW);
 
-		glBindFramebuffer(GL_FRAMEBUFFER, ssaoFBO);
-		//glBindFramebuffer(GL_FRAMEBUFFER, 0);
-		glBindVertexArray(VAO);
-		glDisable(GL_DEPTH_TEST);
+		GLState::bindFramebuffer(ssaoFBO);
+		GLState::bindVertexArray(VAO);
+		GLState::disable(GL_DEPTH_TEST);
 		glClear(GL_COLOR_BUFFER_BIT);
 
-		glActiveTexture(GL_TEXTURE0);
-		glBindTexture(GL_TEXTURE_2D, gBuffer->gPosition);
-		glActiveTexture(GL_TEXTURE1);
-		glBindTexture(GL_TEXTURE_2D, gBuffer->gNormal);
-		glActiveTexture(GL_TEXTURE2);
-		glBindTexture(GL_TEXTURE_2D, noiseTexture);
+		GLState::bindTexture(0, GL_TEXTURE_2D, gBuffer->gPosition);
+		GLState::bindTexture(1, GL_TEXTURE_2D, gBuffer->gNormal);
+		GLState::bindTexture(2, GL_TEXTURE_2D, noiseTexture);
 
 		SSAOShader->use();
 		SSAOShader->setInt("FragPosTex", 0);
 		SSAOShader->setInt("NormalTex", 1);
 		SSAOShader->setInt("NoiseTex", 2);
-		for (int i = 0; i < 64; i++)
-		{
-			std::string sl = "samples[" + std::to_string(i);
-			SSAOShader->setVec3(sl + "]", ssaoKernel[i]);
-		}
+		SSAOShader->setVec3Array("samples", ssaoKernel.data(), (int)ssaoKernel.size());
 		SSAOShader->addCamera(camera);		
 
 		glDrawArrays(GL_TRIANGLES, 0, 6);
-		glEnable(GL_DEPTH_TEST);
-		glBindVertexArray(0);
-		glBindFramebuffer(GL_FRAMEBUFFER, 0);
 
 		drawSSAOBlur();
 
@@ -218,22 +207,17 @@ public:
 
 	void drawSSAOBlur()
 	{
-		glBindFramebuffer(GL_FRAMEBUFFER, ssaoBlurFBO);
-		//glBindFramebuffer(GL_FRAMEBUFFER, 0);
-		glBindVertexArray(VAO);
-		glDisable(GL_DEPTH_TEST);
+		GLState::bindFramebuffer(ssaoBlurFBO);
+		GLState::bindVertexArray(VAO);
+		GLState::disable(GL_DEPTH_TEST);
 		glClear(GL_COLOR_BUFFER_BIT);
 
-		glActiveTexture(GL_TEXTURE0);
-		glBindTexture(GL_TEXTURE_2D, ssaoColorBuffer);
+		GLState::bindTexture(0, GL_TEXTURE_2D, ssaoColorBuffer);
 
 		SSAOBlurShader->use();
 		SSAOBlurShader->setInt("ssaoInput", 0);
 
 		glDrawArrays(GL_TRIANGLES, 0, 6);
-		glEnable(GL_DEPTH_TEST);
-		glBindVertexArray(0);
-		glBindFramebuffer(GL_FRAMEBUFFER, 0);
 
 	}
 };
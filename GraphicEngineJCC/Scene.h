@@ -2,13 +2,23 @@
 #define SCENE_H
 
 #include "LightBase.h"
-#include "DrawableObject.h"
+#include "ECS.h"
+#include "Components.h"
+#include "SceneSystems.h"
+#include "Mesh.h"
+#include "Model.h"
 #include "Texture.h"
 #include "ShadowMap.h"
 #include "Cubemap.h"
+#include "RenderQueue.h"
+#include "LightClusters.h"
+#include "BVH.h"
+#include "SceneFile.h"
+#include "Shape.h"
 //#include "SSAO.h"
 #include "glm/glm.hpp"
 #include <vector>
+#include <map>
 
 static class Scene
 {
@@ -20,67 +30,135 @@ private:
 	~Scene() {}
 
 	//static SSAO* ssao;
+
+	static RenderQueue mainQueue;
+	static BVH spatialIndex; // Over sceneObjects
+	static LightClusters lightClusters; // Point lights of the main pass, binned per froxel
+	static vector<Entity> storageInstanced; // Their mesh is instanced from a TransformSystem
+
+	// Meshes drawn by every entity of a scene file object using them (see loadScene)
+	struct SharedMeshes
+	{
+		Mesh* meshes = nullptr;
+		unsigned int meshCount = 0;
+		AABB bounds;
+	};
+
+	// Entity drawing meshes[0..meshCount), at the origin
+	static Entity createRenderable(Mesh* meshes, unsigned int meshCount, const AABB& bounds, bool worldSpaceBounds)
+	{
+		Entity e = registry.create();
+		registry.add<Transform>(e);
+
+		MeshRenderer renderer;
+		renderer.meshes = meshes;
+		renderer.meshCount = meshCount;
+		registry.add(e, renderer);
+
+		Bounds b;
+		b.local = bounds;
+		b.worldSpace = worldSpaceBounds;
+		registry.add(e, b);
+
+		sceneObjects.push_back(e);
+		spatialIndex.markDirty();
+		GLState::invalidate(); // Mesh setup binds GL objects directly
+		return e;
+	}
+
+	// Entity placing the light at index of its array
+	static Entity createLightEntity(Light::Type type, unsigned int index, vec3 position, vec3 direction)
+	{
+		Entity e = registry.create();
+		registry.add<Transform>(e);
+
+		Light l;
+		l.type = type;
+		l.index = index;
+		l.position = position;
+		l.direction = direction;
+		registry.add(e, l);
+		return e;
+	}
+
 public:
+	// Entities and their components (Transform, Bounds, MeshRenderer, Light). The create functions below add them,
+	// SceneSystems update them once per frame
+	static Registry registry;
+
 	// Scene lights
 	static vector<DirectionalLight> directionalLights;
 	static vector<PointLight> pointLights;
 	static vector<SpotLight> spotLights;
 
-	// Scene objects
-	static vector<DrawableObject*> sceneObjects;
+	// Scene objects: entities with a MeshRenderer
+	static vector<Entity> sceneObjects;
 	static vector<Cubemap*> skyboxes;
 
 	//static bool ssaoEnabled;
 
-	static Mesh* createMesh(vector<float> vertices, vector<unsigned int> indices, vector<Texture> textures, vec3 color = vec3(1.f), int instances = 1, glm::mat4 models[] = {})
+	static Entity createMesh(vector<float> vertices, vector<unsigned int> indices, vector<Texture> textures, vec3 color = vec3(1.f), int instances = 1, glm::mat4 models[] = {})
 	{
-		int nInstances = glm::max(instances, 1);
-		if (instances == 1)
-		{
-			Mesh* m = new Mesh(vertices, indices, textures, color);
-			Scene::sceneObjects.push_back(m);
-			return m;
-		}
-		else
-		{
-			Mesh* m = new Mesh(vertices, indices, textures, color, instances, models);
-			Scene::sceneObjects.push_back(m);
-			return m;
-		}
+		Mesh* m = instances > 1 ? new Mesh(vertices, indices, textures, color, instances, models) : new Mesh(vertices, indices, textures, color);
+		return createRenderable(m, 1, m->bounds, m->isInstanced());
 	}
 
-	static Model* createModel(const char* path, int instances = 1, glm::mat4 models[] = {})
+	// One instance per transform of the system. Edit the transforms any time, the instances follow the next frame
+	static Entity createMesh(vector<float> vertices, vector<unsigned int> indices, vector<Texture> textures, TransformSystem* transforms, vec3 color = vec3(1.f))
 	{
-		int nInstances = glm::max(instances, 1);
-		if (instances == 1)
-		{
-			Model* m = new Model(path);
-			Scene::sceneObjects.push_back(m);
-			return m;
-		}
-		else
-		{
-			Model* m = new Model(path, instances, models);
-			Scene::sceneObjects.push_back(m);
-			return m;
-		}
+		Mesh* m = new Mesh(vertices, indices, textures, color, transforms);
+		Entity e = createRenderable(m, 1, m->bounds, true);
+		storageInstanced.push_back(e);
+		return e;
 	}
 
-	static Cubemap* createSkybox(std::string path, std::string format = ".png")
+	static Entity createModel(const char* path, int instances = 1, glm::mat4 models[] = {})
 	{
-		Cubemap* c = new Cubemap(path, format);
+		Model* m = instances > 1 ? new Model(path, instances, models) : new Model(path);
+		return createRenderable(m->getMeshes(), m->getMeshCount(), m->bounds, instances > 1);
+	}
+
+	// Local transformation of an entity, edit it directly
+	static Transformation& transform(Entity e)
+	{
+		return registry.get<Transform>(e).local;
+	}
+
+	// See SceneSystems::setParent
+	static bool setParent(Entity child, Entity parent)
+	{
+		return SceneSystems::setParent(registry, child, parent);
+	}
+
+	// progressive: baked across frames by bakeSkyboxes (see Cubemap::bake)
+	static Cubemap* createSkybox(std::string path, std::string format = ".png", bool progressive = false)
+	{
+		Cubemap* c = new Cubemap(path, format, progressive);
 		skyboxes.push_back(c);
+		GLState::invalidate(); // The bake leaves its own program, framebuffer and textures bound
 
 		return c;
 	}
 
+	// Call once per frame: the first skybox still baking gets Cubemap::bakeBudgetMs of GPU time
+	static void bakeSkyboxes()
+	{
+		for (Cubemap* c : skyboxes)
+		{
+			if (c->getStage() == Cubemap::DONE) continue;
+			c->bake(Cubemap::bakeBudgetMs);
+			return;
+		}
+	}
+
 	// Lights ********************************************************************************************************************
+	// Each light also gets an entity with a Transform and a Light component: parent it to move the light with an object
 	// DirectionalLight
 	static DirectionalLight createDirectionalLight(vec3 direction = vec3(0.f, -1.f, 0.f), vec3 color = vec3(1.f), vec3 cameraPos = vec3(0.f))
 	{
 		DirectionalLight dLight(direction, color, cameraPos);
-		ShadowMap::configureShadowMap(dLight.shadowMap); 
 		Scene::directionalLights.push_back(dLight);
+		createLightEntity(Light::DIRECTIONAL_LIGHT, (unsigned int)directionalLights.size() - 1, cameraPos, direction);
 
 		return dLight;
 	}
@@ -90,64 +168,254 @@ public:
 		float cutOff = 45.f, float distance = -1.f, vec3 color = vec3(1.f))
 	{
 		SpotLight sLight(position, direction, cutOff, distance, color);
-		ShadowMap::configureShadowMap(sLight.shadowMap); 
 		Scene::spotLights.push_back(sLight);
+		createLightEntity(Light::SPOT_LIGHT, (unsigned int)spotLights.size() - 1, position, direction);
 
 		return sLight;
 	}
 
-	// PointLight
-	static PointLight createPointLight(vec3 position = vec3(0.f, 0.f, 0.f), float distance = -1.f, vec3 color = vec3(1.f))
+	// PointLight. Any number of them is shaded (clustered). Shadowed ones share the ShadowAtlas with the spot lights,
+	// pass castShadows false for the lights that don't need a shadow
+	static PointLight createPointLight(vec3 position = vec3(0.f, 0.f, 0.f), float distance = -1.f, vec3 color = vec3(1.f), bool castShadows = true)
 	{
 		PointLight pLight(position, distance, color);
-		ShadowMap::configureShadowCubeMap(pLight.shadowMap); 
+		pLight.castShadows = castShadows;
 		Scene::pointLights.push_back(pLight);
+		createLightEntity(Light::POINT_LIGHT, (unsigned int)pointLights.size() - 1, position, vec3(0.f, -1.f, 0.f));
 
 		return pLight;
 	}
 
+	// Scene files ********************************************************************************************************************
+	// Creates everything a .jscene file describes (see SceneFile.h). Shapes are generated, textures loaded, and models
+	// imported once per table entry; the GPU mesh of each (mesh, material) pair the objects use is built once, before
+	// any object, and every object using it only gets an entity drawing it. Call before the shaders that size their
+	// light arrays are built
+	static bool loadScene(const char* path)
+	{
+		SceneFile file;
+		if (!file.open(path)) return false;
+
+		ArrayView<SceneFile::Mesh> meshes = file.meshes();
+		ArrayView<SceneFile::Material> materials = file.materials();
+		ArrayView<SceneFile::Object> objects = file.objects();
+
+		vector<vector<float>> vertices(meshes.size());
+		vector<vector<unsigned int>> indices(meshes.size());
+		for (size_t i = 0; i < meshes.size(); i++)
+		{
+			const SceneFile::Mesh& m = meshes[i];
+			if (m.shape == SceneFile::SPHERE) Shape::generateSphere(m.size[0], m.segments[0], m.segments[1], vertices[i], indices[i]);
+			else if (m.shape == SceneFile::CUBE) Shape::generateCube(m.size[0], m.size[1], m.size[2], vertices[i], indices[i]);
+			else if (m.shape == SceneFile::PLANE) Shape::generatePlane(m.size[0], m.size[1], vertices[i], indices[i]);
+		}
+
+		const char* slotTypes[SceneFile::TEXTURE_SLOTS] = { "texture_base", "texture_metallic", "texture_normal", "texture_roughness" };
+		vector<vector<Texture>> textures(materials.size());
+		for (size_t i = 0; i < materials.size(); i++)
+		{
+			for (int slot = 0; slot < SceneFile::TEXTURE_SLOTS; slot++)
+			{
+				if (materials[i].textures[slot] != SceneFile::NONE) textures[i].push_back(Texture(file.string(materials[i].textures[slot]), slotTypes[slot]));
+			}
+		}
+
+		// Shared meshes, by (mesh, material). Models bring their own materials, theirs is always NONE
+		std::map<std::pair<uint32_t, uint32_t>, SharedMeshes> shared;
+		vector<Texture> noTextures;
+		for (size_t i = 0; i < objects.size(); i++)
+		{
+			const SceneFile::Object& o = objects[i];
+			if (o.mesh >= meshes.size() || (o.material != SceneFile::NONE && o.material >= materials.size()) || (o.parent != SceneFile::NONE && o.parent >= i))
+			{
+				std::cout << "ERROR::SCENE::" << path << ": object " << i << " references a missing mesh, material or parent" << std::endl;
+				return false;
+			}
+
+			const SceneFile::Mesh& m = meshes[o.mesh];
+			uint32_t material = m.shape == SceneFile::MODEL ? SceneFile::NONE : o.material;
+			std::pair<uint32_t, uint32_t> key(o.mesh, material);
+			if (shared.count(key)) continue;
+
+			SharedMeshes& s = shared[key];
+			if (m.shape == SceneFile::MODEL)
+			{
+				Model* model = new Model(file.string(m.path));
+				s.meshes = model->getMeshes();
+				s.meshCount = model->getMeshCount();
+				s.bounds = model->bounds;
+			}
+			else
+			{
+				const float* c = o.material == SceneFile::NONE ? nullptr : materials[o.material].color;
+				s.meshes = new Mesh(vertices[o.mesh], indices[o.mesh], c ? textures[o.material] : noTextures, c ? vec3(c[0], c[1], c[2]) : vec3(1.f));
+				s.meshCount = 1;
+				s.bounds = s.meshes->bounds;
+			}
+		}
+
+		vector<Entity> created(objects.size());
+		for (size_t i = 0; i < objects.size(); i++)
+		{
+			const SceneFile::Object& o = objects[i];
+			uint32_t material = meshes[o.mesh].shape == SceneFile::MODEL ? SceneFile::NONE : o.material;
+			const SharedMeshes& s = shared[std::pair<uint32_t, uint32_t>(o.mesh, material)];
+			created[i] = createRenderable(s.meshes, s.meshCount, s.bounds, false);
+
+			Transformation& t = transform(created[i]);
+			t.translation = vec3(o.translation[0], o.translation[1], o.translation[2]);
+			t.rotation = vec3(o.rotation[0], o.rotation[1], o.rotation[2]);
+			t.scale = vec3(o.scale[0], o.scale[1], o.scale[2]);
+			if (o.parent != SceneFile::NONE) setParent(created[i], created[o.parent]);
+		}
+
+		for (const SceneFile::Light& l : file.lights())
+		{
+			vec3 position(l.position[0], l.position[1], l.position[2]);
+			vec3 direction(l.direction[0], l.direction[1], l.direction[2]);
+			vec3 color(l.color[0], l.color[1], l.color[2]);
+
+			if (l.type == SceneFile::DIRECTIONAL_LIGHT)
+			{
+				createDirectionalLight(glm::normalize(direction), color);
+				directionalLights.back().castShadows = l.castShadows != 0;
+			}
+			else if (l.type == SceneFile::SPOT_LIGHT)
+			{
+				createSpotLight(position, glm::normalize(direction), l.cutOff, l.distance, color);
+				spotLights.back().castShadows = l.castShadows != 0;
+			}
+			else if (l.type == SceneFile::POINT_LIGHT)
+			{
+				createPointLight(position, l.distance, color, l.castShadows != 0);
+			}
+		}
+
+		for (const SceneFile::Skybox& s : file.skyboxes()) createSkybox(file.string(s.path), file.string(s.format));
+
+		return true;
+	}
+
+	// Transforms ********************************************************************************************************************
+	// Call once per frame before the passes: the transform, bounds and light systems. World matrices are rebuilt only
+	// where a local transformation changed, then every pass reads the cached ones
+	static void updateTransforms()
+	{
+		RenderQueue::registry = &registry;
+
+		// Batch compose, before the bounds system reads the new boxes
+		for (Entity e : storageInstanced)
+		{
+			MeshRenderer& renderer = registry.get<MeshRenderer>(e);
+			if (!renderer.meshes->refreshInstances()) continue;
+
+			Bounds& b = registry.get<Bounds>(e);
+			b.local = renderer.meshes->bounds;
+			b.transformVersion = ~0u;
+		}
+
+		SceneSystems::updateTransforms(registry);
+		SceneSystems::updateBounds(registry);
+		SceneSystems::updateLights(registry, directionalLights, spotLights, pointLights);
+	}
+
+	// Spatial index ********************************************************************************************************************
+	// Call once per frame after updateTransforms(): refits the entities that moved, rebuilds after entities were added
+	static void updateSpatialIndex()
+	{
+		spatialIndex.update(sceneObjects, registry.pool<Bounds>());
+		RenderQueue::spatialIndex = &spatialIndex;
+	}
+
+	// Closest entity whose bounds the ray hits, null if none
+	static Entity pick(vec3 origin, vec3 direction, float& distance)
+	{
+		if (spatialIndex.isDirty())
+		{
+			updateTransforms();
+			updateSpatialIndex();
+		}
+		return spatialIndex.pick(origin, direction, distance);
+	}
+
+	static const BVH& getSpatialIndex()
+	{
+		return spatialIndex;
+	}
+
+	static const LightClusters& getLightClusters()
+	{
+		return lightClusters;
+	}
+
 	// Shadows ********************************************************************************************************************
-	static void generateShadows(vector<DrawableObject*> sObj = sceneObjects, 
-		DirectionalLight dl = directionalLights[0], vector<PointLight> pl = pointLights, vector<SpotLight> sl = spotLights)
+	// Passing sceneObjects itself (default) lets the passes cull through the spatial index
+	// The directional light cascades are fitted to camera, the atlas tiles of the other lights sized for it
+	static void generateShadows(const Camera& camera, ArrayView<Entity> sObj = sceneObjects, 
+		DirectionalLight& dl = directionalLights[0], vector<PointLight>& pl = pointLights, vector<SpotLight>& sl = spotLights)
 	{
-		ShadowMap::generateShadowMap(dl.shadowMap, sObj, dl.lightCamera, false);
+		// Cascades of the directional lights that cast shadows (shadowMap 0 otherwise), the atlas for the others
+		ShadowMap::updateResources(directionalLights, sl, pl);
+		ShadowAtlas::allocate(camera, sl, pl);
+		ShadowScheduler::plan(camera, dl.shadowMap != 0 ? &dl : nullptr, sl, pl);
+
+		// Each light only renders the casters inside its own volume (see ShadowMap::printStats), the scheduler says
+		// which lights (and cube faces) update this frame
+		if (dl.shadowMap != 0)
+		{
+			ShadowScheduler::beginUpdate(dl, "Directional", 0);
+			ShadowMap::generateShadowMap(dl, camera, sObj);
+			ShadowScheduler::endUpdate();
+		}
 
-		for (int i = 0; i < Scene::spotLights.size(); i++)
+		for (int i = 0; i < sl.size(); i++)
 		{
-			ShadowMap::generateShadowMap(sl[i].shadowMap, sObj, sl[i].lightCamera, true);
+			if (ShadowScheduler::getFaces(sl[i]) == 0) continue;
+			ShadowScheduler::beginUpdate(sl[i], "Spot", i);
+			ShadowMap::generateShadowMap(sl[i], sObj);
+			ShadowScheduler::endUpdate();
 		}
 
-		for (int i = 0; i < Scene::pointLights.size(); i++)
+		for (int i = 0; i < pl.size(); i++)
 		{
-			ShadowMap::generateShadowCubeMap(pl[i].shadowMap, sObj, pl[i].lightCamera);
+			unsigned int faces = ShadowScheduler::getFaces(pl[i]);
+			if (faces == 0) continue;
+			ShadowScheduler::beginUpdate(pl[i], "Point", i);
+			ShadowMap::generateShadowCubeMap(pl[i], sObj, faces);
+			ShadowScheduler::endUpdate();
 		}
+
+		ShadowMoments::generateMipmaps();
 	}
 
 	// Scene ********************************************************************************************************************
 	static void drawScene(unsigned int frameBuffer, Shader& sh, const Camera& camera, Cubemap* skybox, 
-		vector<DrawableObject*> obj = sceneObjects, DirectionalLight dLight = directionalLights[0], vector<SpotLight> sLight = spotLights, 
-		vector<PointLight> pLight = pointLights)
+		ArrayView<Entity> obj = sceneObjects, const DirectionalLight& dLight = directionalLights[0], ArrayView<SpotLight> sLight = spotLights, 
+		ArrayView<PointLight> pLight = pointLights)
 	{
 		//if (ssaoEnabled) ssao->drawSSAO(camera, obj);
 
 		sh.use();
 
 		sh.addDirectionalLight(dLight);
+		sh.addShadowAtlas(ShadowAtlas::getTexture());
+		sh.addShadowMoments(ShadowMoments::getTexture(dLight.shadowMap), ShadowMoments::getTexture(ShadowAtlas::getTexture()),
+			ShadowMoments::exponents, ShadowMoments::lightBleedReduction);
 		sh.addSpotLight(sLight);
-		sh.addPointLight(pLight);
+		lightClusters.build(camera.getViewMatrix(), camera.getProjectionMatrix(true), camera.getNearPlane(), camera.getFarPlane(), pLight);
+		lightClusters.bind(sh);
 		sh.addCubemapLight(skybox->cubemapEnvID, skybox->cubemapPrefilterID, skybox->brdfLutID);
 
 		sh.addCamera(camera);
 
 		//if (ssaoEnabled) sh.setSSAOTexture(ssao->ssaoColorBufferBlur);
 		
-		glBindFramebuffer(GL_FRAMEBUFFER, frameBuffer); // Draw in this frame buffer
+		GLState::bindFramebuffer(frameBuffer); // Draw in this frame buffer
+		GLState::enable(GL_DEPTH_TEST);
 
-		for (int i = 0; i < obj.size(); i++)
-		{
-			sh.setTransform(obj[i]->transformation);
-			obj[i]->Draw(&sh);
-		}
+		// Sorted by material and front to back
+		Frustum frustum = Frustum::fromMatrix(camera.getProjectionMatrix(true) * camera.getViewMatrix());
+		mainQueue.draw(obj, &sh, RenderQueue::MAIN, camera.getPosition(), camera.getFarPlane(), &frustum);
 
 		drawSkybox(camera, skybox); // Skybox
 	}
@@ -171,9 +439,15 @@ std::vector<DirectionalLight> Scene::directionalLights;
 std::vector<PointLight> Scene::pointLights;
 std::vector<SpotLight> Scene::spotLights;
 
-std::vector<DrawableObject*> Scene::sceneObjects;
+Registry Scene::registry;
+std::vector<Entity> Scene::sceneObjects;
 std::vector<Cubemap*> Scene::skyboxes;
 
+RenderQueue Scene::mainQueue;
+BVH Scene::spatialIndex;
+LightClusters Scene::lightClusters;
+std::vector<Entity> Scene::storageInstanced;
+
 //bool Scene::ssaoEnabled = false;
 //SSAO* Scene::ssao = NULL;
 
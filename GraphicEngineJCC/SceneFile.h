@@ -0,0 +1,467 @@
+#ifndef SCENE_FILE_H
+#define SCENE_FILE_H
+
+#include "ArrayView.h"
+#include <cstdint>
+#include <cstring>
+#include <cstdio>
+#include <string>
+#include <vector>
+#include <map>
+#include <fstream>
+#include <sstream>
+#include <iostream>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#undef near // minwindef.h, ShadowMap and the cameras use these names
+#undef far
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+// Binary scene description (.jscene): a header, tables of fixed size records and a string table. The file is
+// mapped and the tables are read in place, there is no per-record parsing. Little endian, every field 4 bytes.
+// The text form (.jscene.txt) is for authoring, Writer::fromText() converts it:
+//
+//   # comment
+//   mesh <name> sphere <radius> <rows> <columns>
+//   mesh <name> cube <x> <y> <z>
+//   mesh <name> plane <x> <y>
+//   mesh <name> model <path>
+//   material <name> <r> <g> <b> [base=<path>] [metallic=<path>] [normal=<path>] [roughness=<path>]
+//   object <mesh> <material or -> <tx> <ty> <tz> [<rx> <ry> <rz> [<sx> <sy> <sz> [<parent object index>]]]
+//   light directional <dx> <dy> <dz> <r> <g> <b> [noshadow]
+//   light spot <px> <py> <pz> <dx> <dy> <dz> <cutOff> <distance> <r> <g> <b> [noshadow]
+//   light point <px> <py> <pz> <distance> <r> <g> <b> [noshadow]
+//   skybox <path> [format]
+class SceneFile
+{
+public:
+	static const uint32_t VERSION = 1;
+	static const uint32_t NONE = 0xFFFFFFFFu; // No string / no material / no parent
+
+	enum MeshShape : uint32_t { SPHERE, CUBE, PLANE, MODEL };
+	enum LightType : uint32_t { DIRECTIONAL_LIGHT, SPOT_LIGHT, POINT_LIGHT };
+	enum TextureSlot { BASE, METALLIC, NORMAL, ROUGHNESS, TEXTURE_SLOTS };
+
+	struct Header
+	{
+		char magic[4];	// "JSCN"
+		uint32_t version;
+		uint32_t fileSize;
+		uint32_t objectCount, objectOffset;
+		uint32_t meshCount, meshOffset;
+		uint32_t materialCount, materialOffset;
+		uint32_t lightCount, lightOffset;
+		uint32_t skyboxCount, skyboxOffset;
+		uint32_t stringsSize, stringsOffset;
+	};
+
+	struct Mesh
+	{
+		uint32_t shape;
+		float size[3];			// Sphere: radius. Cube: x, y, z. Plane: x, y
+		uint32_t segments[2];	// Sphere rows and columns
+		uint32_t path;			// Model file
+	};
+
+	struct Material
+	{
+		float color[3];
+		uint32_t textures[TEXTURE_SLOTS];
+	};
+
+	struct Object
+	{
+		float translation[3];
+		float rotation[3];	// Euler, degrees
+		float scale[3];
+		uint32_t mesh;
+		uint32_t material;	// Ignored for models, they bring their own
+		uint32_t parent;	// Index of an earlier object
+	};
+
+	struct Light
+	{
+		uint32_t type;
+		float position[3];
+		float direction[3];
+		float color[3];
+		float cutOff;
+		float distance;
+		uint32_t castShadows;
+	};
+
+	struct Skybox
+	{
+		uint32_t path;
+		uint32_t format;
+	};
+
+	SceneFile() {}
+	SceneFile(const SceneFile&) = delete;
+	SceneFile& operator=(const SceneFile&) = delete;
+
+	~SceneFile()
+	{
+		close();
+	}
+
+	// Maps the file and checks the header and that every table lies inside it. Cost doesn't depend on the scene size
+	bool open(const char* path)
+	{
+		close();
+		if (!map(path))
+		{
+			std::cout << "ERROR::SCENE_FILE::Can't map " << path << std::endl;
+			return false;
+		}
+
+		if (!validate())
+		{
+			std::cout << "ERROR::SCENE_FILE::" << path << " isn't a version " << VERSION << " scene file or is truncated" << std::endl;
+			close();
+			return false;
+		}
+		return true;
+	}
+
+	void close()
+	{
+		if (data == nullptr) return;
+#ifdef _WIN32
+		UnmapViewOfFile(data);
+		CloseHandle(mapping);
+		CloseHandle(file);
+#else
+		munmap((void*)data, size);
+#endif
+		data = nullptr;
+		size = 0;
+	}
+
+	const Header& header() const { return *(const Header*)data; }
+
+	ArrayView<Object> objects() const { return table<Object>(header().objectOffset, header().objectCount); }
+	ArrayView<Mesh> meshes() const { return table<Mesh>(header().meshOffset, header().meshCount); }
+	ArrayView<Material> materials() const { return table<Material>(header().materialOffset, header().materialCount); }
+	ArrayView<Light> lights() const { return table<Light>(header().lightOffset, header().lightCount); }
+	ArrayView<Skybox> skyboxes() const { return table<Skybox>(header().skyboxOffset, header().skyboxCount); }
+
+	// NONE and out of range offsets give an empty string
+	const char* string(uint32_t offset) const
+	{
+		if (offset >= header().stringsSize) return "";
+		return data + header().stringsOffset + offset;
+	}
+
+	// Builds the tables in memory, from code or from the text form, and writes the binary file
+	class Writer
+	{
+	public:
+		std::vector<Object> objects;
+		std::vector<Mesh> meshes;
+		std::vector<Material> materials;
+		std::vector<Light> lights;
+		std::vector<Skybox> skyboxes;
+
+		// Offset in the string table, equal strings are stored once
+		uint32_t addString(const std::string& s)
+		{
+			std::map<std::string, uint32_t>::iterator it = stringOffsets.find(s);
+			if (it != stringOffsets.end()) return it->second;
+
+			uint32_t offset = (uint32_t)strings.size();
+			strings.insert(strings.end(), s.begin(), s.end());
+			strings.push_back('\0');
+			stringOffsets[s] = offset;
+			return offset;
+		}
+
+		bool write(const char* path) const
+		{
+			Header h = {};
+			std::memcpy(h.magic, "JSCN", 4);
+			h.version = VERSION;
+
+			uint32_t offset = sizeof(Header);
+			h.objectOffset = offset; h.objectCount = (uint32_t)objects.size(); offset += h.objectCount * sizeof(Object);
+			h.meshOffset = offset; h.meshCount = (uint32_t)meshes.size(); offset += h.meshCount * sizeof(Mesh);
+			h.materialOffset = offset; h.materialCount = (uint32_t)materials.size(); offset += h.materialCount * sizeof(Material);
+			h.lightOffset = offset; h.lightCount = (uint32_t)lights.size(); offset += h.lightCount * sizeof(Light);
+			h.skyboxOffset = offset; h.skyboxCount = (uint32_t)skyboxes.size(); offset += h.skyboxCount * sizeof(Skybox);
+			h.stringsOffset = offset; h.stringsSize = (uint32_t)strings.size(); offset += h.stringsSize;
+			h.fileSize = offset;
+
+			std::ofstream out(path, std::ios::binary | std::ios::trunc);
+			if (!out)
+			{
+				std::cout << "ERROR::SCENE_FILE::Can't write " << path << std::endl;
+				return false;
+			}
+			out.write((const char*)&h, sizeof(h));
+			writeTable(out, objects);
+			writeTable(out, meshes);
+			writeTable(out, materials);
+			writeTable(out, lights);
+			writeTable(out, skyboxes);
+			writeTable(out, strings);
+			return (bool)out;
+		}
+
+		// Parses the text form. Mesh and material names are resolved here, the binary file only has indexes
+		bool fromText(std::istream& in, const char* name = "scene")
+		{
+			std::map<std::string, uint32_t> meshIndex, materialIndex;
+			std::string line, keyword;
+			int lineNumber = 0;
+
+			while (std::getline(in, line))
+			{
+				lineNumber++;
+				std::istringstream ls(line);
+				if (!(ls >> keyword) || keyword[0] == '#') continue;
+
+				bool ok = true;
+				if (keyword == "mesh")
+				{
+					std::string meshName, shape;
+					Mesh m = {};
+					m.path = NONE;
+					ok = (bool)(ls >> meshName >> shape);
+					if (shape == "sphere") { m.shape = SPHERE; ok = ok && (ls >> m.size[0] >> m.segments[0] >> m.segments[1]); }
+					else if (shape == "cube") { m.shape = CUBE; ok = ok && (ls >> m.size[0] >> m.size[1] >> m.size[2]); }
+					else if (shape == "plane") { m.shape = PLANE; ok = ok && (ls >> m.size[0] >> m.size[1]); }
+					else if (shape == "model")
+					{
+						std::string path;
+						m.shape = MODEL;
+						ok = ok && (ls >> path);
+						if (ok) m.path = addString(path);
+					}
+					else ok = false;
+
+					if (ok)
+					{
+						meshIndex[meshName] = (uint32_t)meshes.size();
+						meshes.push_back(m);
+					}
+				}
+				else if (keyword == "material")
+				{
+					std::string materialName, option;
+					Material m;
+					for (int i = 0; i < TEXTURE_SLOTS; i++) m.textures[i] = NONE;
+					ok = (bool)(ls >> materialName >> m.color[0] >> m.color[1] >> m.color[2]);
+					while (ok && ls >> option)
+					{
+						size_t eq = option.find('=');
+						int slot = eq == std::string::npos ? -1 : slotIndex(option.substr(0, eq));
+						if (slot < 0) ok = false;
+						else m.textures[slot] = addString(option.substr(eq + 1));
+					}
+
+					if (ok)
+					{
+						materialIndex[materialName] = (uint32_t)materials.size();
+						materials.push_back(m);
+					}
+				}
+				else if (keyword == "object")
+				{
+					std::string meshName, materialName;
+					Object o = { { 0.f, 0.f, 0.f }, { 0.f, 0.f, 0.f }, { 1.f, 1.f, 1.f }, NONE, NONE, NONE };
+					ok = (bool)(ls >> meshName >> materialName >> o.translation[0] >> o.translation[1] >> o.translation[2]);
+					if (ok && ls >> o.rotation[0] >> o.rotation[1] >> o.rotation[2])
+					{
+						if (ls >> o.scale[0] >> o.scale[1] >> o.scale[2])
+						{
+							int parent;
+							if (ls >> parent)
+							{
+								ok = parent >= 0 && parent < (int)objects.size();
+								o.parent = (uint32_t)parent;
+							}
+						}
+					}
+
+					std::map<std::string, uint32_t>::iterator mesh = meshIndex.find(meshName);
+					std::map<std::string, uint32_t>::iterator material = materialIndex.find(materialName);
+					if (mesh == meshIndex.end() || (materialName != "-" && material == materialIndex.end())) ok = false;
+
+					if (ok)
+					{
+						o.mesh = mesh->second;
+						o.material = materialName == "-" ? NONE : material->second;
+						objects.push_back(o);
+					}
+				}
+				else if (keyword == "light")
+				{
+					std::string type, option;
+					Light l = {};
+					l.castShadows = 1;
+					ok = (bool)(ls >> type);
+					if (type == "directional")
+					{
+						l.type = DIRECTIONAL_LIGHT;
+						ok = ok && (ls >> l.direction[0] >> l.direction[1] >> l.direction[2] >> l.color[0] >> l.color[1] >> l.color[2]);
+					}
+					else if (type == "spot")
+					{
+						l.type = SPOT_LIGHT;
+						ok = ok && (ls >> l.position[0] >> l.position[1] >> l.position[2] >> l.direction[0] >> l.direction[1] >> l.direction[2]
+							>> l.cutOff >> l.distance >> l.color[0] >> l.color[1] >> l.color[2]);
+					}
+					else if (type == "point")
+					{
+						l.type = POINT_LIGHT;
+						ok = ok && (ls >> l.position[0] >> l.position[1] >> l.position[2] >> l.distance >> l.color[0] >> l.color[1] >> l.color[2]);
+					}
+					else ok = false;
+
+					if (ok && ls >> option)
+					{
+						if (option == "noshadow") l.castShadows = 0;
+						else ok = false;
+					}
+					if (ok) lights.push_back(l);
+				}
+				else if (keyword == "skybox")
+				{
+					std::string path, format = ".png";
+					ok = (bool)(ls >> path);
+					ls >> format;
+					if (ok)
+					{
+						Skybox s = { addString(path), addString(format) };
+						skyboxes.push_back(s);
+					}
+				}
+				else ok = false;
+
+				if (!ok)
+				{
+					std::cout << "ERROR::SCENE_FILE::" << name << ":" << lineNumber << ": can't parse \"" << line << "\"" << std::endl;
+					return false;
+				}
+			}
+			return true;
+		}
+
+		bool fromText(const char* path)
+		{
+			std::ifstream in(path);
+			if (!in)
+			{
+				std::cout << "ERROR::SCENE_FILE::Can't read " << path << std::endl;
+				return false;
+			}
+			return fromText(in, path);
+		}
+
+	private:
+		std::vector<char> strings;
+		std::map<std::string, uint32_t> stringOffsets;
+
+		template<class T> static void writeTable(std::ofstream& out, const std::vector<T>& table)
+		{
+			if (!table.empty()) out.write((const char*)table.data(), table.size() * sizeof(T));
+		}
+
+		static int slotIndex(const std::string& slot)
+		{
+			if (slot == "base") return BASE;
+			if (slot == "metallic") return METALLIC;
+			if (slot == "normal") return NORMAL;
+			if (slot == "roughness") return ROUGHNESS;
+			return -1;
+		}
+	};
+
+	// Text form to binary file
+	static bool convert(const char* textPath, const char* binaryPath)
+	{
+		Writer writer;
+		if (!writer.fromText(textPath) || !writer.write(binaryPath)) return false;
+
+		std::cout << "SCENE_FILE::" << textPath << " -> " << binaryPath << ": " << writer.objects.size() << " objects, " << writer.meshes.size() << " meshes, "
+			<< writer.materials.size() << " materials, " << writer.lights.size() << " lights, " << writer.skyboxes.size() << " skyboxes" << std::endl;
+		return true;
+	}
+
+private:
+	const char* data = nullptr;
+	size_t size = 0;
+#ifdef _WIN32
+	HANDLE file = INVALID_HANDLE_VALUE;
+	HANDLE mapping = nullptr;
+#endif
+
+	bool map(const char* path)
+	{
+#ifdef _WIN32
+		file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+		if (file == INVALID_HANDLE_VALUE) return false;
+
+		LARGE_INTEGER fileSize;
+		if (!GetFileSizeEx(file, &fileSize) || fileSize.QuadPart == 0 || (mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr)) == nullptr)
+		{
+			CloseHandle(file);
+			return false;
+		}
+
+		data = (const char*)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+		if (data == nullptr)
+		{
+			CloseHandle(mapping);
+			CloseHandle(file);
+			return false;
+		}
+		size = (size_t)fileSize.QuadPart;
+#else
+		int fd = ::open(path, O_RDONLY);
+		if (fd < 0) return false;
+
+		struct stat st;
+		void* p = MAP_FAILED;
+		if (fstat(fd, &st) == 0 && st.st_size > 0) p = mmap(nullptr, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		::close(fd); // The mapping keeps the file
+		if (p == MAP_FAILED) return false;
+
+		data = (const char*)p;
+		size = (size_t)st.st_size;
+#endif
+		return true;
+	}
+
+	bool validate() const
+	{
+		if (size < sizeof(Header)) return false;
+		const Header& h = header();
+		if (std::memcmp(h.magic, "JSCN", 4) != 0 || h.version != VERSION || h.fileSize != size) return false;
+
+		return tableFits(h.objectOffset, h.objectCount, sizeof(Object)) && tableFits(h.meshOffset, h.meshCount, sizeof(Mesh))
+			&& tableFits(h.materialOffset, h.materialCount, sizeof(Material)) && tableFits(h.lightOffset, h.lightCount, sizeof(Light))
+			&& tableFits(h.skyboxOffset, h.skyboxCount, sizeof(Skybox)) && tableFits(h.stringsOffset, h.stringsSize, 1)
+			&& (h.stringsSize == 0 || data[h.stringsOffset + h.stringsSize - 1] == '\0'); // string() can't run past the end
+	}
+
+	bool tableFits(uint32_t offset, uint32_t count, size_t recordSize) const
+	{
+		return offset % 4 == 0 && offset <= size && (uint64_t)count * recordSize <= size - offset;
+	}
+
+	template<class T> ArrayView<T> table(uint32_t offset, uint32_t count) const
+	{
+		return ArrayView<T>((const T*)(data + offset), count);
+	}
+};
+
+#endif SCENE_FILE_H
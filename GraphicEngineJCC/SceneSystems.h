@@ -0,0 +1,223 @@
+#ifndef SCENE_SYSTEMS_H
+#define SCENE_SYSTEMS_H
+
+#include "glm/glm.hpp"
+#include "ECS.h"
+#include "Components.h"
+#include "LightBase.h"
+#include "BVH.h"
+#include "Frustum.h"
+#include "ArrayView.h"
+#include <vector>
+#include <iostream>
+
+// Systems over the scene components, run once per frame in this order: transforms, bounds, lights. Each one walks
+// the dense array of its component, and only rebuilds what changed since the last frame.
+class SceneSystems
+{
+	template<class T> using vector = std::vector<T>;
+	using vec3 = glm::vec3;
+
+private:
+	SceneSystems() {}
+	~SceneSystems() {}
+
+	static unsigned int localRebuilds;
+	static unsigned int worldRebuilds;
+
+public:
+	// Frames begun (beginFrame), stamped on what changes
+	static unsigned int frame;
+
+	// Matrices rebuilt during the last complete frame
+	static unsigned int lastFrameLocalRebuilds;
+	static unsigned int lastFrameWorldRebuilds;
+
+	// Transforms ********************************************************************************************************************
+	// Keeps the child's local transformation, so it moves with its new parent. A null parent makes it a root.
+	// Refused (false) if parent is the child or one of its descendants
+	static bool setParent(Registry& registry, Entity child, Entity parent)
+	{
+		ComponentPool<Transform>& transforms = registry.pool<Transform>();
+		if (!transforms.has(child) || (!parent.isNull() && !transforms.has(parent))) return false;
+
+		for (Entity a = parent; !a.isNull() && transforms.has(a); a = transforms.get(a).parent)
+		{
+			if (a == child)
+			{
+				std::cout << "ERROR::SCENE_SYSTEMS::Parenting entity " << child.index() << " would make a cycle" << std::endl;
+				return false;
+			}
+		}
+
+		Transform& t = transforms.get(child);
+		t.parent = parent;
+		t.dirty = true;
+		return true;
+	}
+
+	// World matrices of the transforms whose local transformation or parent changed, in one pass parents first.
+	// When a reparenting broke that order, depths are recomputed and the pool sorted by them first
+	static void updateTransforms(Registry& registry)
+	{
+		ComponentPool<Transform>& transforms = registry.pool<Transform>();
+		if (updateInOrder(transforms)) return;
+
+		Transform* t = transforms.data();
+		for (size_t i = 0; i < transforms.size(); i++)
+		{
+			t[i].depth = 0;
+			for (Entity a = t[i].parent; !a.isNull() && transforms.has(a); a = transforms.get(a).parent) t[i].depth++;
+		}
+		transforms.sort([](const Transform& a, const Transform& b) { return a.depth < b.depth; });
+		updateInOrder(transforms);
+	}
+
+	// Bounds ********************************************************************************************************************
+	// World boxes of the bounds whose transform changed. Set transformVersion to ~0u after editing local
+	static void updateBounds(Registry& registry)
+	{
+		ComponentPool<Bounds>& bounds = registry.pool<Bounds>();
+		ComponentPool<Transform>& transforms = registry.pool<Transform>();
+
+		const vector<Entity>& entities = bounds.getEntities();
+		Bounds* b = bounds.data();
+		for (size_t i = 0; i < bounds.size(); i++)
+		{
+			const Transform* t = transforms.tryGet(entities[i]);
+			unsigned int version = t ? t->version : 0;
+			if (b[i].transformVersion == version) continue;
+
+			b[i].world = (b[i].worldSpace || !t || b[i].local.isEmpty()) ? b[i].local : b[i].local.transformed(t->world);
+			b[i].transformVersion = version;
+			b[i].version++;
+			b[i].changedFrame = frame;
+		}
+	}
+
+	// Lights ********************************************************************************************************************
+	// Moves the lights whose entity moved
+	static void updateLights(Registry& registry, vector<DirectionalLight>& directional, vector<SpotLight>& spot, vector<PointLight>& point)
+	{
+		ComponentPool<Light>& lights = registry.pool<Light>();
+		ComponentPool<Transform>& transforms = registry.pool<Transform>();
+
+		const vector<Entity>& entities = lights.getEntities();
+		Light* l = lights.data();
+		for (size_t i = 0; i < lights.size(); i++)
+		{
+			const Transform* t = transforms.tryGet(entities[i]);
+			if (!t || l[i].transformVersion == t->version) continue;
+			l[i].transformVersion = t->version;
+
+			vec3 position = vec3(t->world * glm::vec4(l[i].position, 1.f));
+			vec3 direction = glm::normalize(glm::mat3(t->world) * l[i].direction);
+
+			if (l[i].type == Light::DIRECTIONAL_LIGHT && l[i].index < directional.size()) directional[l[i].index].setDirection(direction);
+			else if (l[i].type == Light::SPOT_LIGHT && l[i].index < spot.size())
+			{
+				spot[l[i].index].setPosition(position);
+				spot[l[i].index].setDirection(direction);
+			}
+			else if (l[i].type == Light::POINT_LIGHT && l[i].index < point.size()) point[l[i].index].setPosition(position);
+		}
+	}
+
+	// Culling ********************************************************************************************************************
+	// Candidates whose world bounds intersect the frustum, entities without bounds always pass. Through the spatial
+	// index when it indexes the candidate list
+	static void cull(Registry& registry, ArrayView<Entity> candidates, const Frustum& frustum, vector<Entity>& out, const BVH* index = nullptr)
+	{
+		if (index && index->indexes(candidates))
+		{
+			index->queryFrustum(frustum, out);
+			return;
+		}
+
+		ComponentPool<Bounds>& bounds = registry.pool<Bounds>();
+		for (Entity e : candidates)
+		{
+			const Bounds* b = bounds.tryGet(e);
+			if (!b || b->world.isEmpty() || frustum.intersects(b->world)) out.push_back(e);
+		}
+	}
+
+	static void cullSphere(Registry& registry, ArrayView<Entity> candidates, vec3 center, float radius, vector<Entity>& out, const BVH* index = nullptr)
+	{
+		if (index && index->indexes(candidates))
+		{
+			index->querySphere(center, radius, out);
+			return;
+		}
+
+		ComponentPool<Bounds>& bounds = registry.pool<Bounds>();
+		for (Entity e : candidates)
+		{
+			const Bounds* b = bounds.tryGet(e);
+			if (!b || b->world.isEmpty() || b->world.intersectsSphere(center, radius)) out.push_back(e);
+		}
+	}
+
+	// Stats ********************************************************************************************************************
+	// Call at the start of each frame
+	static void beginFrame()
+	{
+		frame++;
+		lastFrameLocalRebuilds = localRebuilds;
+		lastFrameWorldRebuilds = worldRebuilds;
+		localRebuilds = worldRebuilds = 0;
+	}
+
+	static void printStats()
+	{
+		std::cout << "SCENE_SYSTEMS::" << lastFrameLocalRebuilds << " local / " << lastFrameWorldRebuilds << " world matrices rebuilt" << std::endl;
+	}
+
+private:
+	// False, with the transforms before it updated, at the first one whose parent comes after it
+	static bool updateInOrder(ComponentPool<Transform>& transforms)
+	{
+		Transform* t = transforms.data();
+		for (size_t i = 0; i < transforms.size(); i++)
+		{
+			const Transform* parent = nullptr;
+			if (!t[i].parent.isNull())
+			{
+				parent = transforms.tryGet(t[i].parent);
+				if (parent == nullptr)
+				{
+					t[i].parent = Entity(); // Destroyed, now a root
+					t[i].dirty = true;
+				}
+				else if (parent > t + i) return false;
+			}
+
+			bool localChanged = t[i].dirty || t[i].local != t[i].cachedLocal;
+			if (localChanged)
+			{
+				t[i].cachedLocal = t[i].local;
+				t[i].localMatrix = t[i].local.getMatrix();
+				localRebuilds++;
+			}
+
+			if (localChanged || (parent && parent->version != t[i].parentVersion))
+			{
+				t[i].world = parent ? parent->world * t[i].localMatrix : t[i].localMatrix;
+				if (parent) t[i].parentVersion = parent->version;
+				t[i].version++;
+				worldRebuilds++;
+			}
+			t[i].dirty = false;
+		}
+		return true;
+	}
+};
+
+// Static variables initialization
+unsigned int SceneSystems::frame = 0;
+unsigned int SceneSystems::lastFrameLocalRebuilds = 0;
+unsigned int SceneSystems::lastFrameWorldRebuilds = 0;
+unsigned int SceneSystems::localRebuilds = 0;
+unsigned int SceneSystems::worldRebuilds = 0;
+
+#endif SCENE_SYSTEMS_H
@@ -4,11 +4,14 @@
 #include "glad/glad.h"
 #include "glm/glm.hpp"
 #include "glm/gtc/matrix_transform.hpp"
+#include "glm/gtc/matrix_inverse.hpp"
 #include <glm/gtc/type_ptr.hpp>
 #include "LightBase.h"
 #include "Camera.h"
 #include "Texture.h"
 #include "Transformation.h"
+#include "GLState.h"
+#include "ArrayView.h"
 #include <vector>
 #include <map>
 
@@ -16,17 +19,20 @@
 #include <fstream>
 #include <sstream>
 #include <iostream>
+#include <cstdio>
 
 class Shader
 {
     using string = std::string;
     using ifstream = std::ifstream;
+    using vec2 = glm::vec2;
     using vec3 = glm::vec3;
+    using vec4 = glm::vec4;
     using mat4 = glm::mat4;
 private:
     int materialTextureUnit = 0;    // 0 - 6 textures: diff/base, specular/metalic, gloss/roughness, height, normal, ao...
     int cubemapTextureUnit = 15;     // 7 - 9 textures: 7 = irradiance map, 8 = pre-filter cubemap, 9 = BRDF LUT
-    int shadowMapTextureUnit = 18;  // 10 - 32 textures: / 10 direct / 11 - 20 spot / 21 - 32 point /
+    int shadowMapTextureUnit = 18;  // 18 = directional light cascades, 19 = shadow atlas (spot and point lights), 20 - 21 = their EVSM moments
 
     string shaderFolder = "Shaders/";
 
@@ -56,15 +62,9 @@ private:
     }
 
     // Shader with the possibility to change the #define
-    void createModifiedShader(const char* path, std::map<string, const char*> defineMod, GLenum shaderType)
+    void createModifiedShader(const char* path, GLenum shaderType)
     {
-        string code = readFile(path);
-
-        std::map<string, const char*>::iterator itr;
-        for (itr = defineMod.begin(); itr != defineMod.end(); itr++)
-        {
-            setDefine(code, itr->first, itr->second);
-        }
+        string code = readStageSource(path);
 
         unsigned int shader = createShader(code, shaderType);
         attachShader(shader);
@@ -73,7 +73,18 @@ private:
 
 public:
     // Program ID
-    unsigned int ID;
+    unsigned int ID = 0;
+
+    // Stage files and #define values this program was built from. Kept so the program can be rebuilt (hot reload)
+    string vertexFile, fragmentFile, geometryFile;
+    string computeFile; // Compute programs have this stage only
+    std::map<string, string> defines;
+
+    // Every shader built from files, used by the ShaderManager to find which programs a modified file belongs to
+    static std::vector<Shader*> loadedShaders;
+
+    // False once the GL context is gone, programs aren't deleted after that (see ShaderRegistry::shutdown)
+    static bool glContextAlive;
 
     // Empty shader. Manually create shader, compile attach to a program, etc
     Shader()
@@ -81,7 +92,35 @@ public:
 
     }
 
-    ~Shader() {}
+    // A copy would delete the program twice. Share programs through ShaderRegistry
+    Shader(const Shader&) = delete;
+    Shader& operator=(const Shader&) = delete;
+
+    ~Shader() 
+    {
+        for (int i = 0; i < loadedShaders.size(); i++)
+        {
+            if (loadedShaders[i] == this)
+            {
+                loadedShaders.erase(loadedShaders.begin() + i);
+                break;
+            }
+        }
+
+        if (ID != 0 && glContextAlive) glDeleteProgram(ID);
+    }
+
+    // Compute program from one file
+    explicit Shader(const char* computePath)
+    {
+        computeFile = computePath;
+
+        ID = glCreateProgram();
+        createModifiedShader(computePath, GL_COMPUTE_SHADER);
+        compileProgram();
+
+        loadedShaders.push_back(this);
+    }
 
     // Shader program with the possibility to change the #define values
     Shader(const char* vertexPath, const char* fragmentPath, const char* geometryPath, std::map<string, const char*> defineMod)
@@ -89,20 +128,51 @@ public:
         // If a static shader initializes before main(), load GL functions now
         //OpenGLWrapper::loadGLFunctions();
 
+        vertexFile = vertexPath;
+        fragmentFile = fragmentPath;
+        geometryFile = geometryPath;
+
+        std::map<string, const char*>::iterator itr;
+        for (itr = defineMod.begin(); itr != defineMod.end(); itr++)
+        {
+            defines[itr->first] = itr->second;
+        }
+
         // Shader Program
         ID = glCreateProgram();
 
         // Vertex
-        if (vertexPath != "") createModifiedShader(vertexPath, defineMod, GL_VERTEX_SHADER);
+        if (!vertexFile.empty()) createModifiedShader(vertexPath, GL_VERTEX_SHADER);
 
         // Fragment
-        if (fragmentPath != "") createModifiedShader(fragmentPath, defineMod, GL_FRAGMENT_SHADER);
+        if (!fragmentFile.empty()) createModifiedShader(fragmentPath, GL_FRAGMENT_SHADER);
 
         // Geometry
-        if (geometryPath != "") createModifiedShader(geometryPath, defineMod, GL_GEOMETRY_SHADER);
+        if (!geometryFile.empty()) createModifiedShader(geometryPath, GL_GEOMETRY_SHADER);
 
         compileProgram();
-        
+
+        loadedShaders.push_back(this);
+    }
+
+    // Read a stage file and apply this shader's #define values
+    string readStageSource(const char* path)
+    {
+        string code = readFile(path);
+
+        std::map<string, string>::iterator itr;
+        for (itr = defines.begin(); itr != defines.end(); itr++)
+        {
+            setDefine(code, itr->first, itr->second.c_str());
+        }
+
+        return code;
+    }
+
+    // True if the given file (relative to the shader folder) is one of this program stages
+    bool usesFile(const string& file) const
+    {
+        return file == vertexFile || file == fragmentFile || file == geometryFile || file == computeFile;
     }
 
     string readFile(const char* filePath)
@@ -165,10 +235,16 @@ public:
         {
         case GL_VERTEX_SHADER:
             checkCompileErrors(shader, "VERTEX");
+            break;
         case GL_FRAGMENT_SHADER:
             checkCompileErrors(shader, "FRAGMENT");
+            break;
         case GL_GEOMETRY_SHADER:
             checkCompileErrors(shader, "GEOMETRY");
+            break;
+        case GL_COMPUTE_SHADER:
+            checkCompileErrors(shader, "COMPUTE");
+            break;
         default:
             break;
         }
@@ -198,8 +274,11 @@ public:
         // If a static shader initializes before main(), load GL functions now
         //OpenGLWrapper::loadGLFunctions();
 
-        bool useGeometry = false;
-        if (geometryPath != "") useGeometry = true;
+        vertexFile = vertexPath;
+        fragmentFile = fragmentPath;
+        geometryFile = geometryPath;
+
+        bool useGeometry = !geometryFile.empty();
 
         // Source code in a string
         string vertexCode;
@@ -291,33 +370,36 @@ public:
         glDeleteShader(vertex);
         glDeleteShader(fragment);
         if (useGeometry) glDeleteShader(geometry);
+
+        loadedShaders.push_back(this);
     }
 
     // Activate shader
     void use()
     {
-        glUseProgram(ID);
+        GLState::useProgram(ID);
     }
 
     void addCubemapLight(unsigned int irradianceMap, unsigned int prefilterMap, unsigned int brdfLut)
     {
-        glActiveTexture(GL_TEXTURE0 + cubemapTextureUnit);
-        glBindTexture(GL_TEXTURE_CUBE_MAP, irradianceMap);
+        GLState::bindTexture(cubemapTextureUnit, GL_TEXTURE_CUBE_MAP, irradianceMap);
         setInt("irradianceMap", cubemapTextureUnit);
 
-        glActiveTexture(GL_TEXTURE0 + cubemapTextureUnit + 1);
-        glBindTexture(GL_TEXTURE_CUBE_MAP, prefilterMap);
+        GLState::bindTexture(cubemapTextureUnit + 1, GL_TEXTURE_CUBE_MAP, prefilterMap);
         setInt("prefilterMap", cubemapTextureUnit + 1);
 
-        glActiveTexture(GL_TEXTURE0 + cubemapTextureUnit + 2);
-        glBindTexture(GL_TEXTURE_2D, brdfLut);
+        GLState::bindTexture(cubemapTextureUnit + 2, GL_TEXTURE_2D, brdfLut);
         setInt("brdfLUT", cubemapTextureUnit + 2);
+    }
 
-        glActiveTexture(GL_TEXTURE0);
-
+    // "array[index]field" written in buffer
+    static const char* arrayUniform(char (&buffer)[64], const char* array, int index, const char* field = "")
+    {
+        snprintf(buffer, sizeof(buffer), "%s[%d]%s", array, index, field);
+        return buffer;
     }
 
-    void addDirectionalLight(DirectionalLight dirLight)
+    void addDirectionalLight(const DirectionalLight& dirLight)
     {
         setVec3("dirlight.color", dirLight.color);
         setVec3("dirlight.direction", dirLight.getDirection());
@@ -326,86 +408,102 @@ public:
         setFloat("dirlight.diffuse", dirLight.diffuse);
         setFloat("dirlight.specular", dirLight.specular);
 
-        // Directional light shadow map
-        glActiveTexture(GL_TEXTURE0 + shadowMapTextureUnit);
-        glBindTexture(GL_TEXTURE_2D, dirLight.shadowMap);
+        // Directional light shadow cascades
+        GLState::bindTexture(shadowMapTextureUnit, GL_TEXTURE_2D_ARRAY, dirLight.shadowMap);
         setInt("dShadowMap", shadowMapTextureUnit);
-        glActiveTexture(GL_TEXTURE0);
 
-        mat4 lightProjection = dirLight.lightCamera->getProjectionMatrix(dirLight.perspective);
-        mat4 lightView = dirLight.lightCamera->getViewMatrix();
-        mat4 lightSpaceMatrix = lightProjection * lightView;
+        setMat4("dlightSpaceMatrix", (float*)glm::value_ptr(dirLight.cascadeMatrices[0]), DirectionalLight::CASCADES);
+        // No cascades (castShadows off): every fragment past the last split, unshadowed
+        static const float noSplits[DirectionalLight::CASCADES] = {};
+        setFloatArray("cascadeSplits", dirLight.shadowMap != 0 ? dirLight.cascadeSplits : noSplits, DirectionalLight::CASCADES);
+        setInt("dShadowFilter", (int)dirLight.shadowFilter);
+    }
+
+    // Spot and point light shadows, see ShadowAtlas
+    void addShadowAtlas(unsigned int atlas)
+    {
+        GLState::bindTexture(shadowMapTextureUnit + 1, GL_TEXTURE_2D, atlas);
+        setInt("shadowAtlas", shadowMapTextureUnit + 1);
+    }
+
+    // EVSM moments of the cascades and of the atlas (see ShadowMoments), their warp exponents and light bleeding cut
+    void addShadowMoments(unsigned int cascades, unsigned int atlas, vec2 exponents, float lightBleedReduction)
+    {
+        GLState::bindTexture(shadowMapTextureUnit + 2, GL_TEXTURE_2D_ARRAY, cascades);
+        setInt("dShadowMoments", shadowMapTextureUnit + 2);
+
+        GLState::bindTexture(shadowMapTextureUnit + 3, GL_TEXTURE_2D_ARRAY, atlas);
+        setInt("shadowMomentsAtlas", shadowMapTextureUnit + 3);
 
-        setMat4("dlightSpaceMatrix", glm::value_ptr(lightSpaceMatrix));
+        setVec2("shadowExponents", exponents);
+        setFloat("shadowLightBleed", lightBleedReduction);
     }
 
-    void addSpotLight(std::vector<SpotLight> sLight)
+    void addSpotLight(ArrayView<SpotLight> sLight)
     {
-        int spShadowMapTexUnit = shadowMapTextureUnit + 1;
+        char name[64];
 
         for (int i = 0; i < sLight.size(); i++) 
         {
-            string sl = "spotLight[" + std::to_string(i);
-            
-            setVec3(sl + "].color", sLight[i].color);
-            setVec3(sl + "].pos", sLight[i].getPosition());
-            setVec3(sl + "].direction", sLight[i].getDirection());
-            setFloat(sl + "].cutOff", glm::cos(glm::radians(sLight[i].getCutOff())));
-            setFloat(sl + "].oCutOff", glm::cos(glm::radians(sLight[i].getOuterCutOff())));
+            setVec3(arrayUniform(name, "spotLight", i, ".color"), sLight[i].color);
+            setVec3(arrayUniform(name, "spotLight", i, ".pos"), sLight[i].getPosition());
+            setVec3(arrayUniform(name, "spotLight", i, ".direction"), sLight[i].getDirection());
+            setFloat(arrayUniform(name, "spotLight", i, ".cutOff"), glm::cos(glm::radians(sLight[i].getCutOff())));
+            setFloat(arrayUniform(name, "spotLight", i, ".oCutOff"), glm::cos(glm::radians(sLight[i].getOuterCutOff())));
             //setFloat(sl + "].cutOff", glm::cos(glm::radians(12.5f)));
 
-            setFloat(sl + "].ambient", sLight[i].ambient);
-            setFloat(sl + "].diffuse", sLight[i].diffuse);
-            setFloat(sl + "].specular", sLight[i].specular);
+            setFloat(arrayUniform(name, "spotLight", i, ".ambient"), sLight[i].ambient);
+            setFloat(arrayUniform(name, "spotLight", i, ".diffuse"), sLight[i].diffuse);
+            setFloat(arrayUniform(name, "spotLight", i, ".specular"), sLight[i].specular);
 
-            setFloat(sl + "].constant", sLight[i].constant);
-            setFloat(sl + "].linear", sLight[i].linear);
-            setFloat(sl + "].quadratic", sLight[i].quadratic);
+            setFloat(arrayUniform(name, "spotLight", i, ".constant"), sLight[i].constant);
+            setFloat(arrayUniform(name, "spotLight", i, ".linear"), sLight[i].linear);
+            setFloat(arrayUniform(name, "spotLight", i, ".quadratic"), sLight[i].quadratic);
 
-            string sm = "sShadowMap[" + std::to_string(i);
+            // Atlas tile: uv of its corner, texels per side (0: no shadow)
+            setVec3(arrayUniform(name, "sShadowTile", i), vec3(sLight[i].shadowTiles[0], (float)sLight[i].shadowResolution));
 
-            glActiveTexture(GL_TEXTURE0 + spShadowMapTexUnit + i);
-            glBindTexture(GL_TEXTURE_2D, sLight[i].shadowMap);
-            setInt(sm + "]", spShadowMapTexUnit + i);
-            glActiveTexture(GL_TEXTURE0);
+            // Filter, far plane for the linear depth of the EVSM moments (0: orthographic, depth is linear already)
+            float far = sLight[i].perspective ? sLight[i].lightCamera->getFarPlane() : 0.f;
+            setVec2(arrayUniform(name, "sShadowFilter", i), vec2((float)sLight[i].shadowFilter, far));
 
             mat4 lightProjection = sLight[i].lightCamera->getProjectionMatrix(sLight[i].perspective);
             mat4 lightView = sLight[i].lightCamera->getViewMatrix();
             mat4 lightSpaceMatrix = lightProjection * lightView;
 
-            string slsm = "slightSpaceMatrix[" + std::to_string(i);
-            setMat4(slsm + "]", glm::value_ptr(lightSpaceMatrix));
+            setMat4(arrayUniform(name, "slightSpaceMatrix", i), glm::value_ptr(lightSpaceMatrix));
         }
         
     }
 
-    void addPointLight(std::vector<PointLight> pLight)
+    void addPointLight(ArrayView<PointLight> pLight)
     {
-        int spShadowMapTexUnit = shadowMapTextureUnit + 11;
+        char name[64];
 
         for (int i = 0; i < pLight.size(); i++)
         {
-            string sl = "pointLight[" + std::to_string(i);
-
-            setVec3(sl + "].color", pLight[i].color);
-            setVec3(sl + "].pos", pLight[i].getPosition());
+            setVec3(arrayUniform(name, "pointLight", i, ".color"), pLight[i].color);
+            setVec3(arrayUniform(name, "pointLight", i, ".pos"), pLight[i].getPosition());
 
-            setFloat(sl + "].ambient", pLight[i].ambient);
-            setFloat(sl + "].diffuse", pLight[i].diffuse);
-            setFloat(sl + "].specular", pLight[i].specular);
+            setFloat(arrayUniform(name, "pointLight", i, ".ambient"), pLight[i].ambient);
+            setFloat(arrayUniform(name, "pointLight", i, ".diffuse"), pLight[i].diffuse);
+            setFloat(arrayUniform(name, "pointLight", i, ".specular"), pLight[i].specular);
 
-            setFloat(sl + "].constant", pLight[i].constant);
-            setFloat(sl + "].linear", pLight[i].linear);
-            setFloat(sl + "].quadratic", pLight[i].quadratic);
+            setFloat(arrayUniform(name, "pointLight", i, ".constant"), pLight[i].constant);
+            setFloat(arrayUniform(name, "pointLight", i, ".linear"), pLight[i].linear);
+            setFloat(arrayUniform(name, "pointLight", i, ".quadratic"), pLight[i].quadratic);
 
-            setFloat(sl + "].farPlane", pLight[i].lightCamera->getFarPlane());
+            setFloat(arrayUniform(name, "pointLight", i, ".farPlane"), pLight[i].lightCamera->getFarPlane());
 
-            string sm = "pShadowMap[" + std::to_string(i);
-
-            glActiveTexture(GL_TEXTURE0 + spShadowMapTexUnit + i);
-            glBindTexture(GL_TEXTURE_CUBE_MAP, pLight[i].shadowMap);
-            setInt(sm + "]", spShadowMapTexUnit + i);
-            glActiveTexture(GL_TEXTURE0);
+            // Atlas tiles of the cube faces, two per vec4
+            setFloat(arrayUniform(name, "pointLight", i, ".shadowSize"), (float)pLight[i].shadowResolution);
+            setInt(arrayUniform(name, "pointLight", i, ".shadowFilter"), (int)pLight[i].shadowFilter);
+            for (int f = 0; f < 3; f++)
+            {
+                char field[32];
+                snprintf(field, sizeof(field), ".shadowFaces[%d]", f);
+                setVec4(arrayUniform(name, "pointLight", i, field), vec4(pLight[i].shadowTiles[2 * f], pLight[i].shadowTiles[2 * f + 1]));
+            }
         }
 
     }
@@ -421,7 +519,7 @@ public:
 
     }
 
-    void setTextures(std::vector<Texture> tex)
+    void setTextures(const std::vector<Texture>& tex)
     {
         unsigned int diffuseNr = 1;
         unsigned int baseNr = 1;
@@ -438,32 +536,34 @@ public:
 
         for (unsigned int i = 0; i < tex.size(); i++)
         {
-            glActiveTexture(GL_TEXTURE0 + materialTextureUnit + i);
-            glBindTexture(GL_TEXTURE_2D, tex[i].id);
+            GLState::bindTexture(materialTextureUnit + i, GL_TEXTURE_2D, tex[i].id);
 
             // retrieve texture number (the N in diffuse_textureN)
-            string number;
-            string name = tex[i].type;
+            unsigned int number = 0;
+            const string& name = tex[i].type;
             if (name == "texture_diffuse")
-                number = std::to_string(diffuseNr++);
+                number = diffuseNr++;
             else if (name == "texture_base")
-                number = std::to_string(baseNr++);
+                number = baseNr++;
             else if (name == "texture_specular")
-                number = std::to_string(specularNr++);
+                number = specularNr++;
             else if (name == "texture_metallic")
-                number = std::to_string(metallicNr++);
+                number = metallicNr++;
             else if (name == "texture_normal")
-                number = std::to_string(normalNr++);
+                number = normalNr++;
             else if (name == "texture_depth")
-                number = std::to_string(depthNr++);
+                number = depthNr++;
             else if (name == "texture_roughness")
-                number = std::to_string(roughnessNr++);
+                number = roughnessNr++;
             else if (name == "texture_ao")
-                number = std::to_string(aoNr++);
+                number = aoNr++;
             else if (name == "texture_opacity")
-                number = std::to_string(opacityNr++);
+                number = opacityNr++;
 
-            setInt(("material." + name + number).c_str(), i);
+            char uniform[64];
+            if (number > 0) snprintf(uniform, sizeof(uniform), "material.%s%u", name.c_str(), number);
+            else snprintf(uniform, sizeof(uniform), "material.%s", name.c_str());
+            setInt(uniform, i);
 
         }
         if (diffuseNr == 1) setBool("material.hasDiffuse", false);
@@ -484,9 +584,6 @@ public:
         else setBool("material.hasAO", true);
         if (opacityNr == 1) setBool("material.hasOpacity", false);
         else setBool("material.hasOpacity", true);
-
-        glActiveTexture(GL_TEXTURE0);
-
     }
 
     /*void setSSAOTexture(unsigned int ssaoTex)
@@ -510,49 +607,88 @@ public:
         model = glm::rotate(model, glm::radians(rotation.z), vec3(0.f, 0.f, 1.f));
         model = glm::scale(model, scale);
         
-
-        setMat4("model", glm::value_ptr(model));
+        setModel(model);
     }
 
     void setTransform(Transformation t)
     {
-        glm::mat4 model = glm::mat4(1.f);
-
-        model = glm::translate(model, t.translation);
-        model = glm::rotate(model, glm::radians(t.rotation.x), vec3(1.f, 0.f, 0.f));
-        model = glm::rotate(model, glm::radians(t.rotation.y), vec3(0.f, 1.f, 0.f));
-        model = glm::rotate(model, glm::radians(t.rotation.z), vec3(0.f, 0.f, 1.f));
-        model = glm::scale(model, t.scale);
+        setModel(t.getMatrix());
+    }
 
+    // Model matrix plus its normal matrix, so the vertex shader doesn't invert a matrix per vertex.
+    // Programs without a normalMatrix uniform (depth only passes) skip the inverse
+    void setModel(const mat4& model)
+    {
+        setMat4("model", (float*)glm::value_ptr(model));
 
-        setMat4("model", glm::value_ptr(model));
+        int normalLoc = glGetUniformLocation(ID, "normalMatrix");
+        if (normalLoc != -1)
+        {
+            glm::mat3 normalMatrix = glm::inverseTranspose(glm::mat3(model));
+            glUniformMatrix3fv(normalLoc, 1, GL_FALSE, glm::value_ptr(normalMatrix));
+        }
     }
 
-    // Utility uniform functions
-    void setBool(const string& name, bool value) const
+    // Utility uniform functions. Names are plain C strings: building them never allocates
+    void setBool(const char* name, bool value) const
+    {
+        glUniform1i(glGetUniformLocation(ID, name), (int)value);
+    }
+    // ------------------------------------------------------------------------
+    void setInt(const char* name, int value) const
+    {
+        glUniform1i(glGetUniformLocation(ID, name), value);
+    }
+    // ------------------------------------------------------------------------
+    void setFloat(const char* name, float value) const
+    {
+        glUniform1f(glGetUniformLocation(ID, name), value);
+    }
+    // ------------------------------------------------------------------------
+    void setFloatArray(const char* name, const float* values, int count) const
     {
-        glUniform1i(glGetUniformLocation(ID, name.c_str()), (int)value);
+        glUniform1fv(glGetUniformLocation(ID, name), count, values);
     }
     // ------------------------------------------------------------------------
-    void setInt(const string& name, int value) const
+    void setVec2(const char* name, vec2 vector2) const
     {
-        glUniform1i(glGetUniformLocation(ID, name.c_str()), value);
+        glUniform2f(glGetUniformLocation(ID, name), vector2.x, vector2.y);
     }
     // ------------------------------------------------------------------------
-    void setFloat(const string& name, float value) const
+    void setIvec2(const char* name, glm::ivec2 vector2) const
     {
-        glUniform1f(glGetUniformLocation(ID, name.c_str()), value);
+        glUniform2i(glGetUniformLocation(ID, name), vector2.x, vector2.y);
     }
     // ------------------------------------------------------------------------
-    void setVec3(const string& name, vec3 vector3) const
+    void setVec3(const char* name, vec3 vector3) const
     {
-        glUniform3f(glGetUniformLocation(ID, name.c_str()), vector3.x, vector3.y, vector3.z);
+        glUniform3f(glGetUniformLocation(ID, name), vector3.x, vector3.y, vector3.z);
     }
     // ------------------------------------------------------------------------
-    void setMat4(const string& name, float* colMajorMatrix, int size = 1) const
+    void setVec4(const char* name, vec4 vector4) const
     {
-        glUniformMatrix4fv(glGetUniformLocation(ID, name.c_str()), size, GL_FALSE, colMajorMatrix);
+        glUniform4f(glGetUniformLocation(ID, name), vector4.x, vector4.y, vector4.z, vector4.w);
+    }
+    // ------------------------------------------------------------------------
+    void setVec3Array(const char* name, const vec3* values, int count) const
+    {
+        glUniform3fv(glGetUniformLocation(ID, name), count, glm::value_ptr(values[0]));
+    }
+    // ------------------------------------------------------------------------
+    void setMat3(const char* name, float* colMajorMatrix, int size = 1) const
+    {
+        glUniformMatrix3fv(glGetUniformLocation(ID, name), size, GL_FALSE, colMajorMatrix);
+    }
+    // ------------------------------------------------------------------------
+    void setMat4(const char* name, float* colMajorMatrix, int size = 1) const
+    {
+        glUniformMatrix4fv(glGetUniformLocation(ID, name), size, GL_FALSE, colMajorMatrix);
     }
 
 };
+
+// Static variables initialization
+std::vector<Shader*> Shader::loadedShaders;
+bool Shader::glContextAlive = true;
+
 #endif
\ No newline at end of file
@@ -0,0 +1,573 @@
+#ifndef SHADER_MANAGER_H
+#define SHADER_MANAGER_H
+
+#include "glad/glad.h"
+#include "GLFW/glfw3.h"
+#include "Shader.h"
+#include <vector>
+#include <set>
+#include <string>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <chrono>
+#include <filesystem>
+#include <iostream>
+#include <algorithm>
+#include <cstring>
+
+#ifdef __linux__
+#include <sys/inotify.h>
+#include <poll.h>
+#include <unistd.h>
+#endif
+
+// GL_KHR_parallel_shader_compile (same value in the ARB version). Not in the core glad header
+#ifndef GL_COMPLETION_STATUS_KHR
+#define GL_COMPLETION_STATUS_KHR 0x91B1
+#endif
+typedef void (APIENTRYP PFNGLMAXSHADERCOMPILERTHREADSKHRPROC)(GLuint count);
+
+// Watches the shader folder and rebuilds the programs whose files change, without blocking the frame.
+// The old program stays in use until the new one links; if compiling or linking fails the old one is kept.
+// With GL_KHR/ARB_parallel_shader_compile the driver compiles in its threads and update() polls the status.
+// Without it, a hidden window whose context shares the main one compiles and links on its own thread, and hands
+// back the program with a fence: update() only swaps it in once the fence is signaled.
+class ShaderManager
+{
+	using string = std::string;
+	using clock = std::chrono::steady_clock;
+
+private:
+	// A program being rebuilt in the background
+	struct PendingProgram
+	{
+		Shader* shader;
+		unsigned int program;
+		std::vector<unsigned int> stages;
+		bool linking = false;
+		clock::time_point start;
+	};
+
+	static std::vector<PendingProgram> pending;
+
+	// Worker context: sources read on the main thread, the program built on the worker
+	struct WorkerJob
+	{
+		Shader* shader;
+		unsigned int serial;	// Of the reload, a newer save of the same shader makes the older ones stale
+		string name;
+		string sources[4];		// Vertex, fragment, geometry, compute. Empty: no stage
+		clock::time_point start;
+	};
+
+	struct WorkerResult
+	{
+		Shader* shader;
+		unsigned int serial;
+		string name;
+		unsigned int program;	// 0: compiling or linking failed, see log
+		GLsync fence;			// Signaled once the program is complete for the main context
+		string log;
+		clock::time_point start;
+	};
+
+	struct Reload
+	{
+		Shader* shader;
+		unsigned int serial;
+	};
+
+	static GLFWwindow* workerWindow;	// Hidden, shares the main context. nullptr: the driver compiles in parallel
+	static std::thread compiler;
+	static std::mutex workerMutex;
+	static std::condition_variable workerWake;
+	static std::vector<WorkerJob> workerJobs;		// Queued by update(), taken by the worker
+	static std::vector<WorkerResult> workerResults;	// Built by the worker, taken by update()
+	static std::vector<WorkerResult> fenced;		// Main thread: waiting for their fence
+	static std::vector<Reload> reloads;				// Main thread: latest reload of each shader on the worker
+	static unsigned int nextSerial;
+
+	static std::thread watcher;
+	static std::atomic<bool> watching;
+	static std::mutex changedMutex;
+	static std::set<string> changedFiles; // Written by the watcher thread, consumed in update()
+	static std::set<string> changed;		// changedFiles taken by update(). A member, so a frame without changes allocates nothing
+
+	static bool parallelCompile; // Driver compiles in its own threads, poll GL_COMPLETION_STATUS_KHR instead of waiting
+	static string shaderFolder;
+
+	ShaderManager() {}
+	~ShaderManager() {}
+
+	static bool hasExtension(const char* name)
+	{
+		int count = 0;
+		glGetIntegerv(GL_NUM_EXTENSIONS, &count);
+		for (int i = 0; i < count; i++)
+		{
+			if (strcmp((const char*)glGetStringi(GL_EXTENSIONS, i), name) == 0) return true;
+		}
+		return false;
+	}
+
+	static void notifyChange(const string& file)
+	{
+		std::lock_guard<std::mutex> lock(changedMutex);
+		changedFiles.insert(file);
+	}
+
+	static void watchFolder()
+	{
+#ifdef __linux__
+		int fd = inotify_init1(IN_NONBLOCK);
+		int wd = inotify_add_watch(fd, shaderFolder.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO);
+		if (fd < 0 || wd < 0)
+		{
+			std::cout << "ERROR::SHADER_MANAGER::Cannot watch folder " << shaderFolder << std::endl;
+			return;
+		}
+
+		char buffer[4096];
+		pollfd pfd = { fd, POLLIN, 0 };
+		while (watching)
+		{
+			// Short timeout so stopWatching() doesn't wait long
+			if (poll(&pfd, 1, 200) <= 0) continue;
+
+			ssize_t length = read(fd, buffer, sizeof(buffer));
+			for (ssize_t i = 0; i < length; )
+			{
+				inotify_event* e = (inotify_event*)&buffer[i];
+				if (e->len > 0) notifyChange(e->name);
+				i += sizeof(inotify_event) + e->len;
+			}
+		}
+
+		inotify_rm_watch(fd, wd);
+		close(fd);
+#else
+		// No inotify: compare modification times
+		namespace fs = std::filesystem;
+		std::map<string, fs::file_time_type> lastWrite;
+		std::error_code ec;
+
+		for (auto& entry : fs::directory_iterator(shaderFolder, ec))
+			lastWrite[entry.path().filename().string()] = fs::last_write_time(entry, ec);
+
+		while (watching)
+		{
+			std::this_thread::sleep_for(std::chrono::milliseconds(250));
+
+			for (auto& entry : fs::directory_iterator(shaderFolder, ec))
+			{
+				string file = entry.path().filename().string();
+				fs::file_time_type time = fs::last_write_time(entry, ec);
+				if (ec) continue;
+
+				if (lastWrite.count(file) && lastWrite[file] != time) notifyChange(file);
+				lastWrite[file] = time;
+			}
+		}
+#endif
+	}
+
+	static string programName(const Shader* shader)
+	{
+		return shader->computeFile.empty() ? shader->vertexFile + " + " + shader->fragmentFile : shader->computeFile;
+	}
+
+	// Worker thread, its context current: builds the queued programs, blocking here instead of the frame
+	static void compileLoop()
+	{
+		glfwMakeContextCurrent(workerWindow);
+		std::unique_lock<std::mutex> lock(workerMutex);
+		while (true)
+		{
+			workerWake.wait(lock, [] { return !workerJobs.empty() || !watching; });
+			if (!watching) break;
+
+			WorkerJob job = std::move(workerJobs.front());
+			workerJobs.erase(workerJobs.begin());
+			lock.unlock();
+			WorkerResult result = build(job);
+			lock.lock();
+			workerResults.push_back(std::move(result));
+		}
+		lock.unlock();
+		glfwMakeContextCurrent(NULL);
+	}
+
+	static WorkerResult build(const WorkerJob& job)
+	{
+		WorkerResult r;
+		r.shader = job.shader;
+		r.serial = job.serial;
+		r.name = job.name;
+		r.program = glCreateProgram();
+		r.fence = 0;
+		r.start = job.start;
+
+		GLenum types[4] = { GL_VERTEX_SHADER, GL_FRAGMENT_SHADER, GL_GEOMETRY_SHADER, GL_COMPUTE_SHADER };
+		unsigned int stages[4];
+		int stageCount = 0;
+		int status = 0;
+		char infoLog[1024];
+		bool built = true;
+
+		for (int i = 0; i < 4 && built; i++)
+		{
+			if (job.sources[i].empty()) continue;
+
+			const char* codeC = job.sources[i].c_str();
+			unsigned int stage = glCreateShader(types[i]);
+			stages[stageCount++] = stage;
+			glShaderSource(stage, 1, &codeC, NULL);
+			glCompileShader(stage);
+			glGetShaderiv(stage, GL_COMPILE_STATUS, &status);
+			if (!status)
+			{
+				glGetShaderInfoLog(stage, 1024, NULL, infoLog);
+				r.log = "ERROR::SHADER_MANAGER::Reload of " + job.name + " failed, keeping the previous program\n" + infoLog;
+				built = false;
+			}
+			else glAttachShader(r.program, stage);
+		}
+
+		if (built)
+		{
+			glLinkProgram(r.program);
+			glGetProgramiv(r.program, GL_LINK_STATUS, &status);
+			if (!status)
+			{
+				glGetProgramInfoLog(r.program, 1024, NULL, infoLog);
+				r.log = "ERROR::SHADER_MANAGER::Link of " + job.name + " failed, keeping the previous program\n" + infoLog;
+				built = false;
+			}
+		}
+
+		for (int i = 0; i < stageCount; i++) glDeleteShader(stages[i]);
+		if (!built)
+		{
+			glDeleteProgram(r.program);
+			r.program = 0;
+			return r;
+		}
+
+		// Flushed, so the main context sees the fence
+		r.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+		glFlush();
+		return r;
+	}
+
+	// Queue the shader for the worker, replacing a reload of it still in flight
+	static void queueReload(Shader* shader)
+	{
+		WorkerJob job;
+		job.shader = shader;
+		job.serial = ++nextSerial;
+		job.name = programName(shader);
+		job.start = clock::now();
+
+		const string* files[4] = { &shader->vertexFile, &shader->fragmentFile, &shader->geometryFile, &shader->computeFile };
+		for (int i = 0; i < 4; i++)
+		{
+			if (!files[i]->empty()) job.sources[i] = shader->readStageSource(files[i]->c_str());
+		}
+
+		bool found = false;
+		for (Reload& r : reloads)
+		{
+			if (r.shader != shader) continue;
+			r.serial = job.serial;
+			found = true;
+		}
+		if (!found) reloads.push_back({ shader, job.serial });
+
+		{
+			std::lock_guard<std::mutex> lock(workerMutex);
+			workerJobs.push_back(std::move(job));
+		}
+		workerWake.notify_one();
+	}
+
+	// Swap in the worker's programs whose fence is signaled. Stale ones (newer save, shader destroyed) are dropped
+	static void collectWorker()
+	{
+		{
+			std::lock_guard<std::mutex> lock(workerMutex);
+			for (WorkerResult& r : workerResults) fenced.push_back(std::move(r));
+			workerResults.clear();
+		}
+
+		for (size_t i = 0; i < fenced.size(); )
+		{
+			WorkerResult& r = fenced[i];
+			size_t reload = 0;
+			while (reload < reloads.size() && reloads[reload].shader != r.shader) reload++;
+			bool latest = reload < reloads.size() && reloads[reload].serial == r.serial;
+
+			if (latest && isLoaded(r.shader) && r.fence)
+			{
+				GLenum wait = glClientWaitSync(r.fence, 0, 0); // Timeout 0: polls
+				if (wait == GL_TIMEOUT_EXPIRED)
+				{
+					i++;
+					continue;
+				}
+			}
+
+			if (latest && isLoaded(r.shader))
+			{
+				if (r.program)
+				{
+					glDeleteProgram(r.shader->ID);
+					r.shader->ID = r.program;
+					float ms = std::chrono::duration<float, std::milli>(clock::now() - r.start).count();
+					std::cout << "SHADER_MANAGER::Reloaded " << r.name << " in " << ms << " ms (worker context)" << std::endl;
+				}
+				else std::cout << r.log << std::endl;
+			}
+			else if (r.program) glDeleteProgram(r.program);
+
+			if (latest) reloads.erase(reloads.begin() + reload);
+			if (r.fence) glDeleteSync(r.fence);
+			fenced.erase(fenced.begin() + i);
+		}
+	}
+
+	// Send every stage to the driver. Nothing here waits for the compilation
+	static void startReload(Shader* shader)
+	{
+		PendingProgram p;
+		p.shader = shader;
+		p.program = glCreateProgram();
+		p.start = clock::now();
+
+		const string* files[4] = { &shader->vertexFile, &shader->fragmentFile, &shader->geometryFile, &shader->computeFile };
+		GLenum types[4] = { GL_VERTEX_SHADER, GL_FRAGMENT_SHADER, GL_GEOMETRY_SHADER, GL_COMPUTE_SHADER };
+
+		for (int i = 0; i < 4; i++)
+		{
+			if (files[i]->empty()) continue;
+
+			string code = shader->readStageSource(files[i]->c_str());
+			const char* codeC = code.c_str();
+
+			unsigned int stage = glCreateShader(types[i]);
+			glShaderSource(stage, 1, &codeC, NULL);
+			glCompileShader(stage);
+			p.stages.push_back(stage);
+		}
+
+		pending.push_back(p);
+	}
+
+	static void discard(PendingProgram& p, bool deleteProgram)
+	{
+		for (unsigned int stage : p.stages) glDeleteShader(stage);
+		if (deleteProgram) glDeleteProgram(p.program);
+	}
+
+	// Advance a pending program. Returns true when it's finished (swapped or discarded)
+	static bool advance(PendingProgram& p)
+	{
+		int status = 0;
+		char infoLog[1024];
+		string name = programName(p.shader);
+
+		if (!p.linking)
+		{
+			if (parallelCompile)
+			{
+				for (unsigned int stage : p.stages)
+				{
+					glGetShaderiv(stage, GL_COMPLETION_STATUS_KHR, &status);
+					if (!status) return false;
+				}
+			}
+
+			for (unsigned int stage : p.stages)
+			{
+				glGetShaderiv(stage, GL_COMPILE_STATUS, &status);
+				if (!status)
+				{
+					glGetShaderInfoLog(stage, 1024, NULL, infoLog);
+					std::cout << "ERROR::SHADER_MANAGER::Reload of " << name << " failed, keeping the previous program\n" << infoLog << std::endl;
+					discard(p, true);
+					return true;
+				}
+				glAttachShader(p.program, stage);
+			}
+
+			glLinkProgram(p.program);
+			p.linking = true;
+			return false;
+		}
+
+		if (parallelCompile)
+		{
+			glGetProgramiv(p.program, GL_COMPLETION_STATUS_KHR, &status);
+			if (!status) return false;
+		}
+
+		glGetProgramiv(p.program, GL_LINK_STATUS, &status);
+		if (!status)
+		{
+			glGetProgramInfoLog(p.program, 1024, NULL, infoLog);
+			std::cout << "ERROR::SHADER_MANAGER::Link of " << name << " failed, keeping the previous program\n" << infoLog << std::endl;
+			discard(p, true);
+			return true;
+		}
+
+		// Swap programs. Uniforms are set every frame, so nothing has to be copied
+		glDeleteProgram(p.shader->ID);
+		p.shader->ID = p.program;
+		discard(p, false);
+
+		float ms = std::chrono::duration<float, std::milli>(clock::now() - p.start).count();
+		std::cout << "SHADER_MANAGER::Reloaded " << name << " in " << ms << " ms" << std::endl;
+		return true;
+	}
+
+	static bool isLoaded(Shader* shader)
+	{
+		return std::find(Shader::loadedShaders.begin(), Shader::loadedShaders.end(), shader) != Shader::loadedShaders.end();
+	}
+
+public:
+
+	static void startWatching(string folder = "Shaders/")
+	{
+		if (watching) return;
+
+		shaderFolder = folder;
+		bool khr = hasExtension("GL_KHR_parallel_shader_compile");
+		parallelCompile = khr || hasExtension("GL_ARB_parallel_shader_compile");
+		watching = true;
+
+		if (parallelCompile)
+		{
+			// As many driver threads as it can use
+			PFNGLMAXSHADERCOMPILERTHREADSKHRPROC maxThreads = (PFNGLMAXSHADERCOMPILERTHREADSKHRPROC)glfwGetProcAddress(
+				khr ? "glMaxShaderCompilerThreadsKHR" : "glMaxShaderCompilerThreadsARB");
+			if (maxThreads) maxThreads(0xFFFFFFFFu);
+		}
+		else
+		{
+			// Called from the main thread, its context current: the worker's shares it
+			glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+			workerWindow = glfwCreateWindow(1, 1, "Shader compiler", NULL, glfwGetCurrentContext());
+			glfwWindowHint(GLFW_VISIBLE, GLFW_TRUE);
+			if (workerWindow) compiler = std::thread(compileLoop);
+			else std::cout << "ERROR::SHADER_MANAGER::No worker context, reloads compile on the render thread" << std::endl;
+		}
+
+		watcher = std::thread(watchFolder);
+	}
+
+	static void stopWatching()
+	{
+		if (!watching) return;
+
+		{
+			std::lock_guard<std::mutex> lock(workerMutex);
+			watching = false;
+		}
+		workerWake.notify_one();
+		watcher.join();
+		if (!workerWindow) return;
+
+		compiler.join();
+		for (WorkerResult& r : workerResults) fenced.push_back(std::move(r));
+		for (WorkerResult& r : fenced)
+		{
+			if (r.program) glDeleteProgram(r.program);
+			if (r.fence) glDeleteSync(r.fence);
+		}
+		workerJobs.clear();
+		workerResults.clear();
+		fenced.clear();
+		reloads.clear();
+		glfwDestroyWindow(workerWindow);
+		workerWindow = nullptr;
+	}
+
+	// Call once per frame (main thread, it owns the GL context)
+	static void update()
+	{
+		{
+			std::lock_guard<std::mutex> lock(changedMutex);
+			changed.swap(changedFiles);
+		}
+
+		for (const string& file : changed)
+		{
+			for (Shader* shader : Shader::loadedShaders)
+			{
+				if (!shader->usesFile(file)) continue;
+
+				if (workerWindow)
+				{
+					queueReload(shader);
+					continue;
+				}
+
+				// A newer save replaces a reload still in flight
+				for (size_t i = 0; i < pending.size(); i++)
+				{
+					if (pending[i].shader == shader)
+					{
+						discard(pending[i], true);
+						pending.erase(pending.begin() + i);
+						break;
+					}
+				}
+
+				startReload(shader);
+			}
+		}
+		changed.clear();
+
+		if (workerWindow) collectWorker();
+
+		for (size_t i = 0; i < pending.size(); )
+		{
+			bool done;
+			if (!isLoaded(pending[i].shader))
+			{
+				discard(pending[i], true); // Shader destroyed while rebuilding
+				done = true;
+			}
+			else done = advance(pending[i]);
+
+			if (done) pending.erase(pending.begin() + i);
+			else i++;
+		}
+	}
+};
+
+// Static variables initialization
+std::vector<ShaderManager::PendingProgram> ShaderManager::pending;
+
+GLFWwindow* ShaderManager::workerWindow = nullptr;
+std::thread ShaderManager::compiler;
+std::mutex ShaderManager::workerMutex;
+std::condition_variable ShaderManager::workerWake;
+std::vector<ShaderManager::WorkerJob> ShaderManager::workerJobs;
+std::vector<ShaderManager::WorkerResult> ShaderManager::workerResults;
+std::vector<ShaderManager::WorkerResult> ShaderManager::fenced;
+std::vector<ShaderManager::Reload> ShaderManager::reloads;
+unsigned int ShaderManager::nextSerial = 0;
+
+std::thread ShaderManager::watcher;
+std::atomic<bool> ShaderManager::watching(false);
+std::mutex ShaderManager::changedMutex;
+std::set<std::string> ShaderManager::changedFiles;
+std::set<std::string> ShaderManager::changed;
+
+bool ShaderManager::parallelCompile = false;
+std::string ShaderManager::shaderFolder = "Shaders/";
+
+#endif SHADER_MANAGER_H
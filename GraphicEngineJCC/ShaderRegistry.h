@@ -0,0 +1,120 @@
+#ifndef SHADER_REGISTRY_H
+#define SHADER_REGISTRY_H
+
+#include "Shader.h"
+#include <map>
+#include <memory>
+#include <string>
+#include <iostream>
+
+// Shared shader programs. Asking twice for the same stage files and #define values returns the same program.
+// The program is deleted (glDeleteProgram) when the last handle is released, its entry on the next miss.
+class ShaderRegistry
+{
+	using string = std::string;
+	using ShaderHandle = std::shared_ptr<Shader>;
+
+private:
+	static std::map<string, std::weak_ptr<Shader>> programs;
+
+	static unsigned int compiles;	// Programs built
+	static unsigned int reuses;		// Compiles avoided by returning a live program
+
+	ShaderRegistry() {}
+	~ShaderRegistry() {}
+
+	static string makeKey(const char* vertexPath, const char* fragmentPath, const char* geometryPath, const std::map<string, const char*>& defineMod)
+	{
+		string key = string(vertexPath) + "|" + fragmentPath + "|" + geometryPath;
+
+		std::map<string, const char*>::const_iterator itr;
+		for (itr = defineMod.begin(); itr != defineMod.end(); itr++)
+		{
+			key += "|" + itr->first + "=" + itr->second;
+		}
+
+		return key;
+	}
+
+	// Live program of key, or nullptr. A miss erases the expired entries, so keys of released programs don't pile up
+	static ShaderHandle find(const string& key)
+	{
+		std::map<string, std::weak_ptr<Shader>>::iterator itr = programs.find(key);
+		ShaderHandle shader = itr != programs.end() ? itr->second.lock() : nullptr;
+		if (shader) reuses++;
+		else sweep();
+
+		return shader;
+	}
+
+	static void sweep()
+	{
+		std::map<string, std::weak_ptr<Shader>>::iterator itr = programs.begin();
+		while (itr != programs.end())
+		{
+			if (itr->second.expired()) itr = programs.erase(itr);
+			else itr++;
+		}
+	}
+
+public:
+
+	static ShaderHandle get(const char* vertexPath, const char* fragmentPath, const char* geometryPath = "", std::map<string, const char*> defineMod = {})
+	{
+		string key = makeKey(vertexPath, fragmentPath, geometryPath, defineMod);
+
+		ShaderHandle shader = find(key);
+		if (shader) return shader;
+
+		// Only programs with #define changes need the modified constructor
+		if (defineMod.empty()) shader = std::make_shared<Shader>(vertexPath, fragmentPath, geometryPath);
+		else shader = std::make_shared<Shader>(vertexPath, fragmentPath, geometryPath, defineMod);
+
+		programs[key] = shader;
+		compiles++;
+
+		return shader;
+	}
+
+	static ShaderHandle getCompute(const char* computePath)
+	{
+		string key = string("compute|") + computePath;
+
+		ShaderHandle shader = find(key);
+		if (shader) return shader;
+
+		shader = std::make_shared<Shader>(computePath);
+		programs[key] = shader;
+		compiles++;
+
+		return shader;
+	}
+
+	static unsigned int liveCount()
+	{
+		sweep();
+		return (unsigned int)programs.size();
+	}
+
+	static void printStats()
+	{
+		std::cout << "SHADER_REGISTRY::" << compiles << " programs compiled, " << reuses << " compiles saved, "
+			<< liveCount() << " programs alive" << std::endl;
+	}
+
+	// Call before the GL context is destroyed. Handles released later (static/local objects) won't call GL anymore
+	static void shutdown()
+	{
+		printStats();
+		sweep();
+		Shader::glContextAlive = false;
+	}
+};
+
+// Static variables initialization
+std::map<std::string, std::weak_ptr<Shader>> ShaderRegistry::programs;
+
+unsigned int ShaderRegistry::compiles = 0;
+unsigned int ShaderRegistry::reuses = 0;
+
+#endif SHADER_REGISTRY_H
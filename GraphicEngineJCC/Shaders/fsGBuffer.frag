@@ -7,7 +7,8 @@ layout (location = 2) out vec4 gAlbedoSpec;
 in vec2 TexCoord;
 in vec3 FragPos;
 in vec3 Normal;
-in mat3 TBN;
+in vec3 Tangent;
+mat3 TBN;	// Set at the start of main()
 
 struct Material{
 	sampler2D texture_diffuse1; // TODO: haveDiffuse and haveSpecular
@@ -23,6 +24,14 @@ uniform Material material;
 uniform vec3 cameraPos;
 uniform bool viewSpace;
 
+// Tangent space basis. Interpolated vectors aren't unit length anymore, re-orthogonalize T against N
+mat3 tangentBasis(){
+	vec3 N = normalize(Normal);
+	vec3 T = normalize(Tangent - dot(Tangent, N) * N);
+	vec3 B = cross(N, T);
+	return mat3(T, B, N);
+}
+
 vec2 parallaxMaping(vec2 texCoords){
 	mat3 TBNt = transpose(TBN);
 	float heightScale = 0.1;
@@ -81,6 +90,7 @@ vec2 parallaxMaping(vec2 texCoords){
 
 void main()
 {
+	TBN = tangentBasis();
 	vec2 texCoords = parallaxMaping(TexCoord);
 	// Store the fragment position vector in the first gbuffer texture
 	gPosition = vec4(FragPos, 1);
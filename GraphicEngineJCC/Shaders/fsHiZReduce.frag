@@ -0,0 +1,29 @@
+#version 450 core
+
+layout (location = 0) out float hiZ;
+
+uniform sampler2D source; // Depth buffer or the previous Hi-Z level (as base level)
+
+// Farthest depth of the source texels under this one. Odd sizes take the extra row/column too, so nothing is lost
+void main()
+{
+	ivec2 dst = ivec2(gl_FragCoord.xy);
+	ivec2 srcSize = textureSize(source, 0);
+	ivec2 dstSize = max(srcSize / 2, ivec2(1));
+	ivec2 src = dst * 2;
+
+	int lastX = (dst.x == dstSize.x - 1 && (srcSize.x & 1) != 0) ? 2 : 1;
+	int lastY = (dst.y == dstSize.y - 1 && (srcSize.y & 1) != 0) ? 2 : 1;
+
+	float depth = 0.0;
+	for(int y = 0; y <= lastY; y++)
+	{
+		for(int x = 0; x <= lastX; x++)
+		{
+			ivec2 coord = min(src + ivec2(x, y), srcSize - 1);
+			depth = max(depth, texelFetch(source, coord, 0).r);
+		}
+	}
+
+	hiZ = depth;
+}
@@ -1,7 +1,14 @@
 #version 450 core
 
-#define MAX_POINT_LIGHT 4
 #define MAX_SPOT_LIGHT 4
+#define CASCADES 4			// DirectionalLight::CASCADES
+#define SHADOW_MOMENTS_SCALE 2.0	// ShadowMoments::SCALE
+#define EVSM_MIN_DEVIATION 0.0005	// ShadowMoments::minDeviation
+
+// Froxel grid, LightClusters::TILES_X, TILES_Y and SLICES
+#define CLUSTER_X 16
+#define CLUSTER_Y 9
+#define CLUSTER_Z 24
 
 layout (location = 0) out vec4 FragColor;
 layout (location = 1) out vec4 BrightColor;
@@ -49,21 +56,23 @@ struct DirLight{
 	// This light don't has attenuation
 };
 
+// LightClusters::GPULight
 struct PointLight{
 	vec3 pos;
+	float range;
 
 	vec3 color;
-	float ambient;
-	float diffuse;
-	float specular;
+	float farPlane;
 
 	// Attenuation
 	float constant;
 	float linear;
 	float quadratic;
 
-	float farPlane;
-
+	// Shadow atlas tiles of the cube faces (+X -X +Y -Y +Z -Z): texels per side (0: no shadow), uv of each corner
+	float shadowSize;
+	vec4 shadowFaces[3];
+	int shadowFilter;	// LightBase::ShadowFilter
 };
 
 struct SpotLight{
@@ -90,31 +99,49 @@ vec2 texCoords;		// TexCoords with paralax (if any)
 in vec3 FragPos;
 in vec3 Normal;		// Default normal
 //vec3 n;				// Normal from texture (if any)
-in mat3 TBN;
+in vec3 Tangent;
+mat3 TBN;			// Set at the start of main()
 
 // Input lights
 uniform DirLight dirlight;
-uniform PointLight pointLight[MAX_POINT_LIGHT];
 uniform SpotLight spotLight[MAX_SPOT_LIGHT];
+
+// Point lights, clustered: the lights of each froxel are cluster[i].y indices from lightIndex[cluster[i].x]
+layout (std430, binding = 2) readonly buffer PointLights { PointLight pointLight[]; };
+layout (std430, binding = 3) readonly buffer LightClusters { uvec2 cluster[]; };
+layout (std430, binding = 4) readonly buffer LightIndices { uint lightIndex[]; };
+uniform float clusterNear;
+uniform float clusterLogDepth;	// log(far / near), depth slices are exponential
+
 uniform samplerCube irradianceMap;	// Ambient diffuse light
 uniform samplerCube prefilterMap;	// Ambient specular light
 uniform sampler2D brdfLUT;			// Ambient specular light
 
 
 // Fragment position in every light space
-in vec4 dFragPosLightSpace;
-in vec4 sFragPosLightSpace[MAX_SPOT_LIGHT];
+uniform mat4 dlightSpaceMatrix[CASCADES];	// One per cascade
+uniform float cascadeSplits[CASCADES];		// View depth where each cascade ends
+uniform mat4 slightSpaceMatrix[MAX_SPOT_LIGHT];
 
 // Light shadows
-uniform sampler2D dShadowMap;
-uniform sampler2D sShadowMap[MAX_SPOT_LIGHT];
-uniform samplerCube pShadowMap[MAX_POINT_LIGHT];
+uniform sampler2DArray dShadowMap;			// Layer per cascade
+uniform sampler2D shadowAtlas;				// Tiles of the spot and point lights
+uniform vec3 sShadowTile[MAX_SPOT_LIGHT];	// Atlas uv of the corner, texels per side (0: no shadow)
+uniform int dShadowFilter;					// Directional light: 0 PCF, 1 EVSM (LightBase::ShadowFilter)
+uniform vec2 sShadowFilter[MAX_SPOT_LIGHT];	// Filter, far plane (0: orthographic)
+uniform sampler2DArray dShadowMoments;		// EVSM moments of the cascades, mip-mapped (see ShadowMoments)
+uniform sampler2DArray shadowMomentsAtlas;	// EVSM moments of the atlas tiles, same uv, one layer
+uniform vec2 shadowExponents;				// EVSM warps, positive and negative
+uniform float shadowLightBleed;				// Lit fractions below it are cut to 0, against light leaks
 
 // Camera
 uniform vec3 cameraPos;
+uniform mat4 view;
+uniform mat4 projection;
 uniform float farPlane;
 uniform float nearPlane;
 vec3 viewDir = normalize(cameraPos - FragPos); // View direction
+float fragWidth = length(fwidth(FragPos)); // World size of this fragment, picks the shadow moments mip
 
 // Object material
 uniform Material material;
@@ -202,23 +229,150 @@ float shadowCalculation(vec4 fragPosLightSpace, sampler2D shadowMap){
 	return shadow;
 }
 
-float shadowCalculation(vec3 fragPos, vec3 lightPos, samplerCube depthMap, float farPlane){
-	// get vector between fragment position and light position
-	vec3 fragToLight = fragPos - lightPos;
-	// use the light to fragment vector to sample from the depth map
-	float closestDepth = texture(depthMap, fragToLight).r;
-	// it is currently in linear range between [0,1].
-	// re-transform back to original value
-	closestDepth *= farPlane; // TODO: closestDepth * pointLightFarPlane
-	// now get current linear depth as the length between the
-	// fragment and light position
-	float currentDepth = length(fragToLight);
-	// now test for shadows
-	//float bias = 0.05;
-	float bias = 0;
-	float shadow = currentDepth - bias > closestDepth ? 1.0 : 0.0;
+// Same PCF on one layer of a cascade array
+float shadowCalculation(vec4 fragPosLightSpace, sampler2DArray shadowMap, int layer){
+	vec3 projCoords = fragPosLightSpace.xyz / fragPosLightSpace.w;
+	projCoords = projCoords * 0.5 + 0.5;
+	float currentDepth = projCoords.z;
+	if(currentDepth > 1.0) return 0.0;
 
-	return shadow;
+	float shadow = 0;
+	vec2 texelSize = 1.0 / textureSize(shadowMap, 0).xy;
+	for(int x = -1; x <= 1; ++x)
+	{
+		for(int y = -1; y <= 1; ++y)
+		{
+			float pcfDepth = texture(shadowMap, vec3(projCoords.xy + vec2(x, y) * texelSize, layer)).r;
+			shadow += currentDepth > pcfDepth ? 1.0 : 0.0;
+		}
+	}
+	return shadow / 9.0;
+}
+
+// Fraction of an EVSM moments fetch in front of t (one warp: mean and mean of squares), Chebyshev's upper bound
+float chebyshev(vec2 moments, float t, float minVariance){
+	if(t <= moments.x) return 1.0;
+	float variance = max(moments.y - moments.x * moments.x, minVariance);
+	float d = t - moments.x;
+	return variance / (variance + d * d);
+}
+
+// Fraction in shadow of linear depth (0 - 1) against filtered moments: the lower bound of both warps, minus the
+// light bleeding cut (ShadowMoments::shadow)
+float evsmShadow(vec4 moments, float depth){
+	depth = depth * 2.0 - 1.0;
+	float pos = exp(shadowExponents.x * depth);
+	float neg = -exp(-shadowExponents.y * depth);
+	float posDeviation = EVSM_MIN_DEVIATION * shadowExponents.x * pos;
+	float negDeviation = EVSM_MIN_DEVIATION * shadowExponents.y * neg;
+	float lit = min(chebyshev(moments.xy, pos, posDeviation * posDeviation), chebyshev(moments.zw, neg, negDeviation * negDeviation));
+	return 1.0 - clamp((lit - shadowLightBleed) / (1.0 - shadowLightBleed), 0.0, 1.0);
+}
+
+// Mip of a moments map (size texels per side) whose texels cover the fragment, texel: world size of a level 0 texel
+// there. The last levels (under 2 x 2) are left out
+float momentsLod(float texel, float size){
+	return clamp(log2(fragWidth / texel), 0.0, max(log2(size) - 1.0, 0.0));
+}
+
+// Moments of an atlas tile (size moments texels per side), trilinear, kept inside the tile at that level
+vec4 atlasMoments(vec2 corner, float size, vec2 uv, float lod){
+	float border = 0.5 * exp2(ceil(lod));
+	vec2 texel = clamp(uv * size, vec2(border), vec2(size - border));
+	return textureLod(shadowMomentsAtlas, vec3(corner + texel / vec2(textureSize(shadowMomentsAtlas, 0).xy), 0.0), lod);
+}
+
+// Directional light, EVSM: one fetch of the moments of the cascade
+float cascadeMomentsShadow(vec4 fragPosLightSpace, int layer){
+	vec3 projCoords = fragPosLightSpace.xyz / fragPosLightSpace.w * 0.5 + 0.5;
+	if(projCoords.z > 1.0) return 0.0;
+
+	// Orthographic: the first row of the matrix is 2 / width long
+	mat4 m = dlightSpaceMatrix[layer];
+	float size = float(textureSize(dShadowMoments, 0).x);
+	float lod = momentsLod(2.0 / (length(vec3(m[0][0], m[1][0], m[2][0])) * size), size);
+	return evsmShadow(textureLod(dShadowMoments, vec3(projCoords.xy, layer), lod), projCoords.z);
+}
+
+// Directional light: the first cascade whose slice holds the fragment. Past the last one, no shadow
+float cascadeShadow(){
+	float depth = -(view * vec4(FragPos, 1.0)).z;
+	for(int c = 0; c < CASCADES; ++c)
+	{
+		if(depth >= cascadeSplits[c]) continue;
+		vec4 fragPosLightSpace = dlightSpaceMatrix[c] * vec4(FragPos, 1.0);
+		return dShadowFilter == 1 ? cascadeMomentsShadow(fragPosLightSpace, c) : shadowCalculation(fragPosLightSpace, dShadowMap, c);
+	}
+	return 0.0;
+}
+
+// Depth of an atlas tile (corner in atlas uv, size texels per side) at uv in [0, 1] across the tile. Kept half a
+// texel inside, lookups never read the neighbour tiles
+float atlasDepth(vec2 corner, float size, vec2 uv){
+	vec2 texel = clamp(uv * size, vec2(0.5), vec2(size - 0.5));
+	return texture(shadowAtlas, corner + texel / vec2(textureSize(shadowAtlas, 0))).r;
+}
+
+// Spot light: PCF or EVSM in its atlas tile. Outside the light frustum, no shadow
+float spotShadow(int i){
+	if(sShadowTile[i].z <= 0.0) return 0.0;
+
+	vec4 fragPosLightSpace = slightSpaceMatrix[i] * vec4(FragPos, 1.0);
+	vec3 projCoords = fragPosLightSpace.xyz / fragPosLightSpace.w * 0.5 + 0.5;
+	if(projCoords.z > 1.0 || any(lessThan(projCoords.xy, vec2(0.0))) || any(greaterThan(projCoords.xy, vec2(1.0)))) return 0.0;
+
+	if(sShadowFilter[i].x > 0.5)
+	{
+		// Moments hold view depth / far (perspective: w), texels widen with it
+		float size = sShadowTile[i].z / SHADOW_MOMENTS_SCALE;
+		float w = sShadowFilter[i].y > 0.0 ? fragPosLightSpace.w : 1.0;
+		mat4 m = slightSpaceMatrix[i];
+		float lod = momentsLod(2.0 * w / (length(vec3(m[0][0], m[1][0], m[2][0])) * size), size);
+		float depth = sShadowFilter[i].y > 0.0 ? fragPosLightSpace.w / sShadowFilter[i].y : projCoords.z;
+		return evsmShadow(atlasMoments(sShadowTile[i].xy, size, projCoords.xy, lod), depth);
+	}
+
+	float shadow = 0;
+	for(int x = -1; x <= 1; ++x)
+		for(int y = -1; y <= 1; ++y)
+			shadow += projCoords.z > atlasDepth(sShadowTile[i].xy, sShadowTile[i].z, projCoords.xy + vec2(x, y) / sShadowTile[i].z) ? 1.0 : 0.0;
+	return shadow / 9.0;
+}
+
+// Cube face a direction points to and where it lands on it, as a cube map lookup picks them
+vec2 cubeFaceUV(vec3 d, out int face){
+	vec3 a = abs(d);
+	if(a.x >= a.y && a.x >= a.z){
+		face = d.x > 0.0 ? 0 : 1;
+		return vec2(d.x > 0.0 ? -d.z : d.z, -d.y) / a.x * 0.5 + 0.5;
+	}
+	if(a.y >= a.z){
+		face = d.y > 0.0 ? 2 : 3;
+		return vec2(d.x, d.y > 0.0 ? d.z : -d.z) / a.y * 0.5 + 0.5;
+	}
+	face = d.z > 0.0 ? 4 : 5;
+	return vec2(d.z > 0.0 ? d.x : -d.x, -d.y) / a.z * 0.5 + 0.5;
+}
+
+// Point light: the atlas tile of the cube face towards the fragment holds linear depth / farPlane
+float pointShadow(PointLight light){
+	vec3 fragToLight = FragPos - light.pos;
+	int face;
+	vec2 uv = cubeFaceUV(fragToLight, face);
+	vec4 corners = light.shadowFaces[face / 2];
+	vec2 corner = (face & 1) == 0 ? corners.xy : corners.zw;
+
+	if(light.shadowFilter == 1)
+	{
+		// A 90 degree face: texels 2 / size wide at unit distance along its axis
+		float size = light.shadowSize / SHADOW_MOMENTS_SCALE;
+		vec3 a = abs(fragToLight);
+		float lod = momentsLod(2.0 * max(max(a.x, a.y), a.z) / size, size);
+		return evsmShadow(atlasMoments(corner, size, uv, lod), length(fragToLight) / light.farPlane);
+	}
+
+	float closestDepth = atlasDepth(corner, light.shadowSize, uv) * light.farPlane;
+	return length(fragToLight) > closestDepth ? 1.0 : 0.0;
 }
 
 vec3 calcIrradianceLight(){
@@ -244,13 +398,27 @@ vec3 calcIrradianceLight(){
 	//return vec3(0);
 }
 
+// Froxel of this fragment, same tiles and slices as LightClusters
+uint clusterIndex(){
+	vec4 viewPos = view * vec4(FragPos, 1.0);
+	vec4 clipPos = projection * viewPos;
+	ivec2 tile = ivec2((clipPos.xy / clipPos.w * 0.5 + 0.5) * vec2(CLUSTER_X, CLUSTER_Y));
+	tile = clamp(tile, ivec2(0), ivec2(CLUSTER_X - 1, CLUSTER_Y - 1));
+	int slice = int(log(max(-viewPos.z, clusterNear) / clusterNear) / clusterLogDepth * CLUSTER_Z);
+	slice = clamp(slice, 0, CLUSTER_Z - 1);
+
+	return uint(tile.x + CLUSTER_X * (tile.y + CLUSTER_Y * slice));
+}
+
 vec3 calcPointLights(){
 
 	vec3 F0 = mix(vec3(0.04), specular, metallic);
 	vec3 Lo = vec3(0);
 
-	for(int i = 0; i < MAX_POINT_LIGHT; ++i)
+	uvec2 lights = cluster[clusterIndex()];
+	for(uint l = 0; l < lights.y; ++l)
 	{
+		uint i = lightIndex[lights.x + l];
 		vec3 lightDir =  normalize(pointLight[i].pos - FragPos);
 		vec3 halfwayDir = normalize(lightDir + viewDir); // Blinn-Phong
 
@@ -273,7 +441,7 @@ vec3 calcPointLights(){
 		vec3 spec = numerator / max(denominator, 0.001); // Avoid division by 0
 
 		float shadow = 0;
-		if(dot(Normal, lightDir) > 0) shadow = shadowCalculation(FragPos, pointLight[i].pos, pShadowMap[i],  pointLight[i].farPlane);
+		if(pointLight[i].shadowSize > 0.0 && dot(Normal, lightDir) > 0) shadow = pointShadow(pointLight[i]);
 
 		// Add to outgoing radiance Lo
 		float NdotL = max(dot(normal, lightDir), 0.0);
@@ -313,7 +481,7 @@ vec3 calcDirectLight(){
 	//vec3 Lo = (kD * color / PI + spec) * radiance * NdotL;
 	vec3 Lo = (kD * color + spec) * radiance * NdotL;
 
-	float shadow = shadowCalculation(dFragPosLightSpace, dShadowMap);
+	float shadow = cascadeShadow();
 
 	return (1.0 - shadow) * Lo * ao;
 }
@@ -324,15 +492,15 @@ vec3 calcSpotLights(){
 	vec3 F0 = mix(vec3(0.04), specular, metallic);
 	vec3 Lo = vec3(0);
 
-	for(int i = 0; i < MAX_POINT_LIGHT; ++i)
+	for(int i = 0; i < MAX_SPOT_LIGHT; ++i)
 	{
-		vec3 lightDir =  normalize(pointLight[i].pos - FragPos);
+		vec3 lightDir =  normalize(spotLight[i].pos - FragPos);
 		vec3 halfwayDir = normalize(lightDir + viewDir); // Blinn-Phong
 
-		float dist = length(pointLight[i].pos - FragPos);
-		float attenuation = 1.0 / (pointLight[i].constant + pointLight[i].linear * dist + pointLight[i].quadratic * (dist * dist));
+		float dist = length(spotLight[i].pos - FragPos);
+		float attenuation = 1.0 / (spotLight[i].constant + spotLight[i].linear * dist + spotLight[i].quadratic * (dist * dist));
 
-		vec3 radiance = pointLight[i].color * attenuation;
+		vec3 radiance = spotLight[i].color * attenuation;
 
 		// Cook-Torrance BRDF
 		float NDF = DistributionGGX(normal, halfwayDir, roughness);
@@ -347,8 +515,7 @@ vec3 calcSpotLights(){
 		float denominator = 4.0 * max(dot(normal, viewDir), 0.0) * max(dot(normal, lightDir), 0.0);
 		vec3 spec = numerator / max(denominator, 0.001); // Avoid division by 0
 
-		float shadow = 0;
-		if(dot(Normal, lightDir) > 0) shadow = shadowCalculation(FragPos, pointLight[i].pos, pShadowMap[i],  pointLight[i].farPlane);
+		float shadow = spotShadow(i);
 
 		// Add to outgoing radiance Lo
 		float NdotL = max(dot(normal, lightDir), 0.0);
@@ -362,6 +529,14 @@ vec3 calcSpotLights(){
 	return Lo * ao;
 }
 
+// Tangent space basis. Interpolated vectors aren't unit length anymore, re-orthogonalize T against N
+mat3 tangentBasis(){
+	vec3 N = normalize(Normal);
+	vec3 T = normalize(Tangent - dot(Tangent, N) * N);
+	vec3 B = cross(N, T);
+	return mat3(T, B, N);
+}
+
 vec2 parallaxMaping(vec2 texCoords){
 	mat3 TBNt = transpose(TBN);
 	float heightScale = 0.1;
@@ -499,6 +674,7 @@ void main(){
 
 	vec3 result;
 
+	TBN = tangentBasis();
 	texCoords = parallaxMaping(TexCoord);
 	textureSampling(texCoords);
 	float alpha = checkAlpha(texCoords);
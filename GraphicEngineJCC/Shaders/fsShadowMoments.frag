@@ -0,0 +1,39 @@
+#version 450 core
+
+#define SCALE 2 // ShadowMoments::SCALE
+
+layout (location = 0) out vec4 moments;
+
+uniform sampler2D depthMap;			// Atlas
+uniform sampler2DArray depthLayers;	// Cascades
+uniform int layer;					// Of depthLayers, -1: depthMap
+uniform ivec2 srcCorner;			// Square in depth texels
+uniform ivec2 dstCorner;			// Same square in moments texels
+uniform float nearRatio;			// > 0: perspective depth, near / far. Otherwise linear already
+uniform vec2 exponents;				// Positive and negative warps
+
+vec4 warp(float depth){
+	depth = depth * 2.0 - 1.0;
+	float pos = exp(exponents.x * depth);
+	float neg = -exp(-exponents.y * depth);
+	return vec4(pos, pos * pos, neg, neg * neg);
+}
+
+// Moments of the SCALE x SCALE depth texels under this one, in linear depth (0 - 1)
+void main()
+{
+	ivec2 src = srcCorner + (ivec2(gl_FragCoord.xy) - dstCorner) * SCALE;
+
+	vec4 sum = vec4(0.0);
+	for(int y = 0; y < SCALE; y++)
+	{
+		for(int x = 0; x < SCALE; x++)
+		{
+			float depth = layer < 0 ? texelFetch(depthMap, src + ivec2(x, y), 0).r : texelFetch(depthLayers, ivec3(src + ivec2(x, y), layer), 0).r;
+			if(nearRatio > 0.0) depth = nearRatio / (1.0 - depth * (1.0 - nearRatio));
+			sum += warp(depth);
+		}
+	}
+
+	moments = sum / float(SCALE * SCALE);
+}
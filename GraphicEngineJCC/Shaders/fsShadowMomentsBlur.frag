@@ -0,0 +1,28 @@
+#version 450 core
+
+layout (location = 0) out vec4 moments;
+
+uniform sampler2DArray source;
+uniform int layer;
+uniform ivec2 srcCorner;	// Square read
+uniform ivec2 dstCorner;	// Square written
+uniform int size;			// Of both squares
+uniform ivec2 direction;	// (1, 0) or (0, 1)
+uniform float weight[5] = float[] (0.227027, 0.1945946, 0.1216216, 0.054054, 0.016216);
+
+// One direction of a 9 tap Gaussian, samples clamped to the square so tiles never blur into their neighbours
+void main()
+{
+	ivec2 p = ivec2(gl_FragCoord.xy) - dstCorner;
+	vec4 sum = texelFetch(source, ivec3(srcCorner + p, layer), 0) * weight[0];
+
+	for(int i = 1; i < 5; ++i)
+	{
+		ivec2 a = clamp(p + direction * i, ivec2(0), ivec2(size - 1));
+		ivec2 b = clamp(p - direction * i, ivec2(0), ivec2(size - 1));
+		sum += texelFetch(source, ivec3(srcCorner + a, layer), 0) * weight[i];
+		sum += texelFetch(source, ivec3(srcCorner + b, layer), 0) * weight[i];
+	}
+
+	moments = sum;
+}
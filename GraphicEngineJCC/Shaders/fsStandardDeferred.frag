@@ -2,6 +2,9 @@
 
 #define MAX_POINT_LIGHT 4
 #define MAX_SPOT_LIGHT 4
+#define CASCADES 4
+#define SHADOW_MOMENTS_SCALE 2.0	// ShadowMoments::SCALE
+#define EVSM_MIN_DEVIATION 0.0005	// ShadowMoments::minDeviation
 
 layout (location = 0) out vec4 FragColor;
 layout (location = 1) out vec4 BrightColor;
@@ -44,6 +47,10 @@ struct PointLight{
 
 	float farPlane;
 
+	// Shadow atlas tiles of the cube faces (+X -X +Y -Y +Z -Z): texels per side (0: no shadow), uv of each corner
+	float shadowSize;
+	vec4 shadowFaces[3];
+	int shadowFilter;	// LightBase::ShadowFilter
 };
 
 struct SpotLight{
@@ -76,7 +83,9 @@ vec3 FragPos;
 
 //in vec4 dFragPosLightSpace;
 //in vec4 sFragPosLightSpace[MAX_SPOT_LIGHT];
-uniform mat4 dlightSpaceMatrix;
+uniform mat4 dlightSpaceMatrix[CASCADES];
+uniform float cascadeSplits[CASCADES];
+uniform mat4 view;
 uniform mat4 slightSpaceMatrix[MAX_SPOT_LIGHT];
 
 uniform vec3 cameraPos;
@@ -84,9 +93,15 @@ uniform float farPlane;
 uniform float nearPlane;
 
 //uniform Material material;
-uniform sampler2D dShadowMap;
-uniform sampler2D sShadowMap[MAX_SPOT_LIGHT];
-uniform samplerCube pShadowMap[MAX_POINT_LIGHT];
+uniform sampler2DArray dShadowMap;
+uniform sampler2D shadowAtlas;				// Tiles of the spot and point lights
+uniform vec3 sShadowTile[MAX_SPOT_LIGHT];	// Atlas uv of the corner, texels per side (0: no shadow)
+uniform int dShadowFilter;					// Directional light: 0 PCF, 1 EVSM (LightBase::ShadowFilter)
+uniform vec2 sShadowFilter[MAX_SPOT_LIGHT];	// Filter, far plane (0: orthographic)
+uniform sampler2DArray dShadowMoments;		// EVSM moments of the cascades, mip-mapped (see ShadowMoments)
+uniform sampler2DArray shadowMomentsAtlas;	// EVSM moments of the atlas tiles, same uv, one layer
+uniform vec2 shadowExponents;				// EVSM warps, positive and negative
+uniform float shadowLightBleed;				// Lit fractions below it are cut to 0, against light leaks
 
 uniform DirLight dirlight;
 uniform PointLight pointLight[MAX_POINT_LIGHT];
@@ -96,6 +111,7 @@ vec4 texD, texS; // Texture diffuse and specular sample
 vec3 n;
 
 vec3 viewDir;
+float fragWidth; // World size of this fragment, picks the shadow moments mip
 
 float shadowCalculation(vec4 fragPosLightSpace, sampler2D shadowMap){
 	// perform perspective divide
@@ -132,23 +148,144 @@ float shadowCalculation(vec4 fragPosLightSpace, sampler2D shadowMap){
 	return shadow;
 }
 
-float shadowCalculation(vec3 fragPos, vec3 lightPos, samplerCube depthMap, float farPlane){
-	// get vector between fragment position and light position
-	vec3 fragToLight = fragPos - lightPos;
-	// use the light to fragment vector to sample from the depth map
-	float closestDepth = texture(depthMap, fragToLight).r;
-	// it is currently in linear range between [0,1].
-	// re-transform back to original value
-	closestDepth *= farPlane; // TODO: closestDepth * pointLightFarPlane
-	// now get current linear depth as the length between the
-	// fragment and light position
-	float currentDepth = length(fragToLight);
-	// now test for shadows
-	//float bias = 0.05;
-	float bias = 0;
-	float shadow = currentDepth - bias > closestDepth ? 1.0 : 0.0;
+// Directional light cascades (see fsPBR.frag)
+float shadowCalculation(vec4 fragPosLightSpace, sampler2DArray shadowMap, int layer){
+	vec3 projCoords = fragPosLightSpace.xyz / fragPosLightSpace.w * 0.5 + 0.5;
+	if(projCoords.z > 1.0) return 0.0;
 
-	return shadow;
+	float shadow = 0;
+	vec2 texelSize = 1.0 / textureSize(shadowMap, 0).xy;
+	for(int x = -1; x <= 1; ++x)
+		for(int y = -1; y <= 1; ++y)
+			shadow += projCoords.z > texture(shadowMap, vec3(projCoords.xy + vec2(x, y) * texelSize, layer)).r ? 1.0 : 0.0;
+	return shadow / 9.0;
+}
+
+// Fraction of an EVSM moments fetch in front of t (one warp: mean and mean of squares), Chebyshev's upper bound
+float chebyshev(vec2 moments, float t, float minVariance){
+	if(t <= moments.x) return 1.0;
+	float variance = max(moments.y - moments.x * moments.x, minVariance);
+	float d = t - moments.x;
+	return variance / (variance + d * d);
+}
+
+// Fraction in shadow of linear depth (0 - 1) against filtered moments: the lower bound of both warps, minus the
+// light bleeding cut (ShadowMoments::shadow)
+float evsmShadow(vec4 moments, float depth){
+	depth = depth * 2.0 - 1.0;
+	float pos = exp(shadowExponents.x * depth);
+	float neg = -exp(-shadowExponents.y * depth);
+	float posDeviation = EVSM_MIN_DEVIATION * shadowExponents.x * pos;
+	float negDeviation = EVSM_MIN_DEVIATION * shadowExponents.y * neg;
+	float lit = min(chebyshev(moments.xy, pos, posDeviation * posDeviation), chebyshev(moments.zw, neg, negDeviation * negDeviation));
+	return 1.0 - clamp((lit - shadowLightBleed) / (1.0 - shadowLightBleed), 0.0, 1.0);
+}
+
+// Mip of a moments map (size texels per side) whose texels cover the fragment, texel: world size of a level 0 texel
+// there. The last levels (under 2 x 2) are left out
+float momentsLod(float texel, float size){
+	return clamp(log2(fragWidth / texel), 0.0, max(log2(size) - 1.0, 0.0));
+}
+
+// Moments of an atlas tile (size moments texels per side), trilinear, kept inside the tile at that level
+vec4 atlasMoments(vec2 corner, float size, vec2 uv, float lod){
+	float border = 0.5 * exp2(ceil(lod));
+	vec2 texel = clamp(uv * size, vec2(border), vec2(size - border));
+	return textureLod(shadowMomentsAtlas, vec3(corner + texel / vec2(textureSize(shadowMomentsAtlas, 0).xy), 0.0), lod);
+}
+
+// Directional light, EVSM: one fetch of the moments of the cascade
+float cascadeMomentsShadow(vec4 fragPosLightSpace, int layer){
+	vec3 projCoords = fragPosLightSpace.xyz / fragPosLightSpace.w * 0.5 + 0.5;
+	if(projCoords.z > 1.0) return 0.0;
+
+	// Orthographic: the first row of the matrix is 2 / width long
+	mat4 m = dlightSpaceMatrix[layer];
+	float size = float(textureSize(dShadowMoments, 0).x);
+	float lod = momentsLod(2.0 / (length(vec3(m[0][0], m[1][0], m[2][0])) * size), size);
+	return evsmShadow(textureLod(dShadowMoments, vec3(projCoords.xy, layer), lod), projCoords.z);
+}
+
+float cascadeShadow(){
+	float depth = -(view * vec4(FragPos, 1.0)).z;
+	for(int c = 0; c < CASCADES; ++c)
+	{
+		if(depth >= cascadeSplits[c]) continue;
+		vec4 fragPosLightSpace = dlightSpaceMatrix[c] * vec4(FragPos, 1.0);
+		return dShadowFilter == 1 ? cascadeMomentsShadow(fragPosLightSpace, c) : shadowCalculation(fragPosLightSpace, dShadowMap, c);
+	}
+	return 0.0;
+}
+
+// Depth of an atlas tile (corner in atlas uv, size texels per side) at uv in [0, 1] across the tile. Kept half a
+// texel inside, lookups never read the neighbour tiles
+float atlasDepth(vec2 corner, float size, vec2 uv){
+	vec2 texel = clamp(uv * size, vec2(0.5), vec2(size - 0.5));
+	return texture(shadowAtlas, corner + texel / vec2(textureSize(shadowAtlas, 0))).r;
+}
+
+// Spot light: PCF or EVSM in its atlas tile. Outside the light frustum, no shadow
+float spotShadow(int i){
+	if(sShadowTile[i].z <= 0.0) return 0.0;
+
+	vec4 fragPosLightSpace = slightSpaceMatrix[i] * vec4(FragPos, 1.0);
+	vec3 projCoords = fragPosLightSpace.xyz / fragPosLightSpace.w * 0.5 + 0.5;
+	if(projCoords.z > 1.0 || any(lessThan(projCoords.xy, vec2(0.0))) || any(greaterThan(projCoords.xy, vec2(1.0)))) return 0.0;
+
+	if(sShadowFilter[i].x > 0.5)
+	{
+		// Moments hold view depth / far (perspective: w), texels widen with it
+		float size = sShadowTile[i].z / SHADOW_MOMENTS_SCALE;
+		float w = sShadowFilter[i].y > 0.0 ? fragPosLightSpace.w : 1.0;
+		mat4 m = slightSpaceMatrix[i];
+		float lod = momentsLod(2.0 * w / (length(vec3(m[0][0], m[1][0], m[2][0])) * size), size);
+		float depth = sShadowFilter[i].y > 0.0 ? fragPosLightSpace.w / sShadowFilter[i].y : projCoords.z;
+		return evsmShadow(atlasMoments(sShadowTile[i].xy, size, projCoords.xy, lod), depth);
+	}
+
+	float shadow = 0;
+	for(int x = -1; x <= 1; ++x)
+		for(int y = -1; y <= 1; ++y)
+			shadow += projCoords.z > atlasDepth(sShadowTile[i].xy, sShadowTile[i].z, projCoords.xy + vec2(x, y) / sShadowTile[i].z) ? 1.0 : 0.0;
+	return shadow / 9.0;
+}
+
+// Cube face a direction points to and where it lands on it, as a cube map lookup picks them
+vec2 cubeFaceUV(vec3 d, out int face){
+	vec3 a = abs(d);
+	if(a.x >= a.y && a.x >= a.z){
+		face = d.x > 0.0 ? 0 : 1;
+		return vec2(d.x > 0.0 ? -d.z : d.z, -d.y) / a.x * 0.5 + 0.5;
+	}
+	if(a.y >= a.z){
+		face = d.y > 0.0 ? 2 : 3;
+		return vec2(d.x, d.y > 0.0 ? d.z : -d.z) / a.y * 0.5 + 0.5;
+	}
+	face = d.z > 0.0 ? 4 : 5;
+	return vec2(d.z > 0.0 ? d.x : -d.x, -d.y) / a.z * 0.5 + 0.5;
+}
+
+// Point light: the atlas tile of the cube face towards the fragment holds linear depth / farPlane
+float pointShadow(PointLight light){
+	if(light.shadowSize <= 0.0) return 0.0;
+
+	vec3 fragToLight = FragPos - light.pos;
+	int face;
+	vec2 uv = cubeFaceUV(fragToLight, face);
+	vec4 corners = light.shadowFaces[face / 2];
+	vec2 corner = (face & 1) == 0 ? corners.xy : corners.zw;
+
+	if(light.shadowFilter == 1)
+	{
+		// A 90 degree face: texels 2 / size wide at unit distance along its axis
+		float size = light.shadowSize / SHADOW_MOMENTS_SCALE;
+		vec3 a = abs(fragToLight);
+		float lod = momentsLod(2.0 * max(max(a.x, a.y), a.z) / size, size);
+		return evsmShadow(atlasMoments(corner, size, uv, lod), length(fragToLight) / light.farPlane);
+	}
+
+	float closestDepth = atlasDepth(corner, light.shadowSize, uv) * light.farPlane;
+	return length(fragToLight) > closestDepth ? 1.0 : 0.0;
 }
 
 vec3 calcPointLights(){
@@ -183,7 +320,7 @@ vec3 calcPointLights(){
 
 		float shadow = 0;
 
-		shadow = shadowCalculation(FragPos, p.pos, pShadowMap[i], p.farPlane);
+		shadow = pointShadow(p);
 
 		result += max((ambient + (1-shadow) * (specular, + diffuse)) * attenuation, 0);
 		//result += vec3( i == 0 ? 1:0,i == 1 ? 1:0,i == 2 ? 1:0);
@@ -212,7 +349,7 @@ vec3 calcDirectLight(){
 
 	vec3 specular =  vec3(spec * dirlight.color * dirlight.specular * vec3(texS));
 
-	float shadow = shadowCalculation(dlightSpaceMatrix * vec4(FragPos, 1.0), dShadowMap);
+	float shadow = cascadeShadow();
 
 	return ambient + (1.0 - shadow) * (diffuse + specular);
 	//return vec4(shadow,shadow,shadow,texD.a);
@@ -255,7 +392,7 @@ vec3 calcSpotLights(){
 		float epsilon = iCutOff - oCutOff;
 		float intensity = clamp((theta - oCutOff) / epsilon, 0.0, 1.0);
 
-		float shadow = shadowCalculation(slightSpaceMatrix[i] * vec4(FragPos, 1.0), sShadowMap[i]);
+		float shadow = spotShadow(i);
 
 		result += max((ambient + (1 - shadow)*(specular, + diffuse)) * attenuation * intensity, 0);
 		//result += max(intensity * attenuation, 0);
@@ -287,6 +424,7 @@ void main(){
 
 	FragPos = texture(FragPosTex, TexCoord).rgb;
 	viewDir = normalize(cameraPos -  FragPos);
+	fragWidth = length(fwidth(FragPos));
 
 	//vec3 result;
 
@@ -0,0 +1,22 @@
+#version 450 core
+
+// Box proxy for occlusion queries, 36 vertices from gl_VertexID, no vertex buffer
+uniform mat4 viewProjection;
+uniform vec3 boxMin;
+uniform vec3 boxMax;
+
+const int indices[36] = int[36](
+	0, 2, 1, 1, 2, 3,	// -Z
+	4, 5, 6, 5, 7, 6,	// +Z
+	0, 1, 4, 1, 5, 4,	// -Y
+	2, 6, 3, 3, 6, 7,	// +Y
+	0, 4, 2, 2, 4, 6,	// -X
+	1, 3, 5, 3, 7, 5	// +X
+);
+
+void main()
+{
+	int corner = indices[gl_VertexID];
+	vec3 t = vec3(corner & 1, (corner >> 1) & 1, (corner >> 2) & 1);
+	gl_Position = viewProjection * vec4(mix(boxMin, boxMax, t), 1.0);
+}
@@ -1,9 +1,14 @@
 #version 330 core
 layout (location = 0) in vec3 aPos;
+layout (location = 4) in mat4 iModel;	// Depth-only batches: per instance (see DepthGeometry)
+layout (location = 8) in int iFaceMask;
 
 uniform mat4 model;
+uniform bool batched = false;
+flat out int vFaceMask; // The instance's, the geometry shader uses its faceMask uniform otherwise
 
 void main()
 {
-	gl_Position = model * vec4(aPos, 1.0);
+	vFaceMask = iFaceMask;
+	gl_Position = (batched ? iModel : model) * vec4(aPos, 1.0);
 }
\ No newline at end of file
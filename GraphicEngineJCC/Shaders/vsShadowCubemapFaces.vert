@@ -0,0 +1,40 @@
+#version 410 core
+#extension GL_ARB_shader_viewport_layer_array : enable
+#extension GL_AMD_vertex_shader_viewport_index : enable
+layout (location = 0) in vec3 aPos;
+layout (location = 4) in mat4 iModel;	// Depth-only batches: per instance (see DepthGeometry)
+layout (location = 8) in int iFaceMask;
+
+uniform mat4 model;
+uniform bool batched = false; // Model and face from the instance, one instance per face
+uniform mat4 shadowMatrices[6];
+uniform int faceMask = 63; // Faces the object's bounds touch (bit per face), set per object by the RenderQueue
+uniform int face = -1; // One face per draw (six passes), -1: one instance per face of faceMask, each to its own viewport
+out vec4 FragPos;
+
+void main()
+{
+	int f = face;
+	if(f < 0 && batched) f = findLSB(iFaceMask);
+	else if(f < 0)
+	{
+		// The n-th face of the mask (the RenderQueue draws as many instances as the mask has faces)
+		int n = gl_InstanceID % bitCount(faceMask);
+		for(f = 0; f < 5; ++f)
+		{
+			if((faceMask & (1 << f)) == 0) continue;
+			if(n == 0) break;
+			--n;
+		}
+	}
+
+	if(face < 0)
+	{
+#if defined(GL_ARB_shader_viewport_layer_array) || defined(GL_AMD_vertex_shader_viewport_index)
+		gl_ViewportIndex = f; // Each face is a tile of the shadow atlas, one viewport per tile
+#endif
+	}
+
+	FragPos = (batched ? iModel : model) * vec4(aPos, 1.0);
+	gl_Position = shadowMatrices[f] * FragPos;
+}
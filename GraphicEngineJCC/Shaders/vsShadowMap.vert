@@ -1,10 +1,12 @@
 #version 330 core
 layout (location = 0) in vec3 aPos;
+layout (location = 4) in mat4 iModel; // Depth-only batches: per instance (see DepthGeometry)
 
 uniform mat4 lightSpaceMatrix;
 uniform mat4 model;
+uniform bool batched = false;
 
 void main()
 {
-	gl_Position = lightSpaceMatrix * model * vec4(aPos, 1.0);
+	gl_Position = lightSpaceMatrix * (batched ? iModel : model) * vec4(aPos, 1.0);
 }
\ No newline at end of file
@@ -9,41 +9,32 @@ layout (location = 2) in vec2 aTexCoord;
 layout (location = 3) in vec3 aTangent;
 layout (location = 4) in mat4 iModel;
 
+layout (std430, binding = 1) readonly buffer InstanceModels
+{
+	mat4 instanceModels[];	// TransformSystem world matrices
+};
+
 out vec2 TexCoord;
 out vec3 FragPos;
 out vec3 Normal;
-out mat3 TBN;
-out vec4 dFragPosLightSpace;
-out vec4 sFragPosLightSpace[MAX_SPOT_LIGHT];
+out vec3 Tangent;	// TBN is built in the fragment shader
 
 uniform bool multipleInstances = false;
+uniform bool storageInstances = false; // Instance matrices from InstanceModels instead of iModel
 uniform mat4 model;
+uniform mat3 normalMatrix; // transpose(inverse(model)), computed once per object on the CPU
 uniform mat4 view;
 uniform mat4 projection;
-uniform mat4 dlightSpaceMatrix;
-uniform mat4 slightSpaceMatrix[MAX_SPOT_LIGHT];
 
 void main()
 {
-	if(multipleInstances) gl_Position = projection * view * iModel * vec4(aPos, 1.0);
+	mat4 instanceModel = storageInstances ? instanceModels[gl_InstanceID] : iModel;
+	if(multipleInstances) gl_Position = projection * view * instanceModel * vec4(aPos, 1.0);
 	else gl_Position = projection * view * model * vec4(aPos, 1.0);
 
 	FragPos = vec3(model * vec4(aPos, 1.0)); // World space fragment to light calc
-	Normal = mat3(transpose(inverse(model))) * aNormal; // Avoids bad normal vector scalation
-
-	dFragPosLightSpace = dlightSpaceMatrix * vec4(FragPos, 1.0);
-	for(int i = 0; i< MAX_SPOT_LIGHT; i++)
-	{
-		sFragPosLightSpace[i] = slightSpaceMatrix[i] * vec4(FragPos, 1.0);
-	}
+	Normal = normalMatrix * aNormal; // Avoids bad normal vector scalation
 
 	TexCoord = aTexCoord;
-
-	vec3 T = normalize(vec3(model * vec4(aTangent, 0.0)));
-	vec3 N = normalize(vec3(model * vec4(aNormal, 0.0)));
-	//vec3 B = cross(T, N);
-	vec3 B = cross(N, T);
-	//TBN = transpose(mat3(T, B, N));
-	TBN = mat3(T, B, N);
-
+	Tangent = mat3(model) * aTangent;
 }
\ No newline at end of file
@@ -0,0 +1,319 @@
+#ifndef SHADOW_ATLAS_H
+#define SHADOW_ATLAS_H
+
+#include "glad/glad.h"
+#include "glm/glm.hpp"
+#include "LightBase.h"
+#include "Camera.h"
+#include "Frustum.h"
+#include "GLState.h"
+#include <vector>
+#include <algorithm>
+#include <functional>
+#include <iostream>
+
+// One depth texture shared by the spot and point light shadows (the directional light keeps its cascades). Every
+// frame each shadowed light asks for square tiles (1 per spot light, 1 per cube face of a point light) sized from
+// how much of the screen its range covers and how bright it is, in powers of two between MIN_TILE and MAX_TILE.
+// If the tiles don't fit the atlas every tile is halved (down to MIN_TILE) until they do, then the least important
+// lights are dropped. Power of two squares placed largest first along a Z-order curve always pack without holes, so
+// when the requests change the whole atlas is repacked. A request only changes once the wanted size is 3/4 of a power
+// of two away from the last one, the layout stays put while the camera moves a little.
+class ShadowAtlas
+{
+	template<class T> using vector = std::vector<T>;
+	using vec2 = glm::vec2;
+	using vec3 = glm::vec3;
+
+public:
+	static const unsigned int MIN_TILE = 128;
+	static const unsigned int MAX_TILE = 2048;
+
+	// A shadowed light of the last allocate()
+	struct Tile
+	{
+		const char* light;			// "Spot" or "Point"
+		int index;					// In its light vector
+		unsigned int tiles;			// 1 or 6
+		float importance;			// Screen coverage (0 - 1) by brightness
+		unsigned int requested;		// Texels per side
+		unsigned int size;			// Granted, 0: dropped for the budget
+	};
+
+private:
+	static unsigned int texture;
+	static unsigned int atlasSize;		// Texels per side
+	static size_t budget;				// Bytes
+	static GLenum format;				// GL_DEPTH_COMPONENT32F or GL_DEPTH_COMPONENT16
+	static int maxTextureSize;
+
+	static vector<Tile> tiles;
+	static vector<LightBase*> owners;	// Light of each tile
+	static vector<LightBase*> layoutOwners; // Light and size of every tile of the packed layout
+	static vector<unsigned int> layoutSizes;
+	static vector<unsigned int> order;	// Tile indices, sorted by fit() and pack(). Kept, allocate() doesn't allocate
+	static unsigned int repacks;
+
+	ShadowAtlas() {}
+	~ShadowAtlas() {}
+
+public:
+	// The texture is created by the first setBudget (see ShadowResources)
+	static void init()
+	{
+		glGetIntegerv(GL_MAX_TEXTURE_SIZE, &maxTextureSize);
+	}
+
+	// The largest power of two square (MAX_TILE at least) of depthFormat fitting budgetBytes
+	static unsigned int sizeFor(size_t budgetBytes, GLenum depthFormat = GL_DEPTH_COMPONENT32F)
+	{
+		size_t limit = maxTextureSize > 0 ? (size_t)maxTextureSize : 16384;
+		size_t texel = depthFormat == GL_DEPTH_COMPONENT16 ? 2 : 4;
+		unsigned int size = MAX_TILE;
+		while ((size_t)size * 2 <= limit && (size_t)size * 2 * size * 2 * texel <= budgetBytes) size *= 2;
+		return size;
+	}
+
+	// Resizes the atlas (only the size if there is no texture yet) and forces a repack, if its size or format change.
+	// True if it did
+	static bool setBudget(size_t budgetBytes, GLenum depthFormat = GL_DEPTH_COMPONENT32F)
+	{
+		budget = budgetBytes;
+		unsigned int size = sizeFor(budgetBytes, depthFormat);
+		if (texture != 0 && size == atlasSize && depthFormat == format) return false;
+
+		atlasSize = size;
+		format = depthFormat;
+		layoutOwners.clear();
+		layoutSizes.clear();
+
+		if (maxTextureSize == 0) return true; // Not initialized: CPU only
+		if (texture == 0) glGenTextures(1, &texture);
+
+		glBindTexture(GL_TEXTURE_2D, texture);
+		glTexImage2D(GL_TEXTURE_2D, 0, format, atlasSize, atlasSize, 0, GL_DEPTH_COMPONENT, format == GL_DEPTH_COMPONENT16 ? GL_UNSIGNED_SHORT : GL_FLOAT, NULL);
+
+		// Lookups stay inside their tile (see fsPBR.frag), no border needed
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+		GLState::invalidate();
+		return true;
+	}
+
+	// Deletes the texture, no light casts into it
+	static void release()
+	{
+		if (texture == 0) return;
+		glDeleteTextures(1, &texture);
+		texture = 0;
+		layoutOwners.clear();
+		layoutSizes.clear();
+	}
+
+	// Sizes and places the tiles of every shadowed light for this camera, then writes shadowResolution and
+	// shadowTiles of each light. Lights out of view or without castShadows get shadowResolution 0. CPU only
+	static void allocate(const Camera& camera, vector<SpotLight>& spotLights, vector<PointLight>& pointLights)
+	{
+		tiles.clear();
+		owners.clear();
+
+		Frustum view = Frustum::fromMatrix(camera.getProjectionMatrix(true) * camera.getViewMatrix());
+		float tanHalf = glm::tan(glm::radians(camera.getZoom()) * 0.5f);
+		float height = (float)camera.getCameraHeight();
+
+		for (size_t i = 0; i < spotLights.size(); i++)
+			request(spotLights[i], "Spot", (int)i, 1, spotLights[i].getPosition(), spotLights[i].getRange(), view, camera.getPosition(), tanHalf, height);
+
+		for (size_t i = 0; i < pointLights.size(); i++)
+			request(pointLights[i], "Point", (int)i, 6, pointLights[i].getPosition(), pointLights[i].getRange(), view, camera.getPosition(), tanHalf, height);
+
+		fit();
+		pack();
+	}
+
+	static unsigned int getTexture() { return texture; }
+	static unsigned int getAtlasSize() { return atlasSize; }
+	static size_t getBudget() { return budget; }
+	static GLenum getFormat() { return format; }
+	static unsigned int getRepacks() { return repacks; }
+	static const vector<Tile>& getTiles() { return tiles; }
+
+	static size_t getMemory()
+	{
+		return (size_t)atlasSize * atlasSize * (format == GL_DEPTH_COMPONENT16 ? 2 : 4);
+	}
+
+	// Texels of the atlas taken by the last allocate()
+	static size_t getUsedTexels()
+	{
+		size_t used = 0;
+		for (const Tile& t : tiles) used += (size_t)t.tiles * t.size * t.size;
+		return used;
+	}
+
+	static void printStats()
+	{
+		unsigned int dropped = 0;
+		for (const Tile& t : tiles) dropped += t.size == 0 ? 1 : 0;
+
+		std::cout << "SHADOW_ATLAS::" << atlasSize << "^2, " << (format == GL_DEPTH_COMPONENT16 ? "16 bit, " : "32F, ") << getMemory() / (1024 * 1024) << " MB (budget " << budget / (1024 * 1024) << " MB), "
+			<< 100.f * getUsedTexels() / ((float)atlasSize * atlasSize) << "% used by " << tiles.size() - dropped << " lights, " << dropped << " dropped, "
+			<< repacks << " repacks" << std::endl;
+		for (const Tile& t : tiles)
+		{
+			std::cout << "SHADOW_ATLAS::" << t.light << " light " << t.index << ": " << t.size << "^2";
+			if (t.tiles > 1) std::cout << " x " << t.tiles;
+			if (t.size != t.requested) std::cout << " (" << t.requested << "^2 requested)";
+			std::cout << ", importance " << t.importance << std::endl;
+		}
+	}
+
+private:
+	// Coverage: how much of the screen height the range sphere spans (1 if the camera is inside it)
+	static void request(LightBase& light, const char* type, int index, unsigned int faces, vec3 center, float radius,
+		const Frustum& view, vec3 eye, float tanHalf, float height)
+	{
+		AABB box;
+		box.min = center - vec3(radius);
+		box.max = center + vec3(radius);
+		if (!light.castShadows || !view.intersects(box))
+		{
+			light.shadowResolution = 0;
+			light.shadowRequest = 0;
+			return;
+		}
+
+		float d = glm::length(center - eye);
+		float coverage = d <= radius ? 1.f : glm::min(radius / glm::sqrt(d * d - radius * radius) / tanHalf, 1.f);
+		float importance = coverage * glm::clamp(glm::max(glm::max(light.color.r, light.color.g), light.color.b), 0.1f, 1.f);
+
+		// Nearest power of two, the last one until the wanted size moves far enough from it
+		float wanted = glm::log2(glm::clamp(importance * height, (float)MIN_TILE, (float)MAX_TILE));
+		int exponent = (int)glm::round(wanted);
+		if (light.shadowRequest > 0)
+		{
+			float last = glm::log2((float)light.shadowRequest);
+			if (glm::abs(wanted - last) < 0.75f) exponent = (int)glm::round(last);
+		}
+		light.shadowRequest = 1u << exponent;
+
+		Tile t;
+		t.light = type;
+		t.index = index;
+		t.tiles = faces;
+		t.importance = importance;
+		t.requested = 1u << exponent;
+		t.size = t.requested;
+		tiles.push_back(t);
+		owners.push_back(&light);
+	}
+
+	// Halves every tile until they fit, then drops the least important lights. The same for the same requests, while
+	// the lights keep asking for the same sizes nothing moves
+	static void fit()
+	{
+		size_t capacity = (size_t)atlasSize * atlasSize;
+		size_t used = getUsedTexels();
+		bool halved = true;
+		while (used > capacity && halved)
+		{
+			used = 0;
+			halved = false;
+			for (Tile& t : tiles)
+			{
+				if (t.size > MIN_TILE)
+				{
+					t.size /= 2;
+					halved = true;
+				}
+				used += (size_t)t.tiles * t.size * t.size;
+			}
+		}
+
+		sortByImportance();
+		for (unsigned int i : order)
+		{
+			if (used <= capacity) break;
+			used -= (size_t)tiles[i].tiles * tiles[i].size * tiles[i].size;
+			tiles[i].size = 0;
+		}
+	}
+
+	// Largest tiles first, each one at the next free cell of a Z-order curve over MIN_TILE cells: a block of
+	// k x k cells starts at a multiple of k^2 along the curve, which is where the previous, larger ones ended.
+	// Same size tiles in light order, so the layout is kept as is if every light asks for the same tiles as last time
+	static void pack()
+	{
+		order.resize(tiles.size());
+		for (unsigned int i = 0; i < order.size(); i++) order[i] = i;
+		std::sort(order.begin(), order.end(), [](unsigned int a, unsigned int b)
+			{
+				return tiles[a].size != tiles[b].size ? tiles[a].size > tiles[b].size : std::less<LightBase*>()(owners[a], owners[b]);
+			});
+
+		bool same = order.size() == layoutOwners.size();
+		for (size_t k = 0; k < order.size() && same; k++)
+			same = owners[order[k]] == layoutOwners[k] && tiles[order[k]].size == layoutSizes[k];
+
+		for (unsigned int i : order) owners[i]->shadowResolution = tiles[i].size;
+		if (same) return;
+
+		layoutOwners.clear();
+		layoutSizes.clear();
+		unsigned int cursor = 0;
+		for (unsigned int i : order)
+		{
+			layoutOwners.push_back(owners[i]);
+			layoutSizes.push_back(tiles[i].size);
+			if (tiles[i].size == 0) continue;
+
+			unsigned int cells = tiles[i].size / MIN_TILE;
+			for (unsigned int f = 0; f < tiles[i].tiles; f++)
+			{
+				owners[i]->shadowTiles[f] = vec2((float)(compact(cursor) * MIN_TILE), (float)(compact(cursor >> 1) * MIN_TILE)) / (float)atlasSize;
+				cursor += cells * cells;
+			}
+		}
+		repacks++;
+	}
+
+	// Tile indices from the least important, in order
+	static void sortByImportance()
+	{
+		order.resize(tiles.size());
+		for (unsigned int i = 0; i < order.size(); i++) order[i] = i;
+		std::sort(order.begin(), order.end(), [](unsigned int a, unsigned int b)
+			{
+				return tiles[a].importance != tiles[b].importance ? tiles[a].importance < tiles[b].importance : a < b;
+			});
+	}
+
+	// Even bits of a Z-order index, the x coordinate (odd bits, shifted down: y)
+	static unsigned int compact(unsigned int v)
+	{
+		v &= 0x55555555;
+		v = (v | (v >> 1)) & 0x33333333;
+		v = (v | (v >> 2)) & 0x0F0F0F0F;
+		v = (v | (v >> 4)) & 0x00FF00FF;
+		v = (v | (v >> 8)) & 0x0000FFFF;
+		return v;
+	}
+};
+
+// Static variables initialization
+unsigned int ShadowAtlas::texture = 0;
+unsigned int ShadowAtlas::atlasSize = ShadowAtlas::MAX_TILE;
+size_t ShadowAtlas::budget = 0;
+GLenum ShadowAtlas::format = GL_DEPTH_COMPONENT32F;
+int ShadowAtlas::maxTextureSize = 0;
+
+std::vector<ShadowAtlas::Tile> ShadowAtlas::tiles;
+std::vector<LightBase*> ShadowAtlas::owners;
+std::vector<LightBase*> ShadowAtlas::layoutOwners;
+std::vector<unsigned int> ShadowAtlas::layoutSizes;
+std::vector<unsigned int> ShadowAtlas::order;
+unsigned int ShadowAtlas::repacks = 0;
+
+#endif SHADOW_ATLAS_H
@@ -0,0 +1,255 @@
+#ifndef SHADOW_CACHE_H
+#define SHADOW_CACHE_H
+
+#include "glad/glad.h"
+#include "glm/glm.hpp"
+#include "ECS.h"
+#include "Components.h"
+#include "ArrayView.h"
+#include "GLState.h"
+#include <vector>
+#include <unordered_map>
+#include <cstdint>
+#include <cstring>
+
+// What each shadow view (a cascade, the atlas tile of a spot light, the tiles of a point light) was last rendered
+// with, as two keys: the view itself (matrices, where it is drawn) mixed with the casters inside it and the version
+// of their bounds, which changes whenever they move. A view whose keys didn't change keeps last frame's depth.
+// With layers, casters whose bounds stayed put for STATIC_FRAMES frames are static: they are drawn into a copy of the
+// shadow texture only when that set changes, and the rest (dynamic) are drawn every frame they change over a copy of
+// the static depth.
+class ShadowCache
+{
+	template<class T> using vector = std::vector<T>;
+
+public:
+	static const unsigned int STATIC_FRAMES = 30;
+
+	enum Update
+	{
+		SKIPPED,	// Nothing relevant changed
+		DYNAMIC,	// Static depth copied in, dynamic casters drawn over it
+		STATIC,		// Static layer redrawn, then as DYNAMIC
+		FULL		// Every caster drawn (caching off, or layers off and something changed)
+	};
+
+	// Updates of each kind in the last complete frame
+	struct Stats
+	{
+		unsigned int updates[4] = {};
+	};
+
+	ShadowCache() {}
+
+	~ShadowCache()
+	{
+		for (auto& copy : staticCopies) glDeleteTextures(1, &copy.second.texture);
+	}
+
+	ShadowCache(const ShadowCache&) = delete;
+	ShadowCache& operator=(const ShadowCache&) = delete;
+
+	bool isEnabled() const { return enabled; }
+	bool layersEnabled() const { return enabled && layers && layersAllowed; }
+	bool layersRequested() const { return enabled && layers; }
+
+	// Off: every view renders every frame. Forgets every view
+	void setEnabled(bool enabled)
+	{
+		this->enabled = enabled;
+		clear();
+	}
+
+	// Static and dynamic layers: one more texture like every shadow texture. Forgets every view
+	void setLayers(bool enabled)
+	{
+		layers = enabled;
+		clear();
+	}
+
+	// Whether the shadow memory budget has room for the layers (see ShadowResources). Refused, the static layers are
+	// deleted and the views render without them until they fit again. Forgets every view when it changes
+	void setLayersAllowed(bool allowed)
+	{
+		if (allowed == layersAllowed) return;
+		layersAllowed = allowed;
+		if (!allowed)
+		{
+			for (auto& copy : staticCopies) glDeleteTextures(1, &copy.second.texture);
+			staticCopies.clear();
+		}
+		clear();
+	}
+
+	bool areLayersAllowed() const { return layersAllowed; }
+
+	// Forces every view to render again, e.g. after editing a mesh without moving it
+	void clear()
+	{
+		entries.clear();
+	}
+
+	// Key of a view: any values that change what it renders, or where
+	static uint64_t mix(uint64_t h, uint64_t v)
+	{
+		v *= 0xFF51AFD7ED558CCDull;
+		v ^= v >> 33;
+		return (h ^ v) * 0xC4CEB9FE1A85EC53ull + 0x9E3779B97F4A7C15ull;
+	}
+
+	static uint64_t mix(uint64_t h, const float* values, int count)
+	{
+		for (int i = 0; i < count; i++)
+		{
+			uint32_t bits;
+			std::memcpy(&bits, &values[i], sizeof(bits));
+			h = mix(h, bits);
+		}
+		return h;
+	}
+
+	// Decides how the view (owner and slot identify it, e.g. a light and its cascade) is updated for these casters.
+	// With layers, fills staticCasters and dynamicCasters; without, the caller draws every caster
+	Update plan(const void* owner, int slot, uint64_t viewKey, ArrayView<Entity> casters, ComponentPool<Bounds>& bounds, unsigned int frame)
+	{
+		Update update = decide(owner, slot, viewKey, casters, bounds, frame);
+		frameStats.updates[update]++;
+		return update;
+	}
+
+	const vector<Entity>& getStaticCasters() const { return staticCasters; }
+	const vector<Entity>& getDynamicCasters() const { return dynamicCasters; }
+
+	// The static layer of a shadow texture: same format and size, created (or resized) on first use
+	unsigned int staticLayer(unsigned int texture, GLenum target, GLenum format, unsigned int width, unsigned int height, unsigned int depth = 1)
+	{
+		StaticCopy& copy = staticCopies[texture];
+		if (copy.texture != 0 && copy.format == format && copy.width == width && copy.height == height && copy.depth == depth) return copy.texture;
+
+		// Sized storage can't change, a new texture then
+		if (copy.texture != 0) glDeleteTextures(1, &copy.texture);
+		glGenTextures(1, &copy.texture);
+		copy.format = format;
+		copy.width = width;
+		copy.height = height;
+		copy.depth = depth;
+
+		GLenum type = format == GL_DEPTH_COMPONENT16 ? GL_UNSIGNED_SHORT : GL_FLOAT;
+		glBindTexture(target, copy.texture);
+		if (target == GL_TEXTURE_2D_ARRAY) glTexImage3D(target, 0, format, width, height, depth, 0, GL_DEPTH_COMPONENT, type, NULL);
+		else glTexImage2D(target, 0, format, width, height, 0, GL_DEPTH_COMPONENT, type, NULL);
+		glTexParameteri(target, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+		glTexParameteri(target, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+		GLState::invalidate();
+
+		// The views drawn into the old one have nothing to copy from
+		clear();
+		return copy.texture;
+	}
+
+	// Deletes the static layer of a shadow texture that is gone
+	void release(unsigned int texture)
+	{
+		std::unordered_map<unsigned int, StaticCopy>::iterator itr = staticCopies.find(texture);
+		if (itr == staticCopies.end()) return;
+		glDeleteTextures(1, &itr->second.texture);
+		staticCopies.erase(itr);
+	}
+
+	// Bytes of the static layers
+	size_t getMemory() const
+	{
+		size_t bytes = 0;
+		for (const auto& copy : staticCopies)
+			bytes += (size_t)copy.second.width * copy.second.height * copy.second.depth * (copy.second.format == GL_DEPTH_COMPONENT16 ? 2 : 4);
+		return bytes;
+	}
+
+	// Call at the start of each frame
+	void beginFrame()
+	{
+		lastFrameStats = frameStats;
+		frameStats = Stats();
+	}
+
+	const Stats& getLastFrameStats() const
+	{
+		return lastFrameStats;
+	}
+
+private:
+	struct Entry
+	{
+		uint64_t staticKey = 0;		// Every caster, without layers
+		uint64_t dynamicKey = 0;
+	};
+
+	struct StaticCopy
+	{
+		unsigned int texture = 0;
+		GLenum format = GL_DEPTH_COMPONENT32F;
+		unsigned int width = 0, height = 0, depth = 0;
+	};
+
+	bool enabled = true;
+	bool layers = false;
+	bool layersAllowed = true;
+	std::unordered_map<uint64_t, Entry> entries;
+	std::unordered_map<unsigned int, StaticCopy> staticCopies; // By shadow texture
+	vector<Entity> staticCasters;
+	vector<Entity> dynamicCasters;
+
+	Stats frameStats;
+	Stats lastFrameStats;
+
+	Update decide(const void* owner, int slot, uint64_t viewKey, ArrayView<Entity> casters, ComponentPool<Bounds>& bounds, unsigned int frame)
+	{
+		staticCasters.clear();
+		dynamicCasters.clear();
+		if (!enabled) return FULL;
+		bool layered = layersEnabled();
+
+		// Caster sets summed, their order doesn't matter. No bounds: nothing tells when it moves, always dynamic
+		uint64_t staticSum = 0, dynamicSum = 0;
+		bool alwaysDirty = false;
+		for (Entity e : casters)
+		{
+			const Bounds* b = bounds.tryGet(e);
+			if (b == nullptr) alwaysDirty = true;
+
+			uint64_t h = mix(mix(0, e.id), b ? b->version : 0);
+			if (layered && b && b->changedFrame + STATIC_FRAMES <= frame)
+			{
+				staticSum += h;
+				staticCasters.push_back(e);
+			}
+			else
+			{
+				dynamicSum += h;
+				dynamicCasters.push_back(e);
+			}
+		}
+
+		Entry& entry = entries[mix(mix(0, (uint64_t)(uintptr_t)owner), (uint64_t)slot)];
+		uint64_t staticKey = mix(viewKey, staticSum);
+		uint64_t dynamicKey = alwaysDirty ? 0 : mix(viewKey, dynamicSum);
+
+		if (!layered)
+		{
+			if (staticKey == entry.staticKey && dynamicKey == entry.dynamicKey && !alwaysDirty) return SKIPPED;
+			entry.staticKey = staticKey;
+			entry.dynamicKey = dynamicKey;
+			return FULL;
+		}
+
+		Update update = SKIPPED;
+		if (staticKey != entry.staticKey) update = STATIC;
+		else if (dynamicKey != entry.dynamicKey || alwaysDirty) update = DYNAMIC;
+
+		entry.staticKey = staticKey;
+		entry.dynamicKey = dynamicKey;
+		return update;
+	}
+};
+
+#endif SHADOW_CACHE_H
@@ -4,180 +4,605 @@
 #include "glad/glad.h"
 #include "glm/glm.hpp"
 #include <vector>
-#include "Shader.h"
-#include "DrawableObject.h"
+#include "ShaderRegistry.h"
+#include "ECS.h"
+#include "Components.h"
+#include "SceneSystems.h"
+#include "RenderQueue.h"
 #include "Camera.h"
-//#include "LightBase.h"
+#include "LightBase.h"
+#include "ShadowAtlas.h"
+#include "ShadowResources.h"
+#include "ShadowCache.h"
+#include "ShadowMoments.h"
+#include "ShadowScheduler.h"
+#include <algorithm>
+#include <cstring>
 
 class ShadowMap
 {
+public:
+	// How a point light reaches its 6 cube faces
+	enum CubePath
+	{
+		GEOMETRY_SHADER,	// One draw per caster, the geometry shader emits each triangle once per face of its mask
+		VERTEX_VIEWPORT,	// One draw per caster, one instance per face, the vertex shader picks the viewport (needs an extension)
+		SIX_PASSES			// One pass per face, casters culled against that face only
+	};
+
+	// Casters of one light's shadow map in the last complete frame
+	struct CasterStats
+	{
+		const char* light;			// "Directional", "Spot" or "Point"
+		int index;					// Among the lights of that type, in render order
+		unsigned int candidates;	// Entities left by the light frustum / sphere
+		unsigned int casters;		// Intersecting the light volume, rendered
+		unsigned int faceRenders;	// Point lights: cube faces rendered, summed over the casters
+		unsigned int draws;			// Point lights: draw calls
+		ShadowCache::Update update;	// Skipped, dynamic layer only, or rendered
+	};
+
 private:
 
 	static unsigned int shadowMapFBO;
-	static unsigned int shadowWidth;
-	static unsigned int shadowHeight;
+	static unsigned int cascadeSize; // Each layer of a directional light's cascades
 
 	static bool initialized;
 
-	static Shader* shadowShader;
-	static Shader* shadowCubemapShader;
+	static std::shared_ptr<Shader> shadowShader;
+	static std::shared_ptr<Shader> shadowCubemapShader;
+	static std::shared_ptr<Shader> shadowCubemapFacesShader; // VERTEX_VIEWPORT and SIX_PASSES
+
+	static CubePath cubePath;
+	static bool vertexViewportIndex; // ARB_shader_viewport_layer_array or AMD_vertex_shader_viewport_index
+
+	static RenderQueue shadowQueue;
+	static std::vector<Entity> casters; // Entities inside the current light volume
+	static std::vector<Entity> sphereCasters; // Of a point light drawn face by face
+	static ShadowCache cache;
+
+	// Where a shadow view is drawn: squares of a 2D texture or of one layer of an array (1, or 6 for the cube faces)
+	struct View
+	{
+		unsigned int texture;
+		GLenum target;				// GL_TEXTURE_2D or GL_TEXTURE_2D_ARRAY
+		GLenum format;				// Depth format
+		unsigned int width, height, layers; // Of the texture
+		int layer;
+		unsigned int size;			// Of each square
+		glm::uvec2 corners[6];
+		unsigned int squares;
+	};
+
+	static std::vector<CasterStats> frameStats;
+	static std::vector<CasterStats> lastFrameStats;
 
 	ShadowMap() {}
 	~ShadowMap() {}
 
 public:
 
-	static void init(unsigned int width = 1024, unsigned int height = 1024)
+	// The cascades of the directional lights and the ShadowAtlas of the spot and point lights share budget (bytes),
+	// see ShadowResources
+	static void init(unsigned int cascadeResolution = 2048, size_t budget = 128 * 1024 * 1024)
 	{
-		shadowWidth = width;
-		shadowHeight = height;
-
-		// Delete default shader
-		ShadowMap::shadowShader->~Shader(); 
-		ShadowMap::shadowCubemapShader->~Shader();
+		cascadeSize = cascadeResolution;
+		ShadowAtlas::init();
+		ShadowResources::init(budget, cascadeResolution);
+		ShadowMoments::init();
 
 		// Create custom shaders
-		ShadowMap::shadowShader = new Shader("vsShadowMap.vert", "fsEmpty.frag"); 
-		ShadowMap::shadowCubemapShader = new Shader("vsShadowCubemap.vert", "fsLinearDepth.frag", "gsShadowCubemap.geom");
+		ShadowMap::shadowShader = ShaderRegistry::get("vsShadowMap.vert", "fsEmpty.frag"); 
+		ShadowMap::shadowCubemapShader = ShaderRegistry::get("vsShadowCubemap.vert", "fsLinearDepth.frag", "gsShadowCubemap.geom");
+		ShadowMap::shadowCubemapFacesShader = ShaderRegistry::get("vsShadowCubemapFaces.vert", "fsLinearDepth.frag");
+
+		GLint extensions = 0;
+		glGetIntegerv(GL_NUM_EXTENSIONS, &extensions);
+		for (GLint i = 0; i < extensions; i++)
+		{
+			const char* name = (const char*)glGetStringi(GL_EXTENSIONS, i);
+			if (std::strcmp(name, "GL_ARB_shader_viewport_layer_array") == 0 || std::strcmp(name, "GL_AMD_vertex_shader_viewport_index") == 0)
+				vertexViewportIndex = true;
+		}
+
+		// Casters draw positions only, batched (see RenderQueue::setDepthOnly)
+		shadowQueue.setDepthOnly(true);
 
 		//unsigned int depthMapFBO;
 		glGenFramebuffers(1, &shadowMapFBO);
 		initialized = true;
 	}
 
-	static void configureShadowMap(unsigned int& shadowMap)
+	// Call every frame before the shadow passes: cascades for the directional lights that cast shadows, the atlas
+	// sized and formatted for the others (see ShadowResources). The cached views go with the textures that changed
+	static void updateResources(std::vector<DirectionalLight>& directional, std::vector<SpotLight>& spotLights, std::vector<PointLight>& pointLights)
 	{
 		if (initialized == false) init();
+		if (!ShadowResources::update(directional, spotLights, pointLights, cache)) return;
+
+		cache.clear();
+		for (unsigned int texture : ShadowResources::getReleased())
+		{
+			cache.release(texture);
+			ShadowMoments::release(texture);
+		}
+	}
 
-		glGenTextures(1, &shadowMap);
-		glBindTexture(GL_TEXTURE_2D, shadowMap);
-		glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT, shadowWidth, shadowHeight, 0, GL_DEPTH_COMPONENT, GL_FLOAT, NULL);
+	static unsigned int getCascadeSize()
+	{
+		return cascadeSize;
+	}
 
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_BORDER);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_BORDER);
+	// Bytes of the cascades of one directional light, in the format of the last updateResources
+	static size_t getCascadeMemory()
+	{
+		return ShadowResources::cascadeBytes(ShadowResources::getCascadeFormat());
+	}
 
-		float borderColor[] = { 1.0f, 1.0f, 1.0f, 1.0f };
-		glTexParameterfv(GL_TEXTURE_2D, GL_TEXTURE_BORDER_COLOR, borderColor); // For avoid shadow artifact, add depth map texture with white borders
+	// Directional light: one layer per cascade (see fitCascades), with the casters inside each cascade volume
+	static void generateShadowMap(DirectionalLight& light, const Camera& camera, ArrayView<Entity> obj)
+	{
+		fitCascades(light, camera);
 
+		for (int c = 0; c < DirectionalLight::CASCADES; c++)
+		{
+			Frustum frustum = Frustum::fromMatrix(light.cascadeMatrices[c]);
+			collectCasters(obj, frustum);
+			unsigned int candidates = (unsigned int)casters.size();
+
+			// Casters sorted from the center of the near plane
+			glm::mat4 toWorld = glm::inverse(light.cascadeMatrices[c]);
+			glm::vec4 eye = toWorld * glm::vec4(0.f, 0.f, -1.f, 1.f);
+			glm::vec4 end = toWorld * glm::vec4(0.f, 0.f, 1.f, 1.f);
+			float depth = glm::length(glm::vec3(end) / end.w - glm::vec3(eye) / eye.w);
+
+			View view = { light.shadowMap, GL_TEXTURE_2D_ARRAY, ShadowResources::getCascadeFormat(), cascadeSize, cascadeSize, DirectionalLight::CASCADES, c, cascadeSize, {}, 1 };
+			uint64_t key = ShadowCache::mix(ShadowCache::mix(light.shadowMap, glm::value_ptr(light.cascadeMatrices[c]), 16), cascadeSize);
+			key = ShadowCache::mix(key, light.shadowFilter);
+			ShadowCache::Update update = renderShadowMap(view, &light, c, key, light.cascadeMatrices[c], frustum, glm::vec3(eye) / eye.w, depth);
+			filterView(light, view, update, 0.f);
+			record("Cascade", candidates, 0, update);
+		}
 	}
 
-	static void configureShadowCubeMap(unsigned int& shadowMap)
+	// Splits the camera frustum up to light.shadowDistance in cascades (practical split scheme) and fits an
+	// orthographic projection around each slice, stable as the camera moves and turns. CPU only
+	static void fitCascades(DirectionalLight& light, const Camera& camera)
 	{
-		if (initialized == false) init();
+		// Camera frustum corners, near then far
+		glm::mat4 inverse = glm::inverse(camera.getProjectionMatrix(true) * camera.getViewMatrix());
+		glm::vec3 nearCorners[4], farCorners[4];
+		for (int i = 0; i < 4; i++)
+		{
+			glm::vec4 ndc((i & 1) ? 1.f : -1.f, (i & 2) ? 1.f : -1.f, -1.f, 1.f);
+			glm::vec4 n = inverse * ndc;
+			ndc.z = 1.f;
+			glm::vec4 f = inverse * ndc;
+			nearCorners[i] = glm::vec3(n) / n.w;
+			farCorners[i] = glm::vec3(f) / f.w;
+		}
 
-		glGenTextures(1, &shadowMap);
-		glBindTexture(GL_TEXTURE_CUBE_MAP, shadowMap);
+		float nearPlane = glm::max(camera.getNearPlane(), 0.01f);
+		float farPlane = camera.getFarPlane();
+		float shadowFar = glm::min(farPlane, light.shadowDistance);
 
-		for (unsigned int j = 0; j < 6; ++j)
-			//glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + j, 0, GL_DEPTH_COMPONENT, shadowWidth, shadowHeight, 0, GL_DEPTH_COMPONENT, GL_FLOAT, NULL);
-			glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + j, 0, GL_DEPTH_COMPONENT, shadowWidth, shadowHeight, 0, GL_DEPTH_COMPONENT, GL_FLOAT, NULL);
+		glm::vec3 dir = glm::normalize(light.getDirection());
+		glm::mat4 lightView = glm::lookAt(glm::vec3(0.f), dir, glm::abs(dir.y) > 0.99f ? glm::vec3(0.f, 0.f, 1.f) : glm::vec3(0.f, 1.f, 0.f));
 
-		glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-		glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-		glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-		glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-		glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+		float sliceNear = nearPlane;
+		for (int c = 0; c < DirectionalLight::CASCADES; c++)
+		{
+			// Blend of the logarithmic and the uniform split
+			float t = (float)(c + 1) / DirectionalLight::CASCADES;
+			float sliceFar = glm::mix(nearPlane + (shadowFar - nearPlane) * t, nearPlane * glm::pow(shadowFar / nearPlane, t), light.splitLambda);
+			light.cascadeSplits[c] = sliceFar;
+
+			// Bounding sphere of the slice (view depth is linear along the frustum edges). Its size doesn't change
+			// when the camera turns, and rounded it doesn't wobble from float error either
+			glm::vec3 corners[8];
+			glm::vec3 center(0.f);
+			for (int i = 0; i < 4; i++)
+			{
+				corners[i] = glm::mix(nearCorners[i], farCorners[i], (sliceNear - nearPlane) / (farPlane - nearPlane));
+				corners[i + 4] = glm::mix(nearCorners[i], farCorners[i], (sliceFar - nearPlane) / (farPlane - nearPlane));
+				center += corners[i] + corners[i + 4];
+			}
+			center /= 8.f;
+
+			float radius = 0.f;
+			for (const glm::vec3& p : corners) radius = glm::max(radius, glm::length(p - center));
+			radius = glm::ceil(radius * 16.f) / 16.f;
+
+			// Center snapped to whole texels in light space, so the shadow edges don't shimmer as the camera moves.
+			// Depth reaches shadowDistance towards the light for the casters in front of the slice
+			float texel = 2.f * radius / cascadeSize;
+			glm::vec3 lc = glm::vec3(lightView * glm::vec4(center, 1.f));
+			lc.x = glm::floor(lc.x / texel) * texel;
+			lc.y = glm::floor(lc.y / texel) * texel;
+
+			glm::mat4 projection = glm::ortho(lc.x - radius, lc.x + radius, lc.y - radius, lc.y + radius, -lc.z - radius - light.shadowDistance, -lc.z + radius);
+			light.cascadeMatrices[c] = projection * lightView;
+
+			sliceNear = sliceFar;
+		}
+	}
 
-		float borderColor[] = { 1.0f, 1.0f, 1.0f, 1.0f };
-		glTexParameterfv(GL_TEXTURE_2D, GL_TEXTURE_BORDER_COLOR, borderColor); // For avoid shadow artifact, add depth map texture with white borders
+	// Spot light: casters inside the shadow frustum, then inside the cone up to the light range, into its atlas tile
+	static void generateShadowMap(const SpotLight& light, ArrayView<Entity> obj)
+	{
+		if (light.shadowResolution == 0) return; // No tile this frame (see ShadowAtlas::allocate)
+
+		glm::mat4 lightSpaceMatrix = light.lightCamera->getProjectionMatrix(light.perspective) * light.lightCamera->getViewMatrix();
+		Frustum frustum = Frustum::fromMatrix(lightSpaceMatrix);
+
+		collectCasters(obj, frustum);
+		unsigned int candidates = (unsigned int)casters.size();
+
+		glm::vec3 apex = light.getPosition();
+		glm::vec3 dir = glm::normalize(light.getDirection());
+		float halfAngle = glm::radians(light.getOuterCutOff());
+		float range = light.getRange();
+		ComponentPool<Bounds>& bounds = RenderQueue::registry->pool<Bounds>();
+		casters.erase(std::remove_if(casters.begin(), casters.end(), [&](Entity e)
+			{
+				const Bounds* b = bounds.tryGet(e);
+				return b && !b->world.isEmpty() && !b->world.intersectsCone(apex, dir, halfAngle, range);
+			}), casters.end());
+
+		// Any repack may have given the tile to another light meanwhile
+		View view = atlasView(light, 1);
+		float far = light.lightCamera->getFarPlane();
+		uint64_t key = ShadowCache::mix(ShadowCache::mix(ShadowAtlas::getRepacks(), glm::value_ptr(lightSpaceMatrix), 16), &far, 1);
+		key = ShadowCache::mix(ShadowCache::mix(ShadowCache::mix(key, view.corners[0].x), view.corners[0].y), view.size);
+		key = ShadowCache::mix(key, light.shadowFilter);
+		ShadowCache::Update update = renderShadowMap(view, &light, 0, key, lightSpaceMatrix, frustum, apex, far);
+		filterView(light, view, update, light.perspective ? light.lightCamera->getNearPlane() / far : 0.f);
+		record("Spot", candidates, 0, update);
 	}
 
-	static void generateShadowMap(unsigned int shadowMap, const std::vector<DrawableObject*>& obj, const Camera* lightCamera, bool perspective)
+	// Point light: casters inside the sphere of the light range, each rendered only to the cube faces it touches.
+	// The faces are 6 atlas tiles, one viewport each, reached as getCubePath() says. Fewer faces (bits of faceMask,
+	// see ShadowScheduler): each one is a view of its own, drawn as a single pass
+	static void generateShadowCubeMap(const PointLight& light, ArrayView<Entity> obj, unsigned int faceMask = 0x3F)
 	{
-		glViewport(0, 0, shadowWidth, shadowHeight);
-		glBindFramebuffer(GL_FRAMEBUFFER, shadowMapFBO);
+		if (light.shadowResolution == 0) return; // No tiles this frame (see ShadowAtlas::allocate)
 
-		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, shadowMap, 0); // Set texture
+		const Camera* lightCamera = light.lightCamera;
+		glm::mat4 lightSpaceMatrix[6];
 
-		glDrawBuffer(GL_NONE); // Disable color buffer
-		glReadBuffer(GL_NONE); //
+		float aspect = 1.f;
+		float near = lightCamera->getNearPlane();
+		float far = lightCamera->getFarPlane();
 
-		glClear(GL_DEPTH_BUFFER_BIT);
+		glm::vec3 lightPos = lightCamera->getPosition();
 
-		glCullFace(GL_BACK); // This avoid shadow acne 
+		glm::mat4 shadowProj = glm::perspective(glm::radians(lightCamera->getZoom()), aspect, near, far);
 
-		// Light camera config
-		shadowShader->use();
+		lightSpaceMatrix[0] = shadowProj * glm::lookAt(lightPos, lightPos + glm::vec3(1.0, 0.0, 0.0), glm::vec3(0.0, -1.0, 0.0));
+		lightSpaceMatrix[1] = shadowProj * glm::lookAt(lightPos, lightPos + glm::vec3(-1.0, 0.0, 0.0), glm::vec3(0.0, -1.0, 0.0));
+		lightSpaceMatrix[2] = shadowProj * glm::lookAt(lightPos, lightPos + glm::vec3(0.0, 1.0, 0.0), glm::vec3(0.0, 0.0, 1.0));
+		lightSpaceMatrix[3] = shadowProj * glm::lookAt(lightPos, lightPos + glm::vec3(0.0, -1.0, 0.0), glm::vec3(0.0, 0.0, -1.0));
+		lightSpaceMatrix[4] = shadowProj * glm::lookAt(lightPos, lightPos + glm::vec3(0.0, 0.0, 1.0), glm::vec3(0.0, -1.0, 0.0));
+		lightSpaceMatrix[5] = shadowProj * glm::lookAt(lightPos, lightPos + glm::vec3(0.0, 0.0, -1.0), glm::vec3(0.0, -1.0, 0.0));
 
-		glm::mat4 lightProjection = lightCamera->getProjectionMatrix(perspective);
-		glm::mat4 lightView = lightCamera->getViewMatrix();
-		glm::mat4 lightSpaceMatrix = lightProjection * lightView;
+		// Sphere of the light range
+		float range = light.getRange();
+		casters.clear();
+		SceneSystems::cullSphere(*RenderQueue::registry, obj, lightPos, range, casters, RenderQueue::spatialIndex);
 
-		shadowShader->setMat4("lightSpaceMatrix", glm::value_ptr(lightSpaceMatrix));
+		// Per face: each object is only sent to the faces of its mask
+		Frustum faces[6];
+		for (int f = 0; f < 6; f++) faces[f] = Frustum::fromMatrix(lightSpaceMatrix[f]);
 
-		// Draw
-		for (int i = 0; i < obj.size(); i++)
+		Frustum frustum = Frustum::fromBox(lightPos, range);
+		unsigned int candidates = (unsigned int)casters.size();
+
+		View view = atlasView(light, 6);
+		float values[] = { lightPos.x, lightPos.y, lightPos.z, far, range };
+		uint64_t key = ShadowCache::mix(ShadowCache::mix(ShadowAtlas::getRepacks(), values, 5), view.size);
+		for (int f = 0; f < 6; f++) key = ShadowCache::mix(ShadowCache::mix(key, view.corners[f].x), view.corners[f].y);
+		key = ShadowCache::mix(key, light.shadowFilter);
+
+		unsigned int faceRenders = 0, draws = 0;
+		if (faceMask != 0x3F)
 		{
-			shadowShader->setTransform(obj[i]->transformation);
-			obj[i]->Draw(shadowShader);
+			// Cached apart from the whole cube (slots 1 - 6)
+			sphereCasters = casters;
+			ShadowCache::Update update = ShadowCache::SKIPPED;
+			unsigned int drawn = 0;
+			for (int f = 0; f < 6; f++)
+			{
+				if ((faceMask & (1u << f)) == 0) continue;
+
+				View faceView = view;
+				faceView.corners[0] = view.corners[f];
+				faceView.squares = 1;
+				casters.clear();
+				SceneSystems::cull(*RenderQueue::registry, sphereCasters, faces[f], casters, nullptr);
+
+				ShadowCache::Update faceUpdate = renderView(faceView, &light, 1 + f, ShadowCache::mix(key, f), [&](ArrayView<Entity> list)
+					{
+						shadowCubemapFacesShader->use();
+						shadowCubemapFacesShader->setMat4("shadowMatrices", glm::value_ptr(lightSpaceMatrix[0]), 6);
+						shadowCubemapFacesShader->setVec3("lightPos", lightPos);
+						shadowCubemapFacesShader->setFloat("far_plane", far);
+						shadowCubemapFacesShader->setInt("face", f);
+
+						shadowQueue.draw(list, shadowCubemapFacesShader.get(), RenderQueue::SHADOW, lightPos, far, &frustum, &faces[f], 1);
+						faceRenders += shadowQueue.getFaceRenders();
+						draws += shadowQueue.getDrawCalls();
+					});
+				filterView(light, faceView, faceUpdate, 0.f);
+				if (faceUpdate > update) update = faceUpdate;
+				drawn += (unsigned int)casters.size();
+			}
+			record("Point", candidates, faceRenders, update, draws, drawn);
+			return;
 		}
 
-		// Default config
-		glCullFace(GL_FRONT);
-		glBindFramebuffer(GL_FRAMEBUFFER, 0);
+		ShadowCache::Update update = renderView(view, &light, 0, key, [&](ArrayView<Entity> list)
+			{
+				Shader* shader = cubePath == GEOMETRY_SHADER ? shadowCubemapShader.get() : shadowCubemapFacesShader.get();
+				shader->use();
+				shader->setMat4("shadowMatrices", glm::value_ptr(lightSpaceMatrix[0]), 6);
+				shader->setVec3("lightPos", lightPos);
+				shader->setFloat("far_plane", far);
+
+				if (cubePath == SIX_PASSES)
+				{
+					// Viewport 0 moved to each face's tile in turn (attachView sets them all again)
+					for (int f = 0; f < 6; f++)
+					{
+						glViewportIndexedf(0, (float)view.corners[f].x, (float)view.corners[f].y, (float)view.size, (float)view.size);
+						glScissorIndexed(0, view.corners[f].x, view.corners[f].y, view.size, view.size);
+						shader->setInt("face", f);
+
+						shadowQueue.draw(list, shader, RenderQueue::SHADOW, lightPos, far, &frustum, &faces[f], 1);
+						faceRenders += shadowQueue.getFaceRenders();
+						draws += shadowQueue.getDrawCalls();
+					}
+					return;
+				}
+
+				shader->setInt("face", -1);
+				shadowQueue.setFaceInstancing(cubePath == VERTEX_VIEWPORT);
+				shadowQueue.draw(list, shader, RenderQueue::SHADOW, lightPos, far, &frustum, faces, 6);
+				shadowQueue.setFaceInstancing(false);
+				faceRenders += shadowQueue.getFaceRenders();
+				draws += shadowQueue.getDrawCalls();
+			});
+
+		filterView(light, view, update, 0.f); // Linear depth already
+		record("Point", candidates, faceRenders, update, draws);
 	}
 
-	static void generateShadowCubeMap(unsigned int shadowMap, const std::vector<DrawableObject*>& obj, const Camera* lightCamera)
+	// Selects how point light shadows reach their cube faces. VERTEX_VIEWPORT falls back to SIX_PASSES without the
+	// extension (see init). Returns the path used
+	static CubePath setCubePath(CubePath path)
 	{
-		glViewport(0, 0, shadowWidth, shadowHeight);
-		glBindFramebuffer(GL_FRAMEBUFFER, shadowMapFBO);
+		if (path == VERTEX_VIEWPORT && !vertexViewportIndex) path = SIX_PASSES;
+		cubePath = path;
+		return cubePath;
+	}
 
-		glFramebufferTexture(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, shadowMap, 0); // Set texture
+	static CubePath getCubePath()
+	{
+		return cubePath;
+	}
 
-		glDrawBuffer(GL_NONE); // Disable color buffer
-		glReadBuffer(GL_NONE); //
+	// The vertex shader can write gl_ViewportIndex, known after init()
+	static bool supportsVertexViewport()
+	{
+		return vertexViewportIndex;
+	}
+
+	// Depth-only: casters drawn from the packed positions of the DepthGeometry, without materials, one multi-draw per
+	// queue. Off: each caster through its own vertex array and material, as the main pass does
+	static void setDepthOnly(bool enabled)
+	{
+		shadowQueue.setDepthOnly(enabled);
+	}
+
+	static bool isDepthOnly()
+	{
+		return shadowQueue.isDepthOnly();
+	}
 
-		glClear(GL_DEPTH_BUFFER_BIT);
-		glCullFace(GL_BACK); // This avoid shadow acne 
+	// Skipping the shadow views whose light and casters didn't change (see ShadowCache). Layers: the casters that
+	// stay put are kept in a static copy of each shadow texture, the moving ones drawn over it every frame
+	static void setCaching(bool enabled, bool layers = false)
+	{
+		cache.setEnabled(enabled);
+		cache.setLayers(layers);
+	}
 
-		// Light camera config
-		shadowCubemapShader->use();
+	static const ShadowCache& getCache()
+	{
+		return cache;
+	}
 
-		glm::mat4 lightSpaceMatrix[6];
+	// Call at the start of each frame
+	static void beginFrame()
+	{
+		lastFrameStats.swap(frameStats);
+		frameStats.clear();
+		cache.beginFrame();
+		ShadowMoments::beginFrame();
+		ShadowScheduler::beginFrame();
+	}
 
-		float aspect = (float)shadowWidth / (float)shadowHeight;
-		float near = lightCamera->getNearPlane();
-		float far = lightCamera->getFarPlane();
+	static const std::vector<CasterStats>& getLastFrameStats()
+	{
+		return lastFrameStats;
+	}
 
-		glm::vec3 lightPos = lightCamera->getPosition();
+	static void printStats()
+	{
+		static const char* paths[] = { "geometry shader", "vertex shader viewport", "six passes" };
+		std::cout << "SHADOW_MAP::Point lights: " << paths[cubePath] << (vertexViewportIndex ? "" : " (no vertex shader viewport index)")
+			<< ", casters " << (isDepthOnly() ? "depth-only, batched" : "with their vertex arrays and materials") << std::endl;
+		for (const CasterStats& s : lastFrameStats)
+		{
+			static const char* updates[] = { "cached", "dynamic layer", "static and dynamic layers", "rendered" };
+			std::cout << "SHADOW_MAP::" << s.light << " light " << s.index << ": " << updates[s.update] << ", " << s.casters << " casters of " << s.candidates << " candidates";
+			if (s.faceRenders > 0) std::cout << ", " << s.faceRenders << " face renders (" << s.casters * 6 << " without per-face culling) in " << s.draws << " draws";
+			std::cout << std::endl;
+		}
+		const ShadowCache::Stats& updates = cache.getLastFrameStats();
+		std::cout << "SHADOW_MAP::Updates: " << updates.updates[ShadowCache::FULL] + updates.updates[ShadowCache::STATIC] << " rendered, "
+			<< updates.updates[ShadowCache::DYNAMIC] << " dynamic layer only, " << updates.updates[ShadowCache::SKIPPED] << " skipped"
+			<< (cache.isEnabled() ? (cache.layersEnabled() ? " (static / dynamic layers, " : " (cached, ") : " (caching off, ")
+			<< cache.getMemory() / (1024 * 1024) << " MB of static layers)" << std::endl;
+		std::cout << "SHADOW_MAP::Cascades: " << DirectionalLight::CASCADES << " x " << cascadeSize << "^2, " << getCascadeMemory() / (1024 * 1024) << " MB per directional light" << std::endl;
+		ShadowResources::printStats();
+		ShadowAtlas::printStats();
+		ShadowMoments::printStats();
+		DepthGeometry::printStats();
+		ShadowScheduler::printStats();
+	}
 
-		glm::mat4 shadowProj = glm::perspective(glm::radians(lightCamera->getZoom()), aspect, near, far);
+private:
+	// Entities whose bounds intersect the frustum, through the spatial index when obj is the list it indexes
+	static void collectCasters(ArrayView<Entity> obj, const Frustum& frustum)
+	{
+		casters.clear();
+		SceneSystems::cull(*RenderQueue::registry, obj, frustum, casters, RenderQueue::spatialIndex);
+	}
 
-		lightSpaceMatrix[0] = shadowProj * glm::lookAt(lightPos, lightPos + glm::vec3(1.0, 0.0, 0.0), glm::vec3(0.0, -1.0, 0.0));
-		lightSpaceMatrix[1] = shadowProj * glm::lookAt(lightPos, lightPos + glm::vec3(-1.0, 0.0, 0.0), glm::vec3(0.0, -1.0, 0.0));
-		lightSpaceMatrix[2] = shadowProj * glm::lookAt(lightPos, lightPos + glm::vec3(0.0, 1.0, 0.0), glm::vec3(0.0, 0.0, 1.0));
-		lightSpaceMatrix[3] = shadowProj * glm::lookAt(lightPos, lightPos + glm::vec3(0.0, -1.0, 0.0), glm::vec3(0.0, 0.0, -1.0));
-		lightSpaceMatrix[4] = shadowProj * glm::lookAt(lightPos, lightPos + glm::vec3(0.0, 0.0, 1.0), glm::vec3(0.0, -1.0, 0.0));
-		lightSpaceMatrix[5] = shadowProj * glm::lookAt(lightPos, lightPos + glm::vec3(0.0, 0.0, -1.0), glm::vec3(0.0, -1.0, 0.0));
+	// The atlas tiles of a spot (1) or point (6) light
+	static View atlasView(const LightBase& light, unsigned int squares)
+	{
+		unsigned int atlasSize = ShadowAtlas::getAtlasSize();
+		View view = { ShadowAtlas::getTexture(), GL_TEXTURE_2D, ShadowAtlas::getFormat(), atlasSize, atlasSize, 1, 0, light.shadowResolution, {}, squares };
+		for (unsigned int i = 0; i < squares; i++) view.corners[i] = glm::uvec2(light.shadowTiles[i] * (float)atlasSize);
+		return view;
+	}
 
-		shadowCubemapShader->setMat4("shadowMatrices", glm::value_ptr(lightSpaceMatrix[0]), 6);
-		shadowCubemapShader->setVec3("lightPos", lightPos);
-		shadowCubemapShader->setFloat("far_plane", far);
-		GLenum err;
+	// One view with the shadow map shader, casters near to far from the light
+	static ShadowCache::Update renderShadowMap(const View& view, const void* owner, int slot, uint64_t key, const glm::mat4& lightSpaceMatrix,
+		const Frustum& frustum, glm::vec3 eye, float far)
+	{
+		return renderView(view, owner, slot, key, [&](ArrayView<Entity> list)
+			{
+				shadowShader->use();
+				shadowShader->setMat4("lightSpaceMatrix", (float*)glm::value_ptr(lightSpaceMatrix));
+
+				// Sub-meshes of the casters are still culled against the light volume
+				shadowQueue.draw(list, shadowShader.get(), RenderQueue::SHADOW, eye, far, &frustum);
+			});
+	}
+
+	// EVSM lights: moments of the view, if it was drawn this frame (see ShadowMoments::filter)
+	static void filterView(const LightBase& light, const View& view, ShadowCache::Update update, float nearRatio)
+	{
+		if (light.shadowFilter != LightBase::EVSM || update == ShadowCache::SKIPPED) return;
+		ShadowMoments::filter(view.texture, view.target, view.width, view.height, view.layers, view.layer, view.size, view.corners, view.squares, nearRatio);
+	}
+
+	// Updates a view as the cache decides: nothing, the dynamic casters over a copy of the static layer (redrawn first
+	// if its casters changed), or every caster. Only the squares of the view are cleared and copied. The casters
+	// drawn are left in casters, for the stats (all of them when the static layer was redrawn too)
+	template<class Draw> static ShadowCache::Update renderView(const View& view, const void* owner, int slot, uint64_t key, Draw draw)
+	{
+		ComponentPool<Bounds>& bounds = RenderQueue::registry->pool<Bounds>();
+		unsigned int staticTexture = cache.layersEnabled() ? cache.staticLayer(view.texture, view.target, view.format, view.width, view.height, view.layers) : 0;
 
-		// Draw
-		for (int i = 0; i < obj.size(); i++)
+		ShadowCache::Update update = cache.plan(owner, slot, key, casters, bounds, SceneSystems::frame);
+		if (update == ShadowCache::SKIPPED)
+		{
+			casters.clear();
+			return update;
+		}
+
+		GLState::bindFramebuffer(shadowMapFBO);
+		GLState::enable(GL_DEPTH_TEST);
+		GLState::enable(GL_SCISSOR_TEST);
+		glDrawBuffer(GL_NONE); // Disable color buffer
+		glReadBuffer(GL_NONE); //
+		GLState::cullFace(GL_BACK); // This avoid shadow acne 
+
+		if (update == ShadowCache::FULL)
+		{
+			attachView(view, view.texture, true);
+			draw(ArrayView<Entity>(casters));
+		}
+		else
 		{
-			shadowCubemapShader->setTransform(obj[i]->transformation);
-			obj[i]->Draw(shadowCubemapShader);
+			if (update == ShadowCache::STATIC)
+			{
+				attachView(view, staticTexture, true);
+				draw(ArrayView<Entity>(cache.getStaticCasters()));
+			}
+
+			for (unsigned int i = 0; i < view.squares; i++)
+				glCopyImageSubData(staticTexture, view.target, 0, view.corners[i].x, view.corners[i].y, view.layer,
+					view.texture, view.target, 0, view.corners[i].x, view.corners[i].y, view.layer, view.size, view.size, 1);
+
+			attachView(view, view.texture, false);
+			draw(ArrayView<Entity>(cache.getDynamicCasters()));
+			if (update == ShadowCache::DYNAMIC) casters = cache.getDynamicCasters();
 		}
 
 		// Default config
-		glCullFace(GL_FRONT);
-		glBindFramebuffer(GL_FRAMEBUFFER, 0);
+		GLState::cullFace(GL_FRONT);
+		GLState::disable(GL_SCISSOR_TEST);
+		return update;
+	}
+
+	// Attaches texture (the layer of the view) and sets one viewport and scissor box per square of the view. Clears go
+	// through box 0 only: one square at a time first
+	static void attachView(const View& view, unsigned int texture, bool clear)
+	{
+		if (view.target == GL_TEXTURE_2D_ARRAY) glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, texture, 0, view.layer);
+		else glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, texture, 0);
+
+		for (unsigned int i = 0; clear && i < view.squares; i++)
+		{
+			glScissor(view.corners[i].x, view.corners[i].y, view.size, view.size);
+			glClear(GL_DEPTH_BUFFER_BIT);
+		}
+
+		for (unsigned int i = 0; i < view.squares; i++)
+		{
+			glViewportIndexedf(i, (float)view.corners[i].x, (float)view.corners[i].y, (float)view.size, (float)view.size);
+			glScissorIndexed(i, view.corners[i].x, view.corners[i].y, view.size, view.size);
+		}
+	}
+
+	// drawn: casters rendered, casters.size() if negative
+	static void record(const char* light, unsigned int candidates, unsigned int faceRenders, ShadowCache::Update update, unsigned int draws = 0, int drawn = -1)
+	{
+		CasterStats s;
+		s.light = light;
+		s.index = 0;
+		for (const CasterStats& o : frameStats) s.index += o.light == light;
+		s.candidates = candidates;
+		s.casters = drawn < 0 ? (unsigned int)casters.size() : (unsigned int)drawn;
+		s.faceRenders = faceRenders;
+		s.draws = draws;
+		s.update = update;
+		frameStats.push_back(s);
 	}
 
 };
 
 // Static variables initialization
-Shader* ShadowMap::shadowShader = new Shader(); // Initialize with a default non-functional shader
-Shader* ShadowMap::shadowCubemapShader = new Shader();
+std::shared_ptr<Shader> ShadowMap::shadowShader; // Created in init()
+std::shared_ptr<Shader> ShadowMap::shadowCubemapShader;
+std::shared_ptr<Shader> ShadowMap::shadowCubemapFacesShader;
+
+ShadowMap::CubePath ShadowMap::cubePath = ShadowMap::GEOMETRY_SHADER;
+bool ShadowMap::vertexViewportIndex = false;
+
+RenderQueue ShadowMap::shadowQueue;
+std::vector<Entity> ShadowMap::casters;
+std::vector<Entity> ShadowMap::sphereCasters;
+ShadowCache ShadowMap::cache;
+std::vector<ShadowMap::CasterStats> ShadowMap::frameStats;
+std::vector<ShadowMap::CasterStats> ShadowMap::lastFrameStats;
 
 unsigned int ShadowMap::shadowMapFBO = 0;
-unsigned int ShadowMap::shadowWidth = 1024;
-unsigned int ShadowMap::shadowHeight = 1024;
+unsigned int ShadowMap::cascadeSize = 2048;
 
 bool ShadowMap::initialized = false;
 
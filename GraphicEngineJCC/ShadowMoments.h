@@ -0,0 +1,283 @@
+#ifndef SHADOW_MOMENTS_H
+#define SHADOW_MOMENTS_H
+
+#include "glad/glad.h"
+#include "glm/glm.hpp"
+#include "ShaderRegistry.h"
+#include "GLState.h"
+#include <unordered_map>
+#include <iostream>
+
+// Exponential variance shadow maps (EVSM) of the lights whose shadowFilter is EVSM. Their depth is turned into the
+// first two moments of two exponentially warped depths (positive and negative), SCALE x SCALE depth texels per
+// moments texel, blurred with a separable Gaussian and mip-mapped: a fragment is then shaded from one trilinear
+// fetch whatever the filter size (evsmShadow in fsPBR.frag), instead of the 9 comparisons of PCF. Each depth texture
+// (the cascades, the atlas) gets a moments 2D array in the same uv. Atlas tiles are powers of two at multiples of
+// their size, so the mips of a tile never mix its neighbours up to the tile size
+class ShadowMoments
+{
+public:
+	static const unsigned int SCALE = 2;
+
+	// Warps of the moments (RGBA32F holds exp(2 x 44) at most) and the lit fraction cut to 0 against light bleeding
+	static glm::vec2 exponents;
+	static float lightBleedReduction;
+	static float minDeviation; // Of the depth (-1 - 1 before the warp) always assumed, lit surfaces don't shadow themselves
+
+private:
+	struct Moments
+	{
+		unsigned int texture = 0;
+		unsigned int width = 0, height = 0, layers = 0;
+		bool dirty = false; // Mips are out of date
+	};
+
+	static std::unordered_map<unsigned int, Moments> moments; // By depth texture
+	static unsigned int scratch;		// Horizontal blur result, one square
+	static unsigned int scratchSize;
+	static unsigned int fbo, emptyVAO;
+
+	static std::shared_ptr<Shader> convertShader;
+	static std::shared_ptr<Shader> blurShader;
+
+	static unsigned int views, texels;	// Filtered this frame
+	static unsigned int lastFrameViews, lastFrameTexels;
+
+	ShadowMoments() {}
+	~ShadowMoments() {}
+
+public:
+	static void init()
+	{
+		convertShader = ShaderRegistry::get("vsHiZ.vert", "fsShadowMoments.frag");
+		blurShader = ShaderRegistry::get("vsHiZ.vert", "fsShadowMomentsBlur.frag");
+		glGenFramebuffers(1, &fbo);
+		glGenVertexArrays(1, &emptyVAO);
+	}
+
+	// Moments of a depth texture, 0 until a view of it is filtered
+	static unsigned int getTexture(unsigned int depthTexture)
+	{
+		std::unordered_map<unsigned int, Moments>::const_iterator itr = moments.find(depthTexture);
+		return itr != moments.end() ? itr->second.texture : 0;
+	}
+
+	// Moments of squares (corners in depth texels, size per side) of one layer of a depth texture (2D, or a 2D array
+	// of width x height x layers). nearRatio > 0: perspective depth, made linear with near / far, otherwise depth is
+	// linear already. Mip-mapped at generateMipmaps()
+	static void filter(unsigned int depth, GLenum target, unsigned int width, unsigned int height, unsigned int layers, int layer,
+		unsigned int size, const glm::uvec2* corners, unsigned int squares, float nearRatio)
+	{
+		Moments& m = texture(depth, width / SCALE, height / SCALE, layers);
+		unsigned int momentsSize = size / SCALE;
+		if (momentsSize == 0) return;
+		if (momentsSize > scratchSize) createScratch(momentsSize);
+
+		GLState::bindFramebuffer(fbo);
+		GLState::bindVertexArray(emptyVAO);
+		GLState::disable(GL_DEPTH_TEST);
+		GLState::disable(GL_BLEND);
+		GLState::disable(GL_CULL_FACE);
+		GLState::disable(GL_SCISSOR_TEST);
+		glDrawBuffer(GL_COLOR_ATTACHMENT0);
+
+		// A 2D and a 2D array sampler can't share a unit: depth on 0 (2D) or 1 (array)
+		GLState::bindTexture(target == GL_TEXTURE_2D_ARRAY ? 1 : 0, target, depth);
+
+		for (unsigned int i = 0; i < squares; i++)
+		{
+			glm::ivec2 corner = glm::ivec2(corners[i] / SCALE);
+
+			// Depth to moments, SCALE x SCALE texels averaged
+			attach(m.texture, layer, corner, momentsSize);
+			convertShader->use();
+			convertShader->setInt("depthMap", 0);
+			convertShader->setInt("depthLayers", 1);
+			convertShader->setInt("layer", target == GL_TEXTURE_2D_ARRAY ? layer : -1);
+			convertShader->setIvec2("srcCorner", glm::ivec2(corners[i]));
+			convertShader->setIvec2("dstCorner", corner);
+			convertShader->setFloat("nearRatio", nearRatio);
+			convertShader->setVec2("exponents", exponents);
+			glDrawArrays(GL_TRIANGLES, 0, 3);
+
+			// Horizontal into the scratch square, vertical back, both clamped to the square
+			blurShader->use();
+			blurShader->setInt("source", 2);
+			blurShader->setInt("size", (int)momentsSize);
+
+			attach(scratch, 0, glm::ivec2(0), momentsSize);
+			GLState::bindTexture(2, GL_TEXTURE_2D_ARRAY, m.texture);
+			blurShader->setInt("layer", layer);
+			blurShader->setIvec2("srcCorner", corner);
+			blurShader->setIvec2("dstCorner", glm::ivec2(0));
+			blurShader->setIvec2("direction", glm::ivec2(1, 0));
+			glDrawArrays(GL_TRIANGLES, 0, 3);
+
+			attach(m.texture, layer, corner, momentsSize);
+			GLState::bindTexture(2, GL_TEXTURE_2D_ARRAY, scratch);
+			blurShader->setInt("layer", 0);
+			blurShader->setIvec2("srcCorner", glm::ivec2(0));
+			blurShader->setIvec2("dstCorner", corner);
+			blurShader->setIvec2("direction", glm::ivec2(0, 1));
+			glDrawArrays(GL_TRIANGLES, 0, 3);
+
+			texels += momentsSize * momentsSize;
+		}
+
+		// Shadow passes expect these
+		GLState::enable(GL_DEPTH_TEST);
+		GLState::enable(GL_CULL_FACE);
+		m.dirty = true;
+		views++;
+	}
+
+	// Call once the shadow maps of the frame are filtered
+	static void generateMipmaps()
+	{
+		for (auto& entry : moments)
+		{
+			if (!entry.second.dirty) continue;
+			glGenerateTextureMipmap(entry.second.texture);
+			entry.second.dirty = false;
+		}
+	}
+
+	// Deletes the moments of a depth texture that is gone
+	static void release(unsigned int depthTexture)
+	{
+		std::unordered_map<unsigned int, Moments>::iterator itr = moments.find(depthTexture);
+		if (itr == moments.end()) return;
+		glDeleteTextures(1, &itr->second.texture);
+		moments.erase(itr);
+	}
+
+	// Moments of a depth (0 - 1, linear), as fsShadowMoments.frag writes them
+	static glm::vec4 warp(float depth)
+	{
+		depth = depth * 2.f - 1.f;
+		float pos = glm::exp(exponents.x * depth);
+		float neg = -glm::exp(-exponents.y * depth);
+		return glm::vec4(pos, pos * pos, neg, neg * neg);
+	}
+
+	// Fraction in shadow of a receiver at depth against filtered moments, as evsmShadow in fsPBR.frag
+	static float shadow(const glm::vec4& m, float depth)
+	{
+		glm::vec4 w = warp(depth);
+		float posBias = minDeviation * exponents.x * w.x;
+		float negBias = minDeviation * exponents.y * w.z;
+		float lit = glm::min(chebyshev(m.x, m.y, w.x, posBias * posBias), chebyshev(m.z, m.w, w.z, negBias * negBias));
+		lit = glm::clamp((lit - lightBleedReduction) / (1.f - lightBleedReduction), 0.f, 1.f);
+		return 1.f - lit;
+	}
+
+	// Bytes of every moments texture and the scratch square, mips included
+	static size_t getMemory()
+	{
+		size_t bytes = (size_t)scratchSize * scratchSize * 4 * sizeof(float);
+		for (const auto& entry : moments)
+			bytes += (size_t)entry.second.width * entry.second.height * entry.second.layers * 4 * sizeof(float) * 4 / 3;
+		return bytes;
+	}
+
+	// Bytes the moments of a depth texture of width x height x layers will take, mips included
+	static size_t bytesFor(unsigned int width, unsigned int height, unsigned int layers)
+	{
+		return (size_t)(width / SCALE) * (height / SCALE) * layers * 4 * sizeof(float) * 4 / 3;
+	}
+
+	// Bytes of the scratch square for views of up to size depth texels per side
+	static size_t scratchBytes(unsigned int size)
+	{
+		return (size_t)(size / SCALE) * (size / SCALE) * 4 * sizeof(float);
+	}
+
+	// Call at the start of each frame
+	static void beginFrame()
+	{
+		lastFrameViews = views;
+		lastFrameTexels = texels;
+		views = texels = 0;
+	}
+
+	static void printStats()
+	{
+		std::cout << "SHADOW_MOMENTS::" << lastFrameViews << " views filtered, " << lastFrameTexels / 1000 << "K texels converted and blurred, "
+			<< moments.size() << " textures, " << getMemory() / (1024 * 1024) << " MB (exponents " << exponents.x << " / " << exponents.y
+			<< ", light bleeding cut " << lightBleedReduction << ")" << std::endl;
+	}
+
+private:
+	static float chebyshev(float mean, float meanSquared, float t, float minVariance)
+	{
+		if (t <= mean) return 1.f;
+		float variance = glm::max(meanSquared - mean * mean, minVariance);
+		float d = t - mean;
+		return variance / (variance + d * d);
+	}
+
+	// The moments texture of a depth texture, created (or resized) on first use
+	static Moments& texture(unsigned int depth, unsigned int width, unsigned int height, unsigned int layers)
+	{
+		Moments& m = moments[depth];
+		if (m.texture != 0 && m.width == width && m.height == height && m.layers == layers) return m;
+
+		if (m.texture != 0) glDeleteTextures(1, &m.texture);
+		glGenTextures(1, &m.texture);
+		m.width = width;
+		m.height = height;
+		m.layers = layers;
+
+		int levels = 1;
+		while ((glm::max(width, height) >> levels) > 0) levels++;
+
+		glBindTexture(GL_TEXTURE_2D_ARRAY, m.texture);
+		glTexStorage3D(GL_TEXTURE_2D_ARRAY, levels, GL_RGBA32F, width, height, layers);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+		GLState::invalidate();
+		return m;
+	}
+
+	static void createScratch(unsigned int size)
+	{
+		if (scratch != 0) glDeleteTextures(1, &scratch);
+		glGenTextures(1, &scratch);
+		scratchSize = size;
+
+		glBindTexture(GL_TEXTURE_2D_ARRAY, scratch);
+		glTexStorage3D(GL_TEXTURE_2D_ARRAY, 1, GL_RGBA32F, size, size, 1);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+		GLState::invalidate();
+	}
+
+	static void attach(unsigned int texture, int layer, glm::ivec2 corner, unsigned int size)
+	{
+		glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, texture, 0, layer);
+		glViewport(corner.x, corner.y, size, size);
+	}
+};
+
+// Static variables initialization
+glm::vec2 ShadowMoments::exponents = glm::vec2(40.f, 5.f);
+float ShadowMoments::lightBleedReduction = 0.2f;
+float ShadowMoments::minDeviation = 0.0005f;
+
+std::unordered_map<unsigned int, ShadowMoments::Moments> ShadowMoments::moments;
+unsigned int ShadowMoments::scratch = 0;
+unsigned int ShadowMoments::scratchSize = 0;
+unsigned int ShadowMoments::fbo = 0;
+unsigned int ShadowMoments::emptyVAO = 0;
+
+std::shared_ptr<Shader> ShadowMoments::convertShader;
+std::shared_ptr<Shader> ShadowMoments::blurShader;
+
+unsigned int ShadowMoments::views = 0;
+unsigned int ShadowMoments::texels = 0;
+unsigned int ShadowMoments::lastFrameViews = 0;
+unsigned int ShadowMoments::lastFrameTexels = 0;
+
+#endif SHADOW_MOMENTS_H
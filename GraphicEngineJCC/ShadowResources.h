@@ -0,0 +1,386 @@
+#ifndef SHADOW_RESOURCES_H
+#define SHADOW_RESOURCES_H
+
+#include "glad/glad.h"
+#include "glm/glm.hpp"
+#include "LightBase.h"
+#include "ShadowAtlas.h"
+#include "ShadowCache.h"
+#include "ShadowMoments.h"
+#include "GLState.h"
+#include <vector>
+#include <algorithm>
+#include <iostream>
+
+// The shadow depth textures within one VRAM budget: the cascades of each directional light and the ShadowAtlas of the
+// spot and point lights. update() gives cascades to the directional lights that cast shadows, and takes them back from
+// the ones that stopped or are gone (no light of the vector holds the texture any more). Those go to a pool, the next
+// light wanting the same size and format picks them up; they are deleted after POOL_FRAMES frames, or as soon as the
+// atlas needs the room. The atlas only exists while a spot or point light casts shadows.
+// Depth format per light type (formats): 32 bit float for the directional lights (orthographic depth over the whole
+// shadowDistance) and the spot lights (perspective depth), 16 bit for the point lights (linear distance over the range,
+// see fsLinearDepth.frag). The atlas takes the finest format of the lights casting into it.
+// What goes with each texture is budgeted with it: its static layer (ShadowCache, a copy of it) and the EVSM moments
+// of the lights filtered that way (ShadowMoments, RGBA32F at half resolution with mips: 5.3 bytes per depth texel).
+// Over budget, in this order: the cascades then the atlas drop to 16 bit, the layers are refused, EVSM is refused (the
+// lights go back to PCF), and the atlas shrinks to what is left (the tiles then halve, see ShadowAtlas)
+class ShadowResources
+{
+	template<class T> using vector = std::vector<T>;
+
+public:
+	static const unsigned int POOL_FRAMES = 300;
+
+	enum LightType { DIRECTIONAL, SPOT, POINT, LIGHT_TYPES };
+	static GLenum formats[LIGHT_TYPES]; // GL_DEPTH_COMPONENT32F or GL_DEPTH_COMPONENT16
+
+	// Cascades of a directional light, held or pooled
+	struct Allocation
+	{
+		unsigned int texture;
+		GLenum format;
+		unsigned int size;			// Texels per side of each layer
+		int owner;					// Index in the directional lights of the last update, -1: pooled
+		unsigned int pooledFrame;
+	};
+
+private:
+	// What the lights ask for this update
+	struct Request
+	{
+		unsigned int casting = 0;		// Directional lights casting shadows
+		unsigned int castingEvsm = 0;	// Of them, filtered with EVSM
+		bool atlas = false;				// A spot or point light casts shadows
+		bool atlasEvsm = false;			// One of them with EVSM
+		bool layers = false;			// ShadowCache static layers
+	};
+
+	static size_t budget;
+	static unsigned int cascadeSize;
+	static GLenum cascadeFormat;		// Of the last update
+	static vector<Allocation> allocations;
+	static vector<unsigned int> released; // Deleted by the last update
+	static unsigned int frame;
+	static unsigned int created, reused, deleted; // Since init
+	static ShadowCache* cache;			// Of the last update, its static layers are budgeted
+	static bool layersRefused, evsmRefused; // By the last update
+
+	ShadowResources() {}
+	~ShadowResources() {}
+
+public:
+	static void init(size_t budgetBytes, unsigned int cascadeResolution)
+	{
+		budget = budgetBytes;
+		cascadeSize = cascadeResolution;
+	}
+
+	static void setBudget(size_t budgetBytes) { budget = budgetBytes; }
+	static size_t getBudget() { return budget; }
+
+	static unsigned int bytesPerTexel(GLenum format)
+	{
+		return format == GL_DEPTH_COMPONENT16 ? 2 : 4;
+	}
+
+	// Bytes of the cascades of one directional light in format
+	static size_t cascadeBytes(GLenum format)
+	{
+		return (size_t)cascadeSize * cascadeSize * DirectionalLight::CASCADES * bytesPerTexel(format);
+	}
+
+	static GLenum getCascadeFormat() { return cascadeFormat; }
+
+	// Call every frame before the shadow passes. Sets the shadowMap of every directional light (0 without castShadows)
+	// and sizes the atlas. Over budget, the cache's layers are refused and the EVSM lights set to PCF. True if a texture
+	// was created, deleted or given to another light: what was drawn in them is gone (the deleted ones are in getReleased)
+	static bool update(vector<DirectionalLight>& directional, vector<SpotLight>& spotLights, vector<PointLight>& pointLights, ShadowCache& shadowCache)
+	{
+		frame++;
+		released.clear();
+		cache = &shadowCache;
+		bool changed = false;
+
+		Request r;
+		for (const DirectionalLight& l : directional)
+		{
+			r.casting += l.castShadows ? 1 : 0;
+			r.castingEvsm += l.castShadows && l.shadowFilter == LightBase::EVSM ? 1 : 0;
+		}
+		bool spots = false, points = false;
+		for (const SpotLight& l : spotLights)
+		{
+			spots |= l.castShadows;
+			r.atlasEvsm |= l.castShadows && l.shadowFilter == LightBase::EVSM;
+		}
+		for (const PointLight& l : pointLights)
+		{
+			points |= l.castShadows;
+			r.atlasEvsm |= l.castShadows && l.shadowFilter == LightBase::EVSM;
+		}
+		r.atlas = spots || points;
+		r.layers = shadowCache.layersRequested();
+
+		// Formats: the finest that fits. The atlas needs at least one MAX_TILE square
+		GLenum wanted = formats[DIRECTIONAL];
+		GLenum atlasFormat = finer(spots ? formats[SPOT] : GL_DEPTH_COMPONENT16, points ? formats[POINT] : GL_DEPTH_COMPONENT16);
+		if (minimumCost(r, wanted, atlasFormat) > budget) wanted = GL_DEPTH_COMPONENT16;
+		if (minimumCost(r, wanted, atlasFormat) > budget) atlasFormat = GL_DEPTH_COMPONENT16;
+
+		// Then the static layers, then EVSM. Without EVSM the layers may fit again
+		bool requested = r.layers;
+		bool refuseLayers = r.layers && minimumCost(r, wanted, atlasFormat) > budget;
+		r.layers = !refuseLayers && requested;
+		evsmRefused = (r.castingEvsm > 0 || r.atlasEvsm) && minimumCost(r, wanted, atlasFormat) > budget;
+		if (evsmRefused)
+		{
+			std::cout << "SHADOW_RESOURCES::Over budget, EVSM refused: the lights use PCF" << std::endl;
+			for (DirectionalLight& l : directional) if (l.shadowFilter == LightBase::EVSM) l.shadowFilter = LightBase::PCF;
+			for (SpotLight& l : spotLights) if (l.shadowFilter == LightBase::EVSM) l.shadowFilter = LightBase::PCF;
+			for (PointLight& l : pointLights) if (l.shadowFilter == LightBase::EVSM) l.shadowFilter = LightBase::PCF;
+			r.castingEvsm = 0;
+			r.atlasEvsm = false;
+
+			r.layers = requested;
+			refuseLayers = requested && minimumCost(r, wanted, atlasFormat) > budget;
+			r.layers = !refuseLayers && requested;
+		}
+		if (refuseLayers != layersRefused && requested)
+			std::cout << "SHADOW_RESOURCES::" << (refuseLayers ? "Over budget, static shadow layers refused" : "Static shadow layers fit the budget again") << std::endl;
+		layersRefused = refuseLayers;
+		shadowCache.setLayersAllowed(!refuseLayers);
+
+		// Which allocation each light keeps: the first light holding a texture, casting, in the wanted format
+		for (Allocation& a : allocations) if (a.owner >= 0) a.owner = -2;
+		for (size_t i = 0; i < directional.size(); i++)
+		{
+			DirectionalLight& l = directional[i];
+			Allocation* a = find(l.shadowMap);
+			if (a != nullptr && a->owner == -2 && l.castShadows && a->format == wanted) a->owner = (int)i;
+			else l.shadowMap = 0;
+		}
+		for (Allocation& a : allocations)
+		{
+			if (a.owner != -2) continue;
+			a.owner = -1;
+			a.pooledFrame = frame;
+			changed = true;
+
+			// Its next light draws it again: only the depth is pooled
+			shadowCache.release(a.texture);
+			ShadowMoments::release(a.texture);
+		}
+
+		// Cascades for the casting lights without, from the pool first
+		for (size_t i = 0; i < directional.size(); i++)
+		{
+			DirectionalLight& l = directional[i];
+			if (!l.castShadows || l.shadowMap != 0) continue;
+			l.shadowMap = acquire(wanted, (int)i);
+			changed = true;
+		}
+		cascadeFormat = wanted;
+
+		// Pooled cascades: deleted when old, when they don't fit beside the rest, or when the atlas needs their room
+		// (oldest first)
+		for (size_t i = 0; i < allocations.size();)
+		{
+			if (allocations[i].owner < 0 && frame - allocations[i].pooledFrame > POOL_FRAMES) free(i);
+			else i++;
+		}
+
+		// The held cascades with their layers and moments. Moments of the textures whose lights don't use EVSM any
+		// more are deleted
+		size_t used = r.castingEvsm > 0 || r.atlasEvsm ? ShadowMoments::scratchBytes(std::max(cascadeSize, ShadowAtlas::MAX_TILE)) : 0;
+		for (const Allocation& a : allocations)
+		{
+			if (a.owner < 0) continue;
+			bool evsm = directional[a.owner].shadowFilter == LightBase::EVSM;
+			if (!evsm) ShadowMoments::release(a.texture);
+			used += memory(a) * (r.layers ? 2 : 1) + (evsm ? ShadowMoments::bytesFor(a.size, a.size, DirectionalLight::CASCADES) : 0);
+		}
+		if (!r.atlasEvsm) ShadowMoments::release(ShadowAtlas::getTexture());
+
+		while (getPooledMemory() > 0 && used + atlasMinimumCost(r, atlasFormat) + getPooledMemory() > budget) free(oldestPooled());
+
+		size_t room = budget > used ? budget - used : 0;
+		while (r.atlas && ShadowAtlas::sizeFor(atlasDepthBytes(room - std::min(room, getPooledMemory()), atlasFormat, r), atlasFormat) <
+			ShadowAtlas::sizeFor(atlasDepthBytes(room, atlasFormat, r), atlasFormat))
+			free(oldestPooled());
+		room -= std::min(room, getPooledMemory());
+
+		unsigned int atlas = ShadowAtlas::getTexture();
+		if (!r.atlas)
+		{
+			if (atlas != 0) released.push_back(atlas);
+			ShadowAtlas::release();
+		}
+		else if (ShadowAtlas::setBudget(atlasDepthBytes(room, atlasFormat, r), atlasFormat) && ShadowAtlas::getTexture() != 0) changed = true;
+
+		return changed || !released.empty();
+	}
+
+	// Textures deleted by the last update
+	static const vector<unsigned int>& getReleased() { return released; }
+
+	static const vector<Allocation>& getAllocations() { return allocations; }
+
+	// Bytes of the cascades held by the lights
+	static size_t getCascadeMemory()
+	{
+		size_t bytes = 0;
+		for (const Allocation& a : allocations) bytes += a.owner >= 0 ? memory(a) : 0;
+		return bytes;
+	}
+
+	static size_t getPooledMemory()
+	{
+		size_t bytes = 0;
+		for (const Allocation& a : allocations) bytes += a.owner < 0 ? memory(a) : 0;
+		return bytes;
+	}
+
+	// Bytes of the depth textures
+	static size_t getDepthMemory()
+	{
+		return getCascadeMemory() + getPooledMemory() + (ShadowAtlas::getTexture() != 0 ? ShadowAtlas::getMemory() : 0);
+	}
+
+	// Bytes counted against the budget: the depth textures, their static layers and EVSM moments
+	static size_t getMemory()
+	{
+		return getDepthMemory() + ShadowMoments::getMemory() + (cache != nullptr ? cache->getMemory() : 0);
+	}
+
+	static void printStats()
+	{
+		unsigned int held = 0;
+		for (const Allocation& a : allocations) held += a.owner >= 0 ? 1 : 0;
+
+		std::cout << "SHADOW_RESOURCES::" << getMemory() / (1024 * 1024) << " MB of " << budget / (1024 * 1024) << " MB: "
+			<< held << " cascades " << formatName(cascadeFormat) << " (" << getCascadeMemory() / (1024 * 1024) << " MB), atlas ";
+		if (ShadowAtlas::getTexture() != 0) std::cout << formatName(ShadowAtlas::getFormat()) << " (" << ShadowAtlas::getMemory() / (1024 * 1024) << " MB)";
+		else std::cout << "none";
+		std::cout << ", " << allocations.size() - held << " pooled (" << getPooledMemory() / (1024 * 1024) << " MB), EVSM moments "
+			<< ShadowMoments::getMemory() / (1024 * 1024) << " MB, static layers " << (cache != nullptr ? cache->getMemory() / (1024 * 1024) : 0) << " MB"
+			<< (layersRefused ? ", layers refused" : "") << (evsmRefused ? ", EVSM refused" : "") << "; "
+			<< created << " created, " << reused << " reused, " << deleted << " deleted" << std::endl;
+	}
+
+private:
+	static Allocation* find(unsigned int texture)
+	{
+		if (texture == 0) return nullptr;
+		for (Allocation& a : allocations) if (a.texture == texture) return &a;
+		return nullptr;
+	}
+
+	static size_t memory(const Allocation& a)
+	{
+		return (size_t)a.size * a.size * DirectionalLight::CASCADES * bytesPerTexel(a.format);
+	}
+
+	static GLenum finer(GLenum a, GLenum b)
+	{
+		return bytesPerTexel(a) >= bytesPerTexel(b) ? a : b;
+	}
+
+	static size_t atlasMinimum(GLenum format)
+	{
+		return (size_t)ShadowAtlas::MAX_TILE * ShadowAtlas::MAX_TILE * bytesPerTexel(format);
+	}
+
+	// Bytes the request needs at least in these formats: the cascades, one MAX_TILE square of atlas, with their
+	// static layers, moments and the moments' scratch square
+	static size_t minimumCost(const Request& r, GLenum cascadeFormat, GLenum atlasFormat)
+	{
+		size_t bytes = r.casting * cascadeBytes(cascadeFormat) * (r.layers ? 2 : 1) + r.castingEvsm * ShadowMoments::bytesFor(cascadeSize, cascadeSize, DirectionalLight::CASCADES);
+		if (r.castingEvsm > 0 || r.atlasEvsm) bytes += ShadowMoments::scratchBytes(std::max(cascadeSize, ShadowAtlas::MAX_TILE));
+		return bytes + atlasMinimumCost(r, atlasFormat);
+	}
+
+	// One MAX_TILE square of atlas with its static layer and moments, 0 without atlas
+	static size_t atlasMinimumCost(const Request& r, GLenum atlasFormat)
+	{
+		if (!r.atlas) return 0;
+		return atlasMinimum(atlasFormat) * (r.layers ? 2 : 1) + (r.atlasEvsm ? ShadowMoments::bytesFor(ShadowAtlas::MAX_TILE, ShadowAtlas::MAX_TILE, 1) : 0);
+	}
+
+	static size_t oldestPooled()
+	{
+		size_t oldest = allocations.size();
+		for (size_t i = 0; i < allocations.size(); i++)
+			if (allocations[i].owner < 0 && (oldest == allocations.size() || allocations[i].pooledFrame < allocations[oldest].pooledFrame)) oldest = i;
+		return oldest;
+	}
+
+	// Bytes of atlas depth whose static layer and moments, if requested, fit room with it
+	static size_t atlasDepthBytes(size_t room, GLenum format, const Request& r)
+	{
+		const unsigned int probe = 1024;
+		double texel = bytesPerTexel(format);
+		double perTexel = texel * (r.layers ? 2 : 1) + (r.atlasEvsm ? (double)ShadowMoments::bytesFor(probe, probe, 1) / ((double)probe * probe) : 0.0);
+		return (size_t)(room / perTexel * texel);
+	}
+
+	static const char* formatName(GLenum format)
+	{
+		return format == GL_DEPTH_COMPONENT16 ? "16 bit" : "32F";
+	}
+
+	// A pooled texture of the same format, or a new one
+	static unsigned int acquire(GLenum format, int owner)
+	{
+		for (Allocation& a : allocations)
+		{
+			if (a.owner >= 0 || a.format != format || a.size != cascadeSize) continue;
+			a.owner = owner;
+			reused++;
+			return a.texture;
+		}
+
+		Allocation a = { 0, format, cascadeSize, owner, 0 };
+		glGenTextures(1, &a.texture);
+		glBindTexture(GL_TEXTURE_2D_ARRAY, a.texture);
+		glTexStorage3D(GL_TEXTURE_2D_ARRAY, 1, format, cascadeSize, cascadeSize, DirectionalLight::CASCADES);
+
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_BORDER);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_BORDER);
+
+		float borderColor[] = { 1.0f, 1.0f, 1.0f, 1.0f };
+		glTexParameterfv(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_BORDER_COLOR, borderColor);
+		GLState::invalidate();
+
+		allocations.push_back(a);
+		created++;
+		return a.texture;
+	}
+
+	static void free(size_t i)
+	{
+		glDeleteTextures(1, &allocations[i].texture);
+		released.push_back(allocations[i].texture);
+		allocations.erase(allocations.begin() + i);
+		deleted++;
+	}
+};
+
+// Static variables initialization
+GLenum ShadowResources::formats[ShadowResources::LIGHT_TYPES] = { GL_DEPTH_COMPONENT32F, GL_DEPTH_COMPONENT32F, GL_DEPTH_COMPONENT16 };
+
+size_t ShadowResources::budget = 128 * 1024 * 1024;
+unsigned int ShadowResources::cascadeSize = 2048;
+GLenum ShadowResources::cascadeFormat = GL_DEPTH_COMPONENT32F;
+std::vector<ShadowResources::Allocation> ShadowResources::allocations;
+std::vector<unsigned int> ShadowResources::released;
+unsigned int ShadowResources::frame = 0;
+unsigned int ShadowResources::created = 0;
+unsigned int ShadowResources::reused = 0;
+unsigned int ShadowResources::deleted = 0;
+ShadowCache* ShadowResources::cache = nullptr;
+bool ShadowResources::layersRefused = false;
+bool ShadowResources::evsmRefused = false;
+
+#endif SHADOW_RESOURCES_H
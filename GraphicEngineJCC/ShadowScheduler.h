@@ -0,0 +1,396 @@
+#ifndef SHADOW_SCHEDULER_H
+#define SHADOW_SCHEDULER_H
+
+#include "glad/glad.h"
+#include "glm/glm.hpp"
+#include "LightBase.h"
+#include "Camera.h"
+#include "ShadowAtlas.h"
+#include <vector>
+#include <unordered_map>
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+
+// Spreads the shadow updates of the spot and point lights over frames, so many lights don't all render in the same
+// one. Each frame every light with an atlas tile gets a priority: its ShadowAtlas importance (screen coverage by
+// brightness), raised by how far it moved since its last update and by the frames it has waited. Lights are taken by
+// priority while the estimated cost of their views fits budgetMs, after the directional light (its cascades follow the
+// camera, they update every frame); the first one always fits. Point lights farther than distantRanges of their range
+// from the camera update one cube face per frame, lights less important than lowImportance at most every
+// lowPriorityInterval frames. A light whose tiles moved or changed size in the atlas (they may hold another light's
+// depth, tiles kept through a repack still hold its own) goes before the others; if it doesn't fit either it has no
+// shadow this frame, as the lights the atlas drops. Each update is timed on the CPU and the GPU (timestamp queries, read a few frames later),
+// and the GPU time per view becomes the cost estimate of the light
+class ShadowScheduler
+{
+	template<class T> using vector = std::vector<T>;
+	using vec3 = glm::vec3;
+	using clock = std::chrono::steady_clock;
+
+public:
+	// One light's update, timed
+	struct Update
+	{
+		const char* light;	// "Directional", "Spot" or "Point"
+		int index;			// In its light vector
+		unsigned int views;	// Cascades, tiles or cube faces rendered
+		float cpuMs;
+		float gpuMs;
+	};
+
+	// The last plan
+	struct Stats
+	{
+		unsigned int lights = 0;		// Spot and point lights with atlas tiles
+		unsigned int updated = 0;
+		unsigned int forced = 0;		// Not drawn in their current tiles yet, updated first
+		unsigned int dropped = 0;		// Forced, over the budget: no shadow this frame
+		unsigned int sliced = 0;		// Distant point lights updated, one face
+		unsigned int throttled = 0;		// Low priority, waiting for their interval
+		unsigned int deferred = 0;		// Over the budget
+		unsigned int views = 0;			// Rendered, cascades included
+		unsigned int maxWait = 0;		// Frames since the last update of the light waiting longest
+		float plannedMs = 0.f;			// Estimated cost of the updates
+	};
+
+	static float budgetMs;
+	static float distantRanges;
+	static float lowImportance;
+	static unsigned int lowPriorityInterval;
+	static float moveWeight;				// Priority added per range moved
+
+private:
+	struct LightState
+	{
+		unsigned int faces = 0;			// Views to update this frame: bits of the cube faces, 1 for a spot light
+		unsigned int views = 0;
+		unsigned int lastFrame = 0;		// Of its last update
+		unsigned int seenFrame = 0;
+		unsigned int resolution = 0;	// ShadowAtlas tiles of the last frame
+		glm::vec2 tiles[6];
+		bool drawn = false;				// In these tiles
+		vec3 position = vec3(0.f);		// At its last update
+		unsigned int nextFace = 0;		// Sliced point lights, round robin
+		float viewMs = -1.f;			// Estimated GPU time per view, < 0: unknown yet
+	};
+
+	struct Job
+	{
+		LightBase* light;
+		LightState* state;
+		unsigned int faces;
+		float cost;
+		float priority;
+		bool forced;
+		bool sliced;				// One face of a point light
+		unsigned int order;			// Of the job, ties keep it
+	};
+
+	struct Pending
+	{
+		const LightBase* light;
+		Update update;
+		unsigned int queries[2];	// Begin / end timestamps
+	};
+
+	static bool enabled;
+	static unsigned int frame;
+	static std::unordered_map<const LightBase*, LightState> states;
+	static vector<Job> jobs;
+	static vector<float> spotImportance, pointImportance;	// Kept between frames, plan() doesn't allocate
+	static float averageViewMs;			// Of every light, the estimate of the lights not timed yet
+
+	static vector<Pending> pending;		// Oldest first
+	static vector<unsigned int> freeQueries;
+	static Pending current;
+	static clock::time_point cpuStart;
+	static vector<Update> lastUpdates;	// Read back this frame
+
+	static Stats stats;
+
+	ShadowScheduler() {}
+	~ShadowScheduler() {}
+
+public:
+	// Off: every light (and cube face) updates every frame. Updates are still timed
+	static void setEnabled(bool enabled)
+	{
+		ShadowScheduler::enabled = enabled;
+	}
+
+	static bool isEnabled()
+	{
+		return enabled;
+	}
+
+	// Decides the updates of this frame, after ShadowAtlas::allocate. The directional light (optional) is only paid
+	// for. CPU only
+	static void plan(const Camera& camera, const DirectionalLight* directional, vector<SpotLight>& spotLights, vector<PointLight>& pointLights)
+	{
+		frame++;
+		stats = Stats();
+		jobs.clear();
+
+		// Importance of each light from its atlas request
+		spotImportance.assign(spotLights.size(), 0.f);
+		pointImportance.assign(pointLights.size(), 0.f);
+		for (const ShadowAtlas::Tile& t : ShadowAtlas::getTiles())
+			(t.tiles == 1 ? spotImportance : pointImportance)[t.index] = t.importance;
+
+		float spent = 0.f;
+		if (directional)
+		{
+			LightState& s = state(directional);
+			s.faces = 1;
+			s.views = DirectionalLight::CASCADES;
+			spent = estimate(s) * s.views;
+			stats.views += s.views;
+		}
+
+		for (size_t i = 0; i < spotLights.size(); i++) addJob(spotLights[i], 1, spotImportance[i], camera.getPosition(), spotLights[i].getRange());
+		for (size_t i = 0; i < pointLights.size(); i++) addJob(pointLights[i], 6, pointImportance[i], camera.getPosition(), pointLights[i].getRange());
+
+		// Forced first, then by priority. Ties (and equal priorities) keep the light order
+		std::sort(jobs.begin(), jobs.end(), [](const Job& a, const Job& b)
+			{
+				if (a.forced != b.forced) return a.forced;
+				return a.priority != b.priority ? a.priority > b.priority : a.order < b.order;
+			});
+
+		bool any = false;
+		for (Job& j : jobs)
+		{
+			if (enabled && any && spent + j.cost > budgetMs)
+			{
+				j.state->faces = 0;
+				if (j.forced) j.light->shadowResolution = 0;
+				stats.dropped += j.forced ? 1 : 0;
+				stats.deferred += j.forced ? 0 : 1;
+				continue;
+			}
+			any = true;
+
+			LightState& s = *j.state;
+			s.faces = j.faces;
+			s.views = bitCount(j.faces);
+			s.lastFrame = frame;
+			s.drawn = true;
+			s.position = j.light->lightCamera->getPosition();
+			if (j.sliced) s.nextFace = (s.nextFace + 1) % 6;
+
+			spent += j.cost;
+			stats.updated++;
+			stats.forced += j.forced ? 1 : 0;
+			stats.sliced += j.sliced ? 1 : 0;
+			stats.views += s.views;
+		}
+		stats.plannedMs = spent;
+
+		// Forget the lights that are gone (or moved in memory)
+		for (auto itr = states.begin(); itr != states.end();)
+		{
+			if (itr->second.seenFrame != frame) itr = states.erase(itr);
+			else
+			{
+				if (itr->second.drawn) stats.maxWait = glm::max(stats.maxWait, frame - itr->second.lastFrame);
+				++itr;
+			}
+		}
+	}
+
+	// Views of the light to update this frame: bits of the cube faces (0x3F all), 1 for the other lights, 0: none
+	static unsigned int getFaces(const LightBase& light)
+	{
+		std::unordered_map<const LightBase*, LightState>::const_iterator itr = states.find(&light);
+		return itr != states.end() ? itr->second.faces : 0;
+	}
+
+	// Around the shadow rendering of a planned light
+	static void beginUpdate(const LightBase& light, const char* type, int index)
+	{
+		current.light = &light;
+		current.update.light = type;
+		current.update.index = index;
+		current.update.views = state(&light).views;
+		current.update.gpuMs = 0.f;
+
+		for (int q = 0; q < 2; q++)
+		{
+			if (freeQueries.empty())
+			{
+				unsigned int query;
+				glGenQueries(1, &query);
+				freeQueries.push_back(query);
+			}
+			current.queries[q] = freeQueries.back();
+			freeQueries.pop_back();
+		}
+		glQueryCounter(current.queries[0], GL_TIMESTAMP);
+		cpuStart = clock::now();
+	}
+
+	static void endUpdate()
+	{
+		current.update.cpuMs = std::chrono::duration<float, std::milli>(clock::now() - cpuStart).count();
+		glQueryCounter(current.queries[1], GL_TIMESTAMP);
+		pending.push_back(current);
+	}
+
+	// Forgets every light and estimate
+	static void reset()
+	{
+		states.clear();
+		averageViewMs = 0.1f;
+	}
+
+	// Call at the start of each frame: reads the timings that are ready and updates the estimates
+	static void beginFrame()
+	{
+		lastUpdates.clear();
+		size_t done = 0;
+		for (; done < pending.size(); done++)
+		{
+			Pending& p = pending[done];
+			int available = 0;
+			glGetQueryObjectiv(p.queries[1], GL_QUERY_RESULT_AVAILABLE, &available);
+			if (!available) break; // Timestamps complete in order
+
+			GLuint64 start, end;
+			glGetQueryObjectui64v(p.queries[0], GL_QUERY_RESULT, &start);
+			glGetQueryObjectui64v(p.queries[1], GL_QUERY_RESULT, &end);
+			p.update.gpuMs = (end - start) / 1000000.f;
+			freeQueries.push_back(p.queries[0]);
+			freeQueries.push_back(p.queries[1]);
+			lastUpdates.push_back(p.update);
+
+			if (p.update.views == 0) continue;
+			float viewMs = p.update.gpuMs / p.update.views;
+			averageViewMs = glm::mix(averageViewMs, viewMs, 0.1f);
+			std::unordered_map<const LightBase*, LightState>::iterator itr = states.find(p.light);
+			if (itr != states.end()) itr->second.viewMs = itr->second.viewMs < 0.f ? viewMs : glm::mix(itr->second.viewMs, viewMs, 0.25f);
+		}
+		pending.erase(pending.begin(), pending.begin() + done);
+	}
+
+	static const Stats& getStats()
+	{
+		return stats;
+	}
+
+	// Updates whose GPU time was read this frame (rendered a few frames ago)
+	static const vector<Update>& getLastUpdates()
+	{
+		return lastUpdates;
+	}
+
+	static void printStats()
+	{
+		std::cout << "SHADOW_SCHEDULER::" << (enabled ? "" : "off, ") << stats.updated << " of " << stats.lights << " lights updated (" << stats.forced << " forced, "
+			<< stats.sliced << " one face), " << stats.dropped << " without shadow (tiles moved, over budget), " << stats.throttled << " low priority waiting, "
+			<< stats.deferred << " deferred, " << stats.views << " views, "
+			<< stats.plannedMs << " ms planned of " << budgetMs << " ms, longest wait " << stats.maxWait << " frames" << std::endl;
+
+		float cpu = 0.f, gpu = 0.f;
+		for (const Update& u : lastUpdates)
+		{
+			std::cout << "SHADOW_SCHEDULER::" << u.light << " light " << u.index << ": " << u.views << " views, " << u.cpuMs << " ms CPU, " << u.gpuMs << " ms GPU" << std::endl;
+			cpu += u.cpuMs;
+			gpu += u.gpuMs;
+		}
+		std::cout << "SHADOW_SCHEDULER::" << lastUpdates.size() << " updates timed, " << cpu << " ms CPU, " << gpu << " ms GPU, " << averageViewMs << " ms per view on average" << std::endl;
+	}
+
+private:
+	static LightState& state(const LightBase* light)
+	{
+		LightState& s = states[light];
+		s.seenFrame = frame;
+		return s;
+	}
+
+	static float estimate(const LightState& s)
+	{
+		return s.viewMs >= 0.f ? s.viewMs : averageViewMs;
+	}
+
+	static void addJob(LightBase& light, unsigned int views, float importance, vec3 eye, float range)
+	{
+		LightState& s = state(&light);
+		s.faces = 0;
+
+		bool moved = light.shadowResolution != s.resolution;
+		for (unsigned int t = 0; t < views; t++)
+		{
+			moved |= light.shadowTiles[t] != s.tiles[t];
+			s.tiles[t] = light.shadowTiles[t];
+		}
+		s.resolution = light.shadowResolution;
+		if (moved) s.drawn = false;
+		if (light.shadowResolution == 0) return;
+		stats.lights++;
+
+		Job j;
+		j.light = &light;
+		j.state = &s;
+		j.faces = views == 6 ? 0x3F : 1;
+		j.forced = !s.drawn;
+		j.sliced = false;
+
+		vec3 position = light.lightCamera->getPosition();
+		float travel = glm::length(position - s.position) / glm::max(range, 0.001f);
+		unsigned int waited = frame - s.lastFrame;
+		if (enabled && !j.forced)
+		{
+			// Distant point lights that stay put: one face
+			if (views == 6 && travel < 0.01f && glm::length(position - eye) > distantRanges * range)
+			{
+				j.faces = 1u << s.nextFace;
+				j.sliced = true;
+			}
+
+			if (importance < lowImportance && waited < lowPriorityInterval)
+			{
+				stats.throttled++;
+				return;
+			}
+		}
+
+		j.cost = estimate(s) * bitCount(j.faces);
+		j.priority = importance * (1.f + moveWeight * travel) * waited;
+		j.order = (unsigned int)jobs.size();
+		jobs.push_back(j);
+	}
+
+	static unsigned int bitCount(unsigned int mask)
+	{
+		unsigned int count = 0;
+		for (; mask; mask &= mask - 1) count++;
+		return count;
+	}
+};
+
+// Static variables initialization
+float ShadowScheduler::budgetMs = 2.f;
+float ShadowScheduler::distantRanges = 3.f;
+float ShadowScheduler::lowImportance = 0.05f;
+unsigned int ShadowScheduler::lowPriorityInterval = 4;
+float ShadowScheduler::moveWeight = 4.f;
+
+bool ShadowScheduler::enabled = true;
+unsigned int ShadowScheduler::frame = 0;
+std::unordered_map<const LightBase*, ShadowScheduler::LightState> ShadowScheduler::states;
+std::vector<ShadowScheduler::Job> ShadowScheduler::jobs;
+std::vector<float> ShadowScheduler::spotImportance;
+std::vector<float> ShadowScheduler::pointImportance;
+float ShadowScheduler::averageViewMs = 0.1f;
+
+std::vector<ShadowScheduler::Pending> ShadowScheduler::pending;
+std::vector<unsigned int> ShadowScheduler::freeQueries;
+ShadowScheduler::Pending ShadowScheduler::current;
+ShadowScheduler::clock::time_point ShadowScheduler::cpuStart;
+std::vector<ShadowScheduler::Update> ShadowScheduler::lastUpdates;
+
+ShadowScheduler::Stats ShadowScheduler::stats;
+
+#endif SHADOW_SCHEDULER_H
@@ -238,8 +238,7 @@ public:
 		glDeleteBuffers(1, &EBO);
 		glDeleteTextures(1, &texID);
 		glDeleteTextures(1, &texID2);
-		glDeleteProgram(shaderProgram->ID);
-		delete shaderProgram;
+		delete shaderProgram; // Deletes the program
 	}
 };
 
@@ -0,0 +1,325 @@
+#ifndef TRANSFORM_SYSTEM_H
+#define TRANSFORM_SYSTEM_H
+
+#include "glad/glad.h"
+#include "glm/glm.hpp"
+#include "glm/gtc/quaternion.hpp"
+#include "Transformation.h"
+#include "Shader.h"
+#include <vector>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__SSE__)
+#define TRANSFORM_SSE
+#include <xmmintrin.h>
+#endif
+#if defined(__AVX__)
+#define TRANSFORM_AVX
+#include <immintrin.h>
+#endif
+
+// Many flat transforms (no hierarchy) stored as structure of arrays: one array per component of position,
+// rotation (quaternion) and scale. compose() builds every world matrix (T * R * S) 4 (SSE) or 8 (AVX) objects at a
+// time, and the matrices are laid out to be uploaded as they are to a shader storage buffer (std430 mat4[]).
+// Arrays are padded to a multiple of BATCH with identity transforms, so the SIMD loops have no tail.
+class TransformSystem
+{
+	template<class T> using vector = std::vector<T>;
+	using vec3 = glm::vec3;
+	using quat = glm::quat;
+	using mat4 = glm::mat4;
+
+public:
+	static const int BATCH = 8;
+
+	TransformSystem(size_t reserve = 0)
+	{
+		for (vector<float>* a : components()) a->reserve(reserve + BATCH);
+		world.reserve(reserve + BATCH);
+	}
+
+	~TransformSystem()
+	{
+		if (ssbo != 0 && Shader::glContextAlive) glDeleteBuffers(1, &ssbo);
+	}
+
+	TransformSystem(const TransformSystem&) = delete;
+	TransformSystem& operator=(const TransformSystem&) = delete;
+
+	// Returns the index of the new transform
+	int add(vec3 position = vec3(0.f), quat rotation = quat(1.f, 0.f, 0.f, 0.f), vec3 scale = vec3(1.f))
+	{
+		int i = (int)count++;
+		if (count > px.size())
+		{
+			size_t padded = (count + BATCH - 1) / BATCH * BATCH;
+			px.resize(padded, 0.f); py.resize(padded, 0.f); pz.resize(padded, 0.f);
+			qx.resize(padded, 0.f); qy.resize(padded, 0.f); qz.resize(padded, 0.f); qw.resize(padded, 1.f);
+			sx.resize(padded, 1.f); sy.resize(padded, 1.f); sz.resize(padded, 1.f);
+			world.resize(padded, mat4(1.f));
+		}
+
+		setPosition(i, position);
+		setRotation(i, rotation);
+		setScale(i, scale);
+		return i;
+	}
+
+	int add(const Transformation& t)
+	{
+		return add(t.translation, toQuat(t.rotation), t.scale);
+	}
+
+	void setPosition(int i, vec3 p)
+	{
+		px[i] = p.x; py[i] = p.y; pz[i] = p.z;
+		dirty = true;
+	}
+
+	void setRotation(int i, quat q)
+	{
+		qx[i] = q.x; qy[i] = q.y; qz[i] = q.z; qw[i] = q.w;
+		dirty = true;
+	}
+
+	void setScale(int i, vec3 s)
+	{
+		sx[i] = s.x; sy[i] = s.y; sz[i] = s.z;
+		dirty = true;
+	}
+
+	void set(int i, const Transformation& t)
+	{
+		setPosition(i, t.translation);
+		setRotation(i, toQuat(t.rotation));
+		setScale(i, t.scale);
+	}
+
+	vec3 getPosition(int i) const
+	{
+		return vec3(px[i], py[i], pz[i]);
+	}
+
+	quat getRotation(int i) const
+	{
+		return quat(qw[i], qx[i], qy[i], qz[i]);
+	}
+
+	vec3 getScale(int i) const
+	{
+		return vec3(sx[i], sy[i], sz[i]);
+	}
+
+	size_t size() const
+	{
+		return count;
+	}
+
+	// Valid after compose()/update()
+	const mat4* getWorldMatrices() const
+	{
+		return world.data();
+	}
+
+	const mat4& getWorldMatrix(int i) const
+	{
+		return world[i];
+	}
+
+	// Changes every time the world matrices do
+	unsigned int getVersion() const
+	{
+		return version;
+	}
+
+	// Compose if anything changed since the last time
+	void update()
+	{
+		if (dirty) compose();
+	}
+
+	// Every world matrix, in batches
+	void compose()
+	{
+		size_t padded = px.size();
+#if defined(TRANSFORM_AVX)
+		for (size_t i = 0; i < padded; i += 8) composeAVX(i);
+#elif defined(TRANSFORM_SSE)
+		for (size_t i = 0; i < padded; i += 4) composeSSE(i);
+#else
+		for (size_t i = 0; i < padded; i++) composeOne(i);
+#endif
+		dirty = false;
+		version++;
+	}
+
+	// Reference path, one object at a time
+	void composeScalar()
+	{
+		for (size_t i = 0; i < count; i++) composeOne(i);
+		dirty = false;
+		version++;
+	}
+
+	// Uploads the matrices if they changed since the last upload and binds the buffer (layout(std430, binding = ...))
+	void bindStorage(unsigned int binding)
+	{
+		update();
+
+		if (ssbo == 0) glGenBuffers(1, &ssbo);
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, ssbo);
+		if (uploadedVersion != version)
+		{
+			GLsizeiptr bytes = (GLsizeiptr)(count * sizeof(mat4));
+			if (bytes > ssboBytes)
+			{
+				glBufferData(GL_SHADER_STORAGE_BUFFER, bytes, world.data(), GL_DYNAMIC_DRAW);
+				ssboBytes = bytes;
+			}
+			else
+			{
+				glBufferData(GL_SHADER_STORAGE_BUFFER, ssboBytes, nullptr, GL_DYNAMIC_DRAW); // Orphan, the last frame may still read it
+				glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, bytes, world.data());
+			}
+			uploadedVersion = version;
+		}
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, binding, ssbo);
+	}
+
+	// Same order as Transformation::getMatrix: rotX * rotY * rotZ (degrees)
+	static quat toQuat(vec3 eulerDegrees)
+	{
+		vec3 r = glm::radians(eulerDegrees);
+		return glm::angleAxis(r.x, vec3(1.f, 0.f, 0.f)) * glm::angleAxis(r.y, vec3(0.f, 1.f, 0.f)) * glm::angleAxis(r.z, vec3(0.f, 0.f, 1.f));
+	}
+
+private:
+	size_t count = 0;
+	vector<float> px, py, pz;		// Position
+	vector<float> qx, qy, qz, qw;	// Rotation
+	vector<float> sx, sy, sz;		// Scale
+	vector<mat4> world;				// Same padded size
+
+	bool dirty = false;
+	unsigned int version = 0;
+
+	unsigned int ssbo = 0;
+	GLsizeiptr ssboBytes = 0;
+	unsigned int uploadedVersion = ~0u;
+
+	vector<vector<float>*> components()
+	{
+		return { &px, &py, &pz, &qx, &qy, &qz, &qw, &sx, &sy, &sz };
+	}
+
+	void composeOne(size_t i)
+	{
+		float x = qx[i], y = qy[i], z = qz[i], w = qw[i];
+		float* m = &world[i][0][0];
+
+		m[0] = (1.f - 2.f * (y * y + z * z)) * sx[i];
+		m[1] = 2.f * (x * y + w * z) * sx[i];
+		m[2] = 2.f * (x * z - w * y) * sx[i];
+		m[3] = 0.f;
+
+		m[4] = 2.f * (x * y - w * z) * sy[i];
+		m[5] = (1.f - 2.f * (x * x + z * z)) * sy[i];
+		m[6] = 2.f * (y * z + w * x) * sy[i];
+		m[7] = 0.f;
+
+		m[8] = 2.f * (x * z + w * y) * sz[i];
+		m[9] = 2.f * (y * z - w * x) * sz[i];
+		m[10] = (1.f - 2.f * (x * x + y * y)) * sz[i];
+		m[11] = 0.f;
+
+		m[12] = px[i]; m[13] = py[i]; m[14] = pz[i]; m[15] = 1.f;
+	}
+
+#ifdef TRANSFORM_SSE
+	// One matrix column of 4 objects: lane k of x, y, z, w goes to world[i + k][column]
+	void storeColumn(size_t i, int column, __m128 x, __m128 y, __m128 z, __m128 w)
+	{
+		_MM_TRANSPOSE4_PS(x, y, z, w);
+		_mm_storeu_ps(&world[i][column][0], x);
+		_mm_storeu_ps(&world[i + 1][column][0], y);
+		_mm_storeu_ps(&world[i + 2][column][0], z);
+		_mm_storeu_ps(&world[i + 3][column][0], w);
+	}
+
+	void composeSSE(size_t i)
+	{
+		__m128 x = _mm_loadu_ps(&qx[i]), y = _mm_loadu_ps(&qy[i]), z = _mm_loadu_ps(&qz[i]), w = _mm_loadu_ps(&qw[i]);
+		__m128 one = _mm_set1_ps(1.f), two = _mm_set1_ps(2.f), zero = _mm_setzero_ps();
+
+		__m128 xx = _mm_mul_ps(x, x), yy = _mm_mul_ps(y, y), zz = _mm_mul_ps(z, z);
+		__m128 xy = _mm_mul_ps(x, y), xz = _mm_mul_ps(x, z), yz = _mm_mul_ps(y, z);
+		__m128 wx = _mm_mul_ps(w, x), wy = _mm_mul_ps(w, y), wz = _mm_mul_ps(w, z);
+
+		__m128 s = _mm_loadu_ps(&sx[i]);
+		storeColumn(i, 0,
+			_mm_mul_ps(_mm_sub_ps(one, _mm_mul_ps(two, _mm_add_ps(yy, zz))), s),
+			_mm_mul_ps(_mm_mul_ps(two, _mm_add_ps(xy, wz)), s),
+			_mm_mul_ps(_mm_mul_ps(two, _mm_sub_ps(xz, wy)), s),
+			zero);
+
+		s = _mm_loadu_ps(&sy[i]);
+		storeColumn(i, 1,
+			_mm_mul_ps(_mm_mul_ps(two, _mm_sub_ps(xy, wz)), s),
+			_mm_mul_ps(_mm_sub_ps(one, _mm_mul_ps(two, _mm_add_ps(xx, zz))), s),
+			_mm_mul_ps(_mm_mul_ps(two, _mm_add_ps(yz, wx)), s),
+			zero);
+
+		s = _mm_loadu_ps(&sz[i]);
+		storeColumn(i, 2,
+			_mm_mul_ps(_mm_mul_ps(two, _mm_add_ps(xz, wy)), s),
+			_mm_mul_ps(_mm_mul_ps(two, _mm_sub_ps(yz, wx)), s),
+			_mm_mul_ps(_mm_sub_ps(one, _mm_mul_ps(two, _mm_add_ps(xx, yy))), s),
+			zero);
+
+		storeColumn(i, 3, _mm_loadu_ps(&px[i]), _mm_loadu_ps(&py[i]), _mm_loadu_ps(&pz[i]), one);
+	}
+#endif
+
+#ifdef TRANSFORM_AVX
+	// 8 objects: the math runs 8 wide, the transposes on each half
+	void storeColumn8(size_t i, int column, __m256 x, __m256 y, __m256 z, __m256 w)
+	{
+		storeColumn(i, column, _mm256_castps256_ps128(x), _mm256_castps256_ps128(y), _mm256_castps256_ps128(z), _mm256_castps256_ps128(w));
+		storeColumn(i + 4, column, _mm256_extractf128_ps(x, 1), _mm256_extractf128_ps(y, 1), _mm256_extractf128_ps(z, 1), _mm256_extractf128_ps(w, 1));
+	}
+
+	void composeAVX(size_t i)
+	{
+		__m256 x = _mm256_loadu_ps(&qx[i]), y = _mm256_loadu_ps(&qy[i]), z = _mm256_loadu_ps(&qz[i]), w = _mm256_loadu_ps(&qw[i]);
+		__m256 one = _mm256_set1_ps(1.f), two = _mm256_set1_ps(2.f), zero = _mm256_setzero_ps();
+
+		__m256 xx = _mm256_mul_ps(x, x), yy = _mm256_mul_ps(y, y), zz = _mm256_mul_ps(z, z);
+		__m256 xy = _mm256_mul_ps(x, y), xz = _mm256_mul_ps(x, z), yz = _mm256_mul_ps(y, z);
+		__m256 wx = _mm256_mul_ps(w, x), wy = _mm256_mul_ps(w, y), wz = _mm256_mul_ps(w, z);
+
+		__m256 s = _mm256_loadu_ps(&sx[i]);
+		storeColumn8(i, 0,
+			_mm256_mul_ps(_mm256_sub_ps(one, _mm256_mul_ps(two, _mm256_add_ps(yy, zz))), s),
+			_mm256_mul_ps(_mm256_mul_ps(two, _mm256_add_ps(xy, wz)), s),
+			_mm256_mul_ps(_mm256_mul_ps(two, _mm256_sub_ps(xz, wy)), s),
+			zero);
+
+		s = _mm256_loadu_ps(&sy[i]);
+		storeColumn8(i, 1,
+			_mm256_mul_ps(_mm256_mul_ps(two, _mm256_sub_ps(xy, wz)), s),
+			_mm256_mul_ps(_mm256_sub_ps(one, _mm256_mul_ps(two, _mm256_add_ps(xx, zz))), s),
+			_mm256_mul_ps(_mm256_mul_ps(two, _mm256_add_ps(yz, wx)), s),
+			zero);
+
+		s = _mm256_loadu_ps(&sz[i]);
+		storeColumn8(i, 2,
+			_mm256_mul_ps(_mm256_mul_ps(two, _mm256_add_ps(xz, wy)), s),
+			_mm256_mul_ps(_mm256_mul_ps(two, _mm256_sub_ps(yz, wx)), s),
+			_mm256_mul_ps(_mm256_sub_ps(one, _mm256_mul_ps(two, _mm256_add_ps(xx, yy))), s),
+			zero);
+
+		storeColumn8(i, 3, _mm256_loadu_ps(&px[i]), _mm256_loadu_ps(&py[i]), _mm256_loadu_ps(&pz[i]), one);
+	}
+#endif
+};
+
+#endif TRANSFORM_SYSTEM_H
@@ -2,12 +2,37 @@
 #define TRANSFORMATION_H
 
 #include "glm/glm.hpp"
+#include "glm/gtc/matrix_transform.hpp"
 
 struct Transformation
 {
     glm::vec3 translation = glm::vec3(0.f);
     glm::vec3 rotation = glm::vec3(0.f);
     glm::vec3 scale = glm::vec3(1.f);
+
+    bool operator==(const Transformation& o) const
+    {
+        return translation == o.translation && rotation == o.rotation && scale == o.scale;
+    }
+
+    bool operator!=(const Transformation& o) const
+    {
+        return !(*this == o);
+    }
+
+    // translate * rotX * rotY * rotZ * scale (degrees)
+    glm::mat4 getMatrix() const
+    {
+        glm::mat4 model = glm::mat4(1.f);
+
+        model = glm::translate(model, translation);
+        model = glm::rotate(model, glm::radians(rotation.x), glm::vec3(1.f, 0.f, 0.f));
+        model = glm::rotate(model, glm::radians(rotation.y), glm::vec3(0.f, 1.f, 0.f));
+        model = glm::rotate(model, glm::radians(rotation.z), glm::vec3(0.f, 0.f, 1.f));
+        model = glm::scale(model, scale);
+
+        return model;
+    }
 };
 
 #endif TRANSFORMATION_H